@@ -1264,6 +1264,9 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 
 		device->CopyTex(dst->texture, 0, 0, src, 0, 0, 0, 0);
 
+		if (dst->query)
+			device->context->End(dst->query);
+
 	} catch (const char *error) {
 		blog(LOG_ERROR, "device_copy_texture (D3D11): %s", error);
 	}
@@ -1841,6 +1844,16 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 	stagesurf->device->context->Unmap(stagesurf->texture, 0);
 }
 
+bool gs_stagesurface_ready(gs_stagesurf_t *stagesurf)
+{
+	if (!stagesurf->query)
+		return true;
+
+	HRESULT hr = stagesurf->device->context->GetData(stagesurf->query,
+			NULL, 0, 0);
+	return hr != S_FALSE;
+}
+
 
 void gs_zstencil_destroy(gs_zstencil_t *zstencil)
 {
@@ -333,6 +333,7 @@ struct gs_zstencil_buffer {
 
 struct gs_stage_surface {
 	ComPtr<ID3D11Texture2D> texture;
+	ComPtr<ID3D11Query>     query;
 
 	gs_device       *device;
 	uint32_t        width, height;
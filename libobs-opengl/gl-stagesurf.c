@@ -65,9 +65,36 @@ gs_stagesurf_t *device_stagesurface_create(gs_device_t *device, uint32_t width,
 	return surf;
 }
 
+static inline bool sync_supported(void)
+{
+	return GLAD_GL_VERSION_3_2 || GLAD_GL_ARB_sync;
+}
+
+static inline void delete_sync(struct gs_stage_surface *surf)
+{
+	if (surf->sync) {
+		glDeleteSync(surf->sync);
+		surf->sync = NULL;
+	}
+}
+
+/* inserts a fence after the copy so the surface can be polled with
+ * gs_stagesurface_ready instead of stalling in glMapBuffer */
+static inline void insert_sync(struct gs_stage_surface *surf)
+{
+	if (!sync_supported())
+		return;
+
+	delete_sync(surf);
+	surf->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	gl_success("glFenceSync");
+}
+
 void gs_stagesurface_destroy(gs_stagesurf_t *stagesurf)
 {
 	if (stagesurf) {
+		delete_sync(stagesurf);
+
 		if (stagesurf->pack_buffer)
 			gl_delete_buffers(1, &stagesurf->pack_buffer);
 
@@ -141,6 +168,7 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 	if (!gl_success("glReadPixels"))
 		goto failed_unbind_all;
 
+	insert_sync(dst);
 	success = true;
 
 failed_unbind_all:
@@ -172,6 +200,8 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 	if (!gl_success("glGetTexImage"))
 		goto failed;
 
+	insert_sync(dst);
+
 	gl_bind_texture(GL_TEXTURE_2D, 0);
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 	return;
@@ -232,3 +262,21 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 }
+
+bool gs_stagesurface_ready(gs_stagesurf_t *stagesurf)
+{
+	GLenum ret;
+
+	if (!stagesurf->sync)
+		return true;
+
+	ret = glClientWaitSync(stagesurf->sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (ret == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	if (ret == GL_WAIT_FAILED)
+		gl_success("glClientWaitSync");
+
+	delete_sync(stagesurf);
+	return true;
+}
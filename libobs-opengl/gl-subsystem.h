@@ -437,6 +437,7 @@ struct gs_stage_surface {
 	GLint                gl_internal_format;
 	GLenum               gl_type;
 	GLuint               pack_buffer;
+	GLsync               sync;
 };
 
 struct gs_zstencil_buffer {
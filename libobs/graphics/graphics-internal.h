@@ -182,6 +182,7 @@ struct gs_exports {
 	bool     (*gs_stagesurface_map)(gs_stagesurf_t *stagesurf,
 			uint8_t **data, uint32_t *linesize);
 	void     (*gs_stagesurface_unmap)(gs_stagesurf_t *stagesurf);
+	bool     (*gs_stagesurface_ready)(gs_stagesurf_t *stagesurf);
 
 	void (*gs_zstencil_destroy)(gs_zstencil_t *zstencil);
 
@@ -258,6 +259,15 @@ struct gs_exports {
 #endif
 };
 
+/* bounds of the current projection, when it is orthographic */
+struct ortho_state {
+	bool               valid;
+	float              left;
+	float              right;
+	float              top;
+	float              bottom;
+};
+
 struct blend_state {
 	bool               enabled;
 	enum gs_blend_type src_c;
@@ -266,6 +276,38 @@ struct blend_state {
 	enum gs_blend_type dest_a;
 };
 
+struct gs_image_cache_entry {
+	char                   *file;
+	time_t                 mtime;
+	gs_texture_t           *tex;
+	size_t                 size;
+	long                   refs;
+	uint64_t               last_used;
+};
+
+/* cached textures are marked by counting them in a small table indexed by a
+ * hash of their pointer, so that destroying a texture that isn't cached
+ * usually doesn't have to lock the cache and look for it */
+#define GS_IMAGE_CACHE_MARKS 256
+
+struct gs_image_cache {
+	pthread_mutex_t        mutex;
+	DARRAY(struct gs_image_cache_entry) entries;
+	volatile long          marks[GS_IMAGE_CACHE_MARKS];
+	size_t                 bytes;
+	size_t                 unused_bytes;
+	size_t                 budget;
+	uint64_t               clock;
+
+	uint64_t               hits;
+	uint64_t               misses;
+	uint64_t               evictions;
+};
+
+extern bool gs_image_cache_init(struct gs_image_cache *cache);
+extern void gs_image_cache_free(graphics_t *graphics);
+extern bool gs_image_cache_release(graphics_t *graphics, gs_texture_t *tex);
+
 struct graphics_subsystem {
 	void                   *module;
 	gs_device_t            *device;
@@ -292,9 +334,14 @@ struct graphics_subsystem {
 	pthread_mutex_t        effect_mutex;
 	struct gs_effect       *first_effect;
 
+	struct gs_image_cache  image_cache;
+
 	pthread_mutex_t        mutex;
 	volatile long          ref;
 
 	struct blend_state     cur_blend_state;
 	DARRAY(struct blend_state) blend_state_stack;
+
+	struct ortho_state     cur_ortho;
+	DARRAY(struct ortho_state) ortho_stack;
 };
@@ -161,6 +161,8 @@ static bool graphics_init(struct graphics_subsystem *graphics)
 		return false;
 	if (pthread_mutex_init(&graphics->effect_mutex, NULL) != 0)
 		return false;
+	if (!gs_image_cache_init(&graphics->image_cache))
+		return false;
 
 	graphics->exports.device_blend_function_separate(graphics->device,
 			GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA,
@@ -184,6 +186,7 @@ int gs_create(graphics_t **pgraphics, const char *module, uint32_t adapter)
 	graphics_t *graphics = bzalloc(sizeof(struct graphics_subsystem));
 	pthread_mutex_init_value(&graphics->mutex);
 	pthread_mutex_init_value(&graphics->effect_mutex);
+	pthread_mutex_init_value(&graphics->image_cache.mutex);
 
 	graphics->module = os_dlopen(module);
 	if (!graphics->module) {
@@ -234,6 +237,8 @@ void gs_destroy(graphics_t *graphics)
 			effect = next;
 		}
 
+		gs_image_cache_free(graphics);
+
 		graphics->exports.gs_vertexbuffer_destroy(
 				graphics->sprite_buffer);
 		graphics->exports.gs_vertexbuffer_destroy(
@@ -245,9 +250,11 @@ void gs_destroy(graphics_t *graphics)
 
 	pthread_mutex_destroy(&graphics->mutex);
 	pthread_mutex_destroy(&graphics->effect_mutex);
+	pthread_mutex_destroy(&graphics->image_cache.mutex);
 	da_free(graphics->matrix_stack);
 	da_free(graphics->viewport_stack);
 	da_free(graphics->blend_state_stack);
+	da_free(graphics->ortho_stack);
 	if (graphics->module)
 		os_dlclose(graphics->module);
 	bfree(graphics);
@@ -1119,6 +1126,7 @@ void gs_perspective(float angle, float aspect, float near, float far)
 	xmin = ymin * aspect;
 	xmax = ymax * aspect;
 
+	graphics->cur_ortho.valid = false;
 	graphics->exports.device_frustum(graphics->device, xmin, xmax,
 			ymin, ymax, near, far);
 }
@@ -1836,6 +1844,12 @@ void gs_ortho(float left, float right, float top, float bottom, float znear,
 	if (!gs_valid("gs_ortho"))
 		return;
 
+	graphics->cur_ortho.valid  = true;
+	graphics->cur_ortho.left   = left;
+	graphics->cur_ortho.right  = right;
+	graphics->cur_ortho.top    = top;
+	graphics->cur_ortho.bottom = bottom;
+
 	graphics->exports.device_ortho(graphics->device, left, right, top,
 			bottom, znear, zfar);
 }
@@ -1848,6 +1862,7 @@ void gs_frustum(float left, float right, float top, float bottom, float znear,
 	if (!gs_valid("gs_frustum"))
 		return;
 
+	graphics->cur_ortho.valid = false;
 	graphics->exports.device_frustum(graphics->device, left, right, top,
 			bottom, znear, zfar);
 }
@@ -1859,6 +1874,7 @@ void gs_projection_push(void)
 	if (!gs_valid("gs_projection_push"))
 		return;
 
+	da_push_back(graphics->ortho_stack, &graphics->cur_ortho);
 	graphics->exports.device_projection_push(graphics->device);
 }
 
@@ -1869,9 +1885,31 @@ void gs_projection_pop(void)
 	if (!gs_valid("gs_projection_pop"))
 		return;
 
+	if (graphics->ortho_stack.num) {
+		graphics->cur_ortho = *(struct ortho_state*)
+			da_end(graphics->ortho_stack);
+		da_pop_back(graphics->ortho_stack);
+	}
+
 	graphics->exports.device_projection_pop(graphics->device);
 }
 
+bool gs_get_ortho(float *left, float *right, float *top, float *bottom)
+{
+	graphics_t *graphics = thread_graphics;
+
+	if (!gs_valid("gs_get_ortho"))
+		return false;
+	if (!graphics->cur_ortho.valid)
+		return false;
+
+	*left   = graphics->cur_ortho.left;
+	*right  = graphics->cur_ortho.right;
+	*top    = graphics->cur_ortho.top;
+	*bottom = graphics->cur_ortho.bottom;
+	return true;
+}
+
 void gs_swapchain_destroy(gs_swapchain_t *swapchain)
 {
 	graphics_t *graphics = thread_graphics;
@@ -2076,6 +2114,10 @@ void gs_texture_destroy(gs_texture_t *tex)
 	if (!tex)
 		return;
 
+	/* textures of image files may be shared through the image cache */
+	if (gs_image_cache_release(graphics, tex))
+		return;
+
 	graphics->exports.gs_texture_destroy(tex);
 }
 
@@ -2301,6 +2343,19 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 	graphics->exports.gs_stagesurface_unmap(stagesurf);
 }
 
+bool gs_stagesurface_ready(gs_stagesurf_t *stagesurf)
+{
+	graphics_t *graphics = thread_graphics;
+
+	if (!gs_valid_p("gs_stagesurface_ready", stagesurf))
+		return false;
+
+	if (!graphics->exports.gs_stagesurface_ready)
+		return true;
+
+	return graphics->exports.gs_stagesurface_ready(stagesurf);
+}
+
 void gs_zstencil_destroy(gs_zstencil_t *zstencil)
 {
 	if (!gs_valid("gs_zstencil_destroy"))
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <time.h>
 #include "../util/bmem.h"
 #include "input.h"
 #ifdef __APPLE__
@@ -503,6 +504,57 @@ EXPORT gs_shader_t *gs_pixelshader_create_from_file(const char *file,
 
 EXPORT gs_texture_t *gs_texture_create_from_file(const char *file);
 
+/**
+ * Decodes an image file to pixel data without using the graphics context, so
+ * that images can be decoded on other threads and only uploaded on the
+ * graphics thread.  Returns the data (free with bfree) or NULL on failure.
+ */
+EXPORT uint8_t *gs_create_texture_file_data(const char *file,
+		enum gs_color_format *format, uint32_t *cx, uint32_t *cy);
+
+/* ---------------------------------------------------
+ * image cache
+ *
+ *   Textures of image files are shared through a cache keyed by the path and
+ * modification time of the file.  gs_texture_create_from_file and
+ * gs_image_cache_add return a reference to a cached texture, which is
+ * released with gs_texture_destroy.  Textures that are no longer used stay
+ * cached until the cache goes over its budget, and are then freed least
+ * recently used first.
+ * --------------------------------------------------- */
+
+#define GS_IMAGE_CACHE_DEFAULT_BUDGET (256 * 1024 * 1024)
+
+struct gs_image_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t   entries;
+	size_t   bytes;        /**< Size of every cached texture */
+	size_t   unused_bytes; /**< Size of the textures no longer used */
+	size_t   budget;
+};
+
+/**
+ * Gets a reference to the cached texture of a file, or NULL if it has not
+ * been loaded.  This can be called from any thread, so that threads that
+ * decode images can skip the ones that are already loaded.
+ */
+EXPORT gs_texture_t *gs_image_cache_find(graphics_t *graphics,
+		const char *file, time_t mtime);
+
+/**
+ * Creates a texture from image data decoded with gs_create_texture_file_data
+ * and adds it to the cache, or gets the cached one if the same file has been
+ * added in the meantime.
+ */
+EXPORT gs_texture_t *gs_image_cache_add(const char *file, time_t mtime,
+		enum gs_color_format format, uint32_t cx, uint32_t cy,
+		const uint8_t *data);
+
+EXPORT void gs_image_cache_set_budget(size_t bytes);
+EXPORT void gs_image_cache_get_stats(struct gs_image_cache_stats *stats);
+
 #define GS_FLIP_U (1<<0)
 #define GS_FLIP_V (1<<1)
 
@@ -657,6 +709,12 @@ EXPORT void gs_frustum(float left, float right, float top, float bottom,
 EXPORT void gs_projection_push(void);
 EXPORT void gs_projection_pop(void);
 
+/**
+ * Gets the bounds given to gs_ortho for the current projection.  Returns
+ * false if the current projection isn't orthographic.
+ */
+EXPORT bool gs_get_ortho(float *left, float *right, float *top, float *bottom);
+
 EXPORT void     gs_swapchain_destroy(gs_swapchain_t *swapchain);
 
 EXPORT void     gs_texture_destroy(gs_texture_t *tex);
@@ -698,6 +756,13 @@ EXPORT bool     gs_stagesurface_map(gs_stagesurf_t *stagesurf, uint8_t **data,
 		uint32_t *linesize);
 EXPORT void     gs_stagesurface_unmap(gs_stagesurf_t *stagesurf);
 
+/**
+ * Returns true if the last gs_stage_texture copy into the surface has
+ * completed, meaning gs_stagesurface_map will not stall.  Always returns true
+ * if the graphics module cannot query this.
+ */
+EXPORT bool     gs_stagesurface_ready(gs_stagesurf_t *stagesurf);
+
 EXPORT void     gs_zstencil_destroy(gs_zstencil_t *zstencil);
 
 EXPORT void     gs_samplerstate_destroy(gs_samplerstate_t *samplerstate);
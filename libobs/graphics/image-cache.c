@@ -0,0 +1,325 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include "../util/base.h"
+#include "../util/bmem.h"
+#include "graphics-internal.h"
+
+bool gs_image_cache_init(struct gs_image_cache *cache)
+{
+	cache->budget = GS_IMAGE_CACHE_DEFAULT_BUDGET;
+	return pthread_mutex_init(&cache->mutex, NULL) == 0;
+}
+
+static inline volatile long *texture_mark(struct gs_image_cache *cache,
+		const gs_texture_t *tex)
+{
+	uintptr_t ptr = (uintptr_t)tex;
+	return &cache->marks[((ptr >> 4) ^ (ptr >> 12)) % GS_IMAGE_CACHE_MARKS];
+}
+
+static inline void free_entry(graphics_t *graphics,
+		struct gs_image_cache_entry *entry)
+{
+	os_atomic_dec_long(texture_mark(&graphics->image_cache, entry->tex));
+	graphics->exports.gs_texture_destroy(entry->tex);
+	bfree(entry->file);
+}
+
+void gs_image_cache_free(graphics_t *graphics)
+{
+	struct gs_image_cache *cache = &graphics->image_cache;
+
+	for (size_t i = 0; i < cache->entries.num; i++)
+		free_entry(graphics, cache->entries.array + i);
+
+	if (cache->hits || cache->misses)
+		blog(LOG_INFO, "Image cache: %"PRIu64" hits, %"PRIu64" misses, "
+		               "%"PRIu64" evictions",
+		               cache->hits, cache->misses, cache->evictions);
+
+	da_free(cache->entries);
+}
+
+/* mutex must be locked */
+static struct gs_image_cache_entry *find_entry(struct gs_image_cache *cache,
+		const char *file, time_t mtime)
+{
+	for (size_t i = 0; i < cache->entries.num; i++) {
+		struct gs_image_cache_entry *entry = cache->entries.array + i;
+
+		if (entry->mtime == mtime && strcmp(entry->file, file) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* mutex must be locked */
+static inline gs_texture_t *ref_entry(struct gs_image_cache *cache,
+		struct gs_image_cache_entry *entry)
+{
+	if (entry->refs++ == 0)
+		cache->unused_bytes -= entry->size;
+	entry->last_used = ++cache->clock;
+	return entry->tex;
+}
+
+/* mutex must be locked */
+static void remove_entry(graphics_t *graphics, size_t idx)
+{
+	struct gs_image_cache *cache = &graphics->image_cache;
+	struct gs_image_cache_entry *entry = cache->entries.array + idx;
+
+	cache->bytes        -= entry->size;
+	cache->unused_bytes -= entry->size;
+	cache->evictions++;
+
+	free_entry(graphics, entry);
+	da_erase(cache->entries, idx);
+}
+
+/* frees unused textures, least recently used first, until the cache is within
+ * its budget.  textures still in use are never freed.  mutex must be locked,
+ * and the graphics context entered */
+static void trim_cache(graphics_t *graphics)
+{
+	struct gs_image_cache *cache = &graphics->image_cache;
+
+	while (cache->bytes > cache->budget && cache->unused_bytes) {
+		size_t   oldest_idx  = DARRAY_INVALID;
+		uint64_t oldest_used = UINT64_MAX;
+
+		for (size_t i = 0; i < cache->entries.num; i++) {
+			struct gs_image_cache_entry *entry =
+				cache->entries.array + i;
+
+			if (!entry->refs && entry->last_used < oldest_used) {
+				oldest_idx  = i;
+				oldest_used = entry->last_used;
+			}
+		}
+
+		if (oldest_idx == DARRAY_INVALID)
+			break;
+
+		remove_entry(graphics, oldest_idx);
+	}
+}
+
+/* unused textures of older versions of a file will never be found again.
+ * mutex must be locked, and the graphics context entered */
+static void remove_stale_entries(graphics_t *graphics, const char *file,
+		time_t mtime)
+{
+	struct gs_image_cache *cache = &graphics->image_cache;
+
+	for (size_t i = cache->entries.num; i > 0; i--) {
+		struct gs_image_cache_entry *entry =
+			cache->entries.array + (i - 1);
+
+		if (!entry->refs && entry->mtime != mtime &&
+		    strcmp(entry->file, file) == 0)
+			remove_entry(graphics, i - 1);
+	}
+}
+
+gs_texture_t *gs_image_cache_find(graphics_t *graphics, const char *file,
+		time_t mtime)
+{
+	struct gs_image_cache *cache;
+	struct gs_image_cache_entry *entry;
+	gs_texture_t *tex = NULL;
+
+	if (!graphics || !file || !*file)
+		return NULL;
+
+	cache = &graphics->image_cache;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	entry = find_entry(cache, file, mtime);
+	if (entry) {
+		tex = ref_entry(cache, entry);
+		cache->hits++;
+	}
+
+	pthread_mutex_unlock(&cache->mutex);
+	return tex;
+}
+
+gs_texture_t *gs_image_cache_add(const char *file, time_t mtime,
+		enum gs_color_format format, uint32_t cx, uint32_t cy,
+		const uint8_t *data)
+{
+	graphics_t *graphics = gs_get_context();
+	struct gs_image_cache *cache;
+	struct gs_image_cache_entry *entry;
+	struct gs_image_cache_entry new_entry = {0};
+	gs_texture_t *tex;
+
+	if (!graphics || !file || !*file || !data)
+		return NULL;
+
+	cache = &graphics->image_cache;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	entry = find_entry(cache, file, mtime);
+	if (entry) {
+		tex = ref_entry(cache, entry);
+		cache->hits++;
+		pthread_mutex_unlock(&cache->mutex);
+		return tex;
+	}
+
+	pthread_mutex_unlock(&cache->mutex);
+
+	tex = gs_texture_create(cx, cy, format, 1, &data, 0);
+	if (!tex)
+		return NULL;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/* another thread may have added the same image in the meantime */
+	entry = find_entry(cache, file, mtime);
+	if (entry) {
+		graphics->exports.gs_texture_destroy(tex);
+		tex = ref_entry(cache, entry);
+		cache->hits++;
+		pthread_mutex_unlock(&cache->mutex);
+		return tex;
+	}
+
+	new_entry.file      = bstrdup(file);
+	new_entry.mtime     = mtime;
+	new_entry.tex       = tex;
+	new_entry.size      = (size_t)cx * (size_t)cy *
+		gs_get_format_bpp(format) / 8;
+	new_entry.refs      = 1;
+	new_entry.last_used = ++cache->clock;
+	da_push_back(cache->entries, &new_entry);
+	os_atomic_inc_long(texture_mark(cache, tex));
+	cache->bytes += new_entry.size;
+	cache->misses++;
+
+	remove_stale_entries(graphics, file, mtime);
+	trim_cache(graphics);
+
+	pthread_mutex_unlock(&cache->mutex);
+	return tex;
+}
+
+bool gs_image_cache_release(graphics_t *graphics, gs_texture_t *tex)
+{
+	struct gs_image_cache *cache = &graphics->image_cache;
+	bool cached = false;
+
+	if (!os_atomic_load_long(texture_mark(cache, tex)))
+		return false;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	for (size_t i = 0; i < cache->entries.num; i++) {
+		struct gs_image_cache_entry *entry = cache->entries.array + i;
+
+		if (entry->tex == tex) {
+			if (--entry->refs == 0)
+				cache->unused_bytes += entry->size;
+			cached = true;
+			break;
+		}
+	}
+
+	if (cached)
+		trim_cache(graphics);
+
+	pthread_mutex_unlock(&cache->mutex);
+	return cached;
+}
+
+void gs_image_cache_set_budget(size_t bytes)
+{
+	graphics_t *graphics = gs_get_context();
+
+	if (!graphics)
+		return;
+
+	pthread_mutex_lock(&graphics->image_cache.mutex);
+	graphics->image_cache.budget = bytes;
+	trim_cache(graphics);
+	pthread_mutex_unlock(&graphics->image_cache.mutex);
+}
+
+void gs_image_cache_get_stats(struct gs_image_cache_stats *stats)
+{
+	graphics_t *graphics = gs_get_context();
+	struct gs_image_cache *cache;
+
+	if (!graphics || !stats)
+		return;
+
+	cache = &graphics->image_cache;
+
+	pthread_mutex_lock(&cache->mutex);
+	stats->hits         = cache->hits;
+	stats->misses       = cache->misses;
+	stats->evictions    = cache->evictions;
+	stats->entries      = cache->entries.num;
+	stats->bytes        = cache->bytes;
+	stats->unused_bytes = cache->unused_bytes;
+	stats->budget       = cache->budget;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static time_t get_modified_timestamp(const char *file)
+{
+	struct stat stats;
+	if (stat(file, &stats) != 0)
+		return 0;
+	return stats.st_mtime;
+}
+
+gs_texture_t *gs_texture_create_from_file(const char *file)
+{
+	graphics_t           *graphics = gs_get_context();
+	enum gs_color_format format;
+	uint32_t             cx;
+	uint32_t             cy;
+	uint8_t              *data;
+	gs_texture_t         *tex;
+	time_t               mtime;
+
+	if (!graphics || !file || !*file)
+		return NULL;
+
+	mtime = get_modified_timestamp(file);
+
+	tex = gs_image_cache_find(graphics, file, mtime);
+	if (tex)
+		return tex;
+
+	data = gs_create_texture_file_data(file, &format, &cx, &cy);
+	if (!data)
+		return NULL;
+
+	tex = gs_image_cache_add(file, mtime, format, cx, cy, data);
+	bfree(data);
+	return tex;
+}
@@ -25,6 +25,7 @@
 #include "../util/profiler.h"
 
 #include "audio-io.h"
+#include "audio-mix.h"
 #include "audio-resampler.h"
 
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
@@ -72,6 +73,13 @@ struct audio_line {
 	 * the circular buffer */
 	bool                       audio_data_out_of_bounds;
 
+	/* statistics, see audio_line_get_stats */
+	uint64_t                   cut_off_count;
+	uint64_t                   out_of_bounds_count;
+	int64_t                    jitter_ns;
+	int64_t                    max_latency_ns;
+	int64_t                    window_max_latency;
+
 	struct audio_line          **prev_next;
 	struct audio_line          *next;
 };
@@ -110,8 +118,20 @@ struct audio_output {
 	pthread_mutex_t            input_mutex;
 
 	struct audio_mix           mixes[MAX_AUDIO_MIXES];
+
+	/* buffering currently in use, which can be lower than info.buffer_ms
+	 * with adaptive buffering */
+	volatile long              buffer_ms;
+	uint64_t                   window_start;
+	bool                       cut_off;
+	bool                       window_cut_off;
 };
 
+static inline uint64_t get_buffer_ns(const struct audio_output *audio)
+{
+	return (uint64_t)os_atomic_load_long(&audio->buffer_ms) * 1000000ULL;
+}
+
 static inline void audio_output_removeline(struct audio_output *audio,
 		struct audio_line *line)
 {
@@ -163,6 +183,16 @@ static inline uint64_t conv_frames_to_time(const audio_t *audio,
 		(uint64_t)audio->info.samples_per_sec;
 }
 
+/* used for the running frame count of the audio tick, so it can't overflow
+ * no matter how long audio has been running */
+static inline uint64_t conv_total_frames_to_time(const audio_t *audio,
+		uint64_t frames)
+{
+	uint64_t rate = audio->info.samples_per_sec;
+	return frames / rate * 1000000000ULL +
+		frames % rate * 1000000000ULL / rate;
+}
+
 /* ------------------------------------------------------------------------- */
 
 /* this only really happens with the very initial data insertion.  can be
@@ -179,6 +209,9 @@ static inline void clear_excess_audio_data(struct audio_line *line,
 	                line->name, (uint32_t)size,
 	                prev_time, line->base_timestamp);*/
 
+	line->cut_off_count++;
+	line->audio->cut_off = true;
+
 	if (!line->audio_getting_cut_off) {
 		blog(LOG_WARNING, "Audio line '%s' audio data currently "
 		                  "getting cut off.  This could be due to a "
@@ -211,42 +244,31 @@ static inline size_t min_size(size_t a, size_t b)
 	((val > maxval) ? maxval : ((val < minval) ? minval : val))
 #endif
 
-#define MIX_BUFFER_SIZE 256
-
-/* TODO: optimize mixing */
 static void mix_float(struct audio_output *audio, struct audio_line *line,
-		size_t size, size_t time_offset, size_t plane)
+		size_t size, size_t time_offset, size_t plane,
+		uint32_t active_mixers)
 {
 	float *mixes[MAX_AUDIO_MIXES];
-	float vals[MIX_BUFFER_SIZE];
+	size_t num_mixes = 0;
 
+	/* only include this audio line in the mixes set via the line's
+	 * 'mixers' variable, and skip mixes that have no outputs */
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
-		uint8_t *bytes = audio->mixes[mix_idx].mix_buffers[plane].array;
-		mixes[mix_idx] = (float*)&bytes[time_offset];
-	}
-
-	while (size) {
-		size_t pop_count = min_size(size, sizeof(vals));
-		size -= pop_count;
-
-		circlebuf_pop_front(&line->buffers[plane], vals, pop_count);
-		pop_count /= sizeof(float);
+		uint8_t *bytes;
 
-		for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
-			/* only include this audio line in this mix if it's set
-			 * via the line's 'mixes' variable */
-			if ((line->mixers & (1 << mix_idx)) == 0)
-				continue;
+		if ((line->mixers & active_mixers & (1 << mix_idx)) == 0)
+			continue;
 
-			for (size_t i = 0; i < pop_count; i++) {
-				*(mixes[mix_idx]++) += vals[i];
-			}
-		}
+		bytes = audio->mixes[mix_idx].mix_buffers[plane].array;
+		mixes[num_mixes++] = (float*)&bytes[time_offset];
 	}
+
+	audio_mix_add_circlebuf(mixes, num_mixes, &line->buffers[plane], size);
 }
 
 static inline bool mix_audio_line(struct audio_output *audio,
-		struct audio_line *line, size_t size, uint64_t timestamp)
+		struct audio_line *line, size_t size, uint64_t timestamp,
+		uint32_t active_mixers)
 {
 	size_t time_offset = (size_t)ts_diff_bytes(audio,
 			line->base_timestamp, timestamp);
@@ -262,7 +284,8 @@ static inline bool mix_audio_line(struct audio_output *audio,
 	for (size_t i = 0; i < audio->planes; i++) {
 		size_t pop_size = min_size(size, line->buffers[i].size);
 
-		mix_float(audio, line, pop_size, time_offset, i);
+		mix_float(audio, line, pop_size, time_offset, i,
+				active_mixers);
 	}
 
 	return true;
@@ -319,7 +342,20 @@ static inline void do_audio_output(struct audio_output *audio,
 	pthread_mutex_unlock(&audio->input_mutex);
 }
 
-static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
+static inline uint32_t get_active_mixers(struct audio_output *audio)
+{
+	uint32_t active_mixers = 0;
+
+	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
+		if (audio->mixes[mix_idx].inputs.num)
+			active_mixers |= (1 << mix_idx);
+	}
+
+	return active_mixers;
+}
+
+static inline void clamp_audio_output(struct audio_output *audio, size_t bytes,
+		uint32_t active_mixers)
 {
 	size_t float_size = bytes / sizeof(float);
 
@@ -327,40 +363,27 @@ static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
 		struct audio_mix *mix = &audio->mixes[mix_idx];
 
 		/* do not process mixing if a specific mix is inactive */
-		if (!mix->inputs.num)
+		if ((active_mixers & (1 << mix_idx)) == 0)
 			continue;
 
-		for (size_t plane = 0; plane < audio->planes; plane++) {
-			float *mix_data = (float*)mix->mix_buffers[plane].array;
-			float *mix_end = &mix_data[float_size];
-
-			while (mix_data < mix_end) {
-				float val = *mix_data;
-				val = (val >  1.0f) ?  1.0f : val;
-				val = (val < -1.0f) ? -1.0f : val;
-				*(mix_data++) = val;
-			}
-		}
+		for (size_t plane = 0; plane < audio->planes; plane++)
+			audio_clamp_float((float*)mix->mix_buffers[plane].array,
+					float_size);
 	}
 }
 
-static uint64_t mix_and_output(struct audio_output *audio, uint64_t audio_time,
-		uint64_t prev_time)
+static void mix_and_output(struct audio_output *audio, uint64_t audio_time,
+		uint64_t prev_time, uint32_t frames)
 {
 	struct audio_line *line = audio->first_line;
-	uint32_t frames = (uint32_t)ts_diff_frames(audio, audio_time,
-	                                           prev_time);
 	size_t bytes = frames * audio->block_size;
+	uint32_t active_mixers = get_active_mixers(audio);
 
 #ifdef DEBUG_AUDIO
 	blog(LOG_DEBUG, "audio_time: %llu, prev_time: %llu, bytes: %lu",
 			audio_time, prev_time, bytes);
 #endif
 
-	/* return an adjusted audio_time according to the amount
-	 * of data that was sampled to ensure seamless transmission */
-	audio_time = prev_time + conv_frames_to_time(audio, frames);
-
 	/* resize and clear mix buffers */
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
 		struct audio_mix *mix = &audio->mixes[mix_idx];
@@ -397,7 +420,8 @@ static uint64_t mix_and_output(struct audio_output *audio, uint64_t audio_time,
 			                  line->name);
 		}
 
-		if (mix_audio_line(audio, line, bytes, prev_time))
+		if (mix_audio_line(audio, line, bytes, prev_time,
+					active_mixers))
 			line->base_timestamp = audio_time;
 
 		pthread_mutex_unlock(&line->mutex);
@@ -406,40 +430,170 @@ static uint64_t mix_and_output(struct audio_output *audio, uint64_t audio_time,
 	}
 
 	/* clamps audio data to -1.0..1.0 */
-	clamp_audio_output(audio, bytes);
+	clamp_audio_output(audio, bytes, active_mixers);
 
 	/* output */
 	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
 		do_audio_output(audio, i, prev_time, frames);
-
-	return audio_time;
 }
 
 /* sample audio 40 times a second */
 #define AUDIO_WAIT_TIME (1000/40)
 
+/* mixes whatever time has elapsed since the last mix */
+static uint64_t poll_audio(struct audio_output *audio, uint64_t prev_time,
+		uint32_t *frames)
+{
+	uint64_t audio_time;
+
+	os_sleep_ms(AUDIO_WAIT_TIME);
+
+	/* if buffering was just raised, wait until the buffering time has
+	 * passed again */
+	audio_time = os_gettime_ns() - get_buffer_ns(audio);
+	if (audio_time < prev_time) {
+		*frames = 0;
+		return prev_time;
+	}
+
+	*frames = (uint32_t)ts_diff_frames(audio, audio_time, prev_time);
+
+	/* adjust audio_time according to the amount of data that was
+	 * sampled to ensure seamless transmission */
+	return prev_time + conv_frames_to_time(audio, *frames);
+}
+
+/* waits for the deadline of the next fixed size tick.  the deadlines are
+ * absolute, so time spent mixing doesn't accumulate as drift, and if the
+ * thread falls behind it catches up one tick at a time */
+static uint64_t wait_audio_tick(struct audio_output *audio,
+		uint64_t start_time, uint64_t *total_frames)
+{
+	uint64_t audio_time;
+
+	*total_frames += audio->info.tick_frames;
+	audio_time = start_time +
+		conv_total_frames_to_time(audio, *total_frames);
+
+	os_sleepto_ns(audio_time + get_buffer_ns(audio));
+	return audio_time;
+}
+
+/* ------------------------------------------------------------------------- */
+/* adaptive buffering */
+
+#define BUFFER_WINDOW_NS          5000000000ULL
+#define MIN_ADAPTIVE_BUFFER_MS    40
+#define ADAPTIVE_BUFFER_MARGIN_MS 20
+
+static inline void set_buffer_ms(struct audio_output *audio, long buffer_ms)
+{
+	long max_ms = (long)audio->info.buffer_ms;
+
+	if (buffer_ms > max_ms)
+		buffer_ms = max_ms;
+	if (buffer_ms == os_atomic_load_long(&audio->buffer_ms))
+		return;
+
+	os_atomic_set_long(&audio->buffer_ms, buffer_ms);
+	blog(LOG_INFO, "Audio buffering for '%s' changed to %ld ms",
+			audio->info.name, buffer_ms);
+}
+
+/* lowers buffering to what the slowest line needed over the last window,
+ * by at most a quarter at a time */
+static void shrink_buffering(struct audio_output *audio, int64_t max_latency)
+{
+	long cur_ms    = os_atomic_load_long(&audio->buffer_ms);
+	long target_ms = (long)(max_latency / 1000000) * 3 / 2 +
+	                 ADAPTIVE_BUFFER_MARGIN_MS;
+
+	if (target_ms < MIN_ADAPTIVE_BUFFER_MS)
+		target_ms = MIN_ADAPTIVE_BUFFER_MS;
+	if (target_ms < cur_ms - cur_ms / 4)
+		target_ms = cur_ms - cur_ms / 4;
+
+	if (target_ms < cur_ms)
+		set_buffer_ms(audio, target_ms);
+}
+
+static void update_buffering(struct audio_output *audio)
+{
+	struct audio_line *line;
+	int64_t max_latency = 0;
+	uint64_t now;
+
+	/* data was cut off, so raise buffering straight away */
+	if (audio->cut_off) {
+		if (audio->info.adaptive_buffering)
+			set_buffer_ms(audio,
+				os_atomic_load_long(&audio->buffer_ms) * 2);
+
+		audio->cut_off = false;
+		audio->window_cut_off = true;
+	}
+
+	now = os_gettime_ns();
+	if (now - audio->window_start < BUFFER_WINDOW_NS)
+		return;
+
+	audio->window_start = now;
+
+	for (line = audio->first_line; line; line = line->next) {
+		pthread_mutex_lock(&line->mutex);
+
+		line->max_latency_ns = line->window_max_latency;
+		line->window_max_latency = 0;
+		if (line->max_latency_ns > max_latency)
+			max_latency = line->max_latency_ns;
+
+		pthread_mutex_unlock(&line->mutex);
+	}
+
+	if (audio->info.adaptive_buffering && !audio->window_cut_off)
+		shrink_buffering(audio, max_latency);
+
+	audio->window_cut_off = false;
+}
+
+/* ------------------------------------------------------------------------- */
+
 static void *audio_thread(void *param)
 {
 	struct audio_output *audio = param;
-	uint64_t buffer_time = audio->info.buffer_ms * 1000000;
-	uint64_t prev_time = os_gettime_ns() - buffer_time;
+	uint64_t start_time = os_gettime_ns() - get_buffer_ns(audio);
+	uint64_t prev_time = start_time;
+	uint64_t total_frames = 0;
 	uint64_t audio_time;
+	uint32_t frames;
 
 	os_set_thread_name("audio-io: audio thread");
 
 	const char *audio_thread_name =
 		profile_store_name(obs_get_profiler_name_store(),
 				"audio_thread(%s)", audio->info.name);
+
+	audio->window_start = os_gettime_ns();
 	
 	while (os_event_try(audio->stop_event) == EAGAIN) {
-		os_sleep_ms(AUDIO_WAIT_TIME);
+		if (audio->info.tick_frames) {
+			audio_time = wait_audio_tick(audio, start_time,
+					&total_frames);
+			frames = audio->info.tick_frames;
+		} else {
+			audio_time = poll_audio(audio, prev_time, &frames);
+		}
+
+		if (!frames)
+			continue;
 
 		profile_start(audio_thread_name);
 		pthread_mutex_lock(&audio->line_mutex);
 
-		audio_time = os_gettime_ns() - buffer_time;
-		audio_time = mix_and_output(audio, audio_time, prev_time);
-		prev_time  = audio_time;
+		mix_and_output(audio, audio_time, prev_time, frames);
+		prev_time = audio_time;
+
+		update_buffering(audio);
 
 		pthread_mutex_unlock(&audio->line_mutex);
 		profile_end(audio_thread_name);
@@ -578,6 +732,7 @@ int audio_output_open(audio_t **audio, struct audio_output_info *info)
 		goto fail;
 
 	memcpy(&out->info, info, sizeof(struct audio_output_info));
+	out->buffer_ms  = (long)info->buffer_ms;
 	pthread_mutex_init_value(&out->line_mutex);
 	out->channels   = get_audio_channels(info->speakers);
 	out->planes     = planar ? out->channels : 1;
@@ -725,13 +880,6 @@ uint32_t audio_output_get_sample_rate(const audio_t *audio)
 	return audio ? audio->info.samples_per_sec : 0;
 }
 
-/* TODO: optimize these two functions */
-static inline void mul_vol_float(float *array, float volume, size_t count)
-{
-	for (size_t i = 0; i < count; i++)
-		array[i] *= volume;
-}
-
 static void audio_line_place_data_pos(struct audio_line *line,
 		const struct audio_data *data, size_t position)
 {
@@ -740,17 +888,19 @@ static void audio_line_place_data_pos(struct audio_line *line,
 	size_t total_size = data->frames * line->audio->block_size;
 
 	for (size_t i = 0; i < line->audio->planes; i++) {
-		da_copy_array(line->volume_buffers[i], data->data[i],
-				total_size);
+		da_resize(line->volume_buffers[i], total_size);
 
 		uint8_t *array = line->volume_buffers[i].array;
 
 		switch (line->audio->info.format) {
 		case AUDIO_FORMAT_FLOAT:
 		case AUDIO_FORMAT_FLOAT_PLANAR:
-			mul_vol_float((float*)array, data->volume, total_num);
+			audio_gain_float((float*)array,
+					(const float*)data->data[i],
+					data->volume, total_num);
 			break;
 		default:
+			memcpy(array, data->data[i], total_size);
 			blog(LOG_ERROR, "audio_line_place_data_pos: "
 			                "Unsupported or unknown format");
 			break;
@@ -780,11 +930,38 @@ static inline uint64_t smooth_ts(struct audio_line *line, uint64_t timestamp)
 	return (diff < TS_SMOOTHING_THRESHOLD) ? line->next_ts_min : timestamp;
 }
 
+/* running average of how far timestamps are from where they're expected,
+ * smoothed the same way as RTP interarrival jitter */
+static inline void update_jitter(struct audio_line *line, uint64_t timestamp)
+{
+	int64_t diff;
+
+	if (!line->next_ts_min)
+		return;
+
+	diff = (int64_t)(timestamp - line->next_ts_min);
+	if (diff < 0)
+		diff = -diff;
+
+	line->jitter_ns += (diff - line->jitter_ns) / 16;
+}
+
+static inline void update_latency(struct audio_line *line, uint64_t timestamp)
+{
+	int64_t latency = (int64_t)(os_gettime_ns() - timestamp);
+
+	if (latency > line->window_max_latency)
+		line->window_max_latency = latency;
+}
+
 static bool audio_line_place_data(struct audio_line *line,
 		const struct audio_data *data)
 {
 	int64_t pos;
-	uint64_t timestamp = smooth_ts(line, data->timestamp);
+	uint64_t timestamp;
+
+	update_jitter(line, data->timestamp);
+	timestamp = smooth_ts(line, data->timestamp);
 
 	pos = ts_diff_bytes(line->audio, timestamp, line->base_timestamp);
 
@@ -828,13 +1005,18 @@ void audio_line_output(audio_line_t *line, const struct audio_data *data)
 
 	if (!line->buffers[0].size) {
 		line->base_timestamp = data->timestamp -
-		                       line->audio->info.buffer_ms * 1000000;
+		                       get_buffer_ns(line->audio);
 		inserted_audio = audio_line_place_data(line, data);
 
 	} else if (valid_timestamp_range(line, data->timestamp)) {
 		inserted_audio = audio_line_place_data(line, data);
 	}
 
+	if (inserted_audio)
+		update_latency(line, data->timestamp);
+	else
+		line->out_of_bounds_count++;
+
 	if (!inserted_audio) {
 		if (!line->audio_data_out_of_bounds) {
 			blog(LOG_WARNING, "Audio line '%s' currently "
@@ -871,3 +1053,55 @@ uint32_t audio_line_get_mixers(audio_line_t *line)
 {
 	return !!line ? line->mixers : 0;
 }
+
+static inline void get_line_stats(struct audio_line *line,
+		struct audio_line_stats *stats)
+{
+	struct audio_output *audio = line->audio;
+	uint64_t frames = line->buffers[0].size / audio->block_size;
+
+	stats->buffered_ns         = conv_total_frames_to_time(audio, frames);
+	stats->cut_off_count       = line->cut_off_count;
+	stats->out_of_bounds_count = line->out_of_bounds_count;
+	stats->jitter_ns           = (uint64_t)line->jitter_ns;
+	stats->max_latency_ns      = line->max_latency_ns;
+}
+
+void audio_line_get_stats(audio_line_t *line, struct audio_line_stats *stats)
+{
+	if (!line || !stats) return;
+
+	pthread_mutex_lock(&line->mutex);
+	get_line_stats(line, stats);
+	pthread_mutex_unlock(&line->mutex);
+}
+
+void audio_output_enum_lines(audio_t *audio,
+		bool (*enum_proc)(void *param, const char *name,
+			const struct audio_line_stats *stats),
+		void *param)
+{
+	struct audio_line *line;
+
+	if (!audio || !enum_proc) return;
+
+	pthread_mutex_lock(&audio->line_mutex);
+
+	for (line = audio->first_line; line; line = line->next) {
+		struct audio_line_stats stats;
+
+		pthread_mutex_lock(&line->mutex);
+		get_line_stats(line, &stats);
+		pthread_mutex_unlock(&line->mutex);
+
+		if (!enum_proc(param, line->name, &stats))
+			break;
+	}
+
+	pthread_mutex_unlock(&audio->line_mutex);
+}
+
+uint64_t audio_output_get_buffer_ms(const audio_t *audio)
+{
+	return audio ? (uint64_t)os_atomic_load_long(&audio->buffer_ms) : 0;
+}
@@ -79,6 +79,41 @@ struct audio_output_info {
 	enum audio_format   format;
 	enum speaker_layout speakers;
 	uint64_t            buffer_ms;
+
+	/**
+	 * If nonzero, audio is mixed in ticks of exactly this many frames,
+	 * each one output at a fixed deadline.  Otherwise whatever time has
+	 * elapsed is mixed every 25 milliseconds.
+	 */
+	uint32_t            tick_frames;
+
+	/**
+	 * If true, buffering is lowered below buffer_ms while the timing of
+	 * every audio line allows it, and raised again (up to buffer_ms) when
+	 * a line's data starts getting cut off.
+	 */
+	bool                adaptive_buffering;
+};
+
+/** Timing statistics for an audio line */
+struct audio_line_stats {
+	/** Duration of the audio currently buffered for the line */
+	uint64_t            buffered_ns;
+
+	/** Number of mixes that had to cut off late data for the line */
+	uint64_t            cut_off_count;
+
+	/** Number of chunks rejected for being out of the buffering range */
+	uint64_t            out_of_bounds_count;
+
+	/** Smoothed deviation of timestamps from their expected values */
+	uint64_t            jitter_ns;
+
+	/**
+	 * Highest time between a chunk's timestamp and its arrival over the
+	 * last few seconds.  This is how much buffering the line needs.
+	 */
+	int64_t             max_latency_ns;
 };
 
 struct audio_convert_info {
@@ -218,6 +253,24 @@ EXPORT uint32_t audio_line_get_mixers(audio_line_t *line);
 EXPORT void audio_line_destroy(audio_line_t *line);
 EXPORT void audio_line_output(audio_line_t *line, const struct audio_data *data);
 
+EXPORT void audio_line_get_stats(audio_line_t *line,
+		struct audio_line_stats *stats);
+
+/**
+ * Enumerates the audio lines of the output along with their statistics.
+ * Return false from the callback to stop enumeration.
+ */
+EXPORT void audio_output_enum_lines(audio_t *audio,
+		bool (*enum_proc)(void *param, const char *name,
+			const struct audio_line_stats *stats),
+		void *param);
+
+/**
+ * Returns the buffering currently in use, which can be lower than
+ * audio_output_info.buffer_ms when adaptive buffering is enabled.
+ */
+EXPORT uint64_t audio_output_get_buffer_ms(const audio_t *audio);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,130 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "../util/circlebuf.h"
+#include "audio-mix.h"
+#include <xmmintrin.h>
+
+/* the source vectors are loaded once per block and added to every mix, so
+ * each sample is only read once no matter how many mixes it goes to */
+#define MIX_BLOCK 16
+
+static inline void mix_add(float *const *mixes, size_t num_mixes,
+		size_t mix_offset, const float *src, size_t count)
+{
+	size_t block_count = count & ~(size_t)(MIX_BLOCK - 1);
+	size_t i;
+
+	for (i = 0; i < block_count; i += MIX_BLOCK) {
+		__m128 src0 = _mm_loadu_ps(src + i);
+		__m128 src1 = _mm_loadu_ps(src + i + 4);
+		__m128 src2 = _mm_loadu_ps(src + i + 8);
+		__m128 src3 = _mm_loadu_ps(src + i + 12);
+
+		for (size_t mix_idx = 0; mix_idx < num_mixes; mix_idx++) {
+			float *mix = mixes[mix_idx] + mix_offset + i;
+
+			_mm_storeu_ps(mix,
+				_mm_add_ps(_mm_loadu_ps(mix),      src0));
+			_mm_storeu_ps(mix + 4,
+				_mm_add_ps(_mm_loadu_ps(mix + 4),  src1));
+			_mm_storeu_ps(mix + 8,
+				_mm_add_ps(_mm_loadu_ps(mix + 8),  src2));
+			_mm_storeu_ps(mix + 12,
+				_mm_add_ps(_mm_loadu_ps(mix + 12), src3));
+		}
+	}
+
+	for (size_t mix_idx = 0; mix_idx < num_mixes; mix_idx++) {
+		float *mix = mixes[mix_idx] + mix_offset;
+
+		for (size_t j = i; j < count; j++)
+			mix[j] += src[j];
+	}
+}
+
+void audio_mix_add_float(float *const *mixes, size_t num_mixes,
+		const float *src, size_t count)
+{
+	mix_add(mixes, num_mixes, 0, src, count);
+}
+
+void audio_mix_add_circlebuf(float *const *mixes, size_t num_mixes,
+		struct circlebuf *buf, size_t size)
+{
+	size_t start_size;
+
+	assert(size <= buf->size);
+
+	if (!size)
+		return;
+
+	start_size = buf->capacity - buf->start_pos;
+	if (start_size > size)
+		start_size = size;
+
+	mix_add(mixes, num_mixes, 0,
+			(const float*)((uint8_t*)buf->data + buf->start_pos),
+			start_size / sizeof(float));
+
+	if (start_size < size)
+		mix_add(mixes, num_mixes, start_size / sizeof(float),
+				(const float*)buf->data,
+				(size - start_size) / sizeof(float));
+
+	circlebuf_pop_front(buf, NULL, size);
+}
+
+void audio_clamp_float(float *data, size_t count)
+{
+	const __m128 pos_one = _mm_set1_ps( 1.0f);
+	const __m128 neg_one = _mm_set1_ps(-1.0f);
+	size_t block_count = count & ~(size_t)3;
+	size_t i;
+
+	/* operand order matches the scalar version: NaN is passed through */
+	for (i = 0; i < block_count; i += 4) {
+		__m128 val = _mm_loadu_ps(data + i);
+		val = _mm_min_ps(pos_one, _mm_max_ps(neg_one, val));
+		_mm_storeu_ps(data + i, val);
+	}
+
+	for (; i < count; i++) {
+		float val = data[i];
+		val = (val >  1.0f) ?  1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		data[i] = val;
+	}
+}
+
+void audio_gain_float(float *dst, const float *src, float volume,
+		size_t count)
+{
+	const __m128 vol = _mm_set1_ps(volume);
+	size_t block_count = count & ~(size_t)7;
+	size_t i;
+
+	for (i = 0; i < block_count; i += 8) {
+		__m128 val0 = _mm_loadu_ps(src + i);
+		__m128 val1 = _mm_loadu_ps(src + i + 4);
+		_mm_storeu_ps(dst + i,     _mm_mul_ps(val0, vol));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(val1, vol));
+	}
+
+	for (; i < count; i++)
+		dst[i] = src[i] * volume;
+}
@@ -0,0 +1,54 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct circlebuf;
+
+/*
+ * SSE kernels used by the audio mixer for 32-bit float samples.  The results
+ * are bit-exact with a plain scalar loop; pointers do not need to be aligned.
+ */
+
+/** Adds count floats from src to each of the num_mixes mix buffers */
+EXPORT void audio_mix_add_float(float *const *mixes, size_t num_mixes,
+		const float *src, size_t count);
+
+/**
+ * Pops size bytes of float samples from the front of a circular buffer and
+ * adds them to each of the num_mixes mix buffers.  The buffer storage is
+ * read in place (as at most two contiguous spans) rather than copied out.
+ */
+EXPORT void audio_mix_add_circlebuf(float *const *mixes, size_t num_mixes,
+		struct circlebuf *buf, size_t size);
+
+/** Clamps count floats to the -1.0..1.0 range */
+EXPORT void audio_clamp_float(float *data, size_t count);
+
+/** Writes src multiplied by volume to dst (dst may be the same as src) */
+EXPORT void audio_gain_float(float *dst, const float *src, float volume,
+		size_t count);
+
+#ifdef __cplusplus
+}
+#endif
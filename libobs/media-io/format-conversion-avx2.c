@@ -0,0 +1,485 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/* AVX2 conversion kernels.  This file is compiled with AVX2 enabled and must
+ * only be called after checking for CPU (and OS) support.
+ *
+ * Most AVX2 byte shuffles only work within each 128-bit lane, so the kernels
+ * below shuffle in-lane the same way the SSSE3 kernels do and then fix up the
+ * lane order with a single cross-lane permute. */
+
+#include "format-conversion-internal.h"
+#include <immintrin.h>
+
+#define Z -1
+
+#define LANES(a, b) \
+	_mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1)
+
+#define PIX_SHUF(o, d) \
+	_mm_setr_epi8( \
+		(d) == 0  ? (o)   : Z, (d) == 0  ? (o)+4 : Z, \
+		(d) == 0  ? (o)+8 : Z, (d) == 0  ? (o)+12 : Z, \
+		(d) == 4  ? (o)   : Z, (d) == 4  ? (o)+4 : Z, \
+		(d) == 4  ? (o)+8 : Z, (d) == 4  ? (o)+12 : Z, \
+		(d) == 8  ? (o)   : Z, (d) == 8  ? (o)+4 : Z, \
+		(d) == 8  ? (o)+8 : Z, (d) == 8  ? (o)+12 : Z, \
+		(d) == 12 ? (o)   : Z, (d) == 12 ? (o)+4 : Z, \
+		(d) == 12 ? (o)+8 : Z, (d) == 12 ? (o)+12 : Z)
+
+#define PIX_SHUF256(o, d) LANES(PIX_SHUF(o, d), PIX_SHUF(o, d))
+
+static inline __m256i lane_fixup(__m256i v)
+{
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	return _mm256_permutevar8x32_epi32(v, order);
+}
+
+/* gathers one plane (byte offset 'o' of each pixel) of 32 packed pixels */
+static inline __m256i gather_plane(const __m256i *px, int o)
+{
+	__m256i r;
+
+	switch (o) {
+	case 0:
+		r =                    _mm256_shuffle_epi8(px[0], PIX_SHUF256(0, 0));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[1], PIX_SHUF256(0, 4)));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[2], PIX_SHUF256(0, 8)));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[3], PIX_SHUF256(0, 12)));
+		break;
+	case 1:
+		r =                    _mm256_shuffle_epi8(px[0], PIX_SHUF256(1, 0));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[1], PIX_SHUF256(1, 4)));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[2], PIX_SHUF256(1, 8)));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[3], PIX_SHUF256(1, 12)));
+		break;
+	default:
+		r =                    _mm256_shuffle_epi8(px[0], PIX_SHUF256(2, 0));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[1], PIX_SHUF256(2, 4)));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[2], PIX_SHUF256(2, 8)));
+		r = _mm256_or_si256(r, _mm256_shuffle_epi8(px[3], PIX_SHUF256(2, 12)));
+	}
+
+	return lane_fixup(r);
+}
+
+static inline void load_pixels(const uint8_t *img, __m256i *px)
+{
+	px[0] = _mm256_loadu_si256((const __m256i*)img);
+	px[1] = _mm256_loadu_si256((const __m256i*)(img + 32));
+	px[2] = _mm256_loadu_si256((const __m256i*)(img + 64));
+	px[3] = _mm256_loadu_si256((const __m256i*)(img + 96));
+}
+
+static inline __m256i sum_uv_pairs(__m256i px0, __m256i px1)
+{
+	const __m128i lo = _mm_setr_epi8(0, 4, 2, 6, 8, 12, 10, 14,
+			Z, Z, Z, Z, Z, Z, Z, Z);
+	const __m128i hi = _mm_setr_epi8(Z, Z, Z, Z, Z, Z, Z, Z,
+			0, 4, 2, 6, 8, 12, 10, 14);
+	const __m256i ones = _mm256_set1_epi8(1);
+
+	__m256i uv = _mm256_or_si256(
+			_mm256_shuffle_epi8(px0, LANES(lo, lo)),
+			_mm256_shuffle_epi8(px1, LANES(hi, hi)));
+	return _mm256_maddubs_epi16(uv, ones);
+}
+
+/* averaged 4:2:0 chroma for 32 pixels of two lines, as 32 bytes in
+ * interleaved U V order */
+static inline __m256i average_uv(const __m256i *line0, const __m256i *line1)
+{
+	__m256i a = _mm256_add_epi16(sum_uv_pairs(line0[0], line0[1]),
+			sum_uv_pairs(line1[0], line1[1]));
+	__m256i b = _mm256_add_epi16(sum_uv_pairs(line0[2], line0[3]),
+			sum_uv_pairs(line1[2], line1[3]));
+
+	return lane_fixup(_mm256_packus_epi16(
+			_mm256_srli_epi16(a, 2), _mm256_srli_epi16(b, 2)));
+}
+
+void compress_uyvx_to_i420_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+			1, 3, 5, 7, 9, 11, 13, 15);
+	const __m256i split = LANES(deinterleave, deinterleave);
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line0 = input + y * in_linesize;
+		const uint8_t *line1 = line0 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *u = output[1] + (y>>1) * out_linesize[1];
+		uint8_t *v = output[2] + (y>>1) * out_linesize[2];
+		uint32_t x;
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i px0[4], px1[4], uv;
+
+			load_pixels(line0 + x*4, px0);
+			load_pixels(line1 + x*4, px1);
+
+			_mm256_storeu_si256((__m256i*)(lum0 + x),
+					gather_plane(px0, 1));
+			_mm256_storeu_si256((__m256i*)(lum1 + x),
+					gather_plane(px1, 1));
+
+			uv = _mm256_shuffle_epi8(average_uv(px0, px1), split);
+			uv = _mm256_permute4x64_epi64(uv, _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128((__m128i*)(u + x/2),
+					_mm256_castsi256_si128(uv));
+			_mm_storeu_si128((__m128i*)(v + x/2),
+					_mm256_extracti128_si256(uv, 1));
+		}
+
+		uyvx_to_420_line_ref(line0, line1, x, width, lum0, lum1,
+				u, v, 1);
+	}
+}
+
+void compress_uyvx_to_nv12_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line0 = input + y * in_linesize;
+		const uint8_t *line1 = line0 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *chroma = output[1] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i px0[4], px1[4];
+
+			load_pixels(line0 + x*4, px0);
+			load_pixels(line1 + x*4, px1);
+
+			_mm256_storeu_si256((__m256i*)(lum0 + x),
+					gather_plane(px0, 1));
+			_mm256_storeu_si256((__m256i*)(lum1 + x),
+					gather_plane(px1, 1));
+			_mm256_storeu_si256((__m256i*)(chroma + x),
+					average_uv(px0, px1));
+		}
+
+		uyvx_to_420_line_ref(line0, line1, x, width, lum0, lum1,
+				chroma, chroma + 1, 2);
+	}
+}
+
+void convert_uyvx_to_i444_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *line = input + y * in_linesize;
+		uint32_t pos = y * out_linesize[0];
+		uint8_t *lum = output[0] + pos;
+		uint8_t *u = output[1] + pos;
+		uint8_t *v = output[2] + pos;
+		uint32_t x;
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i px[4];
+
+			load_pixels(line + x*4, px);
+
+			_mm256_storeu_si256((__m256i*)(lum + x),
+					gather_plane(px, 1));
+			_mm256_storeu_si256((__m256i*)(u + x),
+					gather_plane(px, 0));
+			_mm256_storeu_si256((__m256i*)(v + x),
+					gather_plane(px, 2));
+		}
+
+		uyvx_to_444_line_ref(line, x, width, lum, u, v);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* writes 32 packed pixels from 32 luma bytes and 16 interleaved U V pairs,
+ * each given as two 128-bit halves */
+static inline void store_packed_420(uint8_t *out,
+		const __m128i *lum, const __m128i *uv)
+{
+	const __m128i lum_shuf[4] = {
+		_mm_setr_epi8(0,  Z, Z, Z, 1,  Z, Z, Z,
+		              2,  Z, Z, Z, 3,  Z, Z, Z),
+		_mm_setr_epi8(4,  Z, Z, Z, 5,  Z, Z, Z,
+		              6,  Z, Z, Z, 7,  Z, Z, Z),
+		_mm_setr_epi8(8,  Z, Z, Z, 9,  Z, Z, Z,
+		              10, Z, Z, Z, 11, Z, Z, Z),
+		_mm_setr_epi8(12, Z, Z, Z, 13, Z, Z, Z,
+		              14, Z, Z, Z, 15, Z, Z, Z)
+	};
+	const __m128i uv_shuf[4] = {
+		_mm_setr_epi8(Z, 0,  1,  Z, Z, 0,  1,  Z,
+		              Z, 2,  3,  Z, Z, 2,  3,  Z),
+		_mm_setr_epi8(Z, 4,  5,  Z, Z, 4,  5,  Z,
+		              Z, 6,  7,  Z, Z, 6,  7,  Z),
+		_mm_setr_epi8(Z, 8,  9,  Z, Z, 8,  9,  Z,
+		              Z, 10, 11, Z, Z, 10, 11, Z),
+		_mm_setr_epi8(Z, 12, 13, Z, Z, 12, 13, Z,
+		              Z, 14, 15, Z, Z, 14, 15, Z)
+	};
+	const __m256i lum_mask[2] = {
+		LANES(lum_shuf[0], lum_shuf[1]),
+		LANES(lum_shuf[2], lum_shuf[3])
+	};
+	const __m256i uv_mask[2] = {
+		LANES(uv_shuf[0], uv_shuf[1]),
+		LANES(uv_shuf[2], uv_shuf[3])
+	};
+
+	for (size_t half = 0; half < 2; half++) {
+		__m256i l = _mm256_broadcastsi128_si256(lum[half]);
+		__m256i c = _mm256_broadcastsi128_si256(uv[half]);
+
+		for (size_t i = 0; i < 2; i++) {
+			__m256i px = _mm256_or_si256(
+					_mm256_shuffle_epi8(l, lum_mask[i]),
+					_mm256_shuffle_epi8(c, uv_mask[i]));
+			_mm256_storeu_si256(
+					(__m256i*)(out + half*64 + i*32), px);
+		}
+	}
+}
+
+static inline void load_lum(const uint8_t *lum, __m128i *out)
+{
+	out[0] = _mm_loadu_si128((const __m128i*)lum);
+	out[1] = _mm_loadu_si128((const __m128i*)(lum + 16));
+}
+
+void decompress_nv12_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize)/2;
+
+	for (uint32_t y = start_y/2; y < end_y/2; y++) {
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1 = lum0 + in_linesize[0];
+		const uint8_t *chroma = input[1] + y * in_linesize[1];
+		uint8_t *out0 = output + y * 2 * out_linesize;
+		uint8_t *out1 = out0 + out_linesize;
+		uint32_t x;
+
+		for (x = 0; x + 16 <= width_d2; x += 16) {
+			__m128i uv[2], lum[2];
+
+			uv[0] = _mm_loadu_si128((const __m128i*)(chroma + x*2));
+			uv[1] = _mm_loadu_si128(
+					(const __m128i*)(chroma + x*2 + 16));
+
+			load_lum(lum0 + x*2, lum);
+			store_packed_420(out0 + x*8, lum, uv);
+			load_lum(lum1 + x*2, lum);
+			store_packed_420(out1 + x*8, lum, uv);
+		}
+
+		yuv420_to_packed_line_ref(lum0, lum1, chroma, chroma + 1, 2,
+				x, width_d2, out0, out1);
+	}
+}
+
+void decompress_420_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize)/2;
+
+	for (uint32_t y = start_y/2; y < end_y/2; y++) {
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1 = lum0 + in_linesize[0];
+		const uint8_t *u = input[1] + y * in_linesize[1];
+		const uint8_t *v = input[2] + y * in_linesize[2];
+		uint8_t *out0 = output + y * 2 * out_linesize;
+		uint8_t *out1 = out0 + out_linesize;
+		uint32_t x;
+
+		for (x = 0; x + 16 <= width_d2; x += 16) {
+			__m128i uv[2], lum[2];
+			__m128i u16 = _mm_loadu_si128((const __m128i*)(u + x));
+			__m128i v16 = _mm_loadu_si128((const __m128i*)(v + x));
+
+			uv[0] = _mm_unpacklo_epi8(u16, v16);
+			uv[1] = _mm_unpackhi_epi8(u16, v16);
+
+			load_lum(lum0 + x*2, lum);
+			store_packed_420(out0 + x*8, lum, uv);
+			load_lum(lum1 + x*2, lum);
+			store_packed_420(out1 + x*8, lum, uv);
+		}
+
+		yuv420_to_packed_line_ref(lum0, lum1, u, v, 1,
+				x, width_d2, out0, out1);
+	}
+}
+
+void decompress_422_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	uint32_t width_d2 = min_uint32(in_linesize/4, out_linesize/8);
+	__m128i shuf_lo, shuf_hi;
+	__m256i mask_lo, mask_hi;
+
+	if (leading_lum) {
+		shuf_lo = _mm_setr_epi8(0, 1, 2, 3, 2, 1, 2, 3,
+				4, 5, 6, 7, 6, 5, 6, 7);
+		shuf_hi = _mm_setr_epi8(8, 9, 10, 11, 10, 9, 10, 11,
+				12, 13, 14, 15, 14, 13, 14, 15);
+	} else {
+		shuf_lo = _mm_setr_epi8(0, 1, 2, 3, 0, 3, 2, 3,
+				4, 5, 6, 7, 4, 7, 6, 7);
+		shuf_hi = _mm_setr_epi8(8, 9, 10, 11, 8, 11, 10, 11,
+				12, 13, 14, 15, 12, 15, 14, 15);
+	}
+
+	mask_lo = LANES(shuf_lo, shuf_lo);
+	mask_hi = LANES(shuf_hi, shuf_hi);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *line = input + y * in_linesize;
+		uint8_t *out = output + y * out_linesize;
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m256i in = _mm256_loadu_si256(
+					(const __m256i*)(line + x*4));
+			__m256i lo = _mm256_shuffle_epi8(in, mask_lo);
+			__m256i hi = _mm256_shuffle_epi8(in, mask_hi);
+
+			_mm256_storeu_si256((__m256i*)(out + x*8),
+					_mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i*)(out + x*8 + 32),
+					_mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+
+		decompress_422_line_ref(line, x, width_d2, out, leading_lum);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* averaged 4:2:0 U and V samples of 32 pixels of two planar lines, as
+ * 16 bytes of U followed by 16 bytes of V */
+static inline __m256i average_planes(
+		const uint8_t *u0, const uint8_t *u1,
+		const uint8_t *v0, const uint8_t *v1)
+{
+	const __m256i ones = _mm256_set1_epi8(1);
+	__m256i uw = _mm256_add_epi16(
+			_mm256_maddubs_epi16(_mm256_loadu_si256(
+					(const __m256i*)u0), ones),
+			_mm256_maddubs_epi16(_mm256_loadu_si256(
+					(const __m256i*)u1), ones));
+	__m256i vw = _mm256_add_epi16(
+			_mm256_maddubs_epi16(_mm256_loadu_si256(
+					(const __m256i*)v0), ones),
+			_mm256_maddubs_epi16(_mm256_loadu_si256(
+					(const __m256i*)v1), ones));
+	__m256i uv = _mm256_packus_epi16(_mm256_srli_epi16(uw, 2),
+			_mm256_srli_epi16(vw, 2));
+
+	return _mm256_permute4x64_epi64(uv, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+void compress_i444_to_i420_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize[0], out_linesize[0]);
+
+	copy_lum_lines(input, in_linesize, start_y, end_y,
+			output, out_linesize, width);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *u0 = input[1] + y * in_linesize[1];
+		const uint8_t *v0 = input[2] + y * in_linesize[2];
+		const uint8_t *u1 = u0 + in_linesize[1];
+		const uint8_t *v1 = v0 + in_linesize[2];
+		uint8_t *u = output[1] + (y>>1) * out_linesize[1];
+		uint8_t *v = output[2] + (y>>1) * out_linesize[2];
+		uint32_t x;
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i uv = average_planes(u0 + x, u1 + x,
+					v0 + x, v1 + x);
+
+			_mm_storeu_si128((__m128i*)(u + x/2),
+					_mm256_castsi256_si128(uv));
+			_mm_storeu_si128((__m128i*)(v + x/2),
+					_mm256_extracti128_si256(uv, 1));
+		}
+
+		i444_to_420_line_ref(u0, u1, v0, v1, x, width, u, v, 1);
+	}
+}
+
+void compress_i444_to_nv12_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize[0], out_linesize[0]);
+
+	copy_lum_lines(input, in_linesize, start_y, end_y,
+			output, out_linesize, width);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *u0 = input[1] + y * in_linesize[1];
+		const uint8_t *v0 = input[2] + y * in_linesize[2];
+		const uint8_t *u1 = u0 + in_linesize[1];
+		const uint8_t *v1 = v0 + in_linesize[2];
+		uint8_t *chroma = output[1] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i uv = average_planes(u0 + x, u1 + x,
+					v0 + x, v1 + x);
+			__m128i u16 = _mm256_castsi256_si128(uv);
+			__m128i v16 = _mm256_extracti128_si256(uv, 1);
+
+			_mm_storeu_si128((__m128i*)(chroma + x),
+					_mm_unpacklo_epi8(u16, v16));
+			_mm_storeu_si128((__m128i*)(chroma + x + 16),
+					_mm_unpackhi_epi8(u16, v16));
+		}
+
+		i444_to_420_line_ref(u0, u1, v0, v1, x, width,
+				chroma, chroma + 1, 2);
+	}
+}
@@ -0,0 +1,209 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <string.h>
+#include "format-conversion.h"
+
+/*
+ * Scalar reference kernels, operating on a [start_x, end_x) column range so
+ * that the SIMD kernels can use them for the tail of each line.  Every SIMD
+ * kernel must produce output that is bit-exact with these.
+ *
+ * Packed UYVX pixels are little-endian 32-bit values: U in bits 0-7, Y in
+ * bits 8-15, V in bits 16-23.
+ */
+
+static inline uint32_t min_uint32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+#define uyvx_u(px) ((uint8_t)(px))
+#define uyvx_y(px) ((uint8_t)((px) >> 8))
+#define uyvx_v(px) ((uint8_t)((px) >> 16))
+
+static inline void uyvx_to_420_line_ref(
+		const uint8_t *line0, const uint8_t *line1,
+		uint32_t start_x, uint32_t end_x,
+		uint8_t *lum0, uint8_t *lum1,
+		uint8_t *u_out, uint8_t *v_out, uint32_t chroma_step)
+{
+	const uint32_t *in0 = (const uint32_t*)line0;
+	const uint32_t *in1 = (const uint32_t*)line1;
+
+	for (uint32_t x = start_x; x < end_x; x += 2) {
+		uint32_t x1 = (x + 1 < end_x) ? x + 1 : x;
+		uint32_t p00 = in0[x], p01 = in0[x1];
+		uint32_t p10 = in1[x], p11 = in1[x1];
+		uint32_t c = (x >> 1) * chroma_step;
+
+		lum0[x] = uyvx_y(p00);
+		lum1[x] = uyvx_y(p10);
+		if (x1 != x) {
+			lum0[x1] = uyvx_y(p01);
+			lum1[x1] = uyvx_y(p11);
+		}
+
+		u_out[c] = (uint8_t)((uyvx_u(p00) + uyvx_u(p01) +
+		                      uyvx_u(p10) + uyvx_u(p11)) >> 2);
+		v_out[c] = (uint8_t)((uyvx_v(p00) + uyvx_v(p01) +
+		                      uyvx_v(p10) + uyvx_v(p11)) >> 2);
+	}
+}
+
+static inline void uyvx_to_444_line_ref(const uint8_t *line,
+		uint32_t start_x, uint32_t end_x,
+		uint8_t *lum, uint8_t *u_out, uint8_t *v_out)
+{
+	const uint32_t *in = (const uint32_t*)line;
+
+	for (uint32_t x = start_x; x < end_x; x++) {
+		uint32_t px = in[x];
+		lum[x]   = uyvx_y(px);
+		u_out[x] = uyvx_u(px);
+		v_out[x] = uyvx_v(px);
+	}
+}
+
+/* 4:2:0 planar/semi-planar to packed: chroma is given as separate U/V
+ * pointers with a step so that NV12 can be handled with u = uv, v = uv+1,
+ * step = 2 */
+static inline void yuv420_to_packed_line_ref(
+		const uint8_t *lum0, const uint8_t *lum1,
+		const uint8_t *u_in, const uint8_t *v_in, uint32_t chroma_step,
+		uint32_t start_x_d2, uint32_t end_x_d2,
+		uint8_t *out0, uint8_t *out1)
+{
+	uint32_t *output0 = (uint32_t*)out0;
+	uint32_t *output1 = (uint32_t*)out1;
+
+	for (uint32_t x = start_x_d2; x < end_x_d2; x++) {
+		uint32_t c = x * chroma_step;
+		uint32_t out = ((uint32_t)u_in[c] << 8) |
+		               ((uint32_t)v_in[c] << 16);
+
+		output0[x*2]     = lum0[x*2]     | out;
+		output0[x*2 + 1] = lum0[x*2 + 1] | out;
+		output1[x*2]     = lum1[x*2]     | out;
+		output1[x*2 + 1] = lum1[x*2 + 1] | out;
+	}
+}
+
+static inline void decompress_422_line_ref(const uint8_t *line,
+		uint32_t start_x_d2, uint32_t end_x_d2, uint8_t *out,
+		bool leading_lum)
+{
+	const uint32_t *input32 = (const uint32_t*)line;
+	uint32_t *output32 = (uint32_t*)out;
+
+	for (uint32_t x = start_x_d2; x < end_x_d2; x++) {
+		uint32_t dw = input32[x];
+
+		output32[x*2] = dw;
+		if (leading_lum) {
+			dw &= 0xFFFFFF00;
+			dw |= (uint8_t)(dw>>16);
+		} else {
+			dw &= 0xFFFF00FF;
+			dw |= (dw>>16) & 0xFF00;
+		}
+		output32[x*2 + 1] = dw;
+	}
+}
+
+static inline void i444_to_420_line_ref(
+		const uint8_t *u0, const uint8_t *u1,
+		const uint8_t *v0, const uint8_t *v1,
+		uint32_t start_x, uint32_t end_x,
+		uint8_t *u_out, uint8_t *v_out, uint32_t chroma_step)
+{
+	for (uint32_t x = start_x; x < end_x; x += 2) {
+		uint32_t x1 = (x + 1 < end_x) ? x + 1 : x;
+		uint32_t c = (x >> 1) * chroma_step;
+
+		u_out[c] = (uint8_t)((u0[x] + u0[x1] + u1[x] + u1[x1]) >> 2);
+		v_out[c] = (uint8_t)((v0[x] + v0[x1] + v1[x] + v1[x1]) >> 2);
+	}
+}
+
+static inline void copy_lum_lines(const uint8_t *const input[],
+		const uint32_t in_linesize[], uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[],
+		uint32_t width)
+{
+	for (uint32_t y = start_y; y < end_y; y++)
+		memcpy(output[0] + y * out_linesize[0],
+				input[0] + y * in_linesize[0], width);
+}
+
+/* ------------------------------------------------------------------------- */
+/* kernel prototypes, per instruction set */
+
+#define FORMAT_CONVERSION_KERNELS(suffix)                                     \
+void compress_uyvx_to_i420_##suffix(                                          \
+		const uint8_t *input, uint32_t in_linesize,                   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output[], const uint32_t out_linesize[]);            \
+void compress_uyvx_to_nv12_##suffix(                                          \
+		const uint8_t *input, uint32_t in_linesize,                   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output[], const uint32_t out_linesize[]);            \
+void convert_uyvx_to_i444_##suffix(                                           \
+		const uint8_t *input, uint32_t in_linesize,                   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output[], const uint32_t out_linesize[]);            \
+void decompress_nv12_##suffix(                                                \
+		const uint8_t *const input[], const uint32_t in_linesize[],   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output, uint32_t out_linesize);                      \
+void decompress_420_##suffix(                                                 \
+		const uint8_t *const input[], const uint32_t in_linesize[],   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output, uint32_t out_linesize);                      \
+void decompress_422_##suffix(                                                 \
+		const uint8_t *input, uint32_t in_linesize,                   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output, uint32_t out_linesize,                       \
+		bool leading_lum);                                            \
+void compress_i444_to_i420_##suffix(                                          \
+		const uint8_t *const input[], const uint32_t in_linesize[],   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output[], const uint32_t out_linesize[]);            \
+void compress_i444_to_nv12_##suffix(                                          \
+		const uint8_t *const input[], const uint32_t in_linesize[],   \
+		uint32_t start_y, uint32_t end_y,                             \
+		uint8_t *output[], const uint32_t out_linesize[])
+
+FORMAT_CONVERSION_KERNELS(c);
+FORMAT_CONVERSION_KERNELS(ssse3);
+FORMAT_CONVERSION_KERNELS(avx2);
+
+/* SSE2 only has the packed UYVX kernels */
+void compress_uyvx_to_i420_sse2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
+void compress_uyvx_to_nv12_sse2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
+void convert_uyvx_to_i444_sse2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
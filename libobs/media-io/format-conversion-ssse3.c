@@ -0,0 +1,424 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/* SSSE3 conversion kernels.  This file is compiled with SSSE3 enabled and
+ * must only be called after checking for CPU support. */
+
+#include "format-conversion-internal.h"
+#include <tmmintrin.h>
+
+#define Z -1
+
+/* picks the byte at offset 'o' of each of the 4 packed pixels of a register
+ * and places them at bytes [d, d+4) */
+#define PIX_SHUF(o, d) \
+	_mm_setr_epi8( \
+		(d) == 0  ? (o)   : Z, (d) == 0  ? (o)+4 : Z, \
+		(d) == 0  ? (o)+8 : Z, (d) == 0  ? (o)+12 : Z, \
+		(d) == 4  ? (o)   : Z, (d) == 4  ? (o)+4 : Z, \
+		(d) == 4  ? (o)+8 : Z, (d) == 4  ? (o)+12 : Z, \
+		(d) == 8  ? (o)   : Z, (d) == 8  ? (o)+4 : Z, \
+		(d) == 8  ? (o)+8 : Z, (d) == 8  ? (o)+12 : Z, \
+		(d) == 12 ? (o)   : Z, (d) == 12 ? (o)+4 : Z, \
+		(d) == 12 ? (o)+8 : Z, (d) == 12 ? (o)+12 : Z)
+
+/* gathers one plane (byte offset 'o' of each pixel) of 16 packed pixels */
+static inline __m128i gather_plane(const __m128i *px, int o)
+{
+	__m128i r;
+
+	switch (o) {
+	case 0:
+		r =                  _mm_shuffle_epi8(px[0], PIX_SHUF(0, 0));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[1], PIX_SHUF(0, 4)));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[2], PIX_SHUF(0, 8)));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[3], PIX_SHUF(0, 12)));
+		break;
+	case 1:
+		r =                  _mm_shuffle_epi8(px[0], PIX_SHUF(1, 0));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[1], PIX_SHUF(1, 4)));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[2], PIX_SHUF(1, 8)));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[3], PIX_SHUF(1, 12)));
+		break;
+	default:
+		r =                  _mm_shuffle_epi8(px[0], PIX_SHUF(2, 0));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[1], PIX_SHUF(2, 4)));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[2], PIX_SHUF(2, 8)));
+		r = _mm_or_si128(r,  _mm_shuffle_epi8(px[3], PIX_SHUF(2, 12)));
+	}
+
+	return r;
+}
+
+static inline void load_pixels(const uint8_t *img, __m128i *px)
+{
+	px[0] = _mm_loadu_si128((const __m128i*)img);
+	px[1] = _mm_loadu_si128((const __m128i*)(img + 16));
+	px[2] = _mm_loadu_si128((const __m128i*)(img + 32));
+	px[3] = _mm_loadu_si128((const __m128i*)(img + 48));
+}
+
+/* horizontal sums of U and V pixel pairs for 8 pixels, as 16-bit words in
+ * U V U V order */
+static inline __m128i sum_uv_pairs(__m128i px0, __m128i px1)
+{
+	const __m128i lo = _mm_setr_epi8(0, 4, 2, 6, 8, 12, 10, 14,
+			Z, Z, Z, Z, Z, Z, Z, Z);
+	const __m128i hi = _mm_setr_epi8(Z, Z, Z, Z, Z, Z, Z, Z,
+			0, 4, 2, 6, 8, 12, 10, 14);
+	const __m128i ones = _mm_set1_epi8(1);
+
+	__m128i uv = _mm_or_si128(_mm_shuffle_epi8(px0, lo),
+			_mm_shuffle_epi8(px1, hi));
+	return _mm_maddubs_epi16(uv, ones);
+}
+
+/* averaged 4:2:0 chroma for 16 pixels of two lines, as 16 bytes in
+ * interleaved U V order */
+static inline __m128i average_uv(const __m128i *line0, const __m128i *line1)
+{
+	__m128i a = _mm_add_epi16(sum_uv_pairs(line0[0], line0[1]),
+			sum_uv_pairs(line1[0], line1[1]));
+	__m128i b = _mm_add_epi16(sum_uv_pairs(line0[2], line0[3]),
+			sum_uv_pairs(line1[2], line1[3]));
+
+	return _mm_packus_epi16(_mm_srli_epi16(a, 2), _mm_srli_epi16(b, 2));
+}
+
+void compress_uyvx_to_i420_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+			1, 3, 5, 7, 9, 11, 13, 15);
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line0 = input + y * in_linesize;
+		const uint8_t *line1 = line0 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *u = output[1] + (y>>1) * out_linesize[1];
+		uint8_t *v = output[2] + (y>>1) * out_linesize[2];
+		uint32_t x;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i px0[4], px1[4], uv;
+
+			load_pixels(line0 + x*4, px0);
+			load_pixels(line1 + x*4, px1);
+
+			_mm_storeu_si128((__m128i*)(lum0 + x),
+					gather_plane(px0, 1));
+			_mm_storeu_si128((__m128i*)(lum1 + x),
+					gather_plane(px1, 1));
+
+			uv = _mm_shuffle_epi8(average_uv(px0, px1),
+					deinterleave);
+			_mm_storel_epi64((__m128i*)(u + x/2), uv);
+			_mm_storel_epi64((__m128i*)(v + x/2),
+					_mm_srli_si128(uv, 8));
+		}
+
+		uyvx_to_420_line_ref(line0, line1, x, width, lum0, lum1,
+				u, v, 1);
+	}
+}
+
+void compress_uyvx_to_nv12_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line0 = input + y * in_linesize;
+		const uint8_t *line1 = line0 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *chroma = output[1] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i px0[4], px1[4];
+
+			load_pixels(line0 + x*4, px0);
+			load_pixels(line1 + x*4, px1);
+
+			_mm_storeu_si128((__m128i*)(lum0 + x),
+					gather_plane(px0, 1));
+			_mm_storeu_si128((__m128i*)(lum1 + x),
+					gather_plane(px1, 1));
+			_mm_storeu_si128((__m128i*)(chroma + x),
+					average_uv(px0, px1));
+		}
+
+		uyvx_to_420_line_ref(line0, line1, x, width, lum0, lum1,
+				chroma, chroma + 1, 2);
+	}
+}
+
+void convert_uyvx_to_i444_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *line = input + y * in_linesize;
+		uint32_t pos = y * out_linesize[0];
+		uint8_t *lum = output[0] + pos;
+		uint8_t *u = output[1] + pos;
+		uint8_t *v = output[2] + pos;
+		uint32_t x;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i px[4];
+
+			load_pixels(line + x*4, px);
+
+			_mm_storeu_si128((__m128i*)(lum + x),
+					gather_plane(px, 1));
+			_mm_storeu_si128((__m128i*)(u + x),
+					gather_plane(px, 0));
+			_mm_storeu_si128((__m128i*)(v + x),
+					gather_plane(px, 2));
+		}
+
+		uyvx_to_444_line_ref(line, x, width, lum, u, v);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* writes 16 packed pixels from 16 luma bytes and 8 interleaved U V pairs */
+static inline void store_packed_420(uint8_t *out, __m128i lum, __m128i uv)
+{
+	const __m128i lum_shuf[4] = {
+		_mm_setr_epi8(0,  Z, Z, Z, 1,  Z, Z, Z,
+		              2,  Z, Z, Z, 3,  Z, Z, Z),
+		_mm_setr_epi8(4,  Z, Z, Z, 5,  Z, Z, Z,
+		              6,  Z, Z, Z, 7,  Z, Z, Z),
+		_mm_setr_epi8(8,  Z, Z, Z, 9,  Z, Z, Z,
+		              10, Z, Z, Z, 11, Z, Z, Z),
+		_mm_setr_epi8(12, Z, Z, Z, 13, Z, Z, Z,
+		              14, Z, Z, Z, 15, Z, Z, Z)
+	};
+	const __m128i uv_shuf[4] = {
+		_mm_setr_epi8(Z, 0,  1,  Z, Z, 0,  1,  Z,
+		              Z, 2,  3,  Z, Z, 2,  3,  Z),
+		_mm_setr_epi8(Z, 4,  5,  Z, Z, 4,  5,  Z,
+		              Z, 6,  7,  Z, Z, 6,  7,  Z),
+		_mm_setr_epi8(Z, 8,  9,  Z, Z, 8,  9,  Z,
+		              Z, 10, 11, Z, Z, 10, 11, Z),
+		_mm_setr_epi8(Z, 12, 13, Z, Z, 12, 13, Z,
+		              Z, 14, 15, Z, Z, 14, 15, Z)
+	};
+
+	for (size_t i = 0; i < 4; i++) {
+		__m128i px = _mm_or_si128(_mm_shuffle_epi8(lum, lum_shuf[i]),
+				_mm_shuffle_epi8(uv, uv_shuf[i]));
+		_mm_storeu_si128((__m128i*)(out + i*16), px);
+	}
+}
+
+void decompress_nv12_ssse3(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize)/2;
+
+	for (uint32_t y = start_y/2; y < end_y/2; y++) {
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1 = lum0 + in_linesize[0];
+		const uint8_t *chroma = input[1] + y * in_linesize[1];
+		uint8_t *out0 = output + y * 2 * out_linesize;
+		uint8_t *out1 = out0 + out_linesize;
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i uv = _mm_loadu_si128(
+					(const __m128i*)(chroma + x*2));
+
+			store_packed_420(out0 + x*8, _mm_loadu_si128(
+					(const __m128i*)(lum0 + x*2)), uv);
+			store_packed_420(out1 + x*8, _mm_loadu_si128(
+					(const __m128i*)(lum1 + x*2)), uv);
+		}
+
+		yuv420_to_packed_line_ref(lum0, lum1, chroma, chroma + 1, 2,
+				x, width_d2, out0, out1);
+	}
+}
+
+void decompress_420_ssse3(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize)/2;
+
+	for (uint32_t y = start_y/2; y < end_y/2; y++) {
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1 = lum0 + in_linesize[0];
+		const uint8_t *u = input[1] + y * in_linesize[1];
+		const uint8_t *v = input[2] + y * in_linesize[2];
+		uint8_t *out0 = output + y * 2 * out_linesize;
+		uint8_t *out1 = out0 + out_linesize;
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i uv = _mm_unpacklo_epi8(
+					_mm_loadl_epi64((const __m128i*)(u + x)),
+					_mm_loadl_epi64((const __m128i*)(v + x)));
+
+			store_packed_420(out0 + x*8, _mm_loadu_si128(
+					(const __m128i*)(lum0 + x*2)), uv);
+			store_packed_420(out1 + x*8, _mm_loadu_si128(
+					(const __m128i*)(lum1 + x*2)), uv);
+		}
+
+		yuv420_to_packed_line_ref(lum0, lum1, u, v, 1,
+				x, width_d2, out0, out1);
+	}
+}
+
+void decompress_422_ssse3(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	uint32_t width_d2 = min_uint32(in_linesize/4, out_linesize/8);
+	__m128i shuf_lo, shuf_hi;
+
+	/* each 32-bit input pair becomes the input pair followed by a copy
+	 * with the first luma sample replaced by the second */
+	if (leading_lum) {
+		shuf_lo = _mm_setr_epi8(0, 1, 2, 3, 2, 1, 2, 3,
+				4, 5, 6, 7, 6, 5, 6, 7);
+		shuf_hi = _mm_setr_epi8(8, 9, 10, 11, 10, 9, 10, 11,
+				12, 13, 14, 15, 14, 13, 14, 15);
+	} else {
+		shuf_lo = _mm_setr_epi8(0, 1, 2, 3, 0, 3, 2, 3,
+				4, 5, 6, 7, 4, 7, 6, 7);
+		shuf_hi = _mm_setr_epi8(8, 9, 10, 11, 8, 11, 10, 11,
+				12, 13, 14, 15, 12, 15, 14, 15);
+	}
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *line = input + y * in_linesize;
+		uint8_t *out = output + y * out_linesize;
+		uint32_t x;
+
+		for (x = 0; x + 4 <= width_d2; x += 4) {
+			__m128i in = _mm_loadu_si128(
+					(const __m128i*)(line + x*4));
+
+			_mm_storeu_si128((__m128i*)(out + x*8),
+					_mm_shuffle_epi8(in, shuf_lo));
+			_mm_storeu_si128((__m128i*)(out + x*8 + 16),
+					_mm_shuffle_epi8(in, shuf_hi));
+		}
+
+		decompress_422_line_ref(line, x, width_d2, out, leading_lum);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* averaged 4:2:0 samples of 16 pixels of two planar lines, as 8 words */
+static inline __m128i average_plane(const uint8_t *line0, const uint8_t *line1)
+{
+	const __m128i ones = _mm_set1_epi8(1);
+	__m128i a = _mm_maddubs_epi16(
+			_mm_loadu_si128((const __m128i*)line0), ones);
+	__m128i b = _mm_maddubs_epi16(
+			_mm_loadu_si128((const __m128i*)line1), ones);
+
+	return _mm_srli_epi16(_mm_add_epi16(a, b), 2);
+}
+
+void compress_i444_to_i420_ssse3(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize[0], out_linesize[0]);
+
+	copy_lum_lines(input, in_linesize, start_y, end_y,
+			output, out_linesize, width);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *u0 = input[1] + y * in_linesize[1];
+		const uint8_t *v0 = input[2] + y * in_linesize[2];
+		const uint8_t *u1 = u0 + in_linesize[1];
+		const uint8_t *v1 = v0 + in_linesize[2];
+		uint8_t *u = output[1] + (y>>1) * out_linesize[1];
+		uint8_t *v = output[2] + (y>>1) * out_linesize[2];
+		uint32_t x;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i uw = average_plane(u0 + x, u1 + x);
+			__m128i vw = average_plane(v0 + x, v1 + x);
+
+			_mm_storel_epi64((__m128i*)(u + x/2),
+					_mm_packus_epi16(uw, uw));
+			_mm_storel_epi64((__m128i*)(v + x/2),
+					_mm_packus_epi16(vw, vw));
+		}
+
+		i444_to_420_line_ref(u0, u1, v0, v1, x, width, u, v, 1);
+	}
+}
+
+void compress_i444_to_nv12_ssse3(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize[0], out_linesize[0]);
+
+	copy_lum_lines(input, in_linesize, start_y, end_y,
+			output, out_linesize, width);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *u0 = input[1] + y * in_linesize[1];
+		const uint8_t *v0 = input[2] + y * in_linesize[2];
+		const uint8_t *u1 = u0 + in_linesize[1];
+		const uint8_t *v1 = v0 + in_linesize[2];
+		uint8_t *chroma = output[1] + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i uw = average_plane(u0 + x, u1 + x);
+			__m128i vw = average_plane(v0 + x, v1 + x);
+			__m128i uv = _mm_unpacklo_epi8(
+					_mm_packus_epi16(uw, uw),
+					_mm_packus_epi16(vw, vw));
+
+			_mm_storeu_si128((__m128i*)(chroma + x), uv);
+		}
+
+		i444_to_420_line_ref(u0, u1, v0, v1, x, width,
+				chroma, chroma + 1, 2);
+	}
+}
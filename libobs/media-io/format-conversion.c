@@ -15,10 +15,16 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
-#include "format-conversion.h"
+#include "format-conversion-internal.h"
+#include "../util/base.h"
+#include "../util/threading.h"
 #include <xmmintrin.h>
 #include <emmintrin.h>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 /* ...surprisingly, if I don't use a macro to force inlining, it causes the
  * CPU usage to boost by a tremendous amount in debug builds. */
 
@@ -84,12 +90,10 @@ do {                                                                          \
 } while (false)
 
 
-static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
-{
-	return a < b ? a : b;
-}
+/* ------------------------------------------------------------------------- */
+/* SSE2 kernels */
 
-void compress_uyvx_to_i420(
+void compress_uyvx_to_i420_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -109,13 +113,13 @@ void compress_uyvx_to_i420(
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = 0; x + 4 <= width; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
 
-			__m128i line1 = _mm_load_si128((const __m128i*)img);
-			__m128i line2 = _mm_load_si128(
+			__m128i line1 = _mm_loadu_si128((const __m128i*)img);
+			__m128i line2 = _mm_loadu_si128(
 					(const __m128i*)(img + in_linesize));
 
 			pack_shift(lum_plane, lum_pos0, lum_pos1,
@@ -124,10 +128,17 @@ void compress_uyvx_to_i420(
 					chroma_y_pos + (x>>1),
 					line1, line2, uv_mask);
 		}
+
+		uyvx_to_420_line_ref(input + y_pos, input + y_pos + in_linesize,
+				x, width,
+				lum_plane + lum_y_pos,
+				lum_plane + lum_y_pos + out_linesize[0],
+				u_plane + chroma_y_pos, v_plane + chroma_y_pos,
+				1);
 	}
 }
 
-void compress_uyvx_to_nv12(
+void compress_uyvx_to_nv12_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -146,13 +157,13 @@ void compress_uyvx_to_nv12(
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = 0; x + 4 <= width; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
 
-			__m128i line1 = _mm_load_si128((const __m128i*)img);
-			__m128i line2 = _mm_load_si128(
+			__m128i line1 = _mm_loadu_si128((const __m128i*)img);
+			__m128i line2 = _mm_loadu_si128(
 					(const __m128i*)(img + in_linesize));
 
 			pack_shift(lum_plane, lum_pos0, lum_pos1,
@@ -160,10 +171,17 @@ void compress_uyvx_to_nv12(
 			pack_ch_1plane(chroma_plane, chroma_y_pos + x,
 					line1, line2, uv_mask);
 		}
+
+		uyvx_to_420_line_ref(input + y_pos, input + y_pos + in_linesize,
+				x, width,
+				lum_plane + lum_y_pos,
+				lum_plane + lum_y_pos + out_linesize[0],
+				chroma_plane + chroma_y_pos,
+				chroma_plane + chroma_y_pos + 1, 2);
 	}
 }
 
-void convert_uyvx_to_i444(
+void convert_uyvx_to_i444_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -183,13 +201,13 @@ void convert_uyvx_to_i444(
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = 0; x + 4 <= width; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
 
-			__m128i line1 = _mm_load_si128((const __m128i*)img);
-			__m128i line2 = _mm_load_si128(
+			__m128i line1 = _mm_loadu_si128((const __m128i*)img);
+			__m128i line2 = _mm_loadu_si128(
 					(const __m128i*)(img + in_linesize));
 
 			pack_shift(lum_plane, lum_pos0, lum_pos1,
@@ -199,126 +217,415 @@ void convert_uyvx_to_i444(
 			pack_shift(v_plane, lum_pos0, lum_pos1,
 					line1, line2, v_mask, 2);
 		}
+
+		for (uint32_t i = 0; i < 2; i++) {
+			uint32_t lum_pos = lum_y_pos + i * out_linesize[0];
+			uyvx_to_444_line_ref(input + y_pos + i * in_linesize,
+					x, width, lum_plane + lum_pos,
+					u_plane + lum_pos, v_plane + lum_pos);
+		}
 	}
 }
 
-void decompress_420(
-		const uint8_t *const input[], const uint32_t in_linesize[],
+/* ------------------------------------------------------------------------- */
+/* scalar reference kernels */
+
+void compress_uyvx_to_i420_c(
+		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
-		uint8_t *output, uint32_t out_linesize)
+		uint8_t *output[], const uint32_t out_linesize[])
 {
-	uint32_t start_y_d2 = start_y/2;
-	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
-	uint32_t height_d2  = end_y/2;
-	uint32_t y;
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
 
-	for (y = start_y_d2; y < height_d2; y++) {
-		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
-		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
-		uint32_t x;
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line = input + y * in_linesize;
+		uint8_t *lum = output[0] + y * out_linesize[0];
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
 
-		lum0 = input[0] + y * 2 * in_linesize[0];
-		lum1 = lum0 + in_linesize[0];
-		output0 = (uint32_t*)(output + y * 2 * in_linesize[0]);
-		output1 = (uint32_t*)((uint8_t*)output0 + in_linesize[0]);
+		uyvx_to_420_line_ref(line, line + in_linesize, 0, width,
+				lum, lum + out_linesize[0],
+				output[1] + chroma_y_pos,
+				output[2] + chroma_y_pos, 1);
+	}
+}
 
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out;
-			out = (*(chroma0++) << 8) | (*(chroma1++) << 16);
+void compress_uyvx_to_nv12_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
 
-			*(output0++) = *(lum0++) | out;
-			*(output0++) = *(lum0++) | out;
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *line = input + y * in_linesize;
+		uint8_t *lum = output[0] + y * out_linesize[0];
+		uint8_t *chroma = output[1] + (y>>1) * out_linesize[1];
 
-			*(output1++) = *(lum1++) | out;
-			*(output1++) = *(lum1++) | out;
-		}
+		uyvx_to_420_line_ref(line, line + in_linesize, 0, width,
+				lum, lum + out_linesize[0],
+				chroma, chroma + 1, 2);
 	}
 }
 
-void decompress_nv12(
+void convert_uyvx_to_i444_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		uint32_t pos = y * out_linesize[0];
+
+		uyvx_to_444_line_ref(input + y * in_linesize, 0, width,
+				output[0] + pos, output[1] + pos,
+				output[2] + pos);
+	}
+}
+
+void decompress_420_c(
 		const uint8_t *const input[], const uint32_t in_linesize[],
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize)
 {
-	uint32_t start_y_d2 = start_y/2;
-	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
-	uint32_t height_d2  = end_y/2;
-	uint32_t y;
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize)/2;
 
-	for (y = start_y_d2; y < height_d2; y++) {
-		const uint16_t *chroma;
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
-		uint32_t x;
+	for (uint32_t y = start_y/2; y < end_y/2; y++) {
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		uint8_t *out0 = output + y * 2 * out_linesize;
 
-		chroma = (const uint16_t*)(input[1] + y * in_linesize[1]);
-		lum0 = input[0] + y * 2 * in_linesize[0];
-		lum1 = lum0 + in_linesize[0];
-		output0 = (uint32_t*)(output + y * 2 * out_linesize);
-		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
+		yuv420_to_packed_line_ref(lum0, lum0 + in_linesize[0],
+				input[1] + y * in_linesize[1],
+				input[2] + y * in_linesize[2], 1,
+				0, width_d2, out0, out0 + out_linesize);
+	}
+}
 
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out = *(chroma++) << 8;
+void decompress_nv12_c(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize)/2;
 
-			*(output0++) = *(lum0++) | out;
-			*(output0++) = *(lum0++) | out;
+	for (uint32_t y = start_y/2; y < end_y/2; y++) {
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *chroma = input[1] + y * in_linesize[1];
+		uint8_t *out0 = output + y * 2 * out_linesize;
 
-			*(output1++) = *(lum1++) | out;
-			*(output1++) = *(lum1++) | out;
-		}
+		yuv420_to_packed_line_ref(lum0, lum0 + in_linesize[0],
+				chroma, chroma + 1, 2,
+				0, width_d2, out0, out0 + out_linesize);
 	}
 }
 
-void decompress_422(
+void decompress_422_c(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize,
 		bool leading_lum)
 {
-	uint32_t width_d2 = min_uint32(in_linesize, out_linesize)/2;
-	uint32_t y;
+	uint32_t width_d2 = min_uint32(in_linesize/4, out_linesize/8);
 
-	register const uint32_t *input32;
-	register const uint32_t *input32_end;
-	register uint32_t       *output32;
+	for (uint32_t y = start_y; y < end_y; y++)
+		decompress_422_line_ref(input + y * in_linesize, 0, width_d2,
+				output + y * out_linesize, leading_lum);
+}
 
-	if (leading_lum) {
-		for (y = start_y; y < end_y; y++) {
-			input32     = (const uint32_t*)(input + y*in_linesize);
-			input32_end = input32 + width_d2;
-			output32    = (uint32_t*)(output + y*out_linesize);
+void compress_i444_to_i420_c(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize[0], out_linesize[0]);
 
-			while(input32 < input32_end) {
-				register uint32_t dw = *input32;
+	copy_lum_lines(input, in_linesize, start_y, end_y,
+			output, out_linesize, width);
 
-				output32[0] = dw;
-				dw &= 0xFFFFFF00;
-				dw |= (uint8_t)(dw>>16);
-				output32[1] = dw;
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *u = input[1] + y * in_linesize[1];
+		const uint8_t *v = input[2] + y * in_linesize[2];
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
 
-				output32 += 2;
-				input32++;
-			}
-		}
-	} else {
-		for (y = start_y; y < end_y; y++) {
-			input32     = (const uint32_t*)(input + y*in_linesize);
-			input32_end = input32 + width_d2;
-			output32    = (uint32_t*)(output + y*out_linesize);
-
-			while (input32 < input32_end) {
-				register uint32_t dw = *input32;
-
-				output32[0] = dw;
-				dw &= 0xFFFF00FF;
-				dw |= (dw>>16) & 0xFF00;
-				output32[1] = dw;
-
-				output32 += 2;
-				input32++;
-			}
+		i444_to_420_line_ref(u, u + in_linesize[1],
+				v, v + in_linesize[2], 0, width,
+				output[1] + chroma_y_pos,
+				output[2] + chroma_y_pos, 1);
+	}
+}
+
+void compress_i444_to_nv12_c(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = min_uint32(in_linesize[0], out_linesize[0]);
+
+	copy_lum_lines(input, in_linesize, start_y, end_y,
+			output, out_linesize, width);
+
+	for (uint32_t y = start_y; y < end_y; y += 2) {
+		const uint8_t *u = input[1] + y * in_linesize[1];
+		const uint8_t *v = input[2] + y * in_linesize[2];
+		uint8_t *chroma = output[1] + (y>>1) * out_linesize[1];
+
+		i444_to_420_line_ref(u, u + in_linesize[1],
+				v, v + in_linesize[2], 0, width,
+				chroma, chroma + 1, 2);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* runtime dispatch */
+
+struct format_conversion_funcs {
+	void (*compress_uyvx_to_i420)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+	void (*compress_uyvx_to_nv12)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+	void (*convert_uyvx_to_i444)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+	void (*decompress_nv12)(
+			const uint8_t *const input[],
+			const uint32_t in_linesize[],
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output, uint32_t out_linesize);
+	void (*decompress_420)(
+			const uint8_t *const input[],
+			const uint32_t in_linesize[],
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output, uint32_t out_linesize);
+	void (*decompress_422)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output, uint32_t out_linesize,
+			bool leading_lum);
+	void (*compress_i444_to_i420)(
+			const uint8_t *const input[],
+			const uint32_t in_linesize[],
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+	void (*compress_i444_to_nv12)(
+			const uint8_t *const input[],
+			const uint32_t in_linesize[],
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+};
+
+static struct format_conversion_funcs funcs;
+static enum format_conversion_simd cur_simd;
+static enum format_conversion_simd cpu_simd;
+static pthread_once_t funcs_once = PTHREAD_ONCE_INIT;
+
+static enum format_conversion_simd detect_cpu_simd(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	bool ssse3, avx, avx2 = false;
+
+	__cpuid(info, 1);
+	ssse3 = (info[2] & (1 << 9)) != 0;
+	avx   = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0;
+
+	/* the OS must also save the upper halves of the ymm registers */
+	if (avx && (_xgetbv(0) & 6) == 6) {
+		__cpuid(info, 0);
+		if (info[0] >= 7) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
 		}
 	}
+#else
+	bool ssse3, avx2;
+
+	__builtin_cpu_init();
+	ssse3 = __builtin_cpu_supports("ssse3");
+	avx2  = __builtin_cpu_supports("avx2");
+#endif
+
+	if (avx2)
+		return FORMAT_CONVERSION_SIMD_AVX2;
+	if (ssse3)
+		return FORMAT_CONVERSION_SIMD_SSSE3;
+	return FORMAT_CONVERSION_SIMD_SSE2;
+}
+
+#define SET_FUNC(func, suffix) funcs.func = func##_##suffix
+
+static void select_funcs(enum format_conversion_simd simd)
+{
+	if (simd > cpu_simd)
+		simd = cpu_simd;
+
+	switch (simd) {
+	case FORMAT_CONVERSION_SIMD_AVX2:
+		SET_FUNC(compress_uyvx_to_i420, avx2);
+		SET_FUNC(compress_uyvx_to_nv12, avx2);
+		SET_FUNC(convert_uyvx_to_i444,  avx2);
+		SET_FUNC(decompress_nv12,       avx2);
+		SET_FUNC(decompress_420,        avx2);
+		SET_FUNC(decompress_422,        avx2);
+		SET_FUNC(compress_i444_to_i420, avx2);
+		SET_FUNC(compress_i444_to_nv12, avx2);
+		break;
+
+	case FORMAT_CONVERSION_SIMD_SSSE3:
+		SET_FUNC(compress_uyvx_to_i420, ssse3);
+		SET_FUNC(compress_uyvx_to_nv12, ssse3);
+		SET_FUNC(convert_uyvx_to_i444,  ssse3);
+		SET_FUNC(decompress_nv12,       ssse3);
+		SET_FUNC(decompress_420,        ssse3);
+		SET_FUNC(decompress_422,        ssse3);
+		SET_FUNC(compress_i444_to_i420, ssse3);
+		SET_FUNC(compress_i444_to_nv12, ssse3);
+		break;
+
+	case FORMAT_CONVERSION_SIMD_SSE2:
+		SET_FUNC(compress_uyvx_to_i420, sse2);
+		SET_FUNC(compress_uyvx_to_nv12, sse2);
+		SET_FUNC(convert_uyvx_to_i444,  sse2);
+		SET_FUNC(decompress_nv12,       c);
+		SET_FUNC(decompress_420,        c);
+		SET_FUNC(decompress_422,        c);
+		SET_FUNC(compress_i444_to_i420, c);
+		SET_FUNC(compress_i444_to_nv12, c);
+		break;
+
+	case FORMAT_CONVERSION_SIMD_NONE:
+		SET_FUNC(compress_uyvx_to_i420, c);
+		SET_FUNC(compress_uyvx_to_nv12, c);
+		SET_FUNC(convert_uyvx_to_i444,  c);
+		SET_FUNC(decompress_nv12,       c);
+		SET_FUNC(decompress_420,        c);
+		SET_FUNC(decompress_422,        c);
+		SET_FUNC(compress_i444_to_i420, c);
+		SET_FUNC(compress_i444_to_nv12, c);
+		break;
+	}
+
+	cur_simd = simd;
+}
+
+#undef SET_FUNC
+
+static void init_funcs(void)
+{
+	cpu_simd = detect_cpu_simd();
+	select_funcs(cpu_simd);
+
+	blog(LOG_INFO, "Format conversion: using %s kernels",
+			format_conversion_simd_name(cur_simd));
+}
+
+static inline const struct format_conversion_funcs *get_funcs(void)
+{
+	pthread_once(&funcs_once, init_funcs);
+	return &funcs;
+}
+
+enum format_conversion_simd format_conversion_get_simd(void)
+{
+	get_funcs();
+	return cur_simd;
+}
+
+enum format_conversion_simd format_conversion_set_simd(
+		enum format_conversion_simd max_simd)
+{
+	get_funcs();
+	select_funcs(max_simd);
+	return cur_simd;
+}
+
+const char *format_conversion_simd_name(enum format_conversion_simd simd)
+{
+	switch (simd) {
+	case FORMAT_CONVERSION_SIMD_NONE:  return "scalar";
+	case FORMAT_CONVERSION_SIMD_SSE2:  return "SSE2";
+	case FORMAT_CONVERSION_SIMD_SSSE3: return "SSSE3";
+	case FORMAT_CONVERSION_SIMD_AVX2:  return "AVX2";
+	}
+
+	return "unknown";
+}
+
+/* ------------------------------------------------------------------------- */
+
+void compress_uyvx_to_i420(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	get_funcs()->compress_uyvx_to_i420(input, in_linesize,
+			start_y, end_y, output, out_linesize);
+}
+
+void compress_uyvx_to_nv12(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	get_funcs()->compress_uyvx_to_nv12(input, in_linesize,
+			start_y, end_y, output, out_linesize);
+}
+
+void convert_uyvx_to_i444(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	get_funcs()->convert_uyvx_to_i444(input, in_linesize,
+			start_y, end_y, output, out_linesize);
+}
+
+void decompress_420(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	get_funcs()->decompress_420(input, in_linesize,
+			start_y, end_y, output, out_linesize);
+}
+
+void decompress_nv12(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	get_funcs()->decompress_nv12(input, in_linesize,
+			start_y, end_y, output, out_linesize);
+}
+
+void decompress_422(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	get_funcs()->decompress_422(input, in_linesize,
+			start_y, end_y, output, out_linesize, leading_lum);
+}
+
+void compress_i444_to_i420(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	get_funcs()->compress_i444_to_i420(input, in_linesize,
+			start_y, end_y, output, out_linesize);
+}
+
+void compress_i444_to_nv12(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	get_funcs()->compress_i444_to_nv12(input, in_linesize,
+			start_y, end_y, output, out_linesize);
 }
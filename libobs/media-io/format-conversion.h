@@ -25,8 +25,34 @@ extern "C" {
 
 /*
  * Functions for converting to and from packed 444 YUV
+ *
+ * The best kernels supported by the CPU (SSE2/SSSE3/AVX2) are selected the
+ * first time any of these functions is called.
  */
 
+enum format_conversion_simd {
+	FORMAT_CONVERSION_SIMD_NONE,
+	FORMAT_CONVERSION_SIMD_SSE2,
+	FORMAT_CONVERSION_SIMD_SSSE3,
+	FORMAT_CONVERSION_SIMD_AVX2
+};
+
+/** Returns the instruction set currently used by the conversion kernels */
+EXPORT enum format_conversion_simd format_conversion_get_simd(void);
+
+/**
+ * Limits the instruction set used by the conversion kernels (mostly useful
+ * for testing and benchmarking).  Returns the instruction set actually used,
+ * which may be lower than requested if the CPU doesn't support it.
+ *
+ * @note Not thread safe, do not call while frames are being converted.
+ */
+EXPORT enum format_conversion_simd format_conversion_set_simd(
+		enum format_conversion_simd max_simd);
+
+EXPORT const char *format_conversion_simd_name(
+		enum format_conversion_simd simd);
+
 EXPORT void compress_uyvx_to_i420(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
@@ -52,6 +78,16 @@ EXPORT void decompress_420(
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize);
 
+EXPORT void compress_i444_to_i420(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
+
+EXPORT void compress_i444_to_nv12(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
+
 EXPORT void decompress_422(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
@@ -28,6 +28,18 @@ struct video_frame {
 EXPORT void video_frame_init(struct video_frame *frame,
 		enum video_format format, uint32_t width, uint32_t height);
 
+/** Returns the size of the buffer that video_frame_init would allocate */
+EXPORT size_t video_frame_get_size(enum video_format format,
+		uint32_t width, uint32_t height);
+
+/**
+ * Sets up the planes of a frame in a buffer allocated by the caller, which
+ * must be at least video_frame_get_size bytes and aligned with bmalloc.
+ */
+EXPORT void video_frame_init_data(struct video_frame *frame,
+		enum video_format format, uint32_t width, uint32_t height,
+		uint8_t *data);
+
 static inline void video_frame_free(struct video_frame *frame)
 {
 	if (frame) {
@@ -37,23 +37,42 @@ struct cached_frame_info {
 	int count;
 };
 
-struct video_input {
-	struct video_scale_info   conversion;
+/* scaled frames, shared by every input that requests the same conversion so
+ * that each frame is only scaled once no matter how many inputs use it */
+struct video_conversion {
+	struct video_scale_info   info;
 	video_scaler_t            *scaler;
 	struct video_frame        frame[MAX_CONVERT_BUFFERS];
 	int                       cur_frame;
+	long                      refs;
+
+	bool                      scaled;
+	bool                      success;
+};
+
+struct video_input {
+	struct video_scale_info   conversion;
+	struct video_conversion   *scaled;
+	struct video_output       *video;
+
+	pthread_t                 thread;
+	os_sem_t                  *start_sem;
+	bool                      thread_active;
+	bool                      stop;
+
+	struct video_data         frame;
+	bool                      dispatched;
+	volatile bool             removed;
+
+	/* reset while the callback runs on the input thread, and the input
+	 * whose callback is waiting for it from video_output_disconnect */
+	os_event_t                *callback_done;
+	struct video_input        *waiting_on;
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
 };
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
-
 struct video_output {
 	struct video_output_info   info;
 
@@ -69,7 +88,14 @@ struct video_output {
 	bool                       initialized;
 
 	pthread_mutex_t            input_mutex;
-	DARRAY(struct video_input) inputs;
+	DARRAY(struct video_input*) inputs;
+	DARRAY(struct video_conversion*) conversions;
+	volatile long              active_inputs;
+
+	pthread_mutex_t            disconnect_mutex;
+
+	os_sem_t                   *callbacks_done;
+	volatile long              callbacks_left;
 
 	size_t                     available_frames;
 	size_t                     first_added;
@@ -77,37 +103,240 @@ struct video_output {
 	struct cached_frame_info   cache[MAX_CACHE_SIZE];
 };
 
+/* set while an input thread is calling its input's callback, or while the
+ * video thread calls the callback of a single input itself */
+#ifdef _MSC_VER
+static __declspec(thread) struct video_input *thread_input = NULL;
+#else
+static __thread struct video_input *thread_input = NULL;
+#endif
+
 /* ------------------------------------------------------------------------- */
 
-static inline bool scale_video_output(struct video_input *input,
+static inline bool video_scale_info_equal(const struct video_scale_info *a,
+		const struct video_scale_info *b)
+{
+	return a->format     == b->format &&
+	       a->width      == b->width &&
+	       a->height     == b->height &&
+	       a->range      == b->range &&
+	       a->colorspace == b->colorspace;
+}
+
+static struct video_conversion *video_conversion_get(
+		struct video_output *video,
+		const struct video_scale_info *info)
+{
+	struct video_conversion *conv;
+	struct video_scale_info from = {
+		.format = video->info.format,
+		.width  = video->info.width,
+		.height = video->info.height,
+	};
+	int ret;
+
+	for (size_t i = 0; i < video->conversions.num; i++) {
+		conv = video->conversions.array[i];
+
+		if (video_scale_info_equal(&conv->info, info)) {
+			conv->refs++;
+			return conv;
+		}
+	}
+
+	conv = bzalloc(sizeof(struct video_conversion));
+	conv->info = *info;
+	conv->refs = 1;
+
+	ret = video_scaler_create(&conv->scaler, info, &from,
+			VIDEO_SCALE_FAST_BILINEAR);
+	if (ret != VIDEO_SCALER_SUCCESS) {
+		if (ret == VIDEO_SCALER_BAD_CONVERSION)
+			blog(LOG_ERROR, "video_input_init: Bad "
+			                "scale conversion type");
+		else
+			blog(LOG_ERROR, "video_input_init: Failed to "
+			                "create scaler");
+
+		bfree(conv);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_init(&conv->frame[i], info->format,
+				info->width, info->height);
+
+	da_push_back(video->conversions, &conv);
+	return conv;
+}
+
+static void video_conversion_release(struct video_output *video,
+		struct video_conversion *conv)
+{
+	if (!conv || --conv->refs > 0)
+		return;
+
+	da_erase_item(video->conversions, &conv);
+
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_free(&conv->frame[i]);
+	video_scaler_destroy(conv->scaler);
+	bfree(conv);
+}
+
+static void *video_input_thread(void *param)
+{
+	struct video_input *input = param;
+	struct video_output *video = input->video;
+
+	os_set_thread_name("video-io: input thread");
+
+	const char *input_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				"video_input_thread(%s)", video->info.name);
+
+	while (os_sem_wait(input->start_sem) == 0) {
+		if (input->stop)
+			break;
+
+		profile_start(input_thread_name);
+		thread_input = input;
+		input->callback(input->param, &input->frame);
+		thread_input = NULL;
+		profile_end(input_thread_name);
+
+		profile_reenable_thread();
+
+		os_event_signal(input->callback_done);
+
+		if (os_atomic_dec_long(&video->callbacks_left) == 0)
+			os_sem_post(video->callbacks_done);
+	}
+
+	return NULL;
+}
+
+static void video_input_free(struct video_output *video,
+		struct video_input *input)
+{
+	if (input->thread_active) {
+		input->stop = true;
+		os_sem_post(input->start_sem);
+		pthread_join(input->thread, NULL);
+	}
+
+	os_sem_destroy(input->start_sem);
+	os_event_destroy(input->callback_done);
+	video_conversion_release(video, input->scaled);
+	bfree(input);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool scale_video_output(struct video_conversion *conv,
 		struct video_data *data)
 {
-	bool success = true;
+	struct video_frame *frame;
 
-	if (input->scaler) {
-		struct video_frame *frame;
+	if (!conv)
+		return true;
 
-		if (++input->cur_frame == MAX_CONVERT_BUFFERS)
-			input->cur_frame = 0;
+	if (!conv->scaled) {
+		if (++conv->cur_frame == MAX_CONVERT_BUFFERS)
+			conv->cur_frame = 0;
 
-		frame = &input->frame[input->cur_frame];
+		frame = &conv->frame[conv->cur_frame];
 
-		success = video_scaler_scale(input->scaler,
+		conv->scaled  = true;
+		conv->success = video_scaler_scale(conv->scaler,
 				frame->data, frame->linesize,
 				(const uint8_t * const*)data->data,
 				data->linesize);
 
-		if (success) {
-			for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-				data->data[i]     = frame->data[i];
-				data->linesize[i] = frame->linesize[i];
-			}
-		} else {
+		if (!conv->success)
 			blog(LOG_WARNING, "video-io: Could not scale frame!");
+	}
+
+	if (conv->success) {
+		frame = &conv->frame[conv->cur_frame];
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			data->data[i]     = frame->data[i];
+			data->linesize[i] = frame->linesize[i];
 		}
 	}
 
-	return success;
+	return conv->success;
+}
+
+static void video_output_call_inputs(struct video_output *video,
+		const struct video_data *frame)
+{
+	struct video_input *last = NULL;
+	long count = 0;
+
+	for (size_t i = 0; i < video->conversions.num; i++)
+		video->conversions.array[i]->scaled = false;
+
+	for (size_t i = 0; i < video->inputs.num; i++) {
+		struct video_input *input = video->inputs.array[i];
+
+		input->frame = *frame;
+		input->dispatched = scale_video_output(input->scaled,
+				&input->frame);
+
+		if (input->dispatched) {
+			last = input;
+			count++;
+		}
+	}
+
+	if (!count)
+		return;
+
+	/* a single input is called directly rather than on its thread.  it
+	 * counts as its input thread, so that disconnecting from within the
+	 * callback leaves the input to be removed below, and gets a copy of
+	 * the frame so nothing it's given lives in the input. */
+	if (count == 1) {
+		struct video_data frame = last->frame;
+
+		thread_input = last;
+		last->callback(last->param, &frame);
+		thread_input = NULL;
+
+	} else {
+		os_atomic_set_long(&video->callbacks_left, count);
+
+		/* every event is reset before any callback can start, so a
+		 * callback disconnecting another input always waits for it */
+		for (size_t i = 0; i < video->inputs.num; i++) {
+			struct video_input *input = video->inputs.array[i];
+			if (input->dispatched)
+				os_event_reset(input->callback_done);
+		}
+
+		for (size_t i = 0; i < video->inputs.num; i++) {
+			struct video_input *input = video->inputs.array[i];
+			if (input->dispatched)
+				os_sem_post(input->start_sem);
+		}
+
+		os_sem_wait(video->callbacks_done);
+	}
+
+	/* inputs disconnected from within a callback are removed here, once
+	 * every callback has returned */
+	for (size_t i = video->inputs.num; i > 0; i--) {
+		struct video_input *input = video->inputs.array[i-1];
+
+		input->dispatched = false;
+
+		if (input->removed) {
+			da_erase(video->inputs, i-1);
+			video_input_free(video, input);
+		}
+	}
 }
 
 static inline bool video_output_cur_frame(struct video_output *video)
@@ -127,13 +356,7 @@ static inline bool video_output_cur_frame(struct video_output *video)
 
 	pthread_mutex_lock(&video->input_mutex);
 
-	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
-		struct video_data frame = frame_info->frame;
-
-		if (scale_video_output(input, &frame))
-			input->callback(input->param, &frame);
-	}
+	video_output_call_inputs(video, &frame_info->frame);
 
 	pthread_mutex_unlock(&video->input_mutex);
 
@@ -237,8 +460,12 @@ int video_output_open(video_t **video, struct video_output_info *info)
 		goto fail;
 	if (pthread_mutex_init(&out->input_mutex, &attr) != 0)
 		goto fail;
+	if (pthread_mutex_init(&out->disconnect_mutex, NULL) != 0)
+		goto fail;
 	if (os_sem_init(&out->update_semaphore, 0) != 0)
 		goto fail;
+	if (os_sem_init(&out->callbacks_done, 0) != 0)
+		goto fail;
 	if (pthread_create(&out->thread, NULL, video_thread, out) != 0)
 		goto fail;
 
@@ -261,15 +488,18 @@ void video_output_close(video_t *video)
 	video_output_stop(video);
 
 	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+		video_input_free(video, video->inputs.array[i]);
 	da_free(video->inputs);
+	da_free(video->conversions);
 
 	for (size_t i = 0; i < video->info.cache_size; i++)
 		video_frame_free((struct video_frame*)&video->cache[i]);
 
 	os_sem_destroy(video->update_semaphore);
+	os_sem_destroy(video->callbacks_done);
 	pthread_mutex_destroy(&video->data_mutex);
 	pthread_mutex_destroy(&video->input_mutex);
+	pthread_mutex_destroy(&video->disconnect_mutex);
 	bfree(video);
 }
 
@@ -278,7 +508,7 @@ static size_t video_get_input_idx(const video_t *video,
 		void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -289,39 +519,35 @@ static size_t video_get_input_idx(const video_t *video,
 static inline bool video_input_init(struct video_input *input,
 		struct video_output *video)
 {
+	input->video = video;
+
 	if (input->conversion.width  != video->info.width ||
 	    input->conversion.height != video->info.height ||
 	    input->conversion.format != video->info.format) {
-		struct video_scale_info from = {
-			.format = video->info.format,
-			.width  = video->info.width,
-			.height = video->info.height,
-		};
-
-		int ret = video_scaler_create(&input->scaler,
-				&input->conversion, &from,
-				VIDEO_SCALE_FAST_BILINEAR);
-		if (ret != VIDEO_SCALER_SUCCESS) {
-			if (ret == VIDEO_SCALER_BAD_CONVERSION)
-				blog(LOG_ERROR, "video_input_init: Bad "
-				                "scale conversion type");
-			else
-				blog(LOG_ERROR, "video_input_init: Failed to "
-				                "create scaler");
-
+		input->scaled = video_conversion_get(video,
+				&input->conversion);
+		if (!input->scaled)
 			return false;
-		}
-
-		for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-			video_frame_init(&input->frame[i],
-					input->conversion.format,
-					input->conversion.width,
-					input->conversion.height);
 	}
 
+	if (os_sem_init(&input->start_sem, 0) != 0)
+		return false;
+	if (os_event_init(&input->callback_done, OS_EVENT_TYPE_MANUAL) != 0)
+		return false;
+	os_event_signal(input->callback_done);
+	if (pthread_create(&input->thread, NULL, video_input_thread,
+				input) != 0)
+		return false;
+
+	input->thread_active = true;
 	return true;
 }
 
+static inline bool in_input_thread(const video_t *video)
+{
+	return thread_input && thread_input->video == video;
+}
+
 bool video_output_connect(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
@@ -332,31 +558,42 @@ bool video_output_connect(video_t *video,
 	if (!video || !callback)
 		return false;
 
+	/* the video thread holds input_mutex until all callbacks return */
+	if (in_input_thread(video) &&
+	    !pthread_equal(pthread_self(), video->thread)) {
+		blog(LOG_WARNING, "video_output_connect: Cannot connect from "
+		                  "within a video callback");
+		return false;
+	}
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input;
+		input = bzalloc(sizeof(struct video_input));
 
-		input.callback = callback;
-		input.param    = param;
+		input->callback = callback;
+		input->param    = param;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format    = video->info.format;
-			input.conversion.width     = video->info.width;
-			input.conversion.height    = video->info.height;
+			input->conversion.format    = video->info.format;
+			input->conversion.width     = video->info.width;
+			input->conversion.height    = video->info.height;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
-		if (success)
+		success = video_input_init(input, video);
+		if (success) {
 			da_push_back(video->inputs, &input);
+			os_atomic_inc_long(&video->active_inputs);
+		} else
+			video_input_free(video, input);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -364,6 +601,50 @@ bool video_output_connect(video_t *video,
 	return success;
 }
 
+static inline bool video_input_waits_on(const struct video_input *input,
+		const struct video_input *target)
+{
+	for (; input; input = input->waiting_on) {
+		if (input == target)
+			return true;
+	}
+
+	return false;
+}
+
+/* called from within a callback: the video thread holds input_mutex until
+ * every callback has returned, so the input is only flagged here and is
+ * removed by the video thread afterward.  as when called from any other
+ * thread, the input's callback has returned once this does, unless that
+ * callback is itself waiting to disconnect the calling input, in which case
+ * waiting for it would deadlock. */
+static void video_input_remove(struct video_output *video,
+		struct video_input *input)
+{
+	struct video_input *self = thread_input;
+	bool wait;
+
+	if (!os_atomic_set_bool(&input->removed, true))
+		os_atomic_dec_long(&video->active_inputs);
+
+	if (input == self)
+		return;
+
+	pthread_mutex_lock(&video->disconnect_mutex);
+	wait = !video_input_waits_on(input, self);
+	if (wait)
+		self->waiting_on = input;
+	pthread_mutex_unlock(&video->disconnect_mutex);
+
+	if (wait) {
+		os_event_wait(input->callback_done);
+
+		pthread_mutex_lock(&video->disconnect_mutex);
+		self->waiting_on = NULL;
+		pthread_mutex_unlock(&video->disconnect_mutex);
+	}
+}
+
 void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
@@ -371,12 +652,24 @@ void video_output_disconnect(video_t *video,
 	if (!video || !callback)
 		return;
 
+	if (in_input_thread(video)) {
+		size_t idx = video_get_input_idx(video, callback, param);
+		if (idx != DARRAY_INVALID)
+			video_input_remove(video, video->inputs.array[idx]);
+		return;
+	}
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array+idx);
+		struct video_input *input = video->inputs.array[idx];
+
+		if (!input->removed)
+			os_atomic_dec_long(&video->active_inputs);
+
 		da_erase(video->inputs, idx);
+		video_input_free(video, input);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -385,7 +678,7 @@ void video_output_disconnect(video_t *video,
 bool video_output_active(const video_t *video)
 {
 	if (!video) return false;
-	return video->inputs.num != 0;
+	return os_atomic_load_long(&video->active_inputs) != 0;
 }
 
 const struct video_output_info *video_output_get_info(const video_t *video)
@@ -415,6 +708,8 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 
 		cfi = &video->cache[video->last_added];
 		cfi->frame.timestamp = timestamp;
+		cfi->frame.origin_ts = timestamp;
+		cfi->frame.cached_ts = 0;
 		cfi->count = count;
 
 		memcpy(frame, &cfi->frame, sizeof(*frame));
@@ -433,6 +728,8 @@ void video_output_unlock_frame(video_t *video)
 
 	pthread_mutex_lock(&video->data_mutex);
 
+	/* the frame locked last is always the one being unlocked */
+	video->cache[video->last_added].frame.cached_ts = os_gettime_ns();
 	video->available_frames--;
 	os_sem_post(video->update_semaphore);
 
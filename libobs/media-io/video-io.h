@@ -67,6 +67,12 @@ struct video_data {
 	uint8_t           *data[MAX_AV_PLANES];
 	uint32_t          linesize[MAX_AV_PLANES];
 	uint64_t          timestamp;
+
+	/* os_gettime_ns() of the render tick the frame came from (the
+	 * timestamp moves on when a frame is duplicated, this does not), and
+	 * of when the frame was ready in the output cache */
+	uint64_t          origin_ts;
+	uint64_t          cached_ts;
 };
 
 struct video_output_info {
@@ -150,10 +156,21 @@ EXPORT bool video_format_get_parameters(enum video_colorspace color_space,
 EXPORT int video_output_open(video_t **video, struct video_output_info *info);
 EXPORT void video_output_close(video_t *video);
 
+/*
+ * When more than one input is connected, the callbacks are called
+ * concurrently on separate threads.  Inputs that request the same conversion
+ * share the same scaled frame data, so callbacks must not modify it.
+ */
 EXPORT bool video_output_connect(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
+
+/*
+ * Once this returns, the input's callback is no longer running, even when
+ * called from within another input's callback.  The only exception is two
+ * callbacks disconnecting each other, which can't both wait.
+ */
 EXPORT void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
@@ -0,0 +1,81 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "obs-internal.h"
+
+/*
+ * Audio encoder framing
+ *
+ *   Audio is mixed in ticks that don't have to line up with the frames of
+ * the codec, for example when the first tick of a paired encoder is cut
+ * short to start with the video.  Frames that lie within a single tick are
+ * sent straight from the mixed data, and only a frame that spans two ticks
+ * is put together in audio_output_buffer, from what was left of the last
+ * tick (kept in audio_input_buffer) and the start of the current one.
+ */
+
+typedef void (*audio_framing_send_t)(struct obs_encoder *encoder,
+		uint8_t *const data[]);
+
+static inline void audio_framing_push(struct obs_encoder *encoder,
+		uint8_t *const data[], size_t size, audio_framing_send_t send)
+{
+	size_t frame_bytes = encoder->framesize_bytes;
+	size_t buffered    = encoder->audio_input_buffer[0].size;
+	size_t offset      = 0;
+	uint8_t *frame[MAX_AV_PLANES] = {NULL};
+
+	/* complete the frame left over from the last tick */
+	if (buffered) {
+		size_t needed = frame_bytes - buffered;
+
+		if (size < needed) {
+			for (size_t i = 0; i < encoder->planes; i++)
+				circlebuf_push_back(
+						&encoder->audio_input_buffer[i],
+						data[i], size);
+			return;
+		}
+
+		for (size_t i = 0; i < encoder->planes; i++) {
+			uint8_t *out = encoder->audio_output_buffer[i];
+
+			circlebuf_pop_front(&encoder->audio_input_buffer[i],
+					out, buffered);
+			memcpy(out + buffered, data[i], needed);
+		}
+
+		send(encoder, encoder->audio_output_buffer);
+		offset = needed;
+	}
+
+	/* whole frames are encoded straight from the mix */
+	while (size - offset >= frame_bytes) {
+		for (size_t i = 0; i < encoder->planes; i++)
+			frame[i] = data[i] + offset;
+
+		send(encoder, frame);
+		offset += frame_bytes;
+	}
+
+	if (offset < size)
+		for (size_t i = 0; i < encoder->planes; i++)
+			circlebuf_push_back(&encoder->audio_input_buffer[i],
+					data[i] + offset, size - offset);
+}
@@ -146,6 +146,7 @@ void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 
 	avc_packet->data          = output.bytes.array;
 	avc_packet->size          = output.bytes.num;
+	avc_packet->refs          = NULL;
 	avc_packet->drop_priority = get_drop_priority(avc_packet->priority);
 }
 
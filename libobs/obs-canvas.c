@@ -0,0 +1,197 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+#include "obs.h"
+#include "obs-internal.h"
+
+static bool canvas_format_valid(enum video_format format)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_I444:
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool obs_canvas_init_textures(struct obs_canvas *canvas)
+{
+	uint32_t width  = canvas->info.width;
+	uint32_t height = canvas->info.height;
+
+	canvas->output_texture = gs_texture_create(width, height, GS_RGBA, 1,
+			NULL, GS_RENDER_TARGET);
+	if (!canvas->output_texture)
+		return false;
+
+	if (canvas->gpu_conversion) {
+		height = canvas->conversion.height;
+
+		canvas->convert_texture = gs_texture_create(width, height,
+				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
+		if (!canvas->convert_texture)
+			return false;
+	}
+
+	for (size_t i = 0; i < DEFAULT_STAGE_SURFACES; i++) {
+		canvas->copy_surfaces[i] = gs_stagesurface_create(width, height,
+				GS_RGBA);
+		if (!canvas->copy_surfaces[i])
+			return false;
+	}
+
+	return true;
+}
+
+static void obs_canvas_free_textures(struct obs_canvas *canvas)
+{
+	for (size_t i = 0; i < DEFAULT_STAGE_SURFACES; i++)
+		gs_stagesurface_destroy(canvas->copy_surfaces[i]);
+
+	gs_texture_destroy(canvas->convert_texture);
+	gs_texture_destroy(canvas->output_texture);
+}
+
+static bool obs_canvas_init(struct obs_canvas *canvas)
+{
+	struct video_output_info vi;
+	bool success;
+
+	vi.name       = canvas->name;
+	vi.format     = canvas->info.format;
+	vi.fps_num    = canvas->info.fps_num;
+	vi.fps_den    = canvas->info.fps_den;
+	vi.width      = canvas->info.width;
+	vi.height     = canvas->info.height;
+	vi.range      = canvas->info.range;
+	vi.colorspace = canvas->info.colorspace;
+	vi.cache_size = 6;
+
+	if (video_output_open(&canvas->video, &vi) != VIDEO_OUTPUT_SUCCESS) {
+		blog(LOG_ERROR, "obs_canvas_init: Could not open video output "
+		                "for canvas '%s'", canvas->name);
+		return false;
+	}
+
+	canvas->frame_interval = video_output_get_frame_time(canvas->video);
+	canvas->gpu_conversion = obs_calc_conversion_layout(
+			&canvas->conversion, vi.format, vi.width, vi.height);
+
+	obs_make_color_matrix(canvas->color_matrix, vi.format,
+			vi.colorspace, vi.range);
+
+	gs_enter_context(obs->video.graphics);
+	success = obs_canvas_init_textures(canvas);
+	gs_leave_context();
+
+	if (!success)
+		blog(LOG_ERROR, "obs_canvas_init: Failed to create textures "
+		                "for canvas '%s'", canvas->name);
+	return success;
+}
+
+static void obs_canvas_free(struct obs_canvas *canvas)
+{
+	if (canvas->video)
+		video_output_close(canvas->video);
+
+	gs_enter_context(obs->video.graphics);
+	obs_canvas_free_textures(canvas);
+	gs_leave_context();
+
+	if (canvas->copies_skipped)
+		blog(LOG_INFO, "Canvas '%s' skipped %"PRIu32" frames because "
+		               "the GPU was behind",
+		               canvas->name, canvas->copies_skipped);
+
+	bfree(canvas->name);
+	bfree(canvas);
+}
+
+obs_canvas_t *obs_canvas_create(const char *name,
+		const struct obs_canvas_info *info)
+{
+	struct obs_canvas *canvas;
+
+	if (!obs || !obs->video.graphics || !info)
+		return NULL;
+
+	if (!info->width || !info->height || !info->fps_num ||
+	    !info->fps_den || !canvas_format_valid(info->format)) {
+		blog(LOG_ERROR, "obs_canvas_create: Invalid canvas parameters");
+		return NULL;
+	}
+
+	canvas = bzalloc(sizeof(struct obs_canvas));
+	canvas->name = bstrdup(name ? name : "canvas");
+	canvas->info = *info;
+
+	/* align to multiple-of-two and SSE alignment sizes */
+	canvas->info.width  &= 0xFFFFFFFC;
+	canvas->info.height &= 0xFFFFFFFE;
+
+	if (!canvas->info.width || !canvas->info.height ||
+	    !obs_canvas_init(canvas)) {
+		obs_canvas_free(canvas);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&obs->data.canvases_mutex);
+	canvas->prev_next      = &obs->data.first_canvas;
+	canvas->next           = obs->data.first_canvas;
+	obs->data.first_canvas = canvas;
+	if (canvas->next)
+		canvas->next->prev_next = &canvas->next;
+	pthread_mutex_unlock(&obs->data.canvases_mutex);
+
+	blog(LOG_INFO, "Canvas '%s' created: %"PRIu32"x%"PRIu32", "
+	               "%"PRIu32"/%"PRIu32" fps, %s%s",
+	               canvas->name, canvas->info.width, canvas->info.height,
+	               canvas->info.fps_num, canvas->info.fps_den,
+	               get_video_format_name(canvas->info.format),
+	               canvas->gpu_conversion ? " (GPU converted)" : "");
+
+	return canvas;
+}
+
+void obs_canvas_destroy(obs_canvas_t *canvas)
+{
+	if (!canvas)
+		return;
+
+	/* the video thread renders and downloads canvases with the mutex
+	 * locked, so once it's unlinked the canvas is no longer in use */
+	pthread_mutex_lock(&obs->data.canvases_mutex);
+	if (canvas->prev_next)
+		*canvas->prev_next = canvas->next;
+	if (canvas->next)
+		canvas->next->prev_next = canvas->prev_next;
+	pthread_mutex_unlock(&obs->data.canvases_mutex);
+
+	obs_canvas_free(canvas);
+}
+
+video_t *obs_canvas_get_video(const obs_canvas_t *canvas)
+{
+	return canvas ? canvas->video : NULL;
+}
@@ -172,9 +172,31 @@ static inline void render_display_end()
 	gs_present();
 }
 
+/* frames are skipped to stay close to the maximum frame rate on average,
+ * drawing a frame when it is less than half a video frame early */
+static inline bool display_frame_due(struct obs_display *display)
+{
+	uint64_t video_time = obs->video.video_time;
+	uint64_t half_frame;
+
+	if (!display->frame_interval_ns)
+		return true;
+
+	half_frame = video_output_get_frame_time(obs->video.video) / 2;
+	if (video_time + half_frame < display->next_frame_time)
+		return false;
+
+	display->next_frame_time += display->frame_interval_ns;
+	if (display->next_frame_time < video_time)
+		display->next_frame_time = video_time +
+			display->frame_interval_ns;
+	return true;
+}
+
 void render_display(struct obs_display *display)
 {
 	if (!display || !display->enabled) return;
+	if (!display_frame_due(display)) return;
 
 	render_display_begin(display);
 
@@ -208,3 +230,11 @@ void obs_display_set_background_color(obs_display_t *display, uint32_t color)
 	if (display)
 		display->background_color = color;
 }
+
+void obs_display_set_max_fps(obs_display_t *display, uint32_t fps)
+{
+	if (!display) return;
+
+	display->frame_interval_ns = fps ? 1000000000ULL / fps : 0;
+	display->next_frame_time   = 0;
+}
@@ -15,8 +15,10 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include <inttypes.h>
 #include "obs.h"
 #include "obs-internal.h"
+#include "obs-audio-framing.h"
 
 struct obs_encoder_info *find_encoder(const char *id)
 {
@@ -43,6 +45,7 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 
 	pthread_mutex_init_value(&encoder->callbacks_mutex);
 	pthread_mutex_init_value(&encoder->outputs_mutex);
+	pthread_mutex_init_value(&encoder->queue_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -55,6 +58,8 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		return false;
 	if (pthread_mutex_init(&encoder->outputs_mutex, NULL) != 0)
 		return false;
+	if (pthread_mutex_init(&encoder->queue_mutex, NULL) != 0)
+		return false;
 
 	if (encoder->info.get_defaults)
 		encoder->info.get_defaults(encoder->context.settings);
@@ -74,7 +79,8 @@ static struct obs_encoder *create_encoder(const char *id,
 		return NULL;
 
 	encoder = bzalloc(sizeof(struct obs_encoder));
-	encoder->mixer_idx = mixer_idx;
+	encoder->mixer_idx  = mixer_idx;
+	encoder->max_queued = DEFAULT_ENCODER_QUEUE_SIZE;
 
 	if (!ei) {
 		blog(LOG_ERROR, "Encoder ID '%s' not found", id);
@@ -123,6 +129,13 @@ obs_encoder_t *obs_audio_encoder_create(const char *id, const char *name,
 static void receive_video(void *param, struct video_data *frame);
 static void receive_audio(void *param, size_t mix_idx, struct audio_data *data);
 
+static void reset_stats(struct obs_encoder *encoder);
+static void start_encode_thread(struct obs_encoder *encoder);
+static void signal_encode_thread_stop(struct obs_encoder *encoder);
+static void stop_encode_thread(struct obs_encoder *encoder);
+static void abort_encode_thread(struct obs_encoder *encoder);
+static void join_encode_thread(struct obs_encoder *encoder);
+
 static inline void get_audio_info(const struct obs_encoder *encoder,
 		struct audio_convert_info *info)
 {
@@ -171,6 +184,11 @@ static inline bool has_scaling(const struct obs_encoder *encoder)
 
 static void add_connection(struct obs_encoder *encoder)
 {
+	reset_stats(encoder);
+
+	if (encoder->threaded)
+		start_encode_thread(encoder);
+
 	if (encoder->info.type == OBS_ENCODER_AUDIO) {
 		struct audio_convert_info audio_info = {0};
 		get_audio_info(encoder, &audio_info);
@@ -181,6 +199,7 @@ static void add_connection(struct obs_encoder *encoder)
 		struct video_scale_info info = {0};
 		get_video_info(encoder, &info);
 
+		encoder->video_conversion = info;
 		video_output_connect(encoder->media, &info, receive_video,
 			encoder);
 	}
@@ -190,6 +209,10 @@ static void add_connection(struct obs_encoder *encoder)
 
 static void remove_connection(struct obs_encoder *encoder)
 {
+	/* a callback waiting for room in the queue would otherwise keep the
+	 * media output from disconnecting */
+	signal_encode_thread_stop(encoder);
+
 	if (encoder->info.type == OBS_ENCODER_AUDIO)
 		audio_output_disconnect(encoder->media, encoder->mixer_idx,
 				receive_audio, encoder);
@@ -197,6 +220,7 @@ static void remove_connection(struct obs_encoder *encoder)
 		video_output_disconnect(encoder->media, receive_video,
 				encoder);
 
+	stop_encode_thread(encoder);
 	obs_encoder_shutdown(encoder);
 	encoder->active = false;
 }
@@ -210,6 +234,21 @@ static inline void free_audio_buffers(struct obs_encoder *encoder)
 	}
 }
 
+static inline void queued_frame_destroy(struct encoder_queued_frame *frame)
+{
+	for (size_t i = 0; i < MAX_AV_PLANES; i++)
+		bfree(frame->data[i]);
+	bfree(frame);
+}
+
+static inline void free_queued_frames(struct obs_encoder *encoder)
+{
+	for (size_t i = 0; i < encoder->free_frames.num; i++)
+		queued_frame_destroy(encoder->free_frames.array[i]);
+	da_free(encoder->free_frames);
+	circlebuf_free(&encoder->queue);
+}
+
 static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 {
 	if (encoder) {
@@ -223,6 +262,9 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 
 		blog(LOG_INFO, "encoder '%s' destroyed", encoder->context.name);
 
+		abort_encode_thread(encoder);
+		join_encode_thread(encoder);
+		free_queued_frames(encoder);
 		free_audio_buffers(encoder);
 
 		if (encoder->context.data)
@@ -230,6 +272,7 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 		da_free(encoder->callbacks);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
+		pthread_mutex_destroy(&encoder->queue_mutex);
 		obs_context_data_free(&encoder->context);
 		if (encoder->owns_info_id)
 			bfree((void*)encoder->info.id);
@@ -463,15 +506,25 @@ void obs_encoder_stop(obs_encoder_t *encoder,
 
 	idx = get_callback_idx(encoder, new_packet, param);
 	if (idx != DARRAY_INVALID) {
-		da_erase(encoder->callbacks, idx);
-		last = (encoder->callbacks.num == 0);
+		last = (encoder->callbacks.num == 1);
+		if (!last)
+			da_erase(encoder->callbacks, idx);
 	}
 
 	pthread_mutex_unlock(&encoder->callbacks_mutex);
 
 	if (last) {
+		/* the encoder thread encodes the frames it still has queued
+		 * while disconnecting, so the last callback has to stay
+		 * until then to get their packets */
 		remove_connection(encoder);
 
+		pthread_mutex_lock(&encoder->callbacks_mutex);
+		idx = get_callback_idx(encoder, new_packet, param);
+		if (idx != DARRAY_INVALID)
+			da_erase(encoder->callbacks, idx);
+		pthread_mutex_unlock(&encoder->callbacks_mutex);
+
 		if (encoder->destroy_on_stop)
 			obs_encoder_actually_destroy(encoder);
 	}
@@ -686,10 +739,13 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 	first_packet      = *packet;
 	first_packet.data = data.array;
 	first_packet.size = data.num;
+	first_packet.refs = NULL;
 
 	cb->new_packet(cb->param, &first_packet);
 	cb->sent_first_packet = true;
 
+	if (first_packet.refs)
+		obs_encoder_packet_release(&first_packet);
 	da_free(data);
 }
 
@@ -713,6 +769,44 @@ static void full_stop(struct obs_encoder *encoder)
 	}
 }
 
+static void add_encode_time(struct obs_encoder *encoder, uint64_t time)
+{
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	encoder->stats.frames_encoded++;
+	encoder->total_encode_time += time;
+	if (time > encoder->stats.max_encode_time_ns)
+		encoder->stats.max_encode_time_ns = time;
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+}
+
+static inline struct encoder_frame_timing *get_frame_timing(
+		struct obs_encoder *encoder, int64_t pts)
+{
+	uint64_t idx = (uint64_t)(pts / encoder->timebase_num);
+	return &encoder->frame_timing[idx % ENCODER_TIMING_SLOTS];
+}
+
+static inline void store_frame_timing(struct obs_encoder *encoder,
+		const struct encoder_frame *frame)
+{
+	struct encoder_frame_timing *ft = get_frame_timing(encoder, frame->pts);
+	ft->pts    = frame->pts;
+	ft->timing = frame->timing;
+}
+
+static inline void load_frame_timing(struct obs_encoder *encoder,
+		struct encoder_packet *pkt)
+{
+	struct encoder_frame_timing *ft = get_frame_timing(encoder, pkt->pts);
+
+	if (ft->pts == pkt->pts && ft->timing.origin_ts) {
+		pkt->timing = ft->timing;
+		pkt->timing.encoded_ts = os_gettime_ns();
+	}
+}
+
 static const char *do_encode_name = "do_encode";
 static inline void do_encode(struct obs_encoder *encoder,
 		struct encoder_frame *frame)
@@ -731,10 +825,17 @@ static inline void do_encode(struct obs_encoder *encoder,
 	pkt.timebase_den = encoder->timebase_den;
 	pkt.encoder = encoder;
 
+	if (encoder->info.type == OBS_ENCODER_VIDEO)
+		store_frame_timing(encoder, frame);
+
+	uint64_t encode_start = os_gettime_ns();
+
 	profile_start(encoder->profile_encoder_encode_name);
 	success = encoder->info.encode(encoder->context.data, frame, &pkt,
 			&received);
 	profile_end(encoder->profile_encoder_encode_name);
+
+	add_encode_time(encoder, os_gettime_ns() - encode_start);
 	if (!success) {
 		full_stop(encoder);
 		blog(LOG_ERROR, "Error encoding with encoder '%s'",
@@ -747,6 +848,9 @@ static inline void do_encode(struct obs_encoder *encoder,
 		 * you do not want to use relative timestamps here */
 		pkt.dts_usec = encoder->start_ts / 1000 + packet_dts_usec(&pkt);
 
+		if (pkt.type == OBS_ENCODER_VIDEO)
+			load_frame_timing(encoder, &pkt);
+
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
 		for (size_t i = encoder->callbacks.num; i > 0; i--) {
@@ -756,11 +860,179 @@ static inline void do_encode(struct obs_encoder *encoder,
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+		/* release the reference held for the callbacks if any of
+		 * them kept the packet (see share_encoder_packet) */
+		if (pkt.refs)
+			obs_encoder_packet_release(&pkt);
 	}
 
 	profile_end(do_encode_name);
 }
 
+/* ------------------------------------------------------------------------- */
+/* encoder thread queue */
+
+static inline size_t queue_depth(const struct obs_encoder *encoder)
+{
+	return encoder->queue.size / sizeof(struct encoder_queued_frame*);
+}
+
+/* queue_mutex must be locked */
+static inline struct encoder_queued_frame *get_queued_frame(
+		struct obs_encoder *encoder)
+{
+	struct encoder_queued_frame *frame;
+
+	if (!encoder->free_frames.num)
+		return bzalloc(sizeof(struct encoder_queued_frame));
+
+	frame = encoder->free_frames.array[encoder->free_frames.num - 1];
+	da_pop_back(encoder->free_frames);
+	return frame;
+}
+
+/* queue_mutex must be locked */
+static inline void recycle_queued_frame(struct obs_encoder *encoder,
+		struct encoder_queued_frame *frame)
+{
+	da_push_back(encoder->free_frames, &frame);
+}
+
+static inline void copy_queued_plane(struct encoder_queued_frame *frame,
+		size_t plane, const uint8_t *data, size_t size)
+{
+	if (frame->capacity[plane] < size) {
+		bfree(frame->data[plane]);
+		frame->data[plane]     = bmalloc(size);
+		frame->capacity[plane] = size;
+	}
+
+	memcpy(frame->data[plane], data, size);
+}
+
+static inline uint32_t plane_height(enum video_format format, uint32_t cy,
+		size_t plane)
+{
+	if (plane && (format == VIDEO_FORMAT_I420 ||
+	              format == VIDEO_FORMAT_NV12))
+		return cy / 2;
+	return cy;
+}
+
+static void queue_frame(struct obs_encoder *encoder,
+		struct encoder_queued_frame *frame)
+{
+	bool can_drop = encoder->info.type == OBS_ENCODER_VIDEO &&
+		encoder->drop_policy != OBS_ENCODER_BLOCK;
+	struct encoder_queued_frame *dropped = NULL;
+	size_t depth;
+
+	frame->queued_time = os_gettime_ns();
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	while (!can_drop && !encoder->encode_thread_stop &&
+	       queue_depth(encoder) >= encoder->max_queued) {
+		pthread_mutex_unlock(&encoder->queue_mutex);
+		os_event_wait(encoder->queue_space);
+		pthread_mutex_lock(&encoder->queue_mutex);
+	}
+
+	/* once stopping, frames that come in late are let go instead of
+	 * making room for them, the queued ones still get encoded */
+	if (encoder->encode_thread_stop) {
+		recycle_queued_frame(encoder, frame);
+		pthread_mutex_unlock(&encoder->queue_mutex);
+		return;
+	}
+
+	if (queue_depth(encoder) >= encoder->max_queued) {
+		if (encoder->drop_policy == OBS_ENCODER_DROP_OLDEST) {
+			circlebuf_pop_front(&encoder->queue, &dropped,
+					sizeof(dropped));
+			circlebuf_push_back(&encoder->queue, &frame,
+					sizeof(frame));
+		} else {
+			dropped = frame;
+		}
+
+		recycle_queued_frame(encoder, dropped);
+		encoder->stats.frames_dropped++;
+		pthread_mutex_unlock(&encoder->queue_mutex);
+		return;
+	}
+
+	circlebuf_push_back(&encoder->queue, &frame, sizeof(frame));
+
+	depth = queue_depth(encoder);
+	if (depth > encoder->stats.max_queue_depth)
+		encoder->stats.max_queue_depth = (uint32_t)depth;
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	os_sem_post(encoder->queue_sem);
+}
+
+/* the video data is only valid during the callback, so it has to be copied */
+static void queue_video(struct obs_encoder *encoder, struct video_data *data,
+		uint64_t received_ts)
+{
+	const struct video_scale_info *info = &encoder->video_conversion;
+	struct encoder_queued_frame *frame;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	frame = get_queued_frame(encoder);
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		size_t size = (size_t)data->linesize[i] *
+			plane_height(info->format, info->height, i);
+
+		frame->linesize[i] = data->linesize[i];
+		if (size)
+			copy_queued_plane(frame, i, data->data[i], size);
+	}
+
+	frame->frames    = 1;
+	frame->timestamp = data->timestamp;
+	frame->pts       = encoder->cur_pts;
+
+	frame->timing.origin_ts   = data->origin_ts;
+	frame->timing.cached_ts   = data->cached_ts;
+	frame->timing.received_ts = received_ts;
+
+	queue_frame(encoder, frame);
+}
+
+static void queue_audio(struct obs_encoder *encoder, struct audio_data *data)
+{
+	size_t size = data->frames * encoder->blocksize;
+	struct encoder_queued_frame *frame;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	frame = get_queued_frame(encoder);
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	for (size_t i = 0; i < encoder->planes; i++) {
+		frame->linesize[i] = (uint32_t)size;
+		if (size)
+			copy_queued_plane(frame, i, data->data[i], size);
+	}
+
+	frame->frames    = data->frames;
+	frame->timestamp = data->timestamp;
+
+	queue_frame(encoder, frame);
+}
+
+static inline void add_received_frame(struct obs_encoder *encoder)
+{
+	pthread_mutex_lock(&encoder->queue_mutex);
+	encoder->stats.frames_received++;
+	pthread_mutex_unlock(&encoder->queue_mutex);
+}
+
 static const char *receive_video_name = "receive_video";
 static void receive_video(void *param, struct video_data *frame)
 {
@@ -768,35 +1040,44 @@ static void receive_video(void *param, struct video_data *frame)
 
 	struct obs_encoder    *encoder  = param;
 	struct encoder_frame  enc_frame;
+	uint64_t              received_ts = os_gettime_ns();
 
-	memset(&enc_frame, 0, sizeof(struct encoder_frame));
-
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		enc_frame.data[i]     = frame->data[i];
-		enc_frame.linesize[i] = frame->linesize[i];
-	}
+	add_received_frame(encoder);
 
 	if (!encoder->start_ts)
 		encoder->start_ts = frame->timestamp;
 
-	enc_frame.frames = 1;
-	enc_frame.pts    = encoder->cur_pts;
+	if (encoder->encode_thread_active) {
+		queue_video(encoder, frame, received_ts);
 
-	do_encode(encoder, &enc_frame);
+	} else {
+		memset(&enc_frame, 0, sizeof(struct encoder_frame));
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			enc_frame.data[i]     = frame->data[i];
+			enc_frame.linesize[i] = frame->linesize[i];
+		}
+
+		enc_frame.frames = 1;
+		enc_frame.pts    = encoder->cur_pts;
+
+		enc_frame.timing.origin_ts   = frame->origin_ts;
+		enc_frame.timing.cached_ts   = frame->cached_ts;
+		enc_frame.timing.received_ts = received_ts;
+
+		do_encode(encoder, &enc_frame);
+	}
 
 	encoder->cur_pts += encoder->timebase_num;
 
 	profile_end(receive_video_name);
 }
 
-static const char *buffer_audio_name = "buffer_audio";
-static bool buffer_audio(struct obs_encoder *encoder, struct audio_data *data)
+/* sets the start of the audio, and where in the data it starts */
+static bool start_audio(struct obs_encoder *encoder, struct audio_data *data,
+		size_t *offset_size)
 {
-	profile_start(buffer_audio_name);
-
 	size_t samplerate = encoder->samplerate;
-	size_t size = data->frames * encoder->blocksize;
-	size_t offset_size = 0;
 
 	if (!encoder->start_ts && encoder->paired_encoder) {
 		uint64_t end_ts     = data->timestamp;
@@ -804,19 +1085,19 @@ static bool buffer_audio(struct obs_encoder *encoder, struct audio_data *data)
 
 		/* no video yet, so don't start audio */
 		if (!v_start_ts)
-			goto fail;
+			return false;
 
 		/* audio starting point still not synced with video starting
 		 * point, so don't start audio */
 		end_ts += (uint64_t)data->frames * 1000000000ULL / samplerate;
 		if (end_ts <= v_start_ts)
-			goto fail;
+			return false;
 
 		/* ready to start audio, truncate if necessary */
 		if (data->timestamp < v_start_ts) {
 			uint64_t offset = v_start_ts - data->timestamp;
 			offset = (int)(offset * samplerate / 1000000000);
-			offset_size = (size_t)offset * encoder->blocksize;
+			*offset_size = (size_t)offset * encoder->blocksize;
 		}
 
 		encoder->start_ts = v_start_ts;
@@ -825,34 +1106,18 @@ static bool buffer_audio(struct obs_encoder *encoder, struct audio_data *data)
 		encoder->start_ts = data->timestamp;
 	}
 
-	size -= offset_size;
-
-	/* push in to the circular buffer */
-	if (size)
-		for (size_t i = 0; i < encoder->planes; i++)
-			circlebuf_push_back(&encoder->audio_input_buffer[i],
-					data->data[i] + offset_size, size);
-
-	profile_end(buffer_audio_name);
 	return true;
-
-fail:
-	profile_end(buffer_audio_name);
-	return false;
 }
 
-static void send_audio_data(struct obs_encoder *encoder)
+static void send_audio_frame(struct obs_encoder *encoder,
+		uint8_t *const data[])
 {
 	struct encoder_frame  enc_frame;
 
 	memset(&enc_frame, 0, sizeof(struct encoder_frame));
 
 	for (size_t i = 0; i < encoder->planes; i++) {
-		circlebuf_pop_front(&encoder->audio_input_buffer[i],
-				encoder->audio_output_buffer[i],
-				encoder->framesize_bytes);
-
-		enc_frame.data[i]     = encoder->audio_output_buffer[i];
+		enc_frame.data[i]     = data[i];
 		enc_frame.linesize[i] = (uint32_t)encoder->framesize_bytes;
 	}
 
@@ -864,6 +1129,22 @@ static void send_audio_data(struct obs_encoder *encoder)
 	encoder->cur_pts += encoder->framesize;
 }
 
+static void encode_audio(struct obs_encoder *encoder, struct audio_data *data)
+{
+	uint8_t *planes[MAX_AV_PLANES] = {NULL};
+	size_t size = data->frames * encoder->blocksize;
+	size_t offset_size = 0;
+
+	if (!start_audio(encoder, data, &offset_size) || offset_size >= size)
+		return;
+
+	for (size_t i = 0; i < encoder->planes; i++)
+		planes[i] = data->data[i] + offset_size;
+
+	audio_framing_push(encoder, planes, size - offset_size,
+			send_audio_frame);
+}
+
 static const char *receive_audio_name = "receive_audio";
 static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
 {
@@ -871,18 +1152,226 @@ static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
 
 	struct obs_encoder *encoder = param;
 
-	if (!buffer_audio(encoder, data))
-		goto end;
+	add_received_frame(encoder);
 
-	while (encoder->audio_input_buffer[0].size >= encoder->framesize_bytes)
-		send_audio_data(encoder);
+	if (encoder->encode_thread_active)
+		queue_audio(encoder, data);
+	else
+		encode_audio(encoder, data);
 
 	UNUSED_PARAMETER(mix_idx);
 
-end:
 	profile_end(receive_audio_name);
 }
 
+/* ------------------------------------------------------------------------- */
+/* encoder thread */
+
+static void encode_queued_frame(struct obs_encoder *encoder,
+		struct encoder_queued_frame *frame)
+{
+	if (encoder->info.type == OBS_ENCODER_AUDIO) {
+		struct audio_data data;
+		memset(&data, 0, sizeof(struct audio_data));
+
+		for (size_t i = 0; i < encoder->planes; i++)
+			data.data[i] = frame->data[i];
+
+		data.frames    = frame->frames;
+		data.timestamp = frame->timestamp;
+
+		encode_audio(encoder, &data);
+
+	} else {
+		struct encoder_frame enc_frame;
+		memset(&enc_frame, 0, sizeof(struct encoder_frame));
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			if (!frame->linesize[i])
+				continue;
+
+			enc_frame.data[i]     = frame->data[i];
+			enc_frame.linesize[i] = frame->linesize[i];
+		}
+
+		enc_frame.frames = 1;
+		enc_frame.pts    = frame->pts;
+		enc_frame.timing = frame->timing;
+
+		do_encode(encoder, &enc_frame);
+	}
+}
+
+static void *encode_thread(void *param)
+{
+	struct obs_encoder *encoder = param;
+
+	os_set_thread_name("libobs: encoder thread");
+
+	const char *encode_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				"encode_thread(%s)", encoder->context.name);
+
+	while (os_sem_wait(encoder->queue_sem) == 0) {
+		struct encoder_queued_frame *frame = NULL;
+		uint64_t queue_time;
+		bool stop;
+
+		if (encoder->encode_thread_abort)
+			break;
+
+		/* when stopping, the frames that are still queued are
+		 * encoded before the thread exits */
+		pthread_mutex_lock(&encoder->queue_mutex);
+		stop = encoder->encode_thread_stop;
+		if (encoder->queue.size)
+			circlebuf_pop_front(&encoder->queue, &frame,
+					sizeof(frame));
+		pthread_mutex_unlock(&encoder->queue_mutex);
+
+		if (!frame) {
+			if (stop)
+				break;
+			continue;
+		}
+
+		os_event_signal(encoder->queue_space);
+		queue_time = os_gettime_ns() - frame->queued_time;
+
+		profile_start(encode_thread_name);
+		encode_queued_frame(encoder, frame);
+		profile_end(encode_thread_name);
+
+		profile_reenable_thread();
+
+		pthread_mutex_lock(&encoder->queue_mutex);
+
+		encoder->dequeued_frames++;
+		encoder->total_queue_time += queue_time;
+		if (queue_time > encoder->stats.max_queue_time_ns)
+			encoder->stats.max_queue_time_ns = queue_time;
+
+		recycle_queued_frame(encoder, frame);
+
+		pthread_mutex_unlock(&encoder->queue_mutex);
+	}
+
+	return NULL;
+}
+
+static void start_encode_thread(struct obs_encoder *encoder)
+{
+	join_encode_thread(encoder);
+
+	encoder->encode_thread_stop  = false;
+	encoder->encode_thread_abort = false;
+
+	if (os_sem_init(&encoder->queue_sem, 0) != 0)
+		goto fail;
+	if (os_event_init(&encoder->queue_space, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+	if (pthread_create(&encoder->encode_thread, NULL, encode_thread,
+				encoder) != 0)
+		goto fail;
+
+	encoder->encode_thread_active = true;
+	return;
+
+fail:
+	blog(LOG_WARNING, "encoder '%s': Failed to create encoder thread, "
+	                  "encoding on the media thread instead",
+	                  encoder->context.name);
+
+	os_sem_destroy(encoder->queue_sem);
+	os_event_destroy(encoder->queue_space);
+	encoder->queue_sem   = NULL;
+	encoder->queue_space = NULL;
+}
+
+static void signal_encode_thread_stop(struct obs_encoder *encoder)
+{
+	if (!encoder->encode_thread_active)
+		return;
+
+	/* set with the queue locked so that every frame queued before it is
+	 * seen by the encoder thread before it sees the stop */
+	pthread_mutex_lock(&encoder->queue_mutex);
+	encoder->encode_thread_stop = true;
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	os_event_signal(encoder->queue_space);
+}
+
+static void join_encode_thread(struct obs_encoder *encoder)
+{
+	struct encoder_queued_frame *frame;
+
+	if (!encoder->encode_thread_active)
+		return;
+
+	pthread_join(encoder->encode_thread, NULL);
+	encoder->encode_thread_active = false;
+
+	while (encoder->queue.size) {
+		circlebuf_pop_front(&encoder->queue, &frame, sizeof(frame));
+		recycle_queued_frame(encoder, frame);
+	}
+
+	os_sem_destroy(encoder->queue_sem);
+	os_event_destroy(encoder->queue_space);
+	encoder->queue_sem   = NULL;
+	encoder->queue_space = NULL;
+
+	if (encoder->stats.frames_dropped)
+		blog(LOG_INFO, "encoder '%s': %"PRIu64" of %"PRIu64" frames "
+		               "dropped from the encoder queue",
+		               encoder->context.name,
+		               encoder->stats.frames_dropped,
+		               encoder->stats.frames_received);
+}
+
+static void stop_encode_thread(struct obs_encoder *encoder)
+{
+	if (!encoder->encode_thread_active)
+		return;
+
+	/* when encoding fails the encoder is stopped from its own thread,
+	 * which then gets joined when the encoder restarts or is destroyed.
+	 * the encoder is shut down by then, so the rest of the queue is
+	 * skipped. */
+	if (pthread_equal(pthread_self(), encoder->encode_thread)) {
+		abort_encode_thread(encoder);
+		return;
+	}
+
+	signal_encode_thread_stop(encoder);
+	os_sem_post(encoder->queue_sem);
+	join_encode_thread(encoder);
+}
+
+/* stops the encoder thread without encoding the frames still queued */
+static void abort_encode_thread(struct obs_encoder *encoder)
+{
+	if (!encoder->encode_thread_active)
+		return;
+
+	encoder->encode_thread_abort = true;
+	signal_encode_thread_stop(encoder);
+	os_sem_post(encoder->queue_sem);
+}
+
+static void reset_stats(struct obs_encoder *encoder)
+{
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	memset(&encoder->stats, 0, sizeof(encoder->stats));
+	encoder->dequeued_frames   = 0;
+	encoder->total_queue_time  = 0;
+	encoder->total_encode_time = 0;
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+}
+
 void obs_encoder_add_output(struct obs_encoder *encoder,
 		struct obs_output *output)
 {
@@ -903,17 +1392,74 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 	pthread_mutex_unlock(&encoder->outputs_mutex);
 }
 
+/* the reference count is stored in the same allocation, before the data */
+static void create_shared_packet(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	const uint8_t *src_data = src->data;
+	long *refs = bmalloc(sizeof(long) + src->size);
+
+	*refs = 1;
+	*dst = *src;
+	dst->refs = refs;
+	dst->data = (uint8_t*)(refs + 1);
+	memcpy(dst->data, src_data, src->size);
+}
+
+void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	if (!obs_ptr_valid(dst, "obs_encoder_packet_ref"))
+		return;
+	if (!obs_ptr_valid(src, "obs_encoder_packet_ref"))
+		return;
+
+	if (src->refs) {
+		os_atomic_inc_long(src->refs);
+		*dst = *src;
+	} else {
+		create_shared_packet(dst, src);
+	}
+}
+
+void obs_encoder_packet_release(struct encoder_packet *packet)
+{
+	if (!packet)
+		return;
+
+	if (packet->refs) {
+		if (os_atomic_dec_long(packet->refs) == 0)
+			bfree((void*)packet->refs);
+	} else {
+		bfree(packet->data);
+	}
+
+	memset(packet, 0, sizeof(struct encoder_packet));
+}
+
+void share_encoder_packet(struct encoder_packet *dst,
+		struct encoder_packet *src)
+{
+	/* the first callback to keep a packet switches the encoder's packet
+	 * over to a shared copy, so later callbacks add references to that
+	 * instead of copying the data again */
+	if (!src->refs)
+		create_shared_packet(src, src);
+
+	obs_encoder_packet_ref(dst, src);
+}
+
 void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
 	*dst = *src;
+	dst->refs = NULL;
 	dst->data = bmemdup(src->data, src->size);
 }
 
 void obs_free_encoder_packet(struct encoder_packet *packet)
 {
-	bfree(packet->data);
-	memset(packet, 0, sizeof(struct encoder_packet));
+	obs_encoder_packet_release(packet);
 }
 
 void obs_encoder_set_preferred_video_format(obs_encoder_t *encoder,
@@ -1020,3 +1566,46 @@ const char *obs_encoder_get_id(const obs_encoder_t *encoder)
 	return obs_encoder_valid(encoder, "obs_encoder_get_id")
 		? encoder->info.id : NULL;
 }
+
+void obs_encoder_set_threaded(obs_encoder_t *encoder, bool threaded,
+		uint32_t max_queued, enum obs_encoder_drop_policy drop_policy)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_set_threaded"))
+		return;
+
+	encoder->threaded    = threaded;
+	encoder->max_queued  = max_queued ?
+		max_queued : DEFAULT_ENCODER_QUEUE_SIZE;
+	encoder->drop_policy = drop_policy;
+}
+
+bool obs_encoder_threaded(const obs_encoder_t *encoder)
+{
+	return obs_encoder_valid(encoder, "obs_encoder_threaded") ?
+		encoder->threaded : false;
+}
+
+bool obs_encoder_get_stats(const obs_encoder_t *encoder,
+		struct obs_encoder_stats *stats)
+{
+	struct obs_encoder *enc = (struct obs_encoder*)encoder;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_stats"))
+		return false;
+	if (!obs_ptr_valid(stats, "obs_encoder_get_stats"))
+		return false;
+
+	pthread_mutex_lock(&enc->queue_mutex);
+
+	*stats = enc->stats;
+	stats->queue_depth = (uint32_t)queue_depth(enc);
+	if (enc->dequeued_frames)
+		stats->avg_queue_time_ns =
+			enc->total_queue_time / enc->dequeued_frames;
+	if (stats->frames_encoded)
+		stats->avg_encode_time_ns =
+			enc->total_encode_time / stats->frames_encoded;
+
+	pthread_mutex_unlock(&enc->queue_mutex);
+	return true;
+}
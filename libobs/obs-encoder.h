@@ -35,6 +35,19 @@ enum obs_encoder_type {
 	OBS_ENCODER_VIDEO  /**< The encoder provides a video codec */
 };
 
+/**
+ * Times (in os_gettime_ns() time) at which a video frame reached each stage
+ * on its way to the outputs, used to trace latency.  Set by libobs, zero if
+ * unknown.
+ */
+struct obs_frame_timing {
+	uint64_t              origin_ts;    /**< Render tick of the frame */
+	uint64_t              cached_ts;    /**< Ready in the video cache */
+	uint64_t              received_ts;  /**< Received by the encoder */
+	uint64_t              encoded_ts;   /**< Returned by the encoder */
+	uint64_t              output_ts;    /**< Passed to the output */
+};
+
 /** Encoder output packet */
 struct encoder_packet {
 	uint8_t               *data;        /**< Packet data */
@@ -77,6 +90,16 @@ struct encoder_packet {
 
 	/** Encoder from which the track originated from */
 	obs_encoder_t         *encoder;
+
+	/**
+	 * Reference count of the packet data when it's shared between
+	 * outputs (see obs_encoder_packet_ref), or NULL if the data is owned
+	 * by a single packet.  Shared data must not be modified.
+	 */
+	volatile long         *refs;
+
+	/** Stage times of the video frame the packet was encoded from */
+	struct obs_frame_timing timing;
 };
 
 /** Encoder input frame */
@@ -92,6 +115,9 @@ struct encoder_frame {
 
 	/** Presentation timestamp */
 	int64_t               pts;
+
+	/** Stage times of the video frame so far (video only) */
+	struct obs_frame_timing timing;
 };
 
 /**
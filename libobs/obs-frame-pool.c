@@ -0,0 +1,263 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+#include "media-io/video-frame.h"
+#include "obs.h"
+#include "obs-internal.h"
+
+#define MIN_CLASS_SIZE  4096
+
+/* free frames that have not been reused for this long are freed */
+#define FRAME_EXPIRE_NS 10000000000ULL
+#define TRIM_INTERVAL_NS 1000000000ULL
+
+/* frames are allocated along with this header so that the pool knows the
+ * size of their buffer when they come back.  the frame is the first member,
+ * so a pooled frame can still be freed with obs_source_frame_destroy.
+ *
+ * frames that filters allocate themselves can end up being released to the
+ * pool too, so pool frames are tagged by pointing their release_param at
+ * themselves.  a frame copied from a pool frame points at the original, and
+ * one from obs_source_frame_create has no release_param at all. */
+struct pool_frame {
+	struct obs_source_frame frame;
+	uint8_t                 *data;
+	size_t                  size;
+	uint64_t                free_time;
+};
+
+/* rounds up to an eighth of the next power of two, so no more than an
+ * eighth of a buffer goes unused */
+static inline size_t get_class_size(size_t size)
+{
+	size_t step = MIN_CLASS_SIZE;
+
+	while (step * 8 < size)
+		step *= 2;
+
+	return (size + step - 1) & ~(step - 1);
+}
+
+static struct frame_pool_class *find_class(struct obs_frame_pool *pool,
+		size_t size, bool create)
+{
+	struct frame_pool_class new_class = {0};
+	size_t idx;
+
+	for (idx = 0; idx < pool->classes.num; idx++) {
+		struct frame_pool_class *class = pool->classes.array + idx;
+
+		if (class->size == size)
+			return class;
+		if (class->size > size)
+			break;
+	}
+
+	if (!create)
+		return NULL;
+
+	new_class.size = size;
+	da_insert(pool->classes, idx, &new_class);
+	return pool->classes.array + idx;
+}
+
+static inline void pool_frame_free(struct obs_frame_pool *pool,
+		struct pool_frame *pf)
+{
+	pool->bytes_resident -= pf->size;
+	bfree(pf->data);
+	bfree(pf);
+}
+
+/* frames in each class are stored in the order they were released, so the
+ * expired ones are at the front */
+static void trim_pool(struct obs_frame_pool *pool, uint64_t t)
+{
+	if (t - pool->last_trim_time < TRIM_INTERVAL_NS)
+		return;
+
+	pool->last_trim_time = t;
+
+	for (size_t i = 0; i < pool->classes.num; i++) {
+		struct frame_pool_class *class = pool->classes.array + i;
+		size_t expired = 0;
+
+		while (expired < class->frames.num) {
+			struct pool_frame *pf = (struct pool_frame*)
+				class->frames.array[expired];
+			if (t - pf->free_time < FRAME_EXPIRE_NS)
+				break;
+
+			pool->bytes_free -= pf->size;
+			pool_frame_free(pool, pf);
+			expired++;
+		}
+
+		if (expired)
+			da_erase_range(class->frames, 0, expired);
+	}
+}
+
+static inline bool is_pool_frame(const struct obs_source_frame *frame)
+{
+	return !frame->release && frame->release_param == frame;
+}
+
+bool obs_frame_pool_init(struct obs_frame_pool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init_value(&pool->mutex);
+
+	if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+		blog(LOG_ERROR, "obs_frame_pool_init: Failed to create mutex");
+		return false;
+	}
+
+	return true;
+}
+
+void obs_frame_pool_free(struct obs_frame_pool *pool)
+{
+	for (size_t i = 0; i < pool->classes.num; i++) {
+		struct frame_pool_class *class = pool->classes.array + i;
+
+		for (size_t j = 0; j < class->frames.num; j++)
+			pool_frame_free(pool,
+				(struct pool_frame*)class->frames.array[j]);
+		da_free(class->frames);
+	}
+
+	blog(LOG_INFO, "Async frame pool: %"PRIu64" hits, %"PRIu64" misses, "
+	               "%"PRIu64" MB peak resident",
+	               pool->hits, pool->misses,
+	               pool->peak_bytes_resident / (1024 * 1024));
+
+	da_free(pool->classes);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+struct obs_source_frame *obs_frame_pool_get(struct obs_frame_pool *pool,
+		enum video_format format, uint32_t width, uint32_t height)
+{
+	struct frame_pool_class *class;
+	struct pool_frame       *pf = NULL;
+	struct video_frame      vid_frame;
+	size_t                  size;
+
+	size = video_frame_get_size(format, width, height);
+	if (!size)
+		return NULL;
+
+	size = get_class_size(size);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	trim_pool(pool, os_gettime_ns());
+
+	/* the most recently released frame is the most likely to be cached */
+	class = find_class(pool, size, false);
+	if (class && class->frames.num) {
+		pf = (struct pool_frame*)
+			class->frames.array[class->frames.num - 1];
+		da_pop_back(class->frames);
+
+		pool->bytes_free -= size;
+		pool->hits++;
+	} else {
+		pool->bytes_resident += size;
+		if (pool->bytes_resident > pool->peak_bytes_resident)
+			pool->peak_bytes_resident = pool->bytes_resident;
+		pool->misses++;
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!pf) {
+		pf = bmalloc(sizeof(struct pool_frame));
+		pf->data = bmalloc(size);
+		pf->size = size;
+	}
+
+	memset(&pf->frame, 0, sizeof(pf->frame));
+	video_frame_init_data(&vid_frame, format, width, height, pf->data);
+
+	pf->frame.release_param = pf;
+	pf->frame.format = format;
+	pf->frame.width  = width;
+	pf->frame.height = height;
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		pf->frame.data[i]     = vid_frame.data[i];
+		pf->frame.linesize[i] = vid_frame.linesize[i];
+	}
+
+	return &pf->frame;
+}
+
+void obs_frame_pool_release(struct obs_frame_pool *pool,
+		struct obs_source_frame *frame)
+{
+	struct pool_frame *pf = (struct pool_frame*)frame;
+	struct frame_pool_class *class;
+
+	if (!frame)
+		return;
+
+	if (!is_pool_frame(frame)) {
+		obs_source_frame_destroy(frame);
+		return;
+	}
+
+	pf->free_time = os_gettime_ns();
+
+	pthread_mutex_lock(&pool->mutex);
+
+	class = find_class(pool, pf->size, true);
+	da_push_back(class->frames, &frame);
+	pool->bytes_free += pf->size;
+
+	trim_pool(pool, pf->free_time);
+
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/* called from the video thread, so the pool also shrinks while no async
+ * frames are coming and going */
+void obs_frame_pool_trim(struct obs_frame_pool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	trim_pool(pool, os_gettime_ns());
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void obs_get_frame_pool_stats(struct obs_frame_pool_stats *stats)
+{
+	struct obs_frame_pool *pool;
+
+	if (!obs || !stats)
+		return;
+
+	pool = &obs->data.frame_pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	stats->hits           = pool->hits;
+	stats->misses         = pool->misses;
+	stats->bytes_resident = pool->bytes_resident;
+	stats->bytes_free     = pool->bytes_free;
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,160 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "util/c99defs.h"
+#include "util/darray.h"
+#include "util/circlebuf.h"
+#include "obs.h"
+
+/*
+ * Output packet interleaving
+ *
+ *   Packets waiting to be interleaved are queued per track (video, then each
+ * audio track) and merged in dts order, with ties sent in arrival order.
+ * The queues are not locked; outputs use them under interleaved_mutex.
+ */
+
+#define INTERLEAVE_QUEUES (MAX_AUDIO_MIXES + 1)
+
+struct interleaved_packet {
+	struct encoder_packet packet;
+	uint64_t seq;
+};
+
+struct interleave_queues {
+	struct circlebuf queues[INTERLEAVE_QUEUES];
+	uint64_t         seq;
+};
+
+/* queues only ever hold whole packets (their capacity is always a multiple
+ * of the packet size), so a packet never wraps around the end of the buffer */
+static inline struct interleaved_packet *interleave_queue_packet(
+		struct circlebuf *queue, size_t idx)
+{
+	size_t pos = queue->start_pos + idx * sizeof(struct interleaved_packet);
+	if (pos >= queue->capacity)
+		pos -= queue->capacity;
+
+	return (struct interleaved_packet*)((uint8_t*)queue->data + pos);
+}
+
+static inline size_t interleave_queue_count(const struct circlebuf *queue)
+{
+	return queue->size / sizeof(struct interleaved_packet);
+}
+
+static inline struct circlebuf *interleave_track_queue(
+		struct interleave_queues *iq, enum obs_encoder_type type,
+		size_t track_idx)
+{
+	return &iq->queues[type == OBS_ENCODER_VIDEO ? 0 : track_idx + 1];
+}
+
+static inline bool interleaved_packet_before(
+		const struct interleaved_packet *a,
+		const struct interleaved_packet *b)
+{
+	if (a->packet.dts_usec == b->packet.dts_usec)
+		return a->seq < b->seq;
+	return a->packet.dts_usec < b->packet.dts_usec;
+}
+
+/* finds the first packet in interleaved order, or if 'after' is specified
+ * (which must be at the front of its queue), the packet that follows it */
+static inline struct interleaved_packet *interleave_next(
+		struct interleave_queues *iq,
+		const struct interleaved_packet *after, size_t *queue_idx)
+{
+	struct interleaved_packet *first = NULL;
+
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct circlebuf *queue = &iq->queues[i];
+		size_t count = interleave_queue_count(queue);
+		struct interleaved_packet *head;
+
+		if (!count)
+			continue;
+
+		head = interleave_queue_packet(queue, 0);
+		if (head == after) {
+			if (count < 2)
+				continue;
+			head = interleave_queue_packet(queue, 1);
+		}
+
+		if (!first || interleaved_packet_before(head, first)) {
+			first = head;
+			if (queue_idx)
+				*queue_idx = i;
+		}
+	}
+
+	return first;
+}
+
+static inline void interleave_pop(struct interleave_queues *iq,
+		size_t queue_idx, struct encoder_packet *packet)
+{
+	struct interleaved_packet ip;
+
+	circlebuf_pop_front(&iq->queues[queue_idx], &ip, sizeof(ip));
+	*packet = ip.packet;
+}
+
+static inline void interleave_insert(struct interleave_queues *iq,
+		const struct encoder_packet *packet)
+{
+	struct circlebuf *queue = interleave_track_queue(iq, packet->type,
+			packet->track_idx);
+	struct interleaved_packet ip;
+	DARRAY(struct interleaved_packet) later;
+
+	ip.packet = *packet;
+	ip.seq    = iq->seq++;
+
+	/* packets of a track normally arrive in dts order, so this is just a
+	 * push to the back of the queue unless the encoder misbehaves */
+	da_init(later);
+
+	while (queue->size) {
+		struct interleaved_packet *back = interleave_queue_packet(queue,
+				interleave_queue_count(queue) - 1);
+
+		if (back->packet.dts_usec <= packet->dts_usec)
+			break;
+
+		da_push_back(later, back);
+		circlebuf_pop_back(queue, NULL, sizeof(ip));
+	}
+
+	circlebuf_push_back(queue, &ip, sizeof(ip));
+
+	for (size_t i = later.num; i > 0; i--)
+		circlebuf_push_back(queue, later.array + (i - 1), sizeof(ip));
+
+	da_free(later);
+}
+
+/* frees the queues, the packets in them must have been popped already */
+static inline void interleave_free(struct interleave_queues *iq)
+{
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++)
+		circlebuf_free(&iq->queues[i]);
+	iq->seq = 0;
+}
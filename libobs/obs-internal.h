@@ -31,11 +31,16 @@
 
 #include "media-io/audio-resampler.h"
 #include "media-io/video-io.h"
+#include "media-io/video-frame.h"
 #include "media-io/audio-io.h"
 
 #include "obs.h"
+#include "obs-interleave.h"
 
 #define NUM_TEXTURES 2
+#define DEFAULT_STAGE_SURFACES 2
+#define MAX_STAGE_SURFACES 8
+#define MAX_DOWNLOADS_PER_FRAME 2
 #define MICROSECOND_DEN 1000000
 
 static inline int64_t packet_dts_usec(struct encoder_packet *packet)
@@ -188,6 +193,43 @@ extern bool obs_view_init(struct obs_view *view);
 extern void obs_view_free(struct obs_view *view);
 
 
+/* ------------------------------------------------------------------------- */
+/* async frame pool */
+
+/* buffers of similar sizes share a size class, so that sources that change
+ * resolution or format can still reuse each other's frames */
+struct frame_pool_class {
+	size_t                          size;
+	DARRAY(struct obs_source_frame*)frames;
+};
+
+struct obs_frame_pool {
+	pthread_mutex_t                 mutex;
+	DARRAY(struct frame_pool_class) classes;
+	uint64_t                        last_trim_time;
+
+	uint64_t                        hits;
+	uint64_t                        misses;
+	uint64_t                        bytes_resident;
+	uint64_t                        bytes_free;
+	uint64_t                        peak_bytes_resident;
+};
+
+extern bool obs_frame_pool_init(struct obs_frame_pool *pool);
+extern void obs_frame_pool_free(struct obs_frame_pool *pool);
+
+/* returns a frame with refs set to 0 and all fields but the planes and
+ * release_param (which marks it as a pool frame) zeroed */
+extern struct obs_source_frame *obs_frame_pool_get(
+		struct obs_frame_pool *pool, enum video_format format,
+		uint32_t width, uint32_t height);
+
+/* frames that did not come from the pool are destroyed instead */
+extern void obs_frame_pool_release(struct obs_frame_pool *pool,
+		struct obs_source_frame *frame);
+extern void obs_frame_pool_trim(struct obs_frame_pool *pool);
+
+
 /* ------------------------------------------------------------------------- */
 /* displays */
 
@@ -197,6 +239,11 @@ struct obs_display {
 	uint32_t                        cx, cy;
 	uint32_t                        background_color;
 	gs_swapchain_t                  *swap;
+
+	/* video time at which the display is drawn next, if it is limited to
+	 * a frame rate below that of the video */
+	uint64_t                        frame_interval_ns;
+	uint64_t                        next_frame_time;
 	pthread_mutex_t                 draw_callbacks_mutex;
 	DARRAY(struct draw_callback)    draw_callbacks;
 
@@ -217,15 +264,88 @@ struct obs_vframe_info {
 	int count;
 };
 
+#define MAX_CONVERT_THREADS 16
+#define MAX_UPLOAD_THREADS  16
+
+/* an async source frame being copied into its mapped texture */
+struct async_upload {
+	struct obs_source               *source;
+	struct obs_source_frame         *frame;
+	uint8_t                         *ptr;
+	uint32_t                        linesize;
+	uint32_t                        height;
+};
+
+struct async_upload_slice {
+	size_t                          upload_idx;
+	uint32_t                        start_y;
+	uint32_t                        end_y;
+};
+
+struct obs_convert_thread {
+	pthread_t                       thread;
+	os_sem_t                        *start_sem;
+	uint32_t                        start_y;
+	uint32_t                        end_y;
+	bool                            first;
+	bool                            initialized;
+};
+
+/* layout of a frame that the GPU converts to a planar format, with the planes
+ * packed one after the other in an RGBA texture */
+struct obs_conversion_layout {
+	const char                      *tech;
+	uint32_t                        height;
+	uint32_t                        plane_offsets[3];
+	uint32_t                        plane_sizes[3];
+	uint32_t                        plane_linewidth[3];
+};
+
+extern bool obs_calc_conversion_layout(struct obs_conversion_layout *layout,
+		enum video_format format, uint32_t width, uint32_t height);
+extern void obs_make_color_matrix(float matrix[16], enum video_format format,
+		enum video_colorspace colorspace, enum video_range_type range);
+
+/* an additional output resolution/frame rate, scaled on the GPU from the main
+ * texture and output through its own video_t */
+struct obs_canvas {
+	char                            *name;
+	struct obs_canvas_info          info;
+	video_t                         *video;
+	uint64_t                        frame_interval;
+	uint64_t                        next_frame_time;
+
+	bool                            gpu_conversion;
+	struct obs_conversion_layout    conversion;
+	float                           color_matrix[16];
+
+	gs_texture_t                    *output_texture;
+	gs_texture_t                    *convert_texture;
+	gs_stagesurf_t                  *copy_surfaces[DEFAULT_STAGE_SURFACES];
+	struct obs_vframe_info          copy_frame_info[DEFAULT_STAGE_SURFACES];
+	size_t                          copy_head;
+	size_t                          copies_pending;
+	uint32_t                        copies_skipped;
+	int                             uncounted_frames;
+
+	struct obs_canvas               *next;
+	struct obs_canvas               **prev_next;
+};
+
 struct obs_core_video {
 	graphics_t                      *graphics;
-	gs_stagesurf_t                  *copy_surfaces[NUM_TEXTURES];
+	gs_stagesurf_t                  *copy_surfaces[MAX_STAGE_SURFACES];
+	struct obs_vframe_info          copy_frame_info[MAX_STAGE_SURFACES];
+	size_t                          num_copy_surfaces;
+	size_t                          copy_head;
+	size_t                          copies_pending;
+	uint32_t                        copies_skipped;
+	int                             uncounted_frames;
 	gs_texture_t                    *render_textures[NUM_TEXTURES];
 	gs_texture_t                    *output_textures[NUM_TEXTURES];
 	gs_texture_t                    *convert_textures[NUM_TEXTURES];
 	bool                            textures_rendered[NUM_TEXTURES];
 	bool                            textures_output[NUM_TEXTURES];
-	bool                            textures_copied[NUM_TEXTURES];
 	bool                            textures_converted[NUM_TEXTURES];
 	struct circlebuf                vframe_info_buffer;
 	gs_effect_t                     *default_effect;
@@ -236,7 +356,8 @@ struct obs_core_video {
 	gs_effect_t                     *bicubic_effect;
 	gs_effect_t                     *lanczos_effect;
 	gs_effect_t                     *bilinear_lowres_effect;
-	gs_stagesurf_t                  *mapped_surface;
+	gs_stagesurf_t                  *mapped_surfaces[MAX_DOWNLOADS_PER_FRAME];
+	size_t                          num_mapped_surfaces;
 	int                             cur_texture;
 
 	uint64_t                        video_time;
@@ -245,11 +366,25 @@ struct obs_core_video {
 	bool                            thread_initialized;
 
 	bool                            gpu_conversion;
-	const char                      *conversion_tech;
-	uint32_t                        conversion_height;
-	uint32_t                        plane_offsets[3];
-	uint32_t                        plane_sizes[3];
-	uint32_t                        plane_linewidth[3];
+	struct obs_conversion_layout    conversion;
+
+	struct obs_convert_thread       convert_threads[MAX_CONVERT_THREADS];
+	size_t                          num_convert_threads;
+	os_sem_t                        *convert_done_sem;
+	volatile long                   convert_slices_left;
+	volatile bool                   convert_stop;
+	bool                            convert_pending;
+	struct video_data               convert_input;
+	struct video_frame              convert_output;
+
+	pthread_t                       upload_threads[MAX_UPLOAD_THREADS];
+	size_t                          num_upload_threads;
+	os_sem_t                        *upload_start_sem;
+	os_sem_t                        *upload_done_sem;
+	volatile bool                   upload_stop;
+	volatile long                   upload_next_slice;
+	DARRAY(struct async_upload)     async_uploads;
+	DARRAY(struct async_upload_slice) upload_slices;
 
 	uint32_t                        output_width;
 	uint32_t                        output_height;
@@ -275,6 +410,7 @@ struct obs_core_data {
 	struct obs_output               *first_output;
 	struct obs_encoder              *first_encoder;
 	struct obs_service              *first_service;
+	struct obs_canvas               *first_canvas;
 
 	pthread_mutex_t                 sources_mutex;
 	pthread_mutex_t                 displays_mutex;
@@ -282,10 +418,13 @@ struct obs_core_data {
 	pthread_mutex_t                 encoders_mutex;
 	pthread_mutex_t                 services_mutex;
 	pthread_mutex_t                 audio_sources_mutex;
+	pthread_mutex_t                 canvases_mutex;
 
 	struct obs_view                 main_view;
+	struct obs_frame_pool           frame_pool;
 
 	long long                       unnamed_index;
+	volatile long                   last_change_stamp;
 
 	volatile bool                   valid;
 };
@@ -357,6 +496,8 @@ struct obs_core {
 extern struct obs_core *obs;
 
 extern void *obs_video_thread(void *param);
+extern void *obs_convert_thread(void *param);
+extern void *obs_upload_thread(void *param);
 
 
 /* ------------------------------------------------------------------------- */
@@ -447,6 +588,28 @@ struct async_frame {
 	bool used;
 };
 
+#define MAX_ASYNC_FRAMES 30
+
+/* frames waiting to be shown, oldest first */
+struct async_frame_ring {
+	struct obs_source_frame         *frames[MAX_ASYNC_FRAMES];
+	size_t                          head;
+	size_t                          num;
+};
+
+struct async_frame_stats {
+	uint64_t                        received;
+	uint64_t                        shown;
+	uint64_t                        duplicated;
+	uint64_t                        dropped_late;
+
+	/* smoothed interval between frame timestamps, and the smoothed
+	 * deviation from it */
+	uint64_t                        last_received_ts;
+	uint64_t                        avg_interval;
+	uint64_t                        jitter;
+};
+
 struct obs_weak_source {
 	struct obs_weak_ref ref;
 	struct obs_source *source;
@@ -524,7 +687,9 @@ struct obs_source {
 	bool                            async_flip;
 	bool                            async_active;
 	DARRAY(struct async_frame)      async_cache;
-	DARRAY(struct obs_source_frame*)async_frames;
+	struct async_frame_ring         async_frames;
+	struct async_frame_stats        async_stats;
+	uint64_t                        async_shown_ts;
 	pthread_mutex_t                 async_mutex;
 	uint32_t                        async_width;
 	uint32_t                        async_height;
@@ -542,6 +707,16 @@ struct obs_source {
 	enum obs_allow_direct_render    allow_direct;
 	bool                            rendering_filter;
 
+	/* render cache (see OBS_SOURCE_CACHEABLE).  the change stamp is taken
+	 * from obs_core_data::last_change_stamp each time the source changes */
+	volatile long                   change_stamp;
+	long                            last_render_stamp;
+	long                            cached_stamp;
+	uint32_t                        cached_cx;
+	uint32_t                        cached_cy;
+	bool                            cache_valid;
+	gs_texrender_t                  *render_cache;
+
 	/* sources specific hotkeys */
 	obs_hotkey_pair_id              mute_unmute_key;
 	obs_hotkey_id                   push_to_mute_key;
@@ -577,6 +752,12 @@ extern void obs_source_video_tick(obs_source_t *source, float seconds);
 extern float obs_source_get_target_volume(obs_source_t *source,
 		obs_source_t *target);
 
+extern bool obs_source_begin_async_upload(obs_source_t *source,
+		struct async_upload *upload);
+extern void obs_source_upload_async_slice(struct async_upload *upload,
+		uint32_t start_y, uint32_t end_y);
+extern void obs_source_end_async_upload(struct async_upload *upload);
+
 
 /* ------------------------------------------------------------------------- */
 /* outputs  */
@@ -600,6 +781,17 @@ struct obs_weak_output {
 	struct obs_output *output;
 };
 
+/* latency in microseconds, in 1 usec buckets up to 8 usec and then in
+ * buckets an eighth of a power of two wide, so percentiles are within about
+ * 6% of the real value */
+#define LATENCY_BUCKETS 240
+
+struct latency_histogram {
+	uint32_t                        buckets[LATENCY_BUCKETS];
+	uint64_t                        count;
+	uint64_t                        max_ns;
+};
+
 struct obs_output {
 	struct obs_context_data         context;
 	struct obs_output_info          info;
@@ -615,7 +807,7 @@ struct obs_output {
 	int64_t                         highest_audio_ts;
 	int64_t                         highest_video_ts;
 	pthread_mutex_t                 interleaved_mutex;
-	DARRAY(struct encoder_packet)   interleaved_packets;
+	struct interleave_queues        interleaved;
 
 	int                             reconnect_retry_sec;
 	int                             reconnect_retry_max;
@@ -660,6 +852,10 @@ struct obs_output {
 	volatile long                   delay_restart_refs;
 	bool                            delay_active;
 	bool                            delay_capturing;
+
+	pthread_mutex_t                 latency_mutex;
+	struct latency_histogram        latency[OBS_LATENCY_STAGE_COUNT];
+	bool                            latency_sent_reported;
 };
 
 static inline void do_output_signal(struct obs_output *output,
@@ -672,6 +868,11 @@ static inline void do_output_signal(struct obs_output *output,
 }
 
 extern void process_delay(void *data, struct encoder_packet *packet);
+
+/* adds a reference to a packet given to an encoder callback, turning the
+ * encoder's packet into a shared one if it isn't already */
+extern void share_encoder_packet(struct encoder_packet *dst,
+		struct encoder_packet *src);
 extern void obs_output_cleanup_delay(obs_output_t *output);
 extern bool obs_output_delay_start(obs_output_t *output);
 extern void obs_output_delay_stop(obs_output_t *output);
@@ -700,6 +901,30 @@ struct encoder_callback {
 	void *param;
 };
 
+#define DEFAULT_ENCODER_QUEUE_SIZE 8
+
+/* raw frame copied for an encoder thread */
+struct encoder_queued_frame {
+	uint8_t                         *data[MAX_AV_PLANES];
+	uint32_t                        linesize[MAX_AV_PLANES];
+	size_t                          capacity[MAX_AV_PLANES];
+
+	uint32_t                        frames;
+	uint64_t                        timestamp;
+	int64_t                         pts;
+	uint64_t                        queued_time;
+	struct obs_frame_timing         timing;
+};
+
+/* timing of the video frames given to the encoder, looked up by pts when
+ * their packets come out (encoders can buffer and reorder frames) */
+#define ENCODER_TIMING_SLOTS 128
+
+struct encoder_frame_timing {
+	int64_t                         pts;
+	struct obs_frame_timing         timing;
+};
+
 struct obs_encoder {
 	struct obs_context_data         context;
 	struct obs_encoder_info         info;
@@ -750,6 +975,32 @@ struct obs_encoder {
 	DARRAY(struct encoder_callback) callbacks;
 
 	const char                      *profile_encoder_encode_name;
+
+	/* optional encoder thread, see obs_encoder_set_threaded */
+	bool                            threaded;
+	uint32_t                        max_queued;
+	enum obs_encoder_drop_policy    drop_policy;
+	struct video_scale_info         video_conversion;
+
+	pthread_t                       encode_thread;
+	bool                            encode_thread_active;
+	volatile bool                   encode_thread_stop;
+	volatile bool                   encode_thread_abort;
+	os_sem_t                        *queue_sem;
+	os_event_t                      *queue_space;
+
+	/* protects the queue, the frame pool and the statistics */
+	pthread_mutex_t                 queue_mutex;
+	struct circlebuf                queue;
+	DARRAY(struct encoder_queued_frame*) free_frames;
+
+	struct obs_encoder_stats        stats;
+	uint64_t                        dequeued_frames;
+	uint64_t                        total_queue_time;
+	uint64_t                        total_encode_time;
+
+	/* only used from the thread that encodes */
+	struct encoder_frame_timing     frame_timing[ENCODER_TIMING_SLOTS];
 };
 
 extern struct obs_encoder_info *find_encoder(const char *id);
@@ -71,11 +71,14 @@ obs_output_t *obs_output_create(const char *id, const char *name,
 	output = bzalloc(sizeof(struct obs_output));
 	pthread_mutex_init_value(&output->interleaved_mutex);
 	pthread_mutex_init_value(&output->delay_mutex);
+	pthread_mutex_init_value(&output->latency_mutex);
 
 	if (pthread_mutex_init(&output->interleaved_mutex, NULL) != 0)
 		goto fail;
 	if (pthread_mutex_init(&output->delay_mutex, NULL) != 0)
 		goto fail;
+	if (pthread_mutex_init(&output->latency_mutex, NULL) != 0)
+		goto fail;
 	if (!init_output_handlers(output, name, settings, hotkey_data))
 		goto fail;
 
@@ -124,9 +127,15 @@ fail:
 
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_free_encoder_packet(output->interleaved_packets.array+i);
-	da_free(output->interleaved_packets);
+	struct encoder_packet packet;
+	size_t queue_idx;
+
+	while (interleave_next(&output->interleaved, NULL, &queue_idx)) {
+		interleave_pop(&output->interleaved, queue_idx, &packet);
+		obs_encoder_packet_release(&packet);
+	}
+
+	interleave_free(&output->interleaved);
 }
 
 void obs_output_destroy(obs_output_t *output)
@@ -161,6 +170,7 @@ void obs_output_destroy(obs_output_t *output)
 
 		pthread_mutex_destroy(&output->interleaved_mutex);
 		pthread_mutex_destroy(&output->delay_mutex);
+		pthread_mutex_destroy(&output->latency_mutex);
 		os_event_destroy(output->reconnect_stop_event);
 		obs_context_data_free(&output->context);
 		circlebuf_free(&output->delay_data);
@@ -182,6 +192,11 @@ bool obs_output_actual_start(obs_output_t *output)
 
 	output->stopped = false;
 
+	pthread_mutex_lock(&output->latency_mutex);
+	memset(output->latency, 0, sizeof(output->latency));
+	output->latency_sent_reported = false;
+	pthread_mutex_unlock(&output->latency_mutex);
+
 	if (output->context.data)
 		success = output->info.start(output->context.data);
 
@@ -220,6 +235,34 @@ bool obs_output_start(obs_output_t *output)
 	}
 }
 
+static const char *latency_stage_names[OBS_LATENCY_STAGE_COUNT] = {
+	"render",
+	"video queue",
+	"encode",
+	"interleave",
+	"send",
+	"total"
+};
+
+static void log_latency(struct obs_output *output)
+{
+	for (size_t i = 0; i < OBS_LATENCY_STAGE_COUNT; i++) {
+		struct obs_latency_stats stats;
+
+		if (!obs_output_get_latency_stats(output,
+					(enum obs_latency_stage)i, &stats) ||
+		    !stats.count)
+			continue;
+
+		blog(LOG_INFO, "Output '%s': %s latency: p50 %.2f ms, "
+				"p99 %.2f ms, max %.2f ms",
+				output->context.name, latency_stage_names[i],
+				(double)stats.p50_ns / 1000000.0,
+				(double)stats.p99_ns / 1000000.0,
+				(double)stats.max_ns / 1000000.0);
+	}
+}
+
 static void log_frame_info(struct obs_output *output)
 {
 	uint32_t video_frames  = video_output_get_total_frames(output->video);
@@ -251,6 +294,8 @@ static void log_frame_info(struct obs_output *output)
 				output->context.name,
 				dropped, percentage_dropped);
 	}
+
+	log_latency(output);
 }
 
 void obs_output_actual_stop(obs_output_t *output, bool force)
@@ -846,23 +891,183 @@ static inline bool has_higher_opposing_ts(struct obs_output *output,
 		return output->highest_video_ts > packet->dts_usec;
 }
 
+/* ------------------------------------------------------------------------- */
+/* latency */
+
+static size_t latency_bucket(uint64_t ns)
+{
+	uint64_t usec = ns / 1000;
+	size_t   bucket;
+	int      shift = 0;
+
+	if (usec < 8)
+		return (size_t)usec;
+
+	while ((usec >> shift) >= 16)
+		shift++;
+
+	/* 8 buckets per power of two from 8 usec up */
+	bucket = 8 + (size_t)shift * 8 + (size_t)((usec >> shift) & 7);
+	return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/* middle of the range of a bucket, in nanoseconds */
+static uint64_t latency_bucket_value(size_t bucket)
+{
+	uint64_t usec;
+	int      shift;
+
+	if (bucket < 8)
+		return (uint64_t)bucket * 1000 + 500;
+
+	shift = (int)((bucket - 8) / 8);
+	usec  = (8 + (uint64_t)((bucket - 8) % 8)) << shift;
+	return (usec * 1000) + ((1000ULL << shift) / 2);
+}
+
+/* latency_mutex must be locked */
+static inline void add_latency(struct obs_output *output,
+		enum obs_latency_stage stage, uint64_t start, uint64_t end)
+{
+	struct latency_histogram *hist = &output->latency[stage];
+	uint64_t ns;
+
+	if (!start || !end || end < start)
+		return;
+
+	ns = end - start;
+	hist->buckets[latency_bucket(ns)]++;
+	hist->count++;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+}
+
+static void record_latency(struct obs_output *output,
+		struct encoder_packet *packet)
+{
+	struct obs_frame_timing *timing = &packet->timing;
+
+	if (packet->type != OBS_ENCODER_VIDEO || !timing->origin_ts)
+		return;
+
+	timing->output_ts = os_gettime_ns();
+
+	pthread_mutex_lock(&output->latency_mutex);
+
+	add_latency(output, OBS_LATENCY_RENDER,
+			timing->origin_ts, timing->cached_ts);
+	add_latency(output, OBS_LATENCY_VIDEO_QUEUE,
+			timing->cached_ts, timing->received_ts);
+	add_latency(output, OBS_LATENCY_ENCODE,
+			timing->received_ts, timing->encoded_ts);
+	add_latency(output, OBS_LATENCY_INTERLEAVE,
+			timing->encoded_ts, timing->output_ts);
+
+	/* outputs that report their sends measure the total up to there */
+	if (!output->latency_sent_reported)
+		add_latency(output, OBS_LATENCY_TOTAL,
+				timing->origin_ts, timing->output_ts);
+
+	pthread_mutex_unlock(&output->latency_mutex);
+}
+
+void obs_output_frame_sent(obs_output_t *output,
+		const struct obs_frame_timing *timing)
+{
+	uint64_t now;
+
+	if (!obs_output_valid(output, "obs_output_frame_sent"))
+		return;
+	if (!timing || !timing->origin_ts)
+		return;
+
+	now = os_gettime_ns();
+
+	pthread_mutex_lock(&output->latency_mutex);
+
+	/* frames that were already counted up to the output are dropped from
+	 * the total, rather than mixing the two kinds of total */
+	if (!output->latency_sent_reported) {
+		memset(&output->latency[OBS_LATENCY_TOTAL], 0,
+				sizeof(struct latency_histogram));
+		output->latency_sent_reported = true;
+	}
+
+	add_latency(output, OBS_LATENCY_SEND, timing->output_ts, now);
+	add_latency(output, OBS_LATENCY_TOTAL, timing->origin_ts, now);
+
+	pthread_mutex_unlock(&output->latency_mutex);
+}
+
+static uint64_t latency_percentile(const struct latency_histogram *hist,
+		uint64_t percent)
+{
+	uint64_t target = (hist->count * percent + 99) / 100;
+	uint64_t seen = 0;
+
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target && seen) {
+			uint64_t value = latency_bucket_value(i);
+			return value < hist->max_ns ? value : hist->max_ns;
+		}
+	}
+
+	return hist->max_ns;
+}
+
+bool obs_output_get_latency_stats(const obs_output_t *output,
+		enum obs_latency_stage stage, struct obs_latency_stats *stats)
+{
+	const struct latency_histogram *hist;
+
+	if (!obs_output_valid(output, "obs_output_get_latency_stats"))
+		return false;
+	if (!obs_ptr_valid(stats, "obs_output_get_latency_stats"))
+		return false;
+	if ((size_t)stage >= OBS_LATENCY_STAGE_COUNT)
+		return false;
+
+	hist = &output->latency[stage];
+
+	pthread_mutex_lock((pthread_mutex_t*)&output->latency_mutex);
+	stats->count  = hist->count;
+	stats->p50_ns = latency_percentile(hist, 50);
+	stats->p99_ns = latency_percentile(hist, 99);
+	stats->max_ns = hist->max_ns;
+	pthread_mutex_unlock((pthread_mutex_t*)&output->latency_mutex);
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct interleaved_packet *first;
+	struct encoder_packet out;
+	size_t queue_idx;
+
+	first = interleave_next(&output->interleaved, NULL, &queue_idx);
+	if (!first)
+		return;
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timstamp in the interleave buffer.
 	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
+	if (!has_higher_opposing_ts(output, &first->packet))
 		return;
 
+	interleave_pop(&output->interleaved, queue_idx, &out);
+
 	if (out.type == OBS_ENCODER_VIDEO)
 		output->total_frames++;
 
-	da_erase(output->interleaved_packets, 0);
+	record_latency(output, &out);
+
 	if (!output->stopped)
 		output->info.encoded_packet(output->context.data, &out);
-	obs_free_encoder_packet(&out);
+	obs_encoder_packet_release(&out);
 }
 
 static inline void set_higher_ts(struct obs_output *output,
@@ -877,25 +1082,23 @@ static inline void set_higher_ts(struct obs_output *output,
 	}
 }
 
-static bool can_prune_interleaved_packet(struct obs_output *output, size_t idx)
+static bool can_prune_interleaved_packet(struct obs_output *output,
+		struct interleaved_packet *packet)
 {
-	struct encoder_packet *packet;
-	struct encoder_packet *next;
-
-	if (idx >= (output->interleaved_packets.num - 1))
-		return false;
-
-	packet = &output->interleaved_packets.array[idx];
+	struct interleaved_packet *next;
 
 	/* audio packets will almost always come before video packets,
 	 * so it should only ever be necessary to prune audio packets */
-	if (packet->type != OBS_ENCODER_AUDIO)
+	if (packet->packet.type != OBS_ENCODER_AUDIO)
 		return false;
 
-	next = &output->interleaved_packets.array[idx + 1];
+	/* never prune the last packet */
+	next = interleave_next(&output->interleaved, packet, NULL);
+	if (!next)
+		return false;
 
-	if (next->type == OBS_ENCODER_VIDEO &&
-	    next->dts_usec == packet->dts_usec)
+	if (next->packet.type == OBS_ENCODER_VIDEO &&
+	    next->packet.dts_usec == packet->packet.dts_usec)
 		return false;
 
 	return true;
@@ -903,40 +1106,28 @@ static bool can_prune_interleaved_packet(struct obs_output *output, size_t idx)
 
 static void prune_interleaved_packets(struct obs_output *output)
 {
-	size_t start_idx = 0;
+	struct interleaved_packet *packet;
+	size_t queue_idx;
 
-	while (can_prune_interleaved_packet(output, start_idx))
-		start_idx++;
+	while ((packet = interleave_next(&output->interleaved, NULL,
+					&queue_idx))) {
+		struct encoder_packet pruned;
 
-	if (start_idx) {
-		for (size_t i = 0; i < start_idx; i++) {
-			struct encoder_packet *packet =
-				&output->interleaved_packets.array[i];
-			obs_free_encoder_packet(packet);
-		}
+		if (!can_prune_interleaved_packet(output, packet))
+			break;
 
-		da_erase_range(output->interleaved_packets, 0, start_idx);
+		interleave_pop(&output->interleaved, queue_idx, &pruned);
+		obs_encoder_packet_release(&pruned);
 	}
 }
 
 static struct encoder_packet *find_first_packet_type(struct obs_output *output,
 		enum obs_encoder_type type, size_t audio_idx)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
+	struct circlebuf *queue = interleave_track_queue(&output->interleaved,
+			type, audio_idx);
 
-			return packet;
-		}
-	}
-
-	return NULL;
+	return queue->size ? &interleave_queue_packet(queue, 0)->packet : NULL;
 }
 
 static bool initialize_interleaved_packets(struct obs_output *output)
@@ -970,45 +1161,23 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 	output->highest_audio_ts -= audio[0]->dts_usec;
 	output->highest_video_ts -= video->dts_usec;
 
-	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
+	/* apply new offsets to all existing packet DTS/PTS values.  each
+	 * track is offset as a whole, so the queues stay in order and the
+	 * interleaved order is simply recomputed from the new values */
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct circlebuf *queue = &output->interleaved.queues[i];
+		size_t count = interleave_queue_count(queue);
+
+		for (size_t j = 0; j < count; j++) {
+			struct interleaved_packet *ip =
+				interleave_queue_packet(queue, j);
+			apply_interleaved_packet_offset(output, &ip->packet);
+		}
 	}
 
 	return true;
 }
 
-static inline void insert_interleaved_packet(struct obs_output *output,
-		struct encoder_packet *out)
-{
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
-
-		if (out->dts_usec < cur_packet->dts_usec)
-			break;
-	}
-
-	da_insert(output->interleaved_packets, idx, out);
-}
-
-static void resort_interleaved_packets(struct obs_output *output)
-{
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-			sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
-
-	da_free(old_array);
-}
-
 static void interleave_packets(void *data, struct encoder_packet *packet)
 {
 	struct obs_output     *output = data;
@@ -1025,14 +1194,14 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->active_delay_ns)
 		out = *packet;
 	else
-		obs_duplicate_encoder_packet(&out, packet);
+		share_encoder_packet(&out, packet);
 
 	if (was_started)
 		apply_interleaved_packet_offset(output, &out);
 	else
 		check_received(output, packet);
 
-	insert_interleaved_packet(output, &out);
+	interleave_insert(&output->interleaved, &out);
 	set_higher_ts(output, &out);
 
 	/* when both video and audio have been received, we're ready
@@ -1040,10 +1209,8 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->received_audio && output->received_video) {
 		if (!was_started) {
 			prune_interleaved_packets(output);
-			if (initialize_interleaved_packets(output)) {
-				resort_interleaved_packets(output);
+			if (initialize_interleaved_packets(output))
 				send_interleaved(output);
-			}
 		} else {
 			send_interleaved(output);
 		}
@@ -1059,13 +1226,15 @@ static void default_encoded_callback(void *param, struct encoder_packet *packet)
 	if (packet->type == OBS_ENCODER_AUDIO)
 		packet->track_idx = get_track_index(output, packet);
 
+	record_latency(output, packet);
+
 	if (!output->stopped)
 		output->info.encoded_packet(output->context.data, packet);
-	if (output->active_delay_ns)
-		obs_free_encoder_packet(packet);
-
 	if (packet->type == OBS_ENCODER_VIDEO)
 		output->total_frames++;
+
+	if (output->active_delay_ns)
+		obs_encoder_packet_release(packet);
 }
 
 static void default_raw_video_callback(void *param, struct video_data *frame)
@@ -1106,7 +1275,7 @@ static void reset_packet_data(obs_output_t *output)
 	output->video_offset     = 0;
 
 	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
-		output->audio_offsets[0] = 0;
+		output->audio_offsets[i] = 0;
 
 	free_packets(output);
 }
@@ -0,0 +1,90 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "obs-internal.h"
+
+/*
+ * Source render cache stamps
+ *
+ *   The change stamp of a source tree is the latest of the stamps of the
+ * source, its filters and the sources it draws.  A tree is only cacheable
+ * if every source in it that draws video is cacheable; sources without
+ * video (such as audio captures in a scene) are not drawn and are skipped.
+ */
+
+struct cache_stamp {
+	long stamp;
+	bool cacheable;
+};
+
+static inline void cache_stamp_get(obs_source_t *source,
+		struct cache_stamp *cs);
+
+static void cache_stamp_get_child(obs_source_t *parent, obs_source_t *child,
+		void *param)
+{
+	struct cache_stamp *cs = param;
+
+	if (!cs->cacheable)
+		return;
+	if ((child->info.output_flags & OBS_SOURCE_VIDEO) == 0)
+		return;
+
+	cache_stamp_get(child, cs);
+
+	UNUSED_PARAMETER(parent);
+}
+
+static inline void cache_stamp_add(obs_source_t *source,
+		struct cache_stamp *cs)
+{
+	long stamp = os_atomic_load_long(&source->change_stamp);
+	if (stamp > cs->stamp)
+		cs->stamp = stamp;
+}
+
+static inline void cache_stamp_get(obs_source_t *source,
+		struct cache_stamp *cs)
+{
+	uint32_t flags = source->info.output_flags;
+
+	cache_stamp_add(source, cs);
+
+	if ((flags & OBS_SOURCE_CACHEABLE) == 0 ||
+	    (flags & OBS_SOURCE_ASYNC) != 0) {
+		cs->cacheable = false;
+		return;
+	}
+
+	/* disabled filters aren't drawn, but enabling one changes its stamp */
+	pthread_mutex_lock(&source->filter_mutex);
+	for (size_t i = 0; i < source->filters.num && cs->cacheable; i++) {
+		obs_source_t *filter = source->filters.array[i];
+
+		if (filter->enabled)
+			cache_stamp_get(filter, cs);
+		else
+			cache_stamp_add(filter, cs);
+	}
+	pthread_mutex_unlock(&source->filter_mutex);
+
+	if (cs->cacheable && source->info.enum_active_sources)
+		source->info.enum_active_sources(source->context.data,
+				cache_stamp_get_child, cs);
+}
@@ -34,6 +34,9 @@ static const char *obs_scene_signals[] = {
 static inline void signal_item_remove(struct obs_scene_item *item)
 {
 	struct calldata params = {0};
+
+	obs_source_invalidate_cache(item->parent->source);
+
 	calldata_set_ptr(&params, "scene", item->parent);
 	calldata_set_ptr(&params, "item", item);
 
@@ -284,6 +287,8 @@ static void update_item_transform(struct obs_scene_item *item)
 	item->last_width  = width;
 	item->last_height = height;
 
+	obs_source_invalidate_cache(item->parent->source);
+
 	calldata_set_ptr(&params, "scene", item->parent);
 	calldata_set_ptr(&params, "item", item);
 	signal_handler_signal(item->parent->source->context.signals,
@@ -462,7 +467,8 @@ const struct obs_source_info scene_info =
 {
 	.id            = "scene",
 	.type          = OBS_SOURCE_TYPE_INPUT,
-	.output_flags  = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW,
+	.output_flags  = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW |
+	                 OBS_SOURCE_CACHEABLE,
 	.get_name      = scene_getname,
 	.create        = scene_create,
 	.destroy       = scene_destroy,
@@ -724,6 +730,8 @@ obs_sceneitem_t *obs_scene_add(obs_scene_t *scene, obs_source_t *source)
 
 	init_hotkeys(scene, item, obs_source_get_name(source));
 
+	obs_source_invalidate_cache(scene->source);
+
 	calldata_set_ptr(&params, "scene", scene);
 	calldata_set_ptr(&params, "item", item);
 	signal_handler_signal(scene->source->context.signals, "item_add",
@@ -863,6 +871,8 @@ static inline void signal_reorder(struct obs_scene_item *item)
 
 	command = "reorder";
 
+	obs_source_invalidate_cache(item->parent->source);
+
 	calldata_set_ptr(&params, "scene", item->parent);
 
 	signal_handler_signal(item->parent->source->context.signals,
@@ -1081,6 +1091,7 @@ bool obs_sceneitem_set_visible(obs_sceneitem_t *item, bool visible)
 	}
 
 	item->visible = visible;
+	obs_source_invalidate_cache(item->parent->source);
 
 	calldata_set_ptr(&cd, "scene", item->parent);
 	calldata_set_ptr(&cd, "item", item);
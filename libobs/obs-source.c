@@ -24,10 +24,12 @@
 #include "util/platform.h"
 #include "callback/calldata.h"
 #include "graphics/matrix3.h"
+#include "graphics/matrix4.h"
 #include "graphics/vec3.h"
 
 #include "obs.h"
 #include "obs-internal.h"
+#include "obs-render-cache.h"
 
 static inline bool data_valid(const struct obs_source *source, const char *f)
 {
@@ -116,6 +118,25 @@ const char *obs_source_get_display_name(enum obs_source_type type,
 	return (info != NULL) ? info->get_name(info->type_data) : NULL;
 }
 
+static void obs_source_get_async_stats(void *data, calldata_t *cd)
+{
+	struct obs_source *source = data;
+	struct async_frame_stats stats;
+	size_t queue_depth;
+
+	pthread_mutex_lock(&source->async_mutex);
+	stats       = source->async_stats;
+	queue_depth = source->async_frames.num;
+	pthread_mutex_unlock(&source->async_mutex);
+
+	calldata_set_int(cd, "received",     (long long)stats.received);
+	calldata_set_int(cd, "shown",        (long long)stats.shown);
+	calldata_set_int(cd, "duplicated",   (long long)stats.duplicated);
+	calldata_set_int(cd, "dropped_late", (long long)stats.dropped_late);
+	calldata_set_int(cd, "queue_depth",  (long long)queue_depth);
+	calldata_set_int(cd, "jitter_usec",  (long long)(stats.jitter / 1000));
+}
+
 /* internal initialization */
 bool obs_source_init(struct obs_source *source,
 		const struct obs_source_info *info)
@@ -163,6 +184,14 @@ bool obs_source_init(struct obs_source *source,
 		pthread_mutex_unlock(&obs->data.audio_sources_mutex);
 	}
 
+	if (info && (info->output_flags & OBS_SOURCE_ASYNC) != 0)
+		proc_handler_add(source->context.procs,
+				"void get_async_stats(out int received, "
+				"out int shown, out int duplicated, "
+				"out int dropped_late, out int queue_depth, "
+				"out int jitter_usec)",
+				obs_source_get_async_stats, source);
+
 	source->control = bzalloc(sizeof(obs_weak_source_t));
 	source->control->source = source;
 
@@ -336,10 +365,23 @@ void obs_source_frame_init(struct obs_source_frame *frame,
 	}
 }
 
+/* async frames come from the frame pool and are returned to it, unless
+ * they were given to us without copying, in which case they are handed back
+ * to their owner */
+static inline void async_frame_free(struct obs_source_frame *frame)
+{
+	if (frame->release) {
+		frame->release(frame->release_param);
+		bfree(frame);
+	} else {
+		obs_frame_pool_release(&obs->data.frame_pool, frame);
+	}
+}
+
 static inline void obs_source_frame_decref(struct obs_source_frame *frame)
 {
 	if (os_atomic_dec_long(&frame->refs) == 0)
-		obs_source_frame_destroy(frame);
+		async_frame_free(frame);
 }
 
 static bool obs_source_filter_remove_refless(obs_source_t *source,
@@ -392,6 +434,8 @@ void obs_source_destroy(struct obs_source *source)
 		gs_texture_destroy(source->async_texture);
 	if (source->filter_texrender)
 		gs_texrender_destroy(source->filter_texrender);
+	if (source->render_cache)
+		gs_texrender_destroy(source->render_cache);
 	gs_leave_context();
 
 	for (i = 0; i < MAX_AV_PLANES; i++)
@@ -401,7 +445,6 @@ void obs_source_destroy(struct obs_source *source)
 	audio_resampler_destroy(source->resampler);
 
 	da_free(source->async_cache);
-	da_free(source->async_frames);
 	da_free(source->filters);
 	pthread_mutex_destroy(&source->filter_mutex);
 	pthread_mutex_destroy(&source->audio_mutex);
@@ -499,6 +542,7 @@ void obs_source_remove(obs_source_t *source)
 
 	if (!source->removed) {
 		source->removed = true;
+		obs_source_invalidate_cache(source);
 		obs_source_dosignal(source, "source_remove", "remove");
 	}
 }
@@ -580,6 +624,7 @@ static void obs_source_deferred_update(obs_source_t *source)
 				source->context.settings);
 
 	source->defer_update = false;
+	obs_source_invalidate_cache(source);
 }
 
 void obs_source_update(obs_source_t *source, obs_data_t *settings)
@@ -785,6 +830,20 @@ static inline struct obs_source_frame *get_closest_frame(obs_source_t *source,
 static void remove_async_frame(obs_source_t *source,
 		struct obs_source_frame *frame);
 
+/* a hidden source isn't drawn, so its cache isn't kept around either */
+static void free_render_cache(obs_source_t *source)
+{
+	if (!source->render_cache)
+		return;
+
+	obs_enter_graphics();
+	gs_texrender_destroy(source->render_cache);
+	obs_leave_graphics();
+
+	source->render_cache = NULL;
+	source->cache_valid  = false;
+}
+
 void obs_source_video_tick(obs_source_t *source, float seconds)
 {
 	bool now_showing, now_active;
@@ -820,6 +879,7 @@ void obs_source_video_tick(obs_source_t *source, float seconds)
 			show_source(source);
 		} else {
 			hide_source(source);
+			free_render_cache(source);
 		}
 
 		source->showing = now_showing;
@@ -1097,32 +1157,6 @@ static inline bool set_async_texture_size(struct obs_source *source,
 	return !!source->async_texture;
 }
 
-static void upload_raw_frame(gs_texture_t *tex,
-		const struct obs_source_frame *frame)
-{
-	switch (get_convert_type(frame->format)) {
-		case CONVERT_422_U:
-		case CONVERT_422_Y:
-			gs_texture_set_image(tex, frame->data[0],
-					frame->linesize[0], false);
-			break;
-
-		case CONVERT_420:
-			gs_texture_set_image(tex, frame->data[0],
-					frame->width, false);
-			break;
-
-		case CONVERT_NV12:
-			gs_texture_set_image(tex, frame->data[0],
-					frame->width, false);
-			break;
-
-		case CONVERT_NONE:
-			assert(false && "No conversion requested");
-			break;
-	}
-}
-
 static const char *select_conversion_technique(enum video_format format)
 {
 	switch (format) {
@@ -1159,7 +1193,8 @@ static inline void set_eparam(gs_effect_t *effect, const char *name, float val)
 	gs_effect_set_float(param, val);
 }
 
-static bool update_async_texrender(struct obs_source *source,
+/* converts the raw frame data uploaded to the async texture */
+static bool render_async_conversion(struct obs_source *source,
 		const struct obs_source_frame *frame)
 {
 	gs_texture_t   *tex       = source->async_texture;
@@ -1167,8 +1202,6 @@ static bool update_async_texrender(struct obs_source *source,
 
 	gs_texrender_reset(texrender);
 
-	upload_raw_frame(tex, frame);
-
 	uint32_t cx = source->async_width;
 	uint32_t cy = source->async_height;
 
@@ -1217,14 +1250,41 @@ static bool update_async_texrender(struct obs_source *source,
 	return true;
 }
 
-static bool update_async_texture(struct obs_source *source,
-		const struct obs_source_frame *frame)
+static inline struct obs_source_frame *filter_async_video(obs_source_t *source,
+		struct obs_source_frame *in);
+
+static inline bool raw_async_upload(struct obs_source *source)
+{
+	return source->async_gpu_conversion && source->async_convert_texrender;
+}
+
+/*
+ * Async textures are uploaded in three steps: the texture is mapped on the
+ * graphics thread, the frame is copied (and converted if needed) into it in
+ * slices, possibly by the upload threads, and then the texture is unmapped
+ * and converted on the graphics thread again.
+ */
+bool obs_source_begin_async_upload(obs_source_t *source,
+		struct async_upload *upload)
 {
-	gs_texture_t      *tex       = source->async_texture;
-	gs_texrender_t    *texrender = source->async_convert_texrender;
-	enum convert_type type      = get_convert_type(frame->format);
-	uint8_t           *ptr;
-	uint32_t          linesize;
+	struct obs_source_frame *frame;
+
+	if (source->async_rendered)
+		return false;
+
+	source->async_rendered = true;
+
+	frame = obs_source_get_frame(source);
+	if (frame)
+		frame = filter_async_video(source, frame);
+	if (!frame)
+		return false;
+
+	source->timing_adjust = os_gettime_ns() - frame->timestamp;
+	source->timing_set    = true;
+
+	if (!set_async_texture_size(source, frame))
+		goto fail;
 
 	source->async_flip       = frame->flip;
 	source->async_full_range = frame->full_range;
@@ -1235,38 +1295,107 @@ static bool update_async_texture(struct obs_source *source,
 	memcpy(source->async_color_range_max, frame->color_range_max,
 			sizeof frame->color_range_max);
 
-	if (source->async_gpu_conversion && texrender)
-		return update_async_texrender(source, frame);
+	if (!gs_texture_map(source->async_texture, &upload->ptr,
+				&upload->linesize))
+		goto fail;
 
-	if (type == CONVERT_NONE) {
-		gs_texture_set_image(tex, frame->data[0], frame->linesize[0],
-				false);
-		return true;
+	upload->source = source;
+	upload->frame  = frame;
+	upload->height = (raw_async_upload(source) ||
+			get_convert_type(frame->format) == CONVERT_NONE) ?
+		gs_texture_get_height(source->async_texture) : frame->height;
+	return true;
+
+fail:
+	obs_source_release_frame(source, frame);
+	return false;
+}
+
+static void copy_async_rows(const uint8_t *src, uint32_t src_linesize,
+		size_t src_size, uint8_t *dst, uint32_t dst_linesize,
+		uint32_t start_y, uint32_t end_y)
+{
+	uint32_t row_copy = (src_linesize < dst_linesize) ?
+		src_linesize : dst_linesize;
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		size_t offset = (size_t)y * src_linesize;
+		size_t size   = row_copy;
+
+		if (offset >= src_size)
+			break;
+		if (size > src_size - offset)
+			size = src_size - offset;
+
+		memcpy(dst + (size_t)y * dst_linesize, src + offset, size);
 	}
+}
 
-	if (!gs_texture_map(tex, &ptr, &linesize))
-		return false;
+/* called on any thread, start_y must be even for the 4:2:0 formats */
+void obs_source_upload_async_slice(struct async_upload *upload,
+		uint32_t start_y, uint32_t end_y)
+{
+	const struct obs_source_frame *frame = upload->frame;
+	enum convert_type type = get_convert_type(frame->format);
 
-	if (type == CONVERT_420)
+	if (raw_async_upload(upload->source)) {
+		/* the planes of 4:2:0 frames are uploaded as one texture */
+		uint32_t linesize = (type == CONVERT_420 ||
+				type == CONVERT_NV12) ?
+			frame->width : frame->linesize[0];
+
+		copy_async_rows(frame->data[0], linesize,
+				video_frame_get_size(frame->format,
+					frame->width, frame->height),
+				upload->ptr, upload->linesize,
+				start_y, end_y);
+		return;
+	}
+
+	switch (type) {
+	case CONVERT_NONE:
+		copy_async_rows(frame->data[0], frame->linesize[0],
+				(size_t)frame->linesize[0] * frame->height,
+				upload->ptr, upload->linesize,
+				start_y, end_y);
+		break;
+
+	case CONVERT_420:
 		decompress_420((const uint8_t* const*)frame->data,
-				frame->linesize,
-				0, frame->height, ptr, linesize);
+				frame->linesize, start_y, end_y,
+				upload->ptr, upload->linesize);
+		break;
 
-	else if (type == CONVERT_NV12)
+	case CONVERT_NV12:
 		decompress_nv12((const uint8_t* const*)frame->data,
-				frame->linesize,
-				0, frame->height, ptr, linesize);
+				frame->linesize, start_y, end_y,
+				upload->ptr, upload->linesize);
+		break;
 
-	else if (type == CONVERT_422_Y)
+	case CONVERT_422_Y:
 		decompress_422(frame->data[0], frame->linesize[0],
-				0, frame->height, ptr, linesize, true);
+				start_y, end_y,
+				upload->ptr, upload->linesize, true);
+		break;
 
-	else if (type == CONVERT_422_U)
+	case CONVERT_422_U:
 		decompress_422(frame->data[0], frame->linesize[0],
-				0, frame->height, ptr, linesize, false);
+				start_y, end_y,
+				upload->ptr, upload->linesize, false);
+		break;
+	}
+}
 
-	gs_texture_unmap(tex);
-	return true;
+void obs_source_end_async_upload(struct async_upload *upload)
+{
+	struct obs_source *source = upload->source;
+
+	gs_texture_unmap(source->async_texture);
+
+	if (raw_async_upload(source))
+		render_async_conversion(source, upload->frame);
+
+	obs_source_release_frame(source, upload->frame);
 }
 
 static inline void obs_source_draw_texture(struct obs_source *source,
@@ -1329,30 +1458,15 @@ static void obs_source_draw_async_texture(struct obs_source *source)
 	}
 }
 
-static inline struct obs_source_frame *filter_async_video(obs_source_t *source,
-		struct obs_source_frame *in);
-
+/* sources that were not uploaded ahead of rendering by the upload stage of
+ * the graphics thread are uploaded when they are first rendered */
 static void obs_source_update_async_video(obs_source_t *source)
 {
-	if (!source->async_rendered) {
-		struct obs_source_frame *frame = obs_source_get_frame(source);
+	struct async_upload upload;
 
-		if (frame)
-			frame = filter_async_video(source, frame);
-
-		source->async_rendered = true;
-		if (frame) {
-			source->timing_adjust =
-				os_gettime_ns() - frame->timestamp;
-			source->timing_set = true;
-
-			if (!set_async_texture_size(source, frame))
-				return;
-			if (!update_async_texture(source, frame))
-				return;
-		}
-
-		obs_source_release_frame(source, frame);
+	if (obs_source_begin_async_upload(source, &upload)) {
+		obs_source_upload_async_slice(&upload, 0, upload.height);
+		obs_source_end_async_upload(&upload);
 	}
 }
 
@@ -1402,8 +1516,6 @@ static inline void obs_source_main_render(obs_source_t *source)
 				custom_draw ? NULL : gs_get_effect());
 }
 
-static bool ready_async_frame(obs_source_t *source, uint64_t sys_time);
-
 static inline void render_video(obs_source_t *source)
 {
 	if (source->info.type != OBS_SOURCE_TYPE_FILTER &&
@@ -1434,13 +1546,170 @@ static inline void render_video(obs_source_t *source)
 		obs_source_render_async_video(source);
 }
 
+/* ------------------------------------------------------------------------- */
+/* render cache: a cacheable source is rendered to a texture once its change
+ * stamp (the latest of its own, its filters' and those of the sources it
+ * draws) has stayed the same for a frame, and the texture is drawn in its
+ * place until the stamp changes */
+
+static bool update_render_cache(obs_source_t *source, uint32_t cx, uint32_t cy)
+{
+	struct vec4 clear_color;
+	bool success;
+
+	if (!source->render_cache)
+		source->render_cache = gs_texrender_create(GS_RGBA,
+				GS_ZS_NONE);
+
+	gs_texrender_reset(source->render_cache);
+
+	gs_blend_state_push();
+	gs_reset_blend_state();
+
+	success = gs_texrender_begin(source->render_cache, cx, cy);
+	if (success) {
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+		render_video(source);
+
+		gs_texrender_end(source->render_cache);
+	}
+
+	gs_blend_state_pop();
+	return success;
+}
+
+/* the cache holds the source blended over transparent black, so its color
+ * is already multiplied by its alpha */
+static void draw_render_cache(obs_source_t *source)
+{
+	gs_effect_t  *effect = obs->video.default_effect;
+	gs_eparam_t  *image  = gs_effect_get_param_by_name(effect, "image");
+	gs_texture_t *tex    = gs_texrender_get_texture(source->render_cache);
+
+	gs_effect_set_texture(image, tex);
+
+	gs_blend_state_push();
+	gs_blend_function_separate(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA,
+			GS_BLEND_ONE, GS_BLEND_ONE);
+
+	while (gs_effect_loop(effect, "Draw"))
+		gs_draw_sprite(tex, 0, 0, 0);
+
+	gs_blend_state_pop();
+}
+
+/* a source without filters that doesn't draw other sources usually renders
+ * in a single draw, which is no more than drawing the cache would cost */
+static inline bool worth_caching(const obs_source_t *source)
+{
+	return source->filters.num || source->info.enum_active_sources;
+}
+
+/* the cache is rendered at base size, so it's only drawn where each of its
+ * texels lands on exactly one output pixel; drawn scaled, rotated or off
+ * the pixel grid it would be filtered a second time and look softer than
+ * the source rendered directly */
+static bool drawn_pixel_aligned(void)
+{
+	struct matrix4 mat;
+	struct gs_rect viewport;
+	float left, right, top, bottom;
+	float scale_x, scale_y, x, y;
+
+	if (!gs_get_ortho(&left, &right, &top, &bottom))
+		return false;
+	if (close_float(left, right, EPSILON) ||
+	    close_float(top, bottom, EPSILON))
+		return false;
+
+	gs_get_viewport(&viewport);
+	gs_matrix_get(&mat);
+
+	scale_x = (float)viewport.cx / (right - left);
+	scale_y = (float)viewport.cy / (bottom - top);
+
+	if (!close_float(mat.x.x * scale_x, 1.0f, EPSILON) ||
+	    !close_float(mat.y.y * scale_y, 1.0f, EPSILON) ||
+	    !close_float(mat.x.y, 0.0f, EPSILON) ||
+	    !close_float(mat.y.x, 0.0f, EPSILON))
+		return false;
+
+	x = (mat.t.x - left) * scale_x;
+	y = (mat.t.y - top)  * scale_y;
+
+	return close_float(x, roundf(x), LARGE_EPSILON) &&
+	       close_float(y, roundf(y), LARGE_EPSILON);
+}
+
+static bool render_cached_video(obs_source_t *source)
+{
+	struct cache_stamp cs = {0, true};
+	uint32_t cx, cy;
+
+	if ((source->info.output_flags & OBS_SOURCE_CACHEABLE) == 0 ||
+	    source->info.type == OBS_SOURCE_TYPE_FILTER ||
+	    source->rendering_filter || !worth_caching(source) ||
+	    !source->context.data || !source->enabled ||
+	    !drawn_pixel_aligned())
+		return false;
+
+	/* the stamp is taken before rendering, so a change made while the
+	 * cache is rendered always causes it to be rendered again */
+	cache_stamp_get(source, &cs);
+	if (!cs.cacheable) {
+		source->cache_valid = false;
+		return false;
+	}
+
+	cx = obs_source_get_width(source);
+	cy = obs_source_get_height(source);
+
+	if (source->cache_valid && source->cached_stamp == cs.stamp &&
+	    source->cached_cx == cx && source->cached_cy == cy) {
+		draw_render_cache(source);
+		return true;
+	}
+
+	source->cache_valid = false;
+
+	/* sources that change every frame aren't worth caching */
+	if (source->last_render_stamp != cs.stamp) {
+		source->last_render_stamp = cs.stamp;
+		return false;
+	}
+
+	if (!cx || !cy || !update_render_cache(source, cx, cy))
+		return false;
+
+	source->cache_valid  = true;
+	source->cached_stamp = cs.stamp;
+	source->cached_cx    = cx;
+	source->cached_cy    = cy;
+
+	draw_render_cache(source);
+	return true;
+}
+
+void obs_source_invalidate_cache(obs_source_t *source)
+{
+	if (!obs_source_valid(source, "obs_source_invalidate_cache"))
+		return;
+
+	os_atomic_set_long(&source->change_stamp,
+			os_atomic_inc_long(&obs->data.last_change_stamp));
+}
+
 void obs_source_video_render(obs_source_t *source)
 {
 	if (!obs_source_valid(source, "obs_source_video_render"))
 		return;
 
 	obs_source_addref(source);
-	render_video(source);
+	if (!render_cached_video(source))
+		render_video(source);
 	obs_source_release(source);
 }
 
@@ -1578,6 +1847,8 @@ void obs_source_filter_add(obs_source_t *source, obs_source_t *filter)
 
 	pthread_mutex_unlock(&source->filter_mutex);
 
+	obs_source_invalidate_cache(source);
+
 	calldata_set_ptr(&cd, "source", source);
 	calldata_set_ptr(&cd, "filter", filter);
 
@@ -1609,6 +1880,8 @@ static bool obs_source_filter_remove_refless(obs_source_t *source,
 
 	pthread_mutex_unlock(&source->filter_mutex);
 
+	obs_source_invalidate_cache(source);
+
 	calldata_set_ptr(&cd, "source", source);
 	calldata_set_ptr(&cd, "filter", filter);
 
@@ -1732,8 +2005,10 @@ void obs_source_filter_set_order(obs_source_t *source, obs_source_t *filter,
 	success = move_filter_dir(source, filter, movement);
 	pthread_mutex_unlock(&source->filter_mutex);
 
-	if (success)
+	if (success) {
+		obs_source_invalidate_cache(source);
 		obs_source_dosignal(source, NULL, "reorder_filters");
+	}
 }
 
 obs_data_t *obs_source_get_settings(const obs_source_t *source)
@@ -1854,8 +2129,10 @@ static inline void free_async_cache(struct obs_source *source)
 		obs_source_frame_decref(source->async_cache.array[i].frame);
 
 	da_resize(source->async_cache, 0);
-	da_resize(source->async_frames, 0);
-	source->cur_async_frame = NULL;
+	source->async_frames.head = 0;
+	source->async_frames.num  = 0;
+	source->async_shown_ts    = 0;
+	source->cur_async_frame   = NULL;
 }
 
 #define MAX_UNUSED_FRAME_DURATION 5
@@ -1868,27 +2145,23 @@ static void clean_cache(obs_source_t *source)
 		struct async_frame *af = &source->async_cache.array[i - 1];
 		if (!af->used) {
 			if (++af->unused_count == MAX_UNUSED_FRAME_DURATION) {
-				obs_source_frame_destroy(af->frame);
+				async_frame_free(af->frame);
 				da_erase(source->async_cache, i - 1);
 			}
 		}
 	}
 }
 
-#define MAX_ASYNC_FRAMES 30
-
-static inline struct obs_source_frame *cache_video(struct obs_source *source,
+/* called with async_mutex held, returns false if the frame has to be dropped
+ * because too many frames have backed up */
+static bool prepare_async_cache(struct obs_source *source,
 		const struct obs_source_frame *frame)
 {
-	struct obs_source_frame *new_frame = NULL;
-
-	pthread_mutex_lock(&source->async_mutex);
-
-	if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
+	if (source->async_frames.num == MAX_ASYNC_FRAMES) {
+		source->async_stats.dropped_late += MAX_ASYNC_FRAMES;
 		free_async_cache(source);
 		source->last_frame_ts = 0;
-		pthread_mutex_unlock(&source->async_mutex);
-		return NULL;
+		return false;
 	}
 
 	if (async_texture_changed(source, frame)) {
@@ -1898,6 +2171,74 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 		source->async_cache_format = frame->format;
 	}
 
+	return true;
+}
+
+static inline struct obs_source_frame *async_ring_get(
+		const struct async_frame_ring *ring, size_t idx)
+{
+	return ring->frames[(ring->head + idx) % MAX_ASYNC_FRAMES];
+}
+
+static inline struct obs_source_frame *async_ring_pop(
+		struct async_frame_ring *ring)
+{
+	struct obs_source_frame *frame = ring->frames[ring->head];
+
+	ring->head = (ring->head + 1) % MAX_ASYNC_FRAMES;
+	ring->num--;
+	return frame;
+}
+
+static void update_async_stats(struct async_frame_stats *stats, uint64_t ts)
+{
+	if (stats->last_received_ts && ts > stats->last_received_ts) {
+		uint64_t interval = ts - stats->last_received_ts;
+
+		if (interval < MAX_TS_VAR) {
+			if (!stats->avg_interval)
+				stats->avg_interval = interval;
+
+			stats->jitter = (stats->jitter * 15 +
+				uint64_diff(interval, stats->avg_interval)) / 16;
+			stats->avg_interval =
+				(stats->avg_interval * 15 + interval) / 16;
+		}
+	}
+
+	stats->last_received_ts = ts;
+	stats->received++;
+}
+
+/* called with async_mutex held */
+static void push_async_frame(struct obs_source *source,
+		struct obs_source_frame *frame)
+{
+	struct async_frame_ring *ring = &source->async_frames;
+
+	/* the cache mutex is released while a frame is being copied, so the
+	 * queue may have filled up again in the meantime */
+	if (ring->num == MAX_ASYNC_FRAMES) {
+		remove_async_frame(source, async_ring_pop(ring));
+		source->async_stats.dropped_late++;
+	}
+
+	ring->frames[(ring->head + ring->num++) % MAX_ASYNC_FRAMES] = frame;
+	update_async_stats(&source->async_stats, frame->timestamp);
+}
+
+static inline struct obs_source_frame *cache_video(struct obs_source *source,
+		const struct obs_source_frame *frame)
+{
+	struct obs_source_frame *new_frame = NULL;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (!prepare_async_cache(source, frame)) {
+		pthread_mutex_unlock(&source->async_mutex);
+		return NULL;
+	}
+
 	for (size_t i = 0; i < source->async_cache.num; i++) {
 		struct async_frame *af = &source->async_cache.array[i];
 		if (!af->used) {
@@ -1913,8 +2254,13 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 	if (!new_frame) {
 		struct async_frame new_af;
 
-		new_frame = obs_source_frame_create(frame->format,
-				frame->width, frame->height);
+		new_frame = obs_frame_pool_get(&obs->data.frame_pool,
+				frame->format, frame->width, frame->height);
+		if (!new_frame) {
+			pthread_mutex_unlock(&source->async_mutex);
+			return NULL;
+		}
+
 		new_af.frame = new_frame;
 		new_af.used = true;
 		new_af.unused_count = 0;
@@ -1930,7 +2276,7 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 	copy_frame_data(new_frame, frame);
 
 	if (os_atomic_dec_long(&new_frame->refs) == 0) {
-		obs_source_frame_destroy(new_frame);
+		async_frame_free(new_frame);
 		new_frame = NULL;
 	}
 
@@ -1944,6 +2290,9 @@ void obs_source_output_video(obs_source_t *source,
 		return;
 
 	if (!frame) {
+		pthread_mutex_lock(&source->async_mutex);
+		free_async_cache(source);
+		pthread_mutex_unlock(&source->async_mutex);
 		source->async_active = false;
 		return;
 	}
@@ -1955,12 +2304,79 @@ void obs_source_output_video(obs_source_t *source,
 
 	if (output) {
 		pthread_mutex_lock(&source->async_mutex);
-		da_push_back(source->async_frames, &output);
+		push_async_frame(source, output);
 		pthread_mutex_unlock(&source->async_mutex);
 		source->async_active = true;
 	}
 }
 
+/* the texture upload and gpu conversion expect the planes to be laid out the
+ * way copied frames are, so frames in any other layout still get copied */
+static bool frame_has_cache_layout(const struct obs_source_frame *frame)
+{
+	struct video_frame layout;
+
+	video_frame_init_data(&layout, frame->format, frame->width,
+			frame->height, frame->data[0]);
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		if (layout.data[i] != frame->data[i] ||
+		    layout.linesize[i] != frame->linesize[i])
+			return false;
+	}
+
+	return true;
+}
+
+/* the frame is put in the cache marked as used so that it is never reused
+ * for another frame, and is released when it is no longer used */
+void obs_source_output_video_nocopy(obs_source_t *source,
+		const struct obs_source_frame *frame,
+		obs_source_frame_release_t release, void *param)
+{
+	struct obs_source_frame *new_frame;
+	struct async_frame new_af;
+
+	if (!obs_source_valid(source, "obs_source_output_video_nocopy"))
+		return;
+
+	if (!frame || !release) {
+		obs_source_output_video(source, frame);
+		return;
+	}
+
+	if (!frame_has_cache_layout(frame)) {
+		obs_source_output_video(source, frame);
+		release(param);
+		return;
+	}
+
+	new_frame = bmalloc(sizeof(struct obs_source_frame));
+	*new_frame = *frame;
+	new_frame->refs          = 1;
+	new_frame->release       = release;
+	new_frame->release_param = param;
+
+	new_af.frame        = new_frame;
+	new_af.used         = true;
+	new_af.unused_count = 0;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (!prepare_async_cache(source, frame)) {
+		pthread_mutex_unlock(&source->async_mutex);
+		async_frame_free(new_frame);
+		return;
+	}
+
+	da_push_back(source->async_cache, &new_af);
+	push_async_frame(source, new_frame);
+
+	pthread_mutex_unlock(&source->async_mutex);
+
+	source->async_active = true;
+}
+
 static inline struct obs_audio_data *filter_async_audio(obs_source_t *source,
 		struct obs_audio_data *in)
 {
@@ -2147,119 +2563,101 @@ static void remove_async_frame(obs_source_t *source,
 		struct async_frame *f = &source->async_cache.array[i];
 
 		if (f->frame == frame) {
-			f->used = false;
+			if (frame->release) {
+				da_erase(source->async_cache, i);
+				obs_source_frame_decref(frame);
+			} else {
+				f->used = false;
+			}
 			break;
 		}
 	}
 }
 
-/* #define DEBUG_ASYNC_FRAMES 1 */
-
-static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
+/* pops the frame at the given index, dropping the older frames in front of
+ * it, which were not shown in time */
+static struct obs_source_frame *show_async_frame(obs_source_t *source,
+		size_t idx)
 {
-	struct obs_source_frame *next_frame = source->async_frames.array[0];
-	struct obs_source_frame *frame      = NULL;
-	uint64_t sys_offset = sys_time - source->last_sys_timestamp;
-	uint64_t frame_time = next_frame->timestamp;
-	uint64_t frame_offset = 0;
+	struct obs_source_frame *frame;
 
-	if ((source->flags & OBS_SOURCE_FLAG_UNBUFFERED) != 0) {
-		while (source->async_frames.num > 1) {
-			da_erase(source->async_frames, 0);
-			remove_async_frame(source, next_frame);
-			next_frame = source->async_frames.array[0];
-		}
+	for (size_t i = 0; i < idx; i++)
+		remove_async_frame(source, async_ring_pop(&source->async_frames));
 
-		return true;
-	}
+	frame = async_ring_pop(&source->async_frames);
 
-#if DEBUG_ASYNC_FRAMES
-	blog(LOG_DEBUG, "source->last_frame_ts: %llu, frame_time: %llu, "
-			"sys_offset: %llu, frame_offset: %llu, "
-			"number of frames: %lu",
-			source->last_frame_ts, frame_time, sys_offset,
-			frame_time - source->last_frame_ts,
-			(unsigned long)source->async_frames.num);
-#endif
-
-	/* account for timestamp invalidation */
-	if (frame_out_of_bounds(source, frame_time)) {
-#if DEBUG_ASYNC_FRAMES
-		blog(LOG_DEBUG, "timing jump");
-#endif
-		source->last_frame_ts = next_frame->timestamp;
-		return true;
-	} else {
-		frame_offset = frame_time - source->last_frame_ts;
-		source->last_frame_ts += sys_offset;
-	}
+	source->async_shown_ts = frame->timestamp;
+	source->async_stats.dropped_late += idx;
+	source->async_stats.shown++;
+	return frame;
+}
 
-	while (source->last_frame_ts > next_frame->timestamp) {
+/*
+ * last_frame_ts is the render time in the source's own timestamp domain.  It
+ * is synced to the first frame, advanced by the system time that passes
+ * between ticks, and synced again when the timestamps jump.  The queued frame
+ * closest to it is shown, unless the frame already being shown is closer, in
+ * which case that frame is shown again.
+ */
+static inline struct obs_source_frame *get_closest_frame(obs_source_t *source,
+		uint64_t sys_time)
+{
+	struct async_frame_ring *ring = &source->async_frames;
+	struct obs_source_frame *frame;
+	uint64_t best_diff;
+	size_t   best = ring->num;
 
-		/* this tries to reduce the needless frame duplication, also
-		 * helps smooth out async rendering to frame boundaries.  In
-		 * other words, tries to keep the framerate as smooth as
-		 * possible */
-		if ((source->last_frame_ts - next_frame->timestamp) < 2000000)
-			break;
+	if (!ring->num) {
+		if (source->async_shown_ts)
+			source->async_stats.duplicated++;
+		return NULL;
+	}
 
-		if (frame)
-			da_erase(source->async_frames, 0);
+	if ((source->flags & OBS_SOURCE_FLAG_UNBUFFERED) != 0) {
+		frame = show_async_frame(source, ring->num - 1);
+		source->last_frame_ts = frame->timestamp;
+		return frame;
+	}
 
-#if DEBUG_ASYNC_FRAMES
-		blog(LOG_DEBUG, "new frame, "
-				"source->last_frame_ts: %llu, "
-				"next_frame->timestamp: %llu",
-				source->last_frame_ts,
-				next_frame->timestamp);
-#endif
+	frame = async_ring_get(ring, 0);
 
-		remove_async_frame(source, frame);
+	if (!source->last_frame_ts ||
+	    frame_out_of_bounds(source, frame->timestamp)) {
+		source->last_frame_ts = frame->timestamp;
+		return show_async_frame(source, 0);
+	}
 
-		if (source->async_frames.num == 1)
-			return true;
+	source->last_frame_ts += sys_time - source->last_sys_timestamp;
 
-		frame = next_frame;
-		next_frame = source->async_frames.array[1];
+	best_diff = source->async_shown_ts ?
+		uint64_diff(source->async_shown_ts, source->last_frame_ts) :
+		UINT64_MAX;
 
-		/* more timestamp checking and compensating */
-		if ((next_frame->timestamp - frame_time) > MAX_TS_VAR) {
-#if DEBUG_ASYNC_FRAMES
-			blog(LOG_DEBUG, "timing jump");
-#endif
-			source->last_frame_ts =
-				next_frame->timestamp - frame_offset;
-		}
+	/* timestamps only go forward, so the distance to the render time
+	 * shrinks until the closest frame and then grows */
+	for (size_t i = 0; i < ring->num; i++) {
+		uint64_t diff;
 
-		frame_time   = next_frame->timestamp;
-		frame_offset = frame_time - source->last_frame_ts;
-	}
+		/* frames after a timing jump wait until they reach the front
+		 * of the queue, where they sync the render time again */
+		frame = async_ring_get(ring, i);
+		if (frame_out_of_bounds(source, frame->timestamp))
+			break;
 
-#if DEBUG_ASYNC_FRAMES
-	if (!frame)
-		blog(LOG_DEBUG, "no frame!");
-#endif
+		diff = uint64_diff(frame->timestamp, source->last_frame_ts);
+		if (diff >= best_diff)
+			break;
 
-	return frame != NULL;
-}
+		best      = i;
+		best_diff = diff;
+	}
 
-static inline struct obs_source_frame *get_closest_frame(obs_source_t *source,
-		uint64_t sys_time)
-{
-	if (!source->async_frames.num)
+	if (best == ring->num) {
+		source->async_stats.duplicated++;
 		return NULL;
-
-	if (!source->last_frame_ts || ready_async_frame(source, sys_time)) {
-		struct obs_source_frame *frame = source->async_frames.array[0];
-		da_erase(source->async_frames, 0);
-
-		if (!source->last_frame_ts)
-			source->last_frame_ts = frame->timestamp;
-
-		return frame;
 	}
 
-	return NULL;
+	return show_async_frame(source, best);
 }
 
 /*
@@ -2296,12 +2694,12 @@ void obs_source_release_frame(obs_source_t *source,
 		return;
 
 	if (!source) {
-		obs_source_frame_destroy(frame);
+		async_frame_free(frame);
 	} else {
 		pthread_mutex_lock(&source->async_mutex);
 
 		if (os_atomic_dec_long(&frame->refs) == 0)
-			obs_source_frame_destroy(frame);
+			async_frame_free(frame);
 		else
 			remove_async_frame(source, frame);
 
@@ -2808,6 +3206,20 @@ uint32_t obs_source_get_audio_mixers(const obs_source_t *source)
 	return audio_line_get_mixers(source->audio_line);
 }
 
+bool obs_source_get_audio_stats(obs_source_t *source,
+		struct audio_line_stats *stats)
+{
+	if (!obs_source_valid(source, "obs_source_get_audio_stats"))
+		return false;
+	if (!obs_ptr_valid(stats, "obs_source_get_audio_stats"))
+		return false;
+	if ((source->info.output_flags & OBS_SOURCE_AUDIO) == 0)
+		return false;
+
+	audio_line_get_stats(source->audio_line, stats);
+	return true;
+}
+
 void obs_source_draw_set_color_matrix(const struct matrix4 *color_matrix,
 		const struct vec3 *color_range_min,
 		const struct vec3 *color_range_max)
@@ -3016,6 +3428,7 @@ void obs_source_set_enabled(obs_source_t *source, bool enabled)
 		return;
 
 	source->enabled = enabled;
+	obs_source_invalidate_cache(source);
 
 	calldata_set_ptr(&data, "source", source);
 	calldata_set_bool(&data, "enabled", enabled);
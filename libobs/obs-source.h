@@ -103,6 +103,21 @@ enum obs_source_type {
  */
 #define OBS_SOURCE_INTERACTION (1<<5)
 
+/**
+ * Source video only changes when its settings are updated, or when it calls
+ * obs_source_invalidate_cache.
+ *
+ * When this is used, the source is rendered to a texture once it stops
+ * changing, and the texture is drawn in its place afterwards.  Filters must
+ * also specify this flag for a source that uses them to be cached, and a
+ * source that draws other sources (with enum_active_sources) is only cached
+ * if all of the video sources among them are cacheable.  Async sources are
+ * never cached.  Sources without filters that don't draw other sources aren't
+ * cached themselves, but allow the scenes that contain them to be cached.
+ * The cache is only drawn unscaled, and is freed while the source is hidden.
+ */
+#define OBS_SOURCE_CACHEABLE   (1<<6)
+
 /** @} */
 
 typedef void (*obs_source_enum_proc_t)(obs_source_t *parent,
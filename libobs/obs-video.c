@@ -71,6 +71,127 @@ static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 	return cur_time;
 }
 
+/* async sources that are showing have their new frames copied into their
+ * textures before anything is rendered.  the copies are split into slices
+ * that the upload threads and the graphics thread work through together,
+ * leaving only the mapping and unmapping of the textures (and the gpu
+ * conversion) to the graphics thread alone.  sources that are not uploaded
+ * here are uploaded when they are first rendered. */
+
+#define MIN_UPLOAD_SLICE_HEIGHT 64
+
+static void upload_async_slices(struct obs_core_video *video)
+{
+	long num_slices = (long)video->upload_slices.num;
+	long idx;
+
+	while ((idx = os_atomic_inc_long(&video->upload_next_slice) - 1) <
+			num_slices) {
+		struct async_upload_slice *slice =
+			video->upload_slices.array + idx;
+
+		obs_source_upload_async_slice(
+				video->async_uploads.array + slice->upload_idx,
+				slice->start_y, slice->end_y);
+	}
+}
+
+void *obs_upload_thread(void *param)
+{
+	struct obs_core_video *video = &obs->video;
+
+	os_set_thread_name("libobs: upload thread");
+
+	while (os_sem_wait(video->upload_start_sem) == 0) {
+		if (video->upload_stop)
+			break;
+
+		upload_async_slices(video);
+		os_sem_post(video->upload_done_sem);
+	}
+
+	UNUSED_PARAMETER(param);
+	return NULL;
+}
+
+/* slices need to start on even lines for the 4:2:0 formats */
+static void add_upload_slices(struct obs_core_video *video, size_t idx)
+{
+	struct async_upload *upload = video->async_uploads.array + idx;
+	uint32_t num = (uint32_t)video->num_upload_threads + 1;
+	uint32_t slice_height = (upload->height + num - 1) / num;
+
+	if (slice_height < MIN_UPLOAD_SLICE_HEIGHT)
+		slice_height = MIN_UPLOAD_SLICE_HEIGHT;
+	slice_height = (slice_height + 1) & ~1;
+
+	for (uint32_t y = 0; y < upload->height; y += slice_height) {
+		struct async_upload_slice slice;
+
+		slice.upload_idx = idx;
+		slice.start_y    = y;
+		slice.end_y      = (upload->height - y > slice_height) ?
+			y + slice_height : upload->height;
+
+		da_push_back(video->upload_slices, &slice);
+	}
+}
+
+static const char *upload_async_textures_name = "upload_async_textures";
+static void upload_async_textures(struct obs_core_video *video)
+{
+	struct obs_core_data *data = &obs->data;
+	struct obs_source    *source;
+	size_t               num_threads = 0;
+
+	profile_start(upload_async_textures_name);
+
+	da_resize(video->async_uploads, 0);
+	da_resize(video->upload_slices, 0);
+
+	/* also keeps the sources from being destroyed until their uploads
+	 * are done */
+	pthread_mutex_lock(&data->sources_mutex);
+
+	source = data->first_source;
+	while (source) {
+		struct async_upload upload;
+
+		if ((source->info.output_flags & OBS_SOURCE_ASYNC) != 0 &&
+		    source->show_refs > 0 &&
+		    obs_source_begin_async_upload(source, &upload))
+			da_push_back(video->async_uploads, &upload);
+
+		source = (struct obs_source*)source->context.next;
+	}
+
+	for (size_t i = 0; i < video->async_uploads.num; i++)
+		add_upload_slices(video, i);
+
+	if (video->upload_slices.num > 1) {
+		num_threads = video->upload_slices.num - 1;
+		if (num_threads > video->num_upload_threads)
+			num_threads = video->num_upload_threads;
+	}
+
+	os_atomic_set_long(&video->upload_next_slice, 0);
+
+	for (size_t i = 0; i < num_threads; i++)
+		os_sem_post(video->upload_start_sem);
+
+	upload_async_slices(video);
+
+	for (size_t i = 0; i < num_threads; i++)
+		os_sem_wait(video->upload_done_sem);
+
+	for (size_t i = 0; i < video->async_uploads.num; i++)
+		obs_source_end_async_upload(video->async_uploads.array + i);
+
+	pthread_mutex_unlock(&data->sources_mutex);
+
+	profile_end(upload_async_textures_name);
+}
+
 /* in obs-display.c */
 extern void render_display(struct obs_display *display);
 
@@ -106,12 +227,18 @@ static inline void set_render_size(uint32_t width, uint32_t height)
 	gs_set_viewport(0, 0, width, height);
 }
 
-static inline void unmap_last_surface(struct obs_core_video *video)
+static inline void wait_for_conversion(struct obs_core_video *video);
+
+static inline void unmap_last_surfaces(struct obs_core_video *video)
 {
-	if (video->mapped_surface) {
-		gs_stagesurface_unmap(video->mapped_surface);
-		video->mapped_surface = NULL;
+	wait_for_conversion(video);
+
+	for (size_t i = 0; i < video->num_mapped_surfaces; i++) {
+		gs_stagesurface_unmap(video->mapped_surfaces[i]);
+		video->mapped_surfaces[i] = NULL;
 	}
+
+	video->num_mapped_surfaces = 0;
 }
 
 static const char *render_main_texture_name = "render_main_texture";
@@ -135,17 +262,18 @@ static inline void render_main_texture(struct obs_core_video *video,
 }
 
 static inline gs_effect_t *get_scale_effect_internal(
-		struct obs_core_video *video)
+		struct obs_core_video *video, enum obs_scale_type scale_type,
+		uint32_t width, uint32_t height)
 {
 	/* if the dimension is under half the size of the original image,
 	 * bicubic/lanczos can't sample enough pixels to create an accurate
 	 * image, so use the bilinear low resolution effect instead */
-	if (video->output_width  < (video->base_width  / 2) &&
-	    video->output_height < (video->base_height / 2)) {
+	if (width  < (video->base_width  / 2) &&
+	    height < (video->base_height / 2)) {
 		return video->bilinear_lowres_effect;
 	}
 
-	switch (video->scale_type) {
+	switch (scale_type) {
 	case OBS_SCALE_BILINEAR: return video->default_effect;
 	case OBS_SCALE_LANCZOS:  return video->lanczos_effect;
 	case OBS_SCALE_BICUBIC:;
@@ -164,14 +292,15 @@ static inline bool resolution_close(struct obs_core_video *video,
 }
 
 static inline gs_effect_t *get_scale_effect(struct obs_core_video *video,
-		uint32_t width, uint32_t height)
+		enum obs_scale_type scale_type, uint32_t width, uint32_t height)
 {
 	if (resolution_close(video, width, height)) {
 		return video->default_effect;
 	} else {
 		/* if the scale method couldn't be loaded, use either bicubic
 		 * or bilinear by default */
-		gs_effect_t *effect = get_scale_effect_internal(video);
+		gs_effect_t *effect = get_scale_effect_internal(video,
+				scale_type, width, height);
 		if (!effect)
 			effect = !!video->bicubic_effect ?
 				video->bicubic_effect :
@@ -180,14 +309,12 @@ static inline gs_effect_t *get_scale_effect(struct obs_core_video *video,
 	}
 }
 
-static const char *render_output_texture_name = "render_output_texture";
-static inline void render_output_texture(struct obs_core_video *video,
-		int cur_texture, int prev_texture)
+/* scales a main texture to the size of the target, applying the color
+ * matrix of the output format */
+static void scale_texture(struct obs_core_video *video,
+		enum obs_scale_type scale_type, const float *color_matrix,
+		gs_texture_t *texture, gs_texture_t *target)
 {
-	profile_start(render_output_texture_name);
-
-	gs_texture_t *texture = video->render_textures[prev_texture];
-	gs_texture_t *target  = video->output_textures[cur_texture];
 	uint32_t     width   = gs_texture_get_width(target);
 	uint32_t     height  = gs_texture_get_height(target);
 	struct vec2  base_i;
@@ -196,7 +323,8 @@ static inline void render_output_texture(struct obs_core_video *video,
 		1.0f / (float)video->base_width,
 		1.0f / (float)video->base_height);
 
-	gs_effect_t    *effect  = get_scale_effect(video, width, height);
+	gs_effect_t    *effect  = get_scale_effect(video, scale_type,
+			width, height);
 	gs_technique_t *tech    = gs_effect_get_technique(effect, "DrawMatrix");
 	gs_eparam_t    *image   = gs_effect_get_param_by_name(effect, "image");
 	gs_eparam_t    *matrix  = gs_effect_get_param_by_name(effect,
@@ -205,16 +333,13 @@ static inline void render_output_texture(struct obs_core_video *video,
 			"base_dimension_i");
 	size_t      passes, i;
 
-	if (!video->textures_rendered[prev_texture])
-		goto end;
-
 	gs_set_render_target(target, NULL);
 	set_render_size(width, height);
 
 	if (bres_i)
 		gs_effect_set_vec2(bres_i, &base_i);
 
-	gs_effect_set_val(matrix, video->color_matrix, sizeof(float) * 16);
+	gs_effect_set_val(matrix, color_matrix, sizeof(float) * 16);
 	gs_effect_set_texture(image, texture);
 
 	gs_enable_blending(false);
@@ -226,6 +351,20 @@ static inline void render_output_texture(struct obs_core_video *video,
 	}
 	gs_technique_end(tech);
 	gs_enable_blending(true);
+}
+
+static const char *render_output_texture_name = "render_output_texture";
+static inline void render_output_texture(struct obs_core_video *video,
+		int cur_texture, int prev_texture)
+{
+	profile_start(render_output_texture_name);
+
+	if (!video->textures_rendered[prev_texture])
+		goto end;
+
+	scale_texture(video, video->scale_type, video->color_matrix,
+			video->render_textures[prev_texture],
+			video->output_textures[cur_texture]);
 
 	video->textures_output[cur_texture] = true;
 
@@ -239,28 +378,23 @@ static inline void set_eparam(gs_effect_t *effect, const char *name, float val)
 	gs_effect_set_float(param, val);
 }
 
-static const char *render_convert_texture_name = "render_convert_texture";
-static void render_convert_texture(struct obs_core_video *video,
-		int cur_texture, int prev_texture)
+/* packs the planes of an output texture into the target, as described by the
+ * conversion layout */
+static void convert_texture(struct obs_core_video *video,
+		const struct obs_conversion_layout *layout,
+		gs_texture_t *texture, gs_texture_t *target,
+		uint32_t width, uint32_t height)
 {
-	profile_start(render_convert_texture_name);
-
-	gs_texture_t *texture = video->output_textures[prev_texture];
-	gs_texture_t *target  = video->convert_textures[cur_texture];
-	float        fwidth  = (float)video->output_width;
-	float        fheight = (float)video->output_height;
+	float        fwidth  = (float)width;
+	float        fheight = (float)height;
 	size_t       passes, i;
 
 	gs_effect_t    *effect  = video->conversion_effect;
 	gs_eparam_t    *image   = gs_effect_get_param_by_name(effect, "image");
-	gs_technique_t *tech    = gs_effect_get_technique(effect,
-			video->conversion_tech);
+	gs_technique_t *tech    = gs_effect_get_technique(effect, layout->tech);
 
-	if (!video->textures_output[prev_texture])
-		goto end;
-
-	set_eparam(effect, "u_plane_offset", (float)video->plane_offsets[1]);
-	set_eparam(effect, "v_plane_offset", (float)video->plane_offsets[2]);
+	set_eparam(effect, "u_plane_offset", (float)layout->plane_offsets[1]);
+	set_eparam(effect, "v_plane_offset", (float)layout->plane_offsets[2]);
 	set_eparam(effect, "width",  fwidth);
 	set_eparam(effect, "height", fheight);
 	set_eparam(effect, "width_i",  1.0f / fwidth);
@@ -269,23 +403,37 @@ static void render_convert_texture(struct obs_core_video *video,
 	set_eparam(effect, "height_d2", fheight * 0.5f);
 	set_eparam(effect, "width_d2_i",  1.0f / (fwidth  * 0.5f));
 	set_eparam(effect, "height_d2_i", 1.0f / (fheight * 0.5f));
-	set_eparam(effect, "input_height", (float)video->conversion_height);
+	set_eparam(effect, "input_height", (float)layout->height);
 
 	gs_effect_set_texture(image, texture);
 
 	gs_set_render_target(target, NULL);
-	set_render_size(video->output_width, video->conversion_height);
+	set_render_size(width, layout->height);
 
 	gs_enable_blending(false);
 	passes = gs_technique_begin(tech);
 	for (i = 0; i < passes; i++) {
 		gs_technique_begin_pass(tech, i);
-		gs_draw_sprite(texture, 0, video->output_width,
-				video->conversion_height);
+		gs_draw_sprite(texture, 0, width, layout->height);
 		gs_technique_end_pass(tech);
 	}
 	gs_technique_end(tech);
 	gs_enable_blending(true);
+}
+
+static const char *render_convert_texture_name = "render_convert_texture";
+static void render_convert_texture(struct obs_core_video *video,
+		int cur_texture, int prev_texture)
+{
+	profile_start(render_convert_texture_name);
+
+	if (!video->textures_output[prev_texture])
+		goto end;
+
+	convert_texture(video, &video->conversion,
+			video->output_textures[prev_texture],
+			video->convert_textures[cur_texture],
+			video->output_width, video->output_height);
 
 	video->textures_converted[cur_texture] = true;
 
@@ -293,37 +441,169 @@ end:
 	profile_end(render_convert_texture_name);
 }
 
+static inline void pop_vframe_info(struct obs_core_video *video,
+		struct obs_vframe_info *vframe_info)
+{
+	if (video->vframe_info_buffer.size < sizeof(*vframe_info)) {
+		vframe_info->timestamp = video->video_time;
+		vframe_info->count = 1;
+		return;
+	}
+
+	circlebuf_pop_front(&video->vframe_info_buffer, vframe_info,
+			sizeof(*vframe_info));
+}
+
 static const char *stage_output_texture_name = "stage_output_texture";
 static inline void stage_output_texture(struct obs_core_video *video,
-		int cur_texture, int prev_texture)
+		int prev_texture)
 {
 	profile_start(stage_output_texture_name);
 
 	gs_texture_t   *texture;
 	bool        texture_ready;
-	gs_stagesurf_t *copy = video->copy_surfaces[cur_texture];
+	size_t      idx;
 
 	if (video->gpu_conversion) {
 		texture = video->convert_textures[prev_texture];
 		texture_ready = video->textures_converted[prev_texture];
 	} else {
 		texture = video->output_textures[prev_texture];
-		texture_ready = video->output_textures[prev_texture];
+		texture_ready = video->textures_output[prev_texture];
 	}
 
-	unmap_last_surface(video);
+	unmap_last_surfaces(video);
 
 	if (!texture_ready)
 		goto end;
 
-	gs_stage_texture(copy, texture);
+	/* every surface is still waiting on the GPU, so rather than stalling
+	 * the graphics thread, skip this frame and let the last staged frame
+	 * cover its duration */
+	if (video->copies_pending == video->num_copy_surfaces) {
+		struct obs_vframe_info vframe_info;
 
-	video->textures_copied[cur_texture] = true;
+		idx = (video->copy_head + video->copies_pending - 1) %
+			video->num_copy_surfaces;
+
+		pop_vframe_info(video, &vframe_info);
+		video->copy_frame_info[idx].count += vframe_info.count;
+		video->copies_skipped++;
+		goto end;
+	}
+
+	idx = (video->copy_head + video->copies_pending) %
+		video->num_copy_surfaces;
+
+	gs_stage_texture(video->copy_surfaces[idx], texture);
+	pop_vframe_info(video, &video->copy_frame_info[idx]);
+
+	video->copies_pending++;
 
 end:
 	profile_end(stage_output_texture_name);
 }
 
+/* ------------------------------------------------------------------------- */
+/* canvases are scaled from the main texture as soon as it's rendered, rather
+ * than a frame later like the main output, and each has its own staging
+ * ring.  the canvases mutex is locked while they're used */
+
+/* returns the number of canvas frames that this video frame covers, or 0 if
+ * the canvas doesn't need a frame yet */
+static inline int canvas_frame_count(struct obs_canvas *canvas,
+		uint64_t video_time, uint64_t half_frame)
+{
+	int count = 1;
+
+	if (!canvas->next_frame_time)
+		canvas->next_frame_time = video_time;
+	if (video_time + half_frame < canvas->next_frame_time)
+		return 0;
+
+	canvas->next_frame_time += canvas->frame_interval;
+
+	if (canvas->next_frame_time <= video_time) {
+		uint64_t missed = (video_time - canvas->next_frame_time) /
+			canvas->frame_interval + 1;
+
+		canvas->next_frame_time += missed * canvas->frame_interval;
+		count += (int)missed;
+	}
+
+	return count;
+}
+
+static void render_canvas(struct obs_core_video *video,
+		struct obs_canvas *canvas, int cur_texture, int count)
+{
+	gs_texture_t *texture = canvas->output_texture;
+	size_t       idx;
+
+	/* as with the main output, if every surface is still waiting on the
+	 * GPU, let the last staged frame cover this one */
+	if (canvas->copies_pending == DEFAULT_STAGE_SURFACES) {
+		idx = (canvas->copy_head + canvas->copies_pending - 1) %
+			DEFAULT_STAGE_SURFACES;
+
+		canvas->copy_frame_info[idx].count += count;
+		canvas->copies_skipped++;
+		return;
+	}
+
+	scale_texture(video, canvas->info.scale_type, canvas->color_matrix,
+			video->render_textures[cur_texture],
+			canvas->output_texture);
+
+	if (canvas->gpu_conversion) {
+		convert_texture(video, &canvas->conversion,
+				canvas->output_texture,
+				canvas->convert_texture,
+				canvas->info.width, canvas->info.height);
+		texture = canvas->convert_texture;
+	}
+
+	idx = (canvas->copy_head + canvas->copies_pending) %
+		DEFAULT_STAGE_SURFACES;
+
+	gs_stage_texture(canvas->copy_surfaces[idx], texture);
+	canvas->copy_frame_info[idx].timestamp = video->video_time;
+	canvas->copy_frame_info[idx].count     = count;
+
+	canvas->copies_pending++;
+}
+
+static const char *render_canvases_name = "render_canvases";
+static inline void render_canvases(struct obs_core_video *video,
+		int cur_texture)
+{
+	struct obs_canvas *canvas;
+	uint64_t half_frame;
+
+	if (!video->textures_rendered[cur_texture])
+		return;
+
+	profile_start(render_canvases_name);
+
+	half_frame = video_output_get_frame_time(video->video) / 2;
+
+	pthread_mutex_lock(&obs->data.canvases_mutex);
+
+	canvas = obs->data.first_canvas;
+	while (canvas) {
+		int count = canvas_frame_count(canvas, video->video_time,
+				half_frame);
+		if (count)
+			render_canvas(video, canvas, cur_texture, count);
+
+		canvas = canvas->next;
+	}
+
+	pthread_mutex_unlock(&obs->data.canvases_mutex);
+
+	profile_end(render_canvases_name);
+}
+
 static inline void render_video(struct obs_core_video *video, int cur_texture,
 		int prev_texture)
 {
@@ -337,7 +617,8 @@ static inline void render_video(struct obs_core_video *video, int cur_texture,
 	if (video->gpu_conversion)
 		render_convert_texture(video, cur_texture, prev_texture);
 
-	stage_output_texture(video, cur_texture, prev_texture);
+	stage_output_texture(video, prev_texture);
+	render_canvases(video, cur_texture);
 
 	gs_set_render_target(NULL, NULL);
 	gs_enable_blending(true);
@@ -345,19 +626,44 @@ static inline void render_video(struct obs_core_video *video, int cur_texture,
 	gs_end_scene();
 }
 
-static inline bool download_frame(struct obs_core_video *video,
-		int prev_texture, struct video_data *frame)
+/* maps the oldest staged surfaces whose copies have completed.  at most
+ * MAX_DOWNLOADS_PER_FRAME are mapped so the ring can catch up after the GPU
+ * falls behind without stalling on surfaces that aren't ready yet */
+static inline size_t download_frames(struct obs_core_video *video,
+		struct video_data *frames, struct obs_vframe_info *vframe_info)
 {
-	gs_stagesurf_t *surface = video->copy_surfaces[prev_texture];
+	size_t count = 0;
+
+	while (count < MAX_DOWNLOADS_PER_FRAME && video->copies_pending) {
+		size_t idx = video->copy_head;
+		gs_stagesurf_t *surface = video->copy_surfaces[idx];
+		struct video_data *frame = &frames[count];
 
-	if (!video->textures_copied[prev_texture])
-		return false;
+		if (!gs_stagesurface_ready(surface))
+			break;
+
+		if (++video->copy_head == video->num_copy_surfaces)
+			video->copy_head = 0;
+		video->copies_pending--;
+
+		/* the frames of a surface that can't be mapped are covered by
+		 * the next frame that is delivered, as with skipped frames */
+		if (!gs_stagesurface_map(surface, &frame->data[0],
+					&frame->linesize[0])) {
+			video->uncounted_frames +=
+				video->copy_frame_info[idx].count;
+			continue;
+		}
 
-	if (!gs_stagesurface_map(surface, &frame->data[0], &frame->linesize[0]))
-		return false;
+		vframe_info[count] = video->copy_frame_info[idx];
+		vframe_info[count].count += video->uncounted_frames;
+		video->uncounted_frames = 0;
+		frame->timestamp = vframe_info[count].timestamp;
+		video->mapped_surfaces[video->num_mapped_surfaces++] = surface;
+		count++;
+	}
 
-	video->mapped_surface = surface;
-	return true;
+	return count;
 }
 
 static inline uint32_t calc_linesize(uint32_t pos, uint32_t linesize)
@@ -397,7 +703,8 @@ static inline uint32_t make_aligned_linesize_offset(uint32_t offset,
 	return (offset / dst_linesize) * src_linesize + remainder;
 }
 
-static void fix_gpu_converted_alignment(struct obs_core_video *video,
+static void fix_gpu_converted_alignment(
+		const struct obs_conversion_layout *layout,
 		struct video_frame *output, const struct video_data *input)
 {
 	uint32_t src_linesize = input->linesize[0];
@@ -405,61 +712,63 @@ static void fix_gpu_converted_alignment(struct obs_core_video *video,
 	uint32_t src_pos      = 0;
 
 	for (size_t i = 0; i < 3; i++) {
-		if (video->plane_linewidth[i] == 0)
+		if (layout->plane_linewidth[i] == 0)
 			break;
 
-		src_pos = make_aligned_linesize_offset(video->plane_offsets[i],
+		src_pos = make_aligned_linesize_offset(layout->plane_offsets[i],
 				dst_linesize, src_linesize);
 
 		copy_dealign(output->data[i], 0, dst_linesize,
 				input->data[0], src_pos, src_linesize,
-				video->plane_sizes[i]);
+				layout->plane_sizes[i]);
 	}
 }
 
-static void set_gpu_converted_data(struct obs_core_video *video,
+static void set_gpu_converted_data(
+		const struct obs_conversion_layout *layout,
 		struct video_frame *output, const struct video_data *input,
 		const struct video_output_info *info)
 {
-	if (input->linesize[0] == video->output_width*4) {
+	if (input->linesize[0] == info->width*4) {
 		struct video_frame frame;
 
 		for (size_t i = 0; i < 3; i++) {
-			if (video->plane_linewidth[i] == 0)
+			if (layout->plane_linewidth[i] == 0)
 				break;
 
-			frame.linesize[i] = video->plane_linewidth[i];
+			frame.linesize[i] = layout->plane_linewidth[i];
 			frame.data[i] =
-				input->data[0] + video->plane_offsets[i];
+				input->data[0] + layout->plane_offsets[i];
 		}
 
 		video_frame_copy(output, &frame, info->format, info->height);
 
 	} else {
-		fix_gpu_converted_alignment(video, output, input);
+		fix_gpu_converted_alignment(layout, output, input);
 	}
 }
 
 static void convert_frame(
 		struct video_frame *output, const struct video_data *input,
-		const struct video_output_info *info)
+		const struct video_output_info *info,
+		uint32_t start_y, uint32_t end_y)
 {
 	if (info->format == VIDEO_FORMAT_I420) {
 		compress_uyvx_to_i420(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_NV12) {
 		compress_uyvx_to_nv12(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_I444) {
 		convert_uyvx_to_i444(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else {
@@ -469,16 +778,17 @@ static void convert_frame(
 
 static inline void copy_rgbx_frame(
 		struct video_frame *output, const struct video_data *input,
-		const struct video_output_info *info)
+		const struct video_output_info *info,
+		uint32_t start_y, uint32_t end_y)
 {
-	uint8_t *in_ptr = input->data[0];
-	uint8_t *out_ptr = output->data[0];
+	uint8_t *in_ptr = input->data[0] + input->linesize[0] * start_y;
+	uint8_t *out_ptr = output->data[0] + output->linesize[0] * start_y;
 
 	/* if the line sizes match, do a single copy */
 	if (input->linesize[0] == output->linesize[0]) {
-		memcpy(out_ptr, in_ptr, input->linesize[0] * info->height);
+		memcpy(out_ptr, in_ptr, input->linesize[0] * (end_y - start_y));
 	} else {
-		for (size_t y = 0; y < info->height; y++) {
+		for (size_t y = start_y; y < end_y; y++) {
 			memcpy(out_ptr, in_ptr, info->width * 4);
 			in_ptr += input->linesize[0];
 			out_ptr += output->linesize[0];
@@ -486,6 +796,26 @@ static inline void copy_rgbx_frame(
 	}
 }
 
+static inline void convert_video_data(struct obs_core_video *video,
+		struct video_frame *output_frame,
+		const struct video_data *input_frame,
+		const struct video_output_info *info,
+		uint32_t start_y, uint32_t end_y, bool first)
+{
+	if (video->gpu_conversion) {
+		/* already converted by the GPU, the copy isn't sliced */
+		if (first)
+			set_gpu_converted_data(&video->conversion,
+					output_frame, input_frame, info);
+
+	} else if (format_is_yuv(info->format)) {
+		convert_frame(output_frame, input_frame, info, start_y, end_y);
+	} else {
+		copy_rgbx_frame(output_frame, input_frame, info,
+				start_y, end_y);
+	}
+}
+
 static inline void output_video_data(struct obs_core_video *video,
 		struct video_data *input_frame, int count)
 {
@@ -498,18 +828,169 @@ static inline void output_video_data(struct obs_core_video *video,
 	locked = video_output_lock_frame(video->video, &output_frame, count,
 			input_frame->timestamp);
 	if (locked) {
-		if (video->gpu_conversion) {
-			set_gpu_converted_data(video, &output_frame,
-					input_frame, info);
+		convert_video_data(video, &output_frame, input_frame, info,
+				0, info->height, true);
+		video_output_unlock_frame(video->video);
+	}
+}
 
-		} else if (format_is_yuv(info->format)) {
-			convert_frame(&output_frame, input_frame, info);
-		} else {
-			copy_rgbx_frame(&output_frame, input_frame, info);
+static void output_canvas_frame(struct obs_canvas *canvas,
+		const struct video_data *input_frame, int count)
+{
+	const struct video_output_info *info;
+	struct video_frame output_frame;
+
+	info = video_output_get_info(canvas->video);
+
+	if (!video_output_lock_frame(canvas->video, &output_frame, count,
+				input_frame->timestamp))
+		return;
+
+	if (canvas->gpu_conversion)
+		set_gpu_converted_data(&canvas->conversion, &output_frame,
+				input_frame, info);
+	else
+		copy_rgbx_frame(&output_frame, input_frame, info,
+				0, info->height);
+
+	video_output_unlock_frame(canvas->video);
+}
+
+/* canvas frames are copied to their video-io frames straight from the mapped
+ * surfaces, without leaving the graphics context */
+static void download_canvas(struct obs_canvas *canvas)
+{
+	size_t count = 0;
+
+	while (count++ < MAX_DOWNLOADS_PER_FRAME && canvas->copies_pending) {
+		size_t idx = canvas->copy_head;
+		gs_stagesurf_t *surface = canvas->copy_surfaces[idx];
+		struct video_data frame;
+
+		if (!gs_stagesurface_ready(surface))
+			break;
+
+		if (++canvas->copy_head == DEFAULT_STAGE_SURFACES)
+			canvas->copy_head = 0;
+		canvas->copies_pending--;
+
+		memset(&frame, 0, sizeof(frame));
+		if (!gs_stagesurface_map(surface, &frame.data[0],
+					&frame.linesize[0])) {
+			canvas->uncounted_frames +=
+				canvas->copy_frame_info[idx].count;
+			continue;
 		}
 
-		video_output_unlock_frame(video->video);
+		frame.timestamp = canvas->copy_frame_info[idx].timestamp;
+		output_canvas_frame(canvas, &frame,
+				canvas->copy_frame_info[idx].count +
+				canvas->uncounted_frames);
+		canvas->uncounted_frames = 0;
+
+		gs_stagesurface_unmap(surface);
+	}
+}
+
+static const char *download_canvases_name = "download_canvases";
+static inline void download_canvases(void)
+{
+	struct obs_canvas *canvas;
+
+	profile_start(download_canvases_name);
+	pthread_mutex_lock(&obs->data.canvases_mutex);
+
+	canvas = obs->data.first_canvas;
+	while (canvas) {
+		download_canvas(canvas);
+		canvas = canvas->next;
 	}
+
+	pthread_mutex_unlock(&obs->data.canvases_mutex);
+	profile_end(download_canvases_name);
+}
+
+/* ------------------------------------------------------------------------- */
+/* pipelined conversion: the mapped surface is handed off to the conversion
+ * threads, each of which converts one horizontal slice.  the last thread to
+ * finish unlocks the video-io frame, and the graphics thread only waits for
+ * the conversion when it needs to unmap/recycle the surface. */
+
+static const char *convert_slice_name = "convert_slice";
+void *obs_convert_thread(void *param)
+{
+	struct obs_convert_thread *ct = param;
+	struct obs_core_video *video = &obs->video;
+	const struct video_output_info *info;
+
+	os_set_thread_name("libobs: conversion thread");
+
+	info = video_output_get_info(video->video);
+
+	const char *convert_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+			"obs_convert_thread(%d)",
+			(int)(ct - video->convert_threads));
+	profile_register_root(convert_thread_name,
+			video_output_get_frame_time(video->video));
+
+	while (os_sem_wait(ct->start_sem) == 0) {
+		if (video->convert_stop)
+			break;
+
+		profile_start(convert_thread_name);
+
+		profile_start(convert_slice_name);
+		convert_video_data(video, &video->convert_output,
+				&video->convert_input, info,
+				ct->start_y, ct->end_y, ct->first);
+		profile_end(convert_slice_name);
+
+		if (os_atomic_dec_long(&video->convert_slices_left) == 0) {
+			video_output_unlock_frame(video->video);
+			os_sem_post(video->convert_done_sem);
+		}
+
+		profile_end(convert_thread_name);
+
+		profile_reenable_thread();
+	}
+
+	return NULL;
+}
+
+static inline void queue_conversion(struct obs_core_video *video,
+		struct video_data *input_frame, int count)
+{
+	bool locked;
+
+	/* more than one frame can be downloaded per tick when catching up */
+	wait_for_conversion(video);
+
+	locked = video_output_lock_frame(video->video,
+			&video->convert_output, count, input_frame->timestamp);
+	if (!locked)
+		return;
+
+	video->convert_input = *input_frame;
+	video->convert_pending = true;
+	os_atomic_set_long(&video->convert_slices_left,
+			(long)video->num_convert_threads);
+
+	for (size_t i = 0; i < video->num_convert_threads; i++)
+		os_sem_post(video->convert_threads[i].start_sem);
+}
+
+static const char *wait_for_conversion_name = "wait_for_conversion";
+static inline void wait_for_conversion(struct obs_core_video *video)
+{
+	if (!video->convert_pending)
+		return;
+
+	profile_start(wait_for_conversion_name);
+	os_sem_wait(video->convert_done_sem);
+	video->convert_pending = false;
+	profile_end(wait_for_conversion_name);
 }
 
 static inline void video_sleep(struct obs_core_video *video,
@@ -539,15 +1020,17 @@ static const char *output_frame_render_video_name = "render_video";
 static const char *output_frame_download_frame_name = "download_frame";
 static const char *output_frame_gs_flush_name = "gs_flush";
 static const char *output_frame_output_video_data_name = "output_video_data";
+static const char *output_frame_queue_conversion_name = "queue_conversion";
 static inline void output_frame(void)
 {
 	struct obs_core_video *video = &obs->video;
 	int cur_texture  = video->cur_texture;
 	int prev_texture = cur_texture == 0 ? NUM_TEXTURES-1 : cur_texture-1;
-	struct video_data frame;
-	bool frame_ready;
+	struct video_data frames[MAX_DOWNLOADS_PER_FRAME];
+	struct obs_vframe_info vframe_info[MAX_DOWNLOADS_PER_FRAME];
+	size_t num_frames;
 
-	memset(&frame, 0, sizeof(struct video_data));
+	memset(frames, 0, sizeof(frames));
 
 	profile_start(output_frame_gs_context_name);
 	gs_enter_context(video->graphics);
@@ -557,9 +1040,11 @@ static inline void output_frame(void)
 	profile_end(output_frame_render_video_name);
 
 	profile_start(output_frame_download_frame_name);
-	frame_ready = download_frame(video, prev_texture, &frame);
+	num_frames = download_frames(video, frames, vframe_info);
 	profile_end(output_frame_download_frame_name);
 
+	download_canvases();
+
 	profile_start(output_frame_gs_flush_name);
 	gs_flush();
 	profile_end(output_frame_gs_flush_name);
@@ -567,15 +1052,18 @@ static inline void output_frame(void)
 	gs_leave_context();
 	profile_end(output_frame_gs_context_name);
 
-	if (frame_ready) {
-		struct obs_vframe_info vframe_info;
-		circlebuf_pop_front(&video->vframe_info_buffer, &vframe_info,
-				sizeof(vframe_info));
-
-		frame.timestamp = vframe_info.timestamp;
-		profile_start(output_frame_output_video_data_name);
-		output_video_data(video, &frame, vframe_info.count);
-		profile_end(output_frame_output_video_data_name);
+	for (size_t i = 0; i < num_frames; i++) {
+		if (video->num_convert_threads) {
+			profile_start(output_frame_queue_conversion_name);
+			queue_conversion(video, &frames[i],
+					vframe_info[i].count);
+			profile_end(output_frame_queue_conversion_name);
+		} else {
+			profile_start(output_frame_output_video_data_name);
+			output_video_data(video, &frames[i],
+					vframe_info[i].count);
+			profile_end(output_frame_output_video_data_name);
+		}
 	}
 
 	if (++video->cur_texture == NUM_TEXTURES)
@@ -608,14 +1096,24 @@ void *obs_video_thread(void *param)
 		last_time = tick_sources(obs->video.video_time, last_time);
 		profile_end(tick_sources_name);
 
-		profile_start(render_displays_name);
-		render_displays();
-		profile_end(render_displays_name);
+		obs_frame_pool_trim(&obs->data.frame_pool);
+
+		if (obs->video.num_upload_threads) {
+			gs_enter_context(obs->video.graphics);
+			upload_async_textures(&obs->video);
+			gs_leave_context();
+		}
 
 		profile_start(output_frame_name);
 		output_frame();
 		profile_end(output_frame_name);
 
+		/* after the frame, so that displays can draw the main texture
+		 * rendered for it (see obs_render_main_texture) */
+		profile_start(render_displays_name);
+		render_displays();
+		profile_end(render_displays_name);
+
 		profile_end(video_thread_name);
 
 		profile_reenable_thread();
@@ -623,6 +1121,13 @@ void *obs_video_thread(void *param)
 		video_sleep(&obs->video, &obs->video.video_time, interval);
 	}
 
+	/* the last mapped surface may still be in use by the conversion
+	 * threads, so make sure they're done with it before returning */
+	if (obs->video.convert_pending) {
+		os_sem_wait(obs->video.convert_done_sem);
+		obs->video.convert_pending = false;
+	}
+
 	UNUSED_PARAMETER(param);
 	return NULL;
 }
@@ -47,124 +47,115 @@ static inline void make_video_info(struct video_output_info *vi,
 #define GET_ALIGN(val, align) \
 	(((val) + (align-1)) & ~(align-1))
 
-static inline void set_420p_sizes(const struct obs_video_info *ovi)
+static inline void set_420p_sizes(struct obs_conversion_layout *layout,
+		uint32_t width, uint32_t height)
 {
-	struct obs_core_video *video = &obs->video;
 	uint32_t chroma_pixels;
 	uint32_t total_bytes;
 
-	chroma_pixels = (ovi->output_width * ovi->output_height / 4);
+	chroma_pixels = (width * height / 4);
 	chroma_pixels = GET_ALIGN(chroma_pixels, PIXEL_SIZE);
 
-	video->plane_offsets[0] = 0;
-	video->plane_offsets[1] = ovi->output_width * ovi->output_height;
-	video->plane_offsets[2] = video->plane_offsets[1] + chroma_pixels;
-
-	video->plane_linewidth[0] = ovi->output_width;
-	video->plane_linewidth[1] = ovi->output_width/2;
-	video->plane_linewidth[2] = ovi->output_width/2;
+	layout->plane_offsets[0] = 0;
+	layout->plane_offsets[1] = width * height;
+	layout->plane_offsets[2] = layout->plane_offsets[1] + chroma_pixels;
 
-	video->plane_sizes[0] = video->plane_offsets[1];
-	video->plane_sizes[1] = video->plane_sizes[0]/4;
-	video->plane_sizes[2] = video->plane_sizes[1];
+	layout->plane_linewidth[0] = width;
+	layout->plane_linewidth[1] = width/2;
+	layout->plane_linewidth[2] = width/2;
 
-	total_bytes = video->plane_offsets[2] + chroma_pixels;
+	layout->plane_sizes[0] = layout->plane_offsets[1];
+	layout->plane_sizes[1] = layout->plane_sizes[0]/4;
+	layout->plane_sizes[2] = layout->plane_sizes[1];
 
-	video->conversion_height =
-		(total_bytes/PIXEL_SIZE + ovi->output_width-1) /
-		ovi->output_width;
+	total_bytes = layout->plane_offsets[2] + chroma_pixels;
 
-	video->conversion_height = GET_ALIGN(video->conversion_height, 2);
-	video->conversion_tech = "Planar420";
+	layout->height = (total_bytes/PIXEL_SIZE + width-1) / width;
+	layout->height = GET_ALIGN(layout->height, 2);
+	layout->tech = "Planar420";
 }
 
-static inline void set_nv12_sizes(const struct obs_video_info *ovi)
+static inline void set_nv12_sizes(struct obs_conversion_layout *layout,
+		uint32_t width, uint32_t height)
 {
-	struct obs_core_video *video = &obs->video;
 	uint32_t chroma_pixels;
 	uint32_t total_bytes;
 
-	chroma_pixels = (ovi->output_width * ovi->output_height / 2);
+	chroma_pixels = (width * height / 2);
 	chroma_pixels = GET_ALIGN(chroma_pixels, PIXEL_SIZE);
 
-	video->plane_offsets[0] = 0;
-	video->plane_offsets[1] = ovi->output_width * ovi->output_height;
+	layout->plane_offsets[0] = 0;
+	layout->plane_offsets[1] = width * height;
 
-	video->plane_linewidth[0] = ovi->output_width;
-	video->plane_linewidth[1] = ovi->output_width;
+	layout->plane_linewidth[0] = width;
+	layout->plane_linewidth[1] = width;
 
-	video->plane_sizes[0] = video->plane_offsets[1];
-	video->plane_sizes[1] = video->plane_sizes[0]/2;
+	layout->plane_sizes[0] = layout->plane_offsets[1];
+	layout->plane_sizes[1] = layout->plane_sizes[0]/2;
 
-	total_bytes = video->plane_offsets[1] + chroma_pixels;
+	total_bytes = layout->plane_offsets[1] + chroma_pixels;
 
-	video->conversion_height =
-		(total_bytes/PIXEL_SIZE + ovi->output_width-1) /
-		ovi->output_width;
-
-	video->conversion_height = GET_ALIGN(video->conversion_height, 2);
-	video->conversion_tech = "NV12";
+	layout->height = (total_bytes/PIXEL_SIZE + width-1) / width;
+	layout->height = GET_ALIGN(layout->height, 2);
+	layout->tech = "NV12";
 }
 
-static inline void set_444p_sizes(const struct obs_video_info *ovi)
+static inline void set_444p_sizes(struct obs_conversion_layout *layout,
+		uint32_t width, uint32_t height)
 {
-	struct obs_core_video *video = &obs->video;
 	uint32_t chroma_pixels;
 	uint32_t total_bytes;
 
-	chroma_pixels = (ovi->output_width * ovi->output_height);
+	chroma_pixels = (width * height);
 	chroma_pixels = GET_ALIGN(chroma_pixels, PIXEL_SIZE);
 
-	video->plane_offsets[0] = 0;
-	video->plane_offsets[1] = chroma_pixels;
-	video->plane_offsets[2] = chroma_pixels + chroma_pixels;
-
-	video->plane_linewidth[0] = ovi->output_width;
-	video->plane_linewidth[1] = ovi->output_width;
-	video->plane_linewidth[2] = ovi->output_width;
+	layout->plane_offsets[0] = 0;
+	layout->plane_offsets[1] = chroma_pixels;
+	layout->plane_offsets[2] = chroma_pixels + chroma_pixels;
 
-	video->plane_sizes[0] = chroma_pixels;
-	video->plane_sizes[1] = chroma_pixels;
-	video->plane_sizes[2] = chroma_pixels;
+	layout->plane_linewidth[0] = width;
+	layout->plane_linewidth[1] = width;
+	layout->plane_linewidth[2] = width;
 
-	total_bytes = video->plane_offsets[2] + chroma_pixels;
+	layout->plane_sizes[0] = chroma_pixels;
+	layout->plane_sizes[1] = chroma_pixels;
+	layout->plane_sizes[2] = chroma_pixels;
 
-	video->conversion_height =
-		(total_bytes/PIXEL_SIZE + ovi->output_width-1) /
-		ovi->output_width;
+	total_bytes = layout->plane_offsets[2] + chroma_pixels;
 
-	video->conversion_height = GET_ALIGN(video->conversion_height, 2);
-	video->conversion_tech = "Planar444";
+	layout->height = (total_bytes/PIXEL_SIZE + width-1) / width;
+	layout->height = GET_ALIGN(layout->height, 2);
+	layout->tech = "Planar444";
 }
 
-static inline void calc_gpu_conversion_sizes(const struct obs_video_info *ovi)
+/* returns false if the GPU can't convert to the format */
+bool obs_calc_conversion_layout(struct obs_conversion_layout *layout,
+		enum video_format format, uint32_t width, uint32_t height)
 {
-	obs->video.conversion_height = 0;
-	memset(obs->video.plane_offsets, 0, sizeof(obs->video.plane_offsets));
-	memset(obs->video.plane_sizes, 0, sizeof(obs->video.plane_sizes));
-	memset(obs->video.plane_linewidth, 0,
-		sizeof(obs->video.plane_linewidth));
+	memset(layout, 0, sizeof(*layout));
 
-	switch ((uint32_t)ovi->output_format) {
+	switch ((uint32_t)format) {
 	case VIDEO_FORMAT_I420:
-		set_420p_sizes(ovi);
+		set_420p_sizes(layout, width, height);
 		break;
 	case VIDEO_FORMAT_NV12:
-		set_nv12_sizes(ovi);
+		set_nv12_sizes(layout, width, height);
 		break;
 	case VIDEO_FORMAT_I444:
-		set_444p_sizes(ovi);
+		set_444p_sizes(layout, width, height);
 		break;
 	}
+
+	return layout->height != 0;
 }
 
 static bool obs_init_gpu_conversion(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
 
-	calc_gpu_conversion_sizes(ovi);
-
-	if (!video->conversion_height) {
+	if (!obs_calc_conversion_layout(&video->conversion,
+				ovi->output_format,
+				ovi->output_width, ovi->output_height)) {
 		blog(LOG_INFO, "GPU conversion not available for format: %u",
 				(unsigned int)ovi->output_format);
 		video->gpu_conversion = false;
@@ -173,7 +164,7 @@ static bool obs_init_gpu_conversion(struct obs_video_info *ovi)
 
 	for (size_t i = 0; i < NUM_TEXTURES; i++) {
 		video->convert_textures[i] = gs_texture_create(
-				ovi->output_width, video->conversion_height,
+				ovi->output_width, video->conversion.height,
 				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
 
 		if (!video->convert_textures[i])
@@ -187,16 +178,23 @@ static bool obs_init_textures(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
 	uint32_t output_height = video->gpu_conversion ?
-		video->conversion_height : ovi->output_height;
+		video->conversion.height : ovi->output_height;
 	size_t i;
 
-	for (i = 0; i < NUM_TEXTURES; i++) {
+	video->num_copy_surfaces = ovi->staging_surfaces ?
+		ovi->staging_surfaces : DEFAULT_STAGE_SURFACES;
+	if (video->num_copy_surfaces > MAX_STAGE_SURFACES)
+		video->num_copy_surfaces = MAX_STAGE_SURFACES;
+
+	for (i = 0; i < video->num_copy_surfaces; i++) {
 		video->copy_surfaces[i] = gs_stagesurface_create(
 				ovi->output_width, output_height, GS_RGBA);
 
 		if (!video->copy_surfaces[i])
 			return false;
+	}
 
+	for (i = 0; i < NUM_TEXTURES; i++) {
 		video->render_textures[i] = gs_texture_create(
 				ovi->base_width, ovi->base_height,
 				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
@@ -295,14 +293,14 @@ static int obs_init_graphics(struct obs_video_info *ovi)
 	return success ? OBS_VIDEO_SUCCESS : OBS_VIDEO_FAIL;
 }
 
-static inline void set_video_matrix(struct obs_core_video *video,
-		struct obs_video_info *ovi)
+void obs_make_color_matrix(float matrix[16], enum video_format format,
+		enum video_colorspace colorspace, enum video_range_type range)
 {
 	struct matrix4 mat;
 	struct vec4 r_row;
 
-	if (format_is_yuv(ovi->output_format)) {
-		video_format_get_parameters(ovi->colorspace, ovi->range,
+	if (format_is_yuv(format)) {
+		video_format_get_parameters(colorspace, range,
 				(float*)&mat, NULL, NULL);
 		matrix4_inv(&mat, &mat);
 
@@ -314,7 +312,123 @@ static inline void set_video_matrix(struct obs_core_video *video,
 		matrix4_identity(&mat);
 	}
 
-	memcpy(video->color_matrix, &mat, sizeof(float) * 16);
+	memcpy(matrix, &mat, sizeof(float) * 16);
+}
+
+static bool obs_init_convert_threads(struct obs_video_info *ovi)
+{
+	struct obs_core_video *video = &obs->video;
+	uint32_t num = ovi->conversion_threads;
+	uint32_t slice_height;
+
+	if (num > MAX_CONVERT_THREADS)
+		num = MAX_CONVERT_THREADS;
+	if (num > ovi->output_height / 2)
+		num = ovi->output_height / 2;
+	if (!num)
+		return true;
+
+	/* slices need to start on even lines for the 4:2:0 kernels */
+	slice_height = (ovi->output_height / num) & ~1;
+
+	video->convert_stop = false;
+	video->convert_pending = false;
+	if (os_sem_init(&video->convert_done_sem, 0) != 0)
+		return false;
+
+	for (uint32_t i = 0; i < num; i++) {
+		struct obs_convert_thread *ct = &video->convert_threads[i];
+
+		ct->start_y = i * slice_height;
+		ct->end_y   = (i == num - 1) ?
+			ovi->output_height : (i + 1) * slice_height;
+		ct->first   = (i == 0);
+
+		if (os_sem_init(&ct->start_sem, 0) != 0)
+			return false;
+		if (pthread_create(&ct->thread, NULL, obs_convert_thread,
+					ct) != 0)
+			return false;
+
+		ct->initialized = true;
+		video->num_convert_threads++;
+	}
+
+	blog(LOG_INFO, "Using %u conversion threads", num);
+	return true;
+}
+
+static void obs_free_convert_threads(void)
+{
+	struct obs_core_video *video = &obs->video;
+
+	video->convert_stop = true;
+
+	for (size_t i = 0; i < MAX_CONVERT_THREADS; i++) {
+		struct obs_convert_thread *ct = &video->convert_threads[i];
+
+		if (ct->initialized) {
+			os_sem_post(ct->start_sem);
+			pthread_join(ct->thread, NULL);
+		}
+
+		os_sem_destroy(ct->start_sem);
+		memset(ct, 0, sizeof(*ct));
+	}
+
+	os_sem_destroy(video->convert_done_sem);
+	video->convert_done_sem = NULL;
+	video->num_convert_threads = 0;
+	video->convert_pending = false;
+}
+
+static bool obs_init_upload_threads(struct obs_video_info *ovi)
+{
+	struct obs_core_video *video = &obs->video;
+	uint32_t num = ovi->upload_threads;
+
+	if (num > MAX_UPLOAD_THREADS)
+		num = MAX_UPLOAD_THREADS;
+	if (!num)
+		return true;
+
+	video->upload_stop = false;
+	if (os_sem_init(&video->upload_start_sem, 0) != 0)
+		return false;
+	if (os_sem_init(&video->upload_done_sem, 0) != 0)
+		return false;
+
+	for (uint32_t i = 0; i < num; i++) {
+		if (pthread_create(&video->upload_threads[i], NULL,
+					obs_upload_thread, NULL) != 0)
+			return false;
+
+		video->num_upload_threads++;
+	}
+
+	blog(LOG_INFO, "Using %u async texture upload threads", num);
+	return true;
+}
+
+static void obs_free_upload_threads(void)
+{
+	struct obs_core_video *video = &obs->video;
+
+	video->upload_stop = true;
+
+	for (size_t i = 0; i < video->num_upload_threads; i++)
+		os_sem_post(video->upload_start_sem);
+	for (size_t i = 0; i < video->num_upload_threads; i++)
+		pthread_join(video->upload_threads[i], NULL);
+
+	os_sem_destroy(video->upload_start_sem);
+	os_sem_destroy(video->upload_done_sem);
+	video->upload_start_sem = NULL;
+	video->upload_done_sem = NULL;
+	video->num_upload_threads = 0;
+
+	da_free(video->async_uploads);
+	da_free(video->upload_slices);
 }
 
 static int obs_init_video(struct obs_video_info *ovi)
@@ -331,7 +445,8 @@ static int obs_init_video(struct obs_video_info *ovi)
 	video->gpu_conversion = ovi->gpu_conversion;
 	video->scale_type     = ovi->scale_type;
 
-	set_video_matrix(video, ovi);
+	obs_make_color_matrix(video->color_matrix, ovi->output_format,
+			ovi->colorspace, ovi->range);
 
 	errorcode = video_output_open(&video->video, &vi);
 
@@ -354,6 +469,11 @@ static int obs_init_video(struct obs_video_info *ovi)
 
 	gs_leave_context();
 
+	if (!obs_init_convert_threads(ovi))
+		return OBS_VIDEO_FAIL;
+	if (!obs_init_upload_threads(ovi))
+		return OBS_VIDEO_FAIL;
+
 	errorcode = pthread_create(&video->video_thread, NULL,
 			obs_video_thread, obs);
 	if (errorcode != 0)
@@ -382,6 +502,9 @@ static void obs_free_video(void)
 {
 	struct obs_core_video *video = &obs->video;
 
+	obs_free_convert_threads();
+	obs_free_upload_threads();
+
 	if (video->video) {
 		video_output_close(video->video);
 		video->video = NULL;
@@ -391,18 +514,21 @@ static void obs_free_video(void)
 
 		gs_enter_context(video->graphics);
 
-		if (video->mapped_surface) {
-			gs_stagesurface_unmap(video->mapped_surface);
-			video->mapped_surface = NULL;
+		for (size_t i = 0; i < video->num_mapped_surfaces; i++) {
+			gs_stagesurface_unmap(video->mapped_surfaces[i]);
+			video->mapped_surfaces[i] = NULL;
 		}
 
-		for (size_t i = 0; i < NUM_TEXTURES; i++) {
+		for (size_t i = 0; i < MAX_STAGE_SURFACES; i++) {
 			gs_stagesurface_destroy(video->copy_surfaces[i]);
+			video->copy_surfaces[i] = NULL;
+		}
+
+		for (size_t i = 0; i < NUM_TEXTURES; i++) {
 			gs_texture_destroy(video->render_textures[i]);
 			gs_texture_destroy(video->convert_textures[i]);
 			gs_texture_destroy(video->output_textures[i]);
 
-			video->copy_surfaces[i]    = NULL;
 			video->render_textures[i]  = NULL;
 			video->convert_textures[i] = NULL;
 			video->output_textures[i]  = NULL;
@@ -412,16 +538,25 @@ static void obs_free_video(void)
 
 		circlebuf_free(&video->vframe_info_buffer);
 
+		if (video->copies_skipped)
+			blog(LOG_INFO, "Video output skipped %"PRIu32" frames "
+					"because the GPU was behind",
+					video->copies_skipped);
+
 		memset(&video->textures_rendered, 0,
 				sizeof(video->textures_rendered));
 		memset(&video->textures_output, 0,
 				sizeof(video->textures_output));
-		memset(&video->textures_copied, 0,
-				sizeof(video->textures_copied));
 		memset(&video->textures_converted, 0,
 				sizeof(video->textures_converted));
 
 		video->cur_texture = 0;
+		video->num_mapped_surfaces = 0;
+		video->num_copy_surfaces = 0;
+		video->copy_head = 0;
+		video->copies_pending = 0;
+		video->copies_skipped = 0;
+		video->uncounted_frames = 0;
 	}
 }
 
@@ -487,6 +622,7 @@ static bool obs_init_data(void)
 	assert(data != NULL);
 
 	pthread_mutex_init_value(&obs->data.displays_mutex);
+	pthread_mutex_init_value(&obs->data.canvases_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -504,8 +640,12 @@ static bool obs_init_data(void)
 		goto fail;
 	if (pthread_mutex_init(&data->services_mutex, &attr) != 0)
 		goto fail;
+	if (pthread_mutex_init(&data->canvases_mutex, &attr) != 0)
+		goto fail;
 	if (!obs_view_init(&data->main_view))
 		goto fail;
+	if (!obs_frame_pool_init(&data->frame_pool))
+		goto fail;
 
 	data->valid = true;
 
@@ -552,6 +692,7 @@ static void obs_free_data(void)
 	FREE_OBS_LINKED_LIST(encoder);
 	FREE_OBS_LINKED_LIST(display);
 	FREE_OBS_LINKED_LIST(service);
+	FREE_OBS_LINKED_LIST(canvas);
 
 	pthread_mutex_destroy(&data->sources_mutex);
 	pthread_mutex_destroy(&data->audio_sources_mutex);
@@ -559,6 +700,9 @@ static void obs_free_data(void)
 	pthread_mutex_destroy(&data->outputs_mutex);
 	pthread_mutex_destroy(&data->encoders_mutex);
 	pthread_mutex_destroy(&data->services_mutex);
+	pthread_mutex_destroy(&data->canvases_mutex);
+
+	obs_frame_pool_free(&data->frame_pool);
 }
 
 static const char *obs_signals[] = {
@@ -915,15 +1059,21 @@ bool obs_reset_audio(const struct obs_audio_info *oai)
 	ai.format = AUDIO_FORMAT_FLOAT_PLANAR;
 	ai.speakers = oai->speakers;
 	ai.buffer_ms = oai->buffer_ms;
+	ai.tick_frames = oai->tick_frames;
+	ai.adaptive_buffering = oai->adaptive_buffering;
 
 	blog(LOG_INFO, "---------------------------------");
 	blog(LOG_INFO, "audio settings reset:\n"
 	               "\tsamples per sec: %d\n"
 	               "\tspeakers:        %d\n"
-	               "\tbuffering (ms):  %d",
+	               "\tbuffering (ms):  %d\n"
+	               "\ttick frames:     %d\n"
+	               "\tadaptive:        %s",
 	               (int)ai.samples_per_sec,
 	               (int)ai.speakers,
-	               (int)ai.buffer_ms);
+	               (int)ai.buffer_ms,
+	               (int)ai.tick_frames,
+	               ai.adaptive_buffering ? "yes" : "no");
 
 	return obs_init_audio(&ai);
 }
@@ -952,6 +1102,9 @@ bool obs_get_video_info(struct obs_video_info *ovi)
 	ovi->output_format = info->format;
 	ovi->fps_num       = info->fps_num;
 	ovi->fps_den       = info->fps_den;
+	ovi->conversion_threads = (uint32_t)video->num_convert_threads;
+	ovi->upload_threads = (uint32_t)video->num_upload_threads;
+	ovi->staging_surfaces = (uint32_t)video->num_copy_surfaces;
 
 	return true;
 }
@@ -969,6 +1122,8 @@ bool obs_get_audio_info(struct obs_audio_info *oai)
 	oai->samples_per_sec = info->samples_per_sec;
 	oai->speakers = info->speakers;
 	oai->buffer_ms = info->buffer_ms;
+	oai->tick_frames = info->tick_frames;
+	oai->adaptive_buffering = info->adaptive_buffering;
 	return true;
 }
 
@@ -1358,6 +1513,36 @@ void obs_render_main_view(void)
 	obs_view_render(&obs->data.main_view);
 }
 
+void obs_render_main_texture(void)
+{
+	struct obs_core_video *video;
+	gs_texture_t *tex;
+	gs_effect_t  *effect;
+	gs_eparam_t  *param;
+	int          last_texture;
+
+	if (!obs) return;
+
+	/* displays are rendered after the frame, so the last texture is the
+	 * one rendered this frame */
+	video = &obs->video;
+	last_texture = video->cur_texture == 0 ?
+		NUM_TEXTURES - 1 : video->cur_texture - 1;
+
+	if (!video->textures_rendered[last_texture])
+		return;
+
+	tex    = video->render_textures[last_texture];
+	effect = video->default_effect;
+	param  = gs_effect_get_param_by_name(effect, "image");
+	gs_effect_set_texture(param, tex);
+
+	gs_enable_blending(false);
+	while (gs_effect_loop(effect, "Draw"))
+		gs_draw_sprite(tex, 0, 0, 0);
+	gs_enable_blending(true);
+}
+
 void obs_set_master_volume(float volume)
 {
 	struct calldata data = {0};
@@ -50,6 +50,7 @@ struct obs_service;
 struct obs_module;
 struct obs_fader;
 struct obs_volmeter;
+struct obs_canvas;
 
 typedef struct obs_display    obs_display_t;
 typedef struct obs_view       obs_view_t;
@@ -62,6 +63,7 @@ typedef struct obs_service    obs_service_t;
 typedef struct obs_module     obs_module_t;
 typedef struct obs_fader      obs_fader_t;
 typedef struct obs_volmeter   obs_volmeter_t;
+typedef struct obs_canvas     obs_canvas_t;
 
 typedef struct obs_weak_source  obs_weak_source_t;
 typedef struct obs_weak_output  obs_weak_output_t;
@@ -172,6 +174,43 @@ struct obs_video_info {
 	enum video_range_type range;       /**< YUV range (if YUV) */
 
 	enum obs_scale_type scale_type;    /**< How to scale if scaling */
+
+	/**
+	 * Number of worker threads used to convert downloaded frames to the
+	 * output format.  If 0, conversion happens on the graphics thread.
+	 */
+	uint32_t            conversion_threads;
+
+	/**
+	 * Number of worker threads used to copy the frames of async sources
+	 * into their textures.  If 0, frames are copied on the graphics
+	 * thread when the source is rendered.
+	 */
+	uint32_t            upload_threads;
+
+	/**
+	 * Number of staging surfaces used to read frames back from the GPU.
+	 * More surfaces allow the GPU to fall further behind before frames
+	 * are skipped.  If 0, the default of 2 is used.
+	 */
+	uint32_t            staging_surfaces;
+};
+
+/**
+ * Canvas initialization structure
+ */
+struct obs_canvas_info {
+	uint32_t            width;         /**< Canvas width */
+	uint32_t            height;        /**< Canvas height */
+	enum video_format   format;        /**< Canvas format */
+
+	uint32_t            fps_num;       /**< Canvas FPS numerator */
+	uint32_t            fps_den;       /**< Canvas FPS denominator */
+
+	enum video_colorspace colorspace;  /**< YUV type (if YUV) */
+	enum video_range_type range;       /**< YUV range (if YUV) */
+
+	enum obs_scale_type scale_type;    /**< How to scale the main texture */
 };
 
 /**
@@ -181,6 +220,20 @@ struct obs_audio_info {
 	uint32_t            samples_per_sec;
 	enum speaker_layout speakers;
 	uint64_t            buffer_ms;
+
+	/**
+	 * If nonzero, audio is mixed and sent to outputs in fixed ticks of
+	 * this many frames (for example 1024, the AAC frame size).  If 0,
+	 * audio is mixed in variable sized chunks every 25 milliseconds.
+	 */
+	uint32_t            tick_frames;
+
+	/**
+	 * If true, buffer_ms is treated as the maximum buffering, and
+	 * buffering is lowered while all audio sources deliver their audio
+	 * in time.  See audio_output_get_buffer_ms for the current value.
+	 */
+	bool                adaptive_buffering;
 };
 
 /**
@@ -233,6 +286,8 @@ struct obs_source_frame {
 
 	/* used internally by libobs */
 	volatile long       refs;
+	void                (*release)(void *param);
+	void                *release_param;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -307,6 +362,17 @@ EXPORT bool obs_get_video_info(struct obs_video_info *ovi);
 /** Gets the current audio settings, returns false if no audio */
 EXPORT bool obs_get_audio_info(struct obs_audio_info *oai);
 
+/** Async video frame pool statistics */
+struct obs_frame_pool_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bytes_resident; /**< Total size of pooled frame buffers */
+	uint64_t bytes_free;     /**< Size of the ones not currently in use */
+};
+
+/** Gets the statistics of the pool that async video frames come from */
+EXPORT void obs_get_frame_pool_stats(struct obs_frame_pool_stats *stats);
+
 /**
  * Opens a plugin module directly from a specific path.
  *
@@ -536,6 +602,14 @@ EXPORT proc_handler_t *obs_get_proc_handler(void);
 /** Renders the main view */
 EXPORT void obs_render_main_view(void);
 
+/**
+ * Draws the last frame rendered for the main view, in base resolution, into
+ * the current viewport.  Unlike obs_render_main_view this does not render
+ * the scene again, so any number of displays can show the main view for the
+ * cost of a single textured quad each.
+ */
+EXPORT void obs_render_main_texture(void);
+
 /** Sets the master user volume */
 EXPORT void obs_set_master_volume(float volume);
 
@@ -634,6 +708,43 @@ EXPORT bool obs_display_enabled(obs_display_t *display);
 EXPORT void obs_display_set_background_color(obs_display_t *display,
 		uint32_t color);
 
+/**
+ * Limits how often a display is redrawn, for displays that do not need to
+ * update at the full frame rate.  0 (the default) redraws it every frame.
+ */
+EXPORT void obs_display_set_max_fps(obs_display_t *display, uint32_t fps);
+
+
+/* ------------------------------------------------------------------------- */
+/* Canvases */
+
+/**
+ * Adds an output canvas: an additional resolution and frame rate that is
+ * scaled and converted on the GPU from the same main texture as the main
+ * output, and output through its own video handler.  Encoders use it with
+ * obs_encoder_set_video.
+ *
+ *   Canvases only support the I420, NV12, I444, RGBA, BGRA and BGRX formats,
+ * and their frame rate should divide that of the main video.  Canvases keep
+ * running through obs_reset_video.
+ *
+ * @param  name  The name of the canvas, used for logging.
+ * @param  info  The resolution, frame rate and format of the canvas.
+ * @return       The new canvas, or NULL if video has not been initialized or
+ *               the parameters are invalid.
+ */
+EXPORT obs_canvas_t *obs_canvas_create(const char *name,
+		const struct obs_canvas_info *info);
+
+/**
+ * Destroys a canvas.  Encoders using its video handler must be stopped and
+ * detached first.
+ */
+EXPORT void obs_canvas_destroy(obs_canvas_t *canvas);
+
+/** Gets the video handler of a canvas */
+EXPORT video_t *obs_canvas_get_video(const obs_canvas_t *canvas);
+
 
 /* ------------------------------------------------------------------------- */
 /* Sources */
@@ -702,6 +813,14 @@ EXPORT void obs_source_update(obs_source_t *source, obs_data_t *settings);
 /** Renders a video source. */
 EXPORT void obs_source_video_render(obs_source_t *source);
 
+/**
+ * Tells libobs that the video of a source has changed, so that any cached
+ * render of it or of the scenes that contain it is drawn again.  Sources
+ * with OBS_SOURCE_CACHEABLE must call this whenever their video changes
+ * other than through obs_source_update.
+ */
+EXPORT void obs_source_invalidate_cache(obs_source_t *source);
+
 /** Gets the width of a source (if it has video) */
 EXPORT uint32_t obs_source_get_width(obs_source_t *source);
 
@@ -752,7 +871,14 @@ EXPORT const char *obs_source_get_id(const obs_source_t *source);
 EXPORT signal_handler_t *obs_source_get_signal_handler(
 		const obs_source_t *source);
 
-/** Returns the procedure handler for a source */
+/**
+ * Returns the procedure handler for a source
+ *
+ *   Sources with asynchronous video have a "get_async_stats" procedure that
+ * returns the number of frames received, shown, shown again because no newer
+ * frame was due, and dropped because a newer frame was due, as well as the
+ * number of frames queued and the timestamp jitter in microseconds.
+ */
 EXPORT proc_handler_t *obs_source_get_proc_handler(const obs_source_t *source);
 
 /** Sets the user volume for a source that has audio output */
@@ -831,6 +957,10 @@ EXPORT void obs_source_set_audio_mixers(obs_source_t *source, uint32_t mixers);
 /** Gets audio mixer flags */
 EXPORT uint32_t obs_source_get_audio_mixers(const obs_source_t *source);
 
+/** Gets the buffering and timing statistics of the source's audio */
+EXPORT bool obs_source_get_audio_stats(obs_source_t *source,
+		struct audio_line_stats *stats);
+
 /**
  * Increments the 'showing' reference counter to indicate that the source is
  * being shown somewhere.  If the reference counter was 0, will call the 'show'
@@ -909,10 +1039,31 @@ EXPORT void obs_source_draw_set_color_matrix(
 EXPORT void obs_source_draw(gs_texture_t *image, int x, int y,
 		uint32_t cx, uint32_t cy, bool flip);
 
-/** Outputs asynchronous video data.  Set to NULL to deactivate the texture */
+/**
+ * Outputs asynchronous video data.  Set to NULL to deactivate the texture and
+ * drop the frames that are still queued.
+ */
 EXPORT void obs_source_output_video(obs_source_t *source,
 		const struct obs_source_frame *frame);
 
+typedef void (*obs_source_frame_release_t)(void *param);
+
+/**
+ * Outputs asynchronous video data without copying it.
+ *
+ *   The frame's planes are used directly, so they must stay valid (and
+ * writable, as async filters may modify them) until libobs calls release,
+ * which it does once the frame has been uploaded or dropped.  Frames whose
+ * planes are not laid out the way video_frame_init_data lays them out are
+ * still copied, and released right away.
+ *
+ *   release may be called from any thread, including from within this call,
+ * so the caller must not hold any lock that release needs while calling this.
+ */
+EXPORT void obs_source_output_video_nocopy(obs_source_t *source,
+		const struct obs_source_frame *frame,
+		obs_source_frame_release_t release, void *param);
+
 /** Outputs audio data (always asynchronous) */
 EXPORT void obs_source_output_audio(obs_source_t *source,
 		const struct obs_source_audio *audio);
@@ -1280,6 +1431,30 @@ EXPORT uint64_t obs_output_get_total_bytes(const obs_output_t *output);
 EXPORT int obs_output_get_frames_dropped(const obs_output_t *output);
 EXPORT int obs_output_get_total_frames(const obs_output_t *output);
 
+/** Stages of the video pipeline that output latency is measured over */
+enum obs_latency_stage {
+	OBS_LATENCY_RENDER,      /**< Render tick to the video output cache */
+	OBS_LATENCY_VIDEO_QUEUE, /**< Video output cache to the encoder */
+	OBS_LATENCY_ENCODE,      /**< Encoder input to the encoded packet */
+	OBS_LATENCY_INTERLEAVE,  /**< Encoded packet to the output */
+	OBS_LATENCY_SEND,        /**< Output to the network, if reported */
+	OBS_LATENCY_TOTAL,       /**< Render tick to the last stage */
+	OBS_LATENCY_STAGE_COUNT
+};
+
+/** Latency of a stage for the video frames of an output, reset every time
+ * the output starts */
+struct obs_latency_stats {
+	uint64_t count;          /**< Frames measured */
+	uint64_t p50_ns;         /**< Median latency */
+	uint64_t p99_ns;         /**< 99th percentile latency */
+	uint64_t max_ns;         /**< Highest latency */
+};
+
+/** Gets the latency statistics of a stage of an output */
+EXPORT bool obs_output_get_latency_stats(const obs_output_t *output,
+		enum obs_latency_stage stage, struct obs_latency_stats *stats);
+
 /**
  * Sets the preferred scaled resolution for this output.  Set width and height
  * to 0 to disable scaling.
@@ -1337,6 +1512,15 @@ EXPORT bool obs_output_begin_data_capture(obs_output_t *output, uint32_t flags);
 /** Ends data capture from media/encoders */
 EXPORT void obs_output_end_data_capture(obs_output_t *output);
 
+/**
+ * Reports that the packet of a video frame has been sent, with the timing of
+ * the packet as it was passed to the output.  Outputs that call this get the
+ * OBS_LATENCY_SEND stage measured, and their total latency measured up to
+ * the send rather than up to the output.
+ */
+EXPORT void obs_output_frame_sent(obs_output_t *output,
+		const struct obs_frame_timing *timing);
+
 /**
  * Signals that the output has stopped itself.
  *
@@ -1437,6 +1621,46 @@ EXPORT void obs_encoder_set_preferred_video_format(obs_encoder_t *encoder,
 EXPORT enum video_format obs_encoder_get_preferred_video_format(
 		const obs_encoder_t *encoder);
 
+/** What to do with a new frame when an encoder thread's queue is full */
+enum obs_encoder_drop_policy {
+	OBS_ENCODER_DROP_NEWEST, /**< Drop the new frame */
+	OBS_ENCODER_DROP_OLDEST, /**< Drop the oldest queued frame */
+	OBS_ENCODER_BLOCK        /**< Wait until the encoder catches up */
+};
+
+/**
+ * Makes the encoder encode on its own thread rather than on the video or
+ * audio thread, so that a slow encoder doesn't hold up every other encoder
+ * using the same video/audio output.  Raw frames are copied into a queue of
+ * up to max_queued frames (0 for the default); when the queue is full,
+ * drop_policy decides what happens.  Audio is never dropped, so audio
+ * encoders always use OBS_ENCODER_BLOCK.
+ *
+ * Takes effect the next time the encoder starts.
+ */
+EXPORT void obs_encoder_set_threaded(obs_encoder_t *encoder, bool threaded,
+		uint32_t max_queued, enum obs_encoder_drop_policy drop_policy);
+EXPORT bool obs_encoder_threaded(const obs_encoder_t *encoder);
+
+/** Encoder statistics, reset every time the encoder starts */
+struct obs_encoder_stats {
+	uint64_t frames_received;    /**< Raw frames/audio packets received */
+	uint64_t frames_encoded;     /**< Calls to the encode callback */
+	uint64_t frames_dropped;     /**< Frames dropped from a full queue */
+
+	uint32_t queue_depth;        /**< Frames currently queued */
+	uint32_t max_queue_depth;    /**< Most frames queued at once */
+
+	uint64_t avg_queue_time_ns;  /**< Average time spent queued */
+	uint64_t max_queue_time_ns;  /**< Longest time spent queued */
+	uint64_t avg_encode_time_ns; /**< Average encode callback duration */
+	uint64_t max_encode_time_ns; /**< Longest encode callback duration */
+};
+
+/** Gets the statistics of an encoder */
+EXPORT bool obs_encoder_get_stats(const obs_encoder_t *encoder,
+		struct obs_encoder_stats *stats);
+
 /** Gets the default settings for an encoder type */
 EXPORT obs_data_t *obs_encoder_defaults(const char *id);
 
@@ -1487,10 +1711,34 @@ EXPORT void *obs_encoder_get_type_data(obs_encoder_t *encoder);
 
 EXPORT const char *obs_encoder_get_id(const obs_encoder_t *encoder);
 
-/** Duplicates an encoder packet */
+/**
+ * Adds a reference to the data of an encoder packet.  Packets passed to
+ * outputs by libobs are reference counted, so all outputs using the same
+ * encoder share the same data rather than each having a copy.  If the
+ * source packet's data isn't reference counted, a shared copy is made.
+ *
+ * Shared packet data is read-only; transform it into a new packet (for
+ * example with obs_parse_avc_packet) or make a private copy with
+ * obs_duplicate_encoder_packet rather than modifying it.
+ */
+EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src);
+
+/** Releases a packet reference, freeing the data with the last reference */
+EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
+
+/**
+ * Duplicates an encoder packet into a private copy of its data, which the
+ * caller may modify.  To keep a packet only to read it, use
+ * obs_encoder_packet_ref instead, which doesn't copy shared data.
+ */
 EXPORT void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src);
 
+/**
+ * Frees an encoder packet from obs_duplicate_encoder_packet (same as
+ * obs_encoder_packet_release, which also frees shared packets)
+ */
 EXPORT void obs_free_encoder_packet(struct encoder_packet *packet);
 
 
@@ -1,6 +1,12 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
 #include <inttypes.h>
 #include "profiler.h"
 
+#include "circlebuf.h"
 #include "darray.h"
 #include "dstr.h"
 #include "platform.h"
@@ -257,6 +263,7 @@ static void merge_call(profile_entry *entry, profile_call *call,
 }
 
 static bool enabled = false;
+static bool trace_mode = false;
 static pthread_mutex_t root_mutex = PTHREAD_MUTEX_INITIALIZER;
 static DARRAY(profile_root_entry) root_entries;
 
@@ -268,6 +275,9 @@ static __thread profile_call *thread_context = NULL;
 static __thread bool thread_enabled = true;
 #endif
 
+static void stop_trace_thread(void);
+static void free_trace(void);
+
 void profiler_start(void)
 {
 	pthread_mutex_lock(&root_mutex);
@@ -277,6 +287,8 @@ void profiler_start(void)
 
 void profiler_stop(void)
 {
+	stop_trace_thread();
+
 	pthread_mutex_lock(&root_mutex);
 	enabled = false;
 	pthread_mutex_unlock(&root_mutex);
@@ -370,17 +382,14 @@ static void merge_context(profile_call *context)
 	free_call_context(prev_call);
 }
 
-void profile_start(const char *name)
+static profile_call *call_begin(profile_call **context, const char *name)
 {
-	if (!thread_enabled)
-		return;
-
 	profile_call new_call = {
 		.name = name,
 #ifdef TRACK_OVERHEAD
 		.overhead_start = os_gettime_ns(),
 #endif
-		.parent = thread_context,
+		.parent = *context,
 	};
 
 	profile_call *call = NULL;
@@ -393,17 +402,17 @@ void profile_start(const char *name)
 		memcpy(call, &new_call, sizeof(profile_call));
 	}
 
-	thread_context = call;
-	call->start_time = os_gettime_ns();
+	*context = call;
+	return call;
 }
 
-void profile_end(const char *name)
-{
-	uint64_t end = os_gettime_ns();
-	if (!thread_enabled)
-		return;
+typedef struct profile_thread_ring profile_thread_ring;
+static void add_trace_call(profile_thread_ring *ring, profile_call *call);
 
-	profile_call *call = thread_context;
+static void call_end(profile_call **context, const char *name, uint64_t end,
+		profile_thread_ring *ring)
+{
+	profile_call *call = *context;
 	if (!call) {
 		blog(LOG_ERROR, "Called profile end with no active profile");
 		return;
@@ -425,24 +434,57 @@ void profile_end(const char *name)
 			return;
 
 		while (call->name != name) {
-			profile_end(call->name);
+			call_end(context, call->name, end, ring);
 			call = call->parent;
 		}
 	}
 
-	thread_context = call->parent;
+	*context = call->parent;
 
 	call->end_time = end;
 #ifdef TRACK_OVERHEAD
 	call->overhead_end = os_gettime_ns();
 #endif
 
+	if (ring)
+		add_trace_call(ring, call);
+
 	if (call->parent)
 		return;
 
 	merge_context(call);
 }
 
+static void trace_event(const char *name, uint64_t time, bool begin);
+
+void profile_start(const char *name)
+{
+	if (!thread_enabled)
+		return;
+
+	if (trace_mode) {
+		trace_event(name, os_gettime_ns(), true);
+		return;
+	}
+
+	profile_call *call = call_begin(&thread_context, name);
+	call->start_time = os_gettime_ns();
+}
+
+void profile_end(const char *name)
+{
+	uint64_t end = os_gettime_ns();
+	if (!thread_enabled)
+		return;
+
+	if (trace_mode) {
+		trace_event(name, end, false);
+		return;
+	}
+
+	call_end(&thread_context, name, end, NULL);
+}
+
 static int profiler_time_entry_compare(const void *first, const void *second)
 {
 	int64_t diff = ((profiler_time_entry*)second)->time_delta -
@@ -806,6 +848,9 @@ void profiler_free(void)
 {
 	DARRAY(profile_root_entry) old_root_entries = {0};
 
+	stop_trace_thread();
+	free_trace();
+
 	pthread_mutex_lock(&root_mutex);
 	enabled = false;
 	da_move(old_root_entries, root_entries);
@@ -831,6 +876,438 @@ void profiler_free(void)
 }
 
 
+/* ------------------------------------------------------------------------- */
+/* Trace recording */
+
+#define DEFAULT_THREAD_EVENTS    16384
+#define DEFAULT_TRACE_CALLS      262144
+#define TRACE_DRAIN_INTERVAL_MS  50
+#define CACHE_LINE_SIZE          64
+
+#ifdef _WIN32
+static inline long load_acquire(volatile long *ptr)
+{
+	return InterlockedOr(ptr, 0);
+}
+
+static inline void store_release(volatile long *ptr, long val)
+{
+	InterlockedExchange(ptr, val);
+}
+#else
+static inline long load_acquire(volatile long *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(volatile long *ptr, long val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+#endif
+
+typedef struct profile_event profile_event;
+struct profile_event {
+	const char *name;
+	uint64_t time;
+	bool begin;
+};
+
+/* each thread writes its events to its own ring, which the aggregation thread
+ * reads, so the threads being profiled never lock or allocate after their
+ * first event */
+struct profile_thread_ring {
+	/* recording thread */
+	volatile long write_pos;
+	unsigned long write_idx;
+	size_t open_calls;
+	size_t skip_depth;
+	uint64_t dropped;
+	char pad0[CACHE_LINE_SIZE];
+
+	/* aggregation thread */
+	volatile long read_pos;
+	profile_call *context;
+	const char *name;
+	char pad1[CACHE_LINE_SIZE];
+
+	unsigned long size;
+	profile_event *events;
+	uint32_t tid;
+	profile_thread_ring *next;
+};
+
+typedef struct trace_call trace_call;
+struct trace_call {
+	const char *name;
+	uint64_t start_time;
+	uint64_t end_time;
+	uint32_t tid;
+};
+
+static volatile bool tracing = false;
+static volatile long trace_generation = 0;
+static uint64_t trace_start_time = 0;
+static size_t thread_events = 0;
+static profile_thread_ring *thread_rings = NULL;
+static uint32_t num_thread_rings = 0;
+
+static pthread_t trace_thread;
+static os_event_t *trace_stop_event = NULL;
+static bool trace_thread_active = false;
+
+/* completed calls are kept for the trace export, dropping the oldest ones
+ * once there are max_trace_calls of them */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct circlebuf trace_calls = {0};
+static size_t max_trace_calls = 0;
+
+#ifdef _MSC_VER
+static __declspec(thread) profile_thread_ring *thread_ring = NULL;
+static __declspec(thread) long thread_ring_generation = 0;
+#else
+static __thread profile_thread_ring *thread_ring = NULL;
+static __thread long thread_ring_generation = 0;
+#endif
+
+static profile_thread_ring *get_thread_ring(void)
+{
+	long generation = os_atomic_load_long(&trace_generation);
+	profile_thread_ring *ring;
+
+	if (thread_ring && thread_ring_generation == generation)
+		return thread_ring;
+
+	ring = bzalloc(sizeof(profile_thread_ring));
+	ring->size = (unsigned long)thread_events;
+	ring->events = bmalloc(sizeof(profile_event) * thread_events);
+
+	pthread_mutex_lock(&root_mutex);
+	if (!tracing || generation != trace_generation) {
+		pthread_mutex_unlock(&root_mutex);
+		bfree(ring->events);
+		bfree(ring);
+		return NULL;
+	}
+
+	ring->tid = ++num_thread_rings;
+	ring->next = thread_rings;
+	thread_rings = ring;
+	pthread_mutex_unlock(&root_mutex);
+
+	thread_ring = ring;
+	thread_ring_generation = generation;
+	return ring;
+}
+
+static void trace_event(const char *name, uint64_t time, bool begin)
+{
+	profile_thread_ring *ring;
+	unsigned long used;
+	profile_event *event;
+
+	if (!os_atomic_load_bool(&tracing))
+		return;
+
+	ring = get_thread_ring();
+	if (!ring)
+		return;
+
+	/* calls nested in a dropped call are dropped with it */
+	if (ring->skip_depth) {
+		if (begin)
+			ring->skip_depth++;
+		else
+			ring->skip_depth--;
+		return;
+	}
+
+	/* calls that were already active when tracing started */
+	if (!begin && !ring->open_calls)
+		return;
+
+	/* a call is only recorded if there is also room for its end and the
+	 * ends of the calls it is nested in, so that every recorded call is
+	 * closed */
+	used = ring->write_idx - (unsigned long)load_acquire(&ring->read_pos);
+	if (begin && used + ring->open_calls + 2 > ring->size) {
+		ring->skip_depth = 1;
+		ring->dropped++;
+		return;
+	}
+
+	event = &ring->events[ring->write_idx & (ring->size - 1)];
+	event->name  = name;
+	event->time  = time;
+	event->begin = begin;
+
+	if (begin)
+		ring->open_calls++;
+	else
+		ring->open_calls--;
+
+	store_release(&ring->write_pos, (long)++ring->write_idx);
+}
+
+static void add_trace_call(profile_thread_ring *ring, profile_call *call)
+{
+	trace_call t_call = {
+		.name = call->name,
+		.start_time = call->start_time,
+		.end_time = call->end_time,
+		.tid = ring->tid,
+	};
+
+	pthread_mutex_lock(&trace_mutex);
+
+	if (!ring->name && !call->parent)
+		ring->name = call->name;
+
+	if (trace_calls.size == max_trace_calls * sizeof(trace_call))
+		circlebuf_pop_front(&trace_calls, NULL, sizeof(trace_call));
+	circlebuf_push_back(&trace_calls, &t_call, sizeof(trace_call));
+
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+/* builds the calls from the events in the same way profile_start and
+ * profile_end do when not tracing, and merges them into the root entries */
+static void drain_ring(profile_thread_ring *ring)
+{
+	unsigned long read_idx  = (unsigned long)ring->read_pos;
+	unsigned long write_idx = (unsigned long)load_acquire(&ring->write_pos);
+
+	for (; read_idx != write_idx; read_idx++) {
+		profile_event *event =
+			&ring->events[read_idx & (ring->size - 1)];
+
+		if (event->begin) {
+			profile_call *call = call_begin(&ring->context,
+					event->name);
+			call->start_time = event->time;
+		} else {
+			call_end(&ring->context, event->name, event->time,
+					ring);
+		}
+	}
+
+	store_release(&ring->read_pos, (long)read_idx);
+}
+
+static void drain_rings(void)
+{
+	profile_thread_ring *ring;
+
+	pthread_mutex_lock(&root_mutex);
+	ring = thread_rings;
+	pthread_mutex_unlock(&root_mutex);
+
+	/* rings are only ever added to the front of the list */
+	for (; ring; ring = ring->next)
+		drain_ring(ring);
+}
+
+static void *trace_thread_func(void *unused)
+{
+	os_set_thread_name("profiler: trace aggregation");
+
+	while (os_event_timedwait(trace_stop_event,
+				TRACE_DRAIN_INTERVAL_MS) == ETIMEDOUT)
+		drain_rings();
+
+	drain_rings();
+
+	UNUSED_PARAMETER(unused);
+	return NULL;
+}
+
+static inline unsigned long next_pow2(size_t size)
+{
+	unsigned long val = 1;
+	while (val < size)
+		val <<= 1;
+	return val;
+}
+
+void profiler_start_trace(size_t events_per_thread, size_t max_calls)
+{
+	if (trace_thread_active)
+		return;
+
+	if (os_event_init(&trace_stop_event, OS_EVENT_TYPE_MANUAL) != 0) {
+		blog(LOG_ERROR, "profiler_start_trace: Failed to create event");
+		profiler_start();
+		return;
+	}
+
+	pthread_mutex_lock(&trace_mutex);
+	max_trace_calls = max_calls ? max_calls : DEFAULT_TRACE_CALLS;
+	circlebuf_reserve(&trace_calls, max_trace_calls * sizeof(trace_call));
+	pthread_mutex_unlock(&trace_mutex);
+
+	pthread_mutex_lock(&root_mutex);
+	thread_events = next_pow2(events_per_thread ?
+			events_per_thread : DEFAULT_THREAD_EVENTS);
+	trace_start_time = os_gettime_ns();
+	trace_generation++;
+	trace_mode = true;
+	tracing = true;
+	enabled = true;
+	pthread_mutex_unlock(&root_mutex);
+
+	if (pthread_create(&trace_thread, NULL, trace_thread_func, NULL) != 0) {
+		blog(LOG_ERROR, "profiler_start_trace: Failed to create "
+				"aggregation thread");
+		os_atomic_set_bool(&tracing, false);
+		return;
+	}
+
+	trace_thread_active = true;
+}
+
+static void stop_trace_thread(void)
+{
+	if (!trace_thread_active)
+		return;
+
+	os_atomic_set_bool(&tracing, false);
+	os_event_signal(trace_stop_event);
+	pthread_join(trace_thread, NULL);
+	os_event_destroy(trace_stop_event);
+
+	trace_stop_event = NULL;
+	trace_thread_active = false;
+}
+
+static void free_trace(void)
+{
+	profile_thread_ring *ring;
+	uint64_t dropped = 0;
+
+	pthread_mutex_lock(&root_mutex);
+	ring = thread_rings;
+	thread_rings = NULL;
+	num_thread_rings = 0;
+	trace_generation++;
+	trace_mode = false;
+	pthread_mutex_unlock(&root_mutex);
+
+	while (ring) {
+		profile_thread_ring *next = ring->next;
+		profile_call *context = ring->context;
+
+		while (context && context->parent)
+			context = context->parent;
+		free_call_context(context);
+
+		dropped += ring->dropped;
+		bfree(ring->events);
+		bfree(ring);
+		ring = next;
+	}
+
+	if (dropped)
+		blog(LOG_INFO, "Profiler trace: %"PRIu64" calls were dropped "
+				"because their thread's buffer was full",
+				dropped);
+
+	pthread_mutex_lock(&trace_mutex);
+	circlebuf_free(&trace_calls);
+	max_trace_calls = 0;
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+static void dstr_cat_json_string(struct dstr *dst, const char *str)
+{
+	dstr_cat_ch(dst, '"');
+
+	for (; str && *str; str++) {
+		unsigned char ch = (unsigned char)*str;
+
+		if (ch == '"' || ch == '\\') {
+			dstr_cat_ch(dst, '\\');
+			dstr_cat_ch(dst, (char)ch);
+		} else if (ch < 0x20) {
+			dstr_catf(dst, "\\u%04x", ch);
+		} else {
+			dstr_cat_ch(dst, (char)ch);
+		}
+	}
+
+	dstr_cat_ch(dst, '"');
+}
+
+static inline double trace_usec(uint64_t ts)
+{
+	return ts > trace_start_time ?
+		(double)(ts - trace_start_time) / 1000.0 : 0.0;
+}
+
+/* writes the kept calls in the Chrome trace event format, with one "complete"
+ * event per call and the threads named after their first root */
+bool profiler_trace_dump_json(const char *filename)
+{
+	struct dstr buffer = {0};
+	struct circlebuf calls;
+	profile_thread_ring *ring;
+	bool first = true;
+	FILE *f;
+
+	f = os_fopen(filename, "wb");
+	if (!f)
+		return false;
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+
+	pthread_mutex_lock(&root_mutex);
+	ring = thread_rings;
+	pthread_mutex_unlock(&root_mutex);
+
+	pthread_mutex_lock(&trace_mutex);
+
+	for (; ring; ring = ring->next) {
+		dstr_printf(&buffer, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":1,\"tid\":%"PRIu32",\"args\":{"
+				"\"name\":", first ? "" : ",\n", ring->tid);
+		if (ring->name)
+			dstr_cat_json_string(&buffer, ring->name);
+		else
+			dstr_catf(&buffer, "\"thread %"PRIu32"\"", ring->tid);
+		dstr_cat(&buffer, "}}");
+
+		fwrite(buffer.array, 1, buffer.len, f);
+		first = false;
+	}
+
+	/* popping from a copy leaves the kept calls in place */
+	calls = trace_calls;
+
+	while (calls.size) {
+		trace_call t_call;
+		circlebuf_pop_front(&calls, &t_call, sizeof(trace_call));
+
+		dstr_printf(&buffer, "%s{\"name\":", first ? "" : ",\n");
+		dstr_cat_json_string(&buffer, t_call.name);
+		dstr_catf(&buffer, ",\"ph\":\"X\",\"pid\":1,\"tid\":%"PRIu32","
+				"\"ts\":%.3f,\"dur\":%.3f}", t_call.tid,
+				trace_usec(t_call.start_time),
+				(double)(t_call.end_time - t_call.start_time) /
+				1000.0);
+
+		fwrite(buffer.array, 1, buffer.len, f);
+		first = false;
+	}
+
+	pthread_mutex_unlock(&trace_mutex);
+
+	fputs("\n]}\n", f);
+	fclose(f);
+
+	dstr_free(&buffer);
+	return true;
+}
+
+
 /* ------------------------------------------------------------------------- */
 /* Profiler name storage */
 
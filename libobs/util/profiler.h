@@ -33,6 +33,22 @@ EXPORT void profiler_print_time_between_calls(profiler_snapshot_t *snap);
 
 EXPORT void profiler_free(void);
 
+/* ------------------------------------------------------------------------- */
+/* Trace recording */
+
+/*
+ * Starts the profiler in trace mode instead of profiler_start.  Each thread
+ * records its profile_start/profile_end calls as events in its own ring of
+ * events_per_thread events, without locking or allocating, and a separate
+ * thread aggregates them into the usual profiler results.  The last max_calls
+ * calls are also kept for profiler_trace_dump_json.  Zero selects the
+ * defaults.  Has to be called before anything is profiled.
+ */
+EXPORT void profiler_start_trace(size_t events_per_thread, size_t max_calls);
+
+/* writes the kept calls as Chrome trace event JSON (chrome://tracing) */
+EXPORT bool profiler_trace_dump_json(const char *filename);
+
 /* ------------------------------------------------------------------------- */
 /* Profiler name storage */
 
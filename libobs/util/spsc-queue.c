@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2013 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include <string.h>
+#include "bmem.h"
+#include "threading.h"
+#include "spsc-queue.h"
+
+#define CACHE_LINE_SIZE 64
+
+/*
+ * The wait handshake below needs sequentially consistent stores and loads
+ * (the consumer stores "waiting" then loads the producer position, the
+ * producer does the opposite), which the os_atomic_* functions do not
+ * guarantee on every architecture, so these are done here directly.
+ */
+#ifdef _WIN32
+static inline long atomic_load(volatile long *ptr)
+{
+	return InterlockedOr(ptr, 0);
+}
+
+static inline long atomic_exchange(volatile long *ptr, long val)
+{
+	return InterlockedExchange(ptr, val);
+}
+
+static inline void *atomic_load_ptr(void *volatile *ptr)
+{
+	return InterlockedCompareExchangePointer(ptr, NULL, NULL);
+}
+
+static inline void atomic_store_ptr(void *volatile *ptr, void *val)
+{
+	InterlockedExchangePointer(ptr, val);
+}
+#else
+static inline long atomic_load(volatile long *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline long atomic_exchange(volatile long *ptr, long val)
+{
+	return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline void *atomic_load_ptr(void *volatile *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_store_ptr(void *volatile *ptr, void *val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+#endif
+
+struct spsc_block {
+	void *volatile     next;
+	volatile long      committed; /* elements written by the producer */
+
+	/* element data follows */
+};
+
+struct spsc_queue {
+	/* consumer */
+	struct spsc_block  *head;
+	size_t             head_idx;
+	char               pad0[CACHE_LINE_SIZE];
+
+	/* producer */
+	struct spsc_block  *tail;
+	size_t             tail_idx;
+	char               pad1[CACHE_LINE_SIZE];
+
+	/* shared, only written when the consumer goes to sleep */
+	volatile long      waiting;
+	os_sem_t           *sem;
+	size_t             element_size;
+	size_t             block_elements;
+};
+
+static inline size_t block_header_size(void)
+{
+	/* keep the elements 16-byte aligned */
+	return (sizeof(struct spsc_block) + 15) & ~(size_t)15;
+}
+
+static struct spsc_block *block_create(struct spsc_queue *queue)
+{
+	struct spsc_block *block = bmalloc(block_header_size() +
+			queue->element_size * queue->block_elements);
+	block->next      = NULL;
+	block->committed = 0;
+	return block;
+}
+
+static inline uint8_t *block_element(struct spsc_queue *queue,
+		struct spsc_block *block, size_t idx)
+{
+	return (uint8_t*)block + block_header_size() +
+		idx * queue->element_size;
+}
+
+spsc_queue_t *spsc_queue_create(size_t element_size, size_t block_elements)
+{
+	struct spsc_queue *queue;
+
+	if (!element_size || !block_elements)
+		return NULL;
+
+	queue = bzalloc(sizeof(struct spsc_queue));
+	queue->element_size   = element_size;
+	queue->block_elements = block_elements;
+
+	if (os_sem_init(&queue->sem, 0) != 0) {
+		bfree(queue);
+		return NULL;
+	}
+
+	queue->head = queue->tail = block_create(queue);
+	return queue;
+}
+
+void spsc_queue_destroy(spsc_queue_t *queue)
+{
+	struct spsc_block *block;
+
+	if (!queue)
+		return;
+
+	block = queue->head;
+	while (block) {
+		struct spsc_block *next = block->next;
+		bfree(block);
+		block = next;
+	}
+
+	os_sem_destroy(queue->sem);
+	bfree(queue);
+}
+
+void spsc_queue_push(spsc_queue_t *queue, const void *data)
+{
+	struct spsc_block *tail = queue->tail;
+
+	if (queue->tail_idx == queue->block_elements) {
+		struct spsc_block *block = block_create(queue);
+
+		/* the consumer frees the full block once it sees the next one,
+		 * so it must not be touched after this */
+		atomic_store_ptr(&tail->next, block);
+		queue->tail     = tail = block;
+		queue->tail_idx = 0;
+	}
+
+	memcpy(block_element(queue, tail, queue->tail_idx), data,
+			queue->element_size);
+	atomic_exchange(&tail->committed, (long)++queue->tail_idx);
+
+	if (atomic_load(&queue->waiting) && atomic_exchange(&queue->waiting, 0))
+		os_sem_post(queue->sem);
+}
+
+static uint8_t *front_element(struct spsc_queue *queue)
+{
+	struct spsc_block *head = queue->head;
+
+	if (queue->head_idx == queue->block_elements) {
+		struct spsc_block *next = atomic_load_ptr(&head->next);
+		if (!next)
+			return NULL;
+
+		bfree(head);
+		queue->head     = head = next;
+		queue->head_idx = 0;
+	}
+
+	if (queue->head_idx == (size_t)atomic_load(&head->committed))
+		return NULL;
+
+	return block_element(queue, head, queue->head_idx);
+}
+
+bool spsc_queue_pop(spsc_queue_t *queue, void *data)
+{
+	uint8_t *element = front_element(queue);
+	if (!element)
+		return false;
+
+	if (data)
+		memcpy(data, element, queue->element_size);
+	queue->head_idx++;
+	return true;
+}
+
+bool spsc_queue_peek(spsc_queue_t *queue, void *data)
+{
+	uint8_t *element = front_element(queue);
+	if (!element)
+		return false;
+
+	memcpy(data, element, queue->element_size);
+	return true;
+}
+
+bool spsc_queue_empty(spsc_queue_t *queue)
+{
+	return front_element(queue) == NULL;
+}
+
+void spsc_queue_wait(spsc_queue_t *queue)
+{
+	if (!spsc_queue_empty(queue))
+		return;
+
+	/* the producer posts the semaphore if it sees this flag, so check
+	 * again after setting it in case a push came in just before */
+	atomic_exchange(&queue->waiting, 1);
+
+	if (!spsc_queue_empty(queue)) {
+		atomic_exchange(&queue->waiting, 0);
+		return;
+	}
+
+	os_sem_wait(queue->sem);
+}
+
+void spsc_queue_wake(spsc_queue_t *queue)
+{
+	atomic_exchange(&queue->waiting, 0);
+	os_sem_post(queue->sem);
+}
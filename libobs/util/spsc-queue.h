@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2013 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Single-producer/single-consumer queue
+ *
+ *   A lock-free queue of fixed-size elements for handing data from one thread
+ * to another.  Exactly one thread may push and exactly one thread may pop,
+ * peek or wait at any given time; those threads never block each other.
+ *
+ *   Elements are stored in linked blocks, so the queue is unbounded.  The
+ * producer and consumer positions are kept on separate cache lines.  A
+ * waiting consumer sleeps on a semaphore that the producer only posts when
+ * the consumer has actually gone to sleep, so pushing to a queue whose
+ * consumer is busy costs no system call.
+ */
+
+#include "c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct spsc_queue;
+typedef struct spsc_queue spsc_queue_t;
+
+/**
+ * Creates a queue of elements of element_size bytes, allocated in blocks of
+ * block_elements elements at a time.
+ */
+EXPORT spsc_queue_t *spsc_queue_create(size_t element_size,
+		size_t block_elements);
+
+/** Destroys the queue.  Elements still in it are discarded. */
+EXPORT void spsc_queue_destroy(spsc_queue_t *queue);
+
+/* producer */
+EXPORT void spsc_queue_push(spsc_queue_t *queue, const void *data);
+
+/* consumer */
+EXPORT bool spsc_queue_pop(spsc_queue_t *queue, void *data);
+EXPORT bool spsc_queue_peek(spsc_queue_t *queue, void *data);
+EXPORT bool spsc_queue_empty(spsc_queue_t *queue);
+
+/**
+ * Blocks until the queue is not empty or spsc_queue_wake is called.  May also
+ * return spuriously, so the caller should check the queue again.
+ */
+EXPORT void spsc_queue_wait(spsc_queue_t *queue);
+
+/** Wakes the consumer up from spsc_queue_wait (from any thread) */
+EXPORT void spsc_queue_wake(spsc_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
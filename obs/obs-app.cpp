@@ -57,6 +57,7 @@ static string currentLogFile;
 static string lastLogFile;
 
 static bool portable_mode = false;
+static bool profiler_trace = false;
 
 QObject *CreateShortcutFilter()
 {
@@ -994,6 +995,8 @@ static void SaveProfilerData(const ProfilerSnapshot &snap)
 	ostringstream dst;
 	dst.write(LITERAL_SIZE("obs-studio/profiler_data/"));
 	dst.write(currentLogFile.c_str(), pos);
+
+	string base = dst.str();
 	dst.write(LITERAL_SIZE(".csv.gz"));
 #undef LITERAL_SIZE
 
@@ -1001,6 +1004,15 @@ static void SaveProfilerData(const ProfilerSnapshot &snap)
 	if (!profiler_snapshot_dump_csv_gz(snap.get(), path))
 		blog(LOG_WARNING, "Could not save profiler data to '%s'",
 				static_cast<const char*>(path));
+
+	if (!profiler_trace)
+		return;
+
+	BPtr<char> tracePath = GetConfigPathPtr(
+			(base + ".trace.json").c_str());
+	if (!profiler_trace_dump_json(tracePath))
+		blog(LOG_WARNING, "Could not save profiler trace to '%s'",
+				static_cast<const char*>(tracePath));
 }
 
 static auto ProfilerFree = [](void *)
@@ -1028,7 +1040,10 @@ static int run_program(fstream &logFile, int argc, char *argv[])
 		prof_release(static_cast<void*>(&ProfilerFree),
 				ProfilerFree);
 
-	profiler_start();
+	if (profiler_trace)
+		profiler_start_trace(0, 0);
+	else
+		profiler_start();
 	profile_register_root(run_program_init, 0);
 
 	auto PrintInitProfile = [&]()
@@ -1437,6 +1452,9 @@ int main(int argc, char *argv[])
 	for (int i = 1; i < argc; i++) {
 		if (arg_is(argv[i], "--portable", "-p")) {
 			portable_mode = true;
+
+		} else if (arg_is(argv[i], "--profiler-trace", nullptr)) {
+			profiler_trace = true;
 		}
 	}
 
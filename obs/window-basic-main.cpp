@@ -712,11 +712,17 @@ bool OBSBasic::InitBasicConfigDefaults()
 	config_set_default_string(basicConfig, "Video", "ColorSpace", "601");
 	config_set_default_string(basicConfig, "Video", "ColorRange",
 			"Partial");
+	config_set_default_uint  (basicConfig, "Video", "ConversionThreads", 0);
+	config_set_default_uint  (basicConfig, "Video", "UploadThreads", 0);
+	config_set_default_uint  (basicConfig, "Video", "StagingSurfaces", 0);
 
 	config_set_default_uint  (basicConfig, "Audio", "SampleRate", 44100);
 	config_set_default_string(basicConfig, "Audio", "ChannelSetup",
 			"Stereo");
 	config_set_default_uint  (basicConfig, "Audio", "BufferingTime", 1000);
+	config_set_default_uint  (basicConfig, "Audio", "TickFrames", 0);
+	config_set_default_bool  (basicConfig, "Audio", "AdaptiveBuffering",
+			false);
 
 	return true;
 }
@@ -1987,7 +1993,7 @@ void OBSBasic::RenderMain(void *data, uint32_t cx, uint32_t cy)
 
 	window->DrawBackdrop(float(ovi.base_width), float(ovi.base_height));
 
-	obs_render_main_view();
+	obs_render_main_texture();
 	gs_load_vertexbuffer(nullptr);
 
 	/* --------------------------------------- */
@@ -2114,6 +2120,12 @@ int OBSBasic::ResetVideo()
 	ovi.adapter        = 0;
 	ovi.gpu_conversion = true;
 	ovi.scale_type     = GetScaleType(basicConfig);
+	ovi.conversion_threads = (uint32_t)config_get_uint(basicConfig,
+			"Video", "ConversionThreads");
+	ovi.upload_threads = (uint32_t)config_get_uint(basicConfig,
+			"Video", "UploadThreads");
+	ovi.staging_surfaces = (uint32_t)config_get_uint(basicConfig,
+			"Video", "StagingSurfaces");
 
 	ret = AttemptToResetVideo(&ovi);
 	if (IS_WIN32 && ret != OBS_VIDEO_SUCCESS) {
@@ -2151,6 +2163,10 @@ bool OBSBasic::ResetAudio()
 		ai.speakers = SPEAKERS_STEREO;
 
 	ai.buffer_ms = config_get_uint(basicConfig, "Audio", "BufferingTime");
+	ai.tick_frames = (uint32_t)config_get_uint(basicConfig, "Audio",
+			"TickFrames");
+	ai.adaptive_buffering = config_get_bool(basicConfig, "Audio",
+			"AdaptiveBuffering");
 
 	return obs_reset_audio(&ai);
 }
@@ -1,5 +1,7 @@
 #include <obs-module.h>
 #include <util/platform.h>
+#include <util/threading.h>
+#include <util/darray.h>
 #include <sys/stat.h>
 
 #define blog(log_level, format, ...) \
@@ -13,36 +15,322 @@
 #define warn(format, ...) \
 	blog(LOG_WARNING, format, ##__VA_ARGS__)
 
+#define FILE_CHECK_INTERVAL_MS 1000
+
+/* a texture found in the image cache, or data decoded to create one */
+struct loaded_image {
+	gs_texture_t         *tex;
+	uint8_t              *data;
+	char                 *file;
+	time_t               timestamp;
+	enum gs_color_format format;
+	uint32_t             cx;
+	uint32_t             cy;
+};
+
 struct image_source {
 	obs_source_t *source;
+	graphics_t   *graphics;
 
-	char         *file;
 	bool         persistent;
-	time_t       file_timestamp;
-	float        update_time_elapsed;
 
 	gs_texture_t *tex;
 	uint32_t     cx;
 	uint32_t     cy;
+
+	/* shared with the loader thread, protected by the loader mutex */
+	char         *file;
+	time_t       file_timestamp;
+	bool         load_requested;
+	bool         watching;
+
+	struct loaded_image  loaded;
+	bool                 loaded_ready;
 };
 
+/* images are decoded on a single thread shared by every image source, and
+ * only uploaded by the sources themselves from the video tick.  the same
+ * thread checks the files of the sources that are showing for changes, so
+ * the video thread never touches the file system */
+struct image_loader {
+	pthread_t            thread;
+	bool                 thread_active;
+	os_event_t           *event;
+	volatile bool        stop;
+
+	pthread_mutex_t      mutex;
+	DARRAY(struct image_source*) sources;
+
+	/* held while decoding, so destroyed sources can wait for it */
+	pthread_mutex_t      decode_mutex;
+};
+
+static struct image_loader loader;
+
 
 static time_t get_modified_timestamp(const char *filename)
 {
 	struct stat stats;
-	stat(filename, &stats);
+	if (stat(filename, &stats) != 0)
+		return 0;
 	return stats.st_mtime;
 }
 
+static void free_loaded_image(struct loaded_image *image)
+{
+	if (image->tex) {
+		obs_enter_graphics();
+		gs_texture_destroy(image->tex);
+		obs_leave_graphics();
+	}
+
+	bfree(image->data);
+	bfree(image->file);
+	memset(image, 0, sizeof(*image));
+}
+
+/* loader mutex must be locked */
+static inline void take_loaded_image(struct image_source *context,
+		struct loaded_image *image)
+{
+	*image = context->loaded;
+	memset(&context->loaded, 0, sizeof(context->loaded));
+	context->loaded_ready = false;
+}
+
+/* loader mutex must be locked */
+static struct image_source *next_load_request(void)
+{
+	for (size_t i = 0; i < loader.sources.num; i++) {
+		struct image_source *context = loader.sources.array[i];
+		if (context->load_requested)
+			return context;
+	}
+
+	return NULL;
+}
+
+/* images that are thrown away are returned in discard, to be freed once the
+ * source can no longer be waiting for this */
+static void decode_image(struct image_source *context,
+		struct loaded_image discard[2])
+{
+	struct loaded_image image = {0};
+	struct loaded_image old = {0};
+	const char *file;
+
+	pthread_mutex_lock(&loader.mutex);
+	image.file = bstrdup(context->file);
+	context->load_requested = false;
+	pthread_mutex_unlock(&loader.mutex);
+
+	file = image.file;
+
+	/* images already loaded by other sources are taken from the cache */
+	if (file && *file) {
+		image.timestamp = get_modified_timestamp(file);
+		image.tex = gs_image_cache_find(context->graphics, file,
+				image.timestamp);
+
+		if (!image.tex) {
+			debug("loading texture '%s'", file);
+			image.data = gs_create_texture_file_data(file,
+					&image.format, &image.cx, &image.cy);
+			if (!image.data)
+				warn("failed to load texture '%s'", file);
+		}
+	}
+
+	pthread_mutex_lock(&loader.mutex);
+
+	/* the result is thrown away if the source was destroyed or unloaded,
+	 * or if the file changed again while it was being decoded */
+	if (da_find(loader.sources, &context, 0) != DARRAY_INVALID &&
+	    context->watching && !context->load_requested) {
+		take_loaded_image(context, &old);
+		context->loaded         = image;
+		context->loaded_ready   = true;
+		context->file_timestamp = image.timestamp;
+		memset(&image, 0, sizeof(image));
+	}
+
+	pthread_mutex_unlock(&loader.mutex);
+
+	discard[0] = old;
+	discard[1] = image;
+}
+
+struct file_check {
+	struct image_source *context;
+	char                *file;
+	time_t              timestamp;
+	time_t              modified;
+};
+
+/* the files are checked with the loader mutex released, since sources take
+ * it from the video tick every frame */
+static void check_modified_files(void)
+{
+	DARRAY(struct file_check) checks;
+
+	da_init(checks);
+
+	pthread_mutex_lock(&loader.mutex);
+
+	for (size_t i = 0; i < loader.sources.num; i++) {
+		struct image_source *context = loader.sources.array[i];
+		struct file_check *check;
+
+		if (!context->watching || context->load_requested ||
+		    !context->file || !*context->file)
+			continue;
+		if (!obs_source_showing(context->source))
+			continue;
+
+		check = da_push_back_new(checks);
+		check->context   = context;
+		check->file      = bstrdup(context->file);
+		check->timestamp = context->file_timestamp;
+	}
+
+	pthread_mutex_unlock(&loader.mutex);
+
+	for (size_t i = 0; i < checks.num; i++) {
+		struct file_check *check = checks.array + i;
+		check->modified = get_modified_timestamp(check->file);
+	}
+
+	pthread_mutex_lock(&loader.mutex);
+
+	/* sources may have been destroyed or changed files in the meantime */
+	for (size_t i = 0; i < checks.num; i++) {
+		struct file_check *check = checks.array + i;
+		struct image_source *context = check->context;
+
+		if (check->timestamp >= check->modified)
+			continue;
+		if (da_find(loader.sources, &context, 0) == DARRAY_INVALID)
+			continue;
+
+		if (context->watching && context->file &&
+		    strcmp(context->file, check->file) == 0 &&
+		    context->file_timestamp == check->timestamp)
+			context->load_requested = true;
+	}
+
+	pthread_mutex_unlock(&loader.mutex);
+
+	for (size_t i = 0; i < checks.num; i++)
+		bfree(checks.array[i].file);
+	da_free(checks);
+}
+
+static void *loader_thread(void *unused)
+{
+	uint64_t last_check = os_gettime_ns();
+
+	UNUSED_PARAMETER(unused);
+	os_set_thread_name("image-source: loader thread");
+
+	while (!loader.stop) {
+		struct image_source *context;
+		uint64_t t;
+
+		os_event_timedwait(loader.event, FILE_CHECK_INTERVAL_MS);
+
+		t = os_gettime_ns();
+		if (t - last_check >= FILE_CHECK_INTERVAL_MS * 1000000ULL) {
+			check_modified_files();
+			last_check = t;
+		}
+
+		for (;;) {
+			struct loaded_image discard[2] = {{0}};
+
+			pthread_mutex_lock(&loader.decode_mutex);
+			pthread_mutex_lock(&loader.mutex);
+			context = loader.stop ? NULL : next_load_request();
+			pthread_mutex_unlock(&loader.mutex);
+
+			if (context)
+				decode_image(context, discard);
+			pthread_mutex_unlock(&loader.decode_mutex);
+
+			/* releasing cached textures enters the graphics
+			 * context, which must not be done while a source
+			 * may be waiting on the decode mutex */
+			free_loaded_image(&discard[0]);
+			free_loaded_image(&discard[1]);
+
+			if (!context)
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+static bool loader_init(void)
+{
+	pthread_mutex_init_value(&loader.mutex);
+	pthread_mutex_init_value(&loader.decode_mutex);
+
+	if (pthread_mutex_init(&loader.mutex, NULL) != 0)
+		return false;
+	if (pthread_mutex_init(&loader.decode_mutex, NULL) != 0)
+		return false;
+	if (os_event_init(&loader.event, OS_EVENT_TYPE_AUTO) != 0)
+		return false;
+	if (pthread_create(&loader.thread, NULL, loader_thread, NULL) != 0)
+		return false;
+
+	loader.thread_active = true;
+	return true;
+}
+
+static void loader_free(void)
+{
+	if (loader.thread_active) {
+		loader.stop = true;
+		os_event_signal(loader.event);
+		pthread_join(loader.thread, NULL);
+		loader.thread_active = false;
+	}
+
+	da_free(loader.sources);
+	os_event_destroy(loader.event);
+	pthread_mutex_destroy(&loader.mutex);
+	pthread_mutex_destroy(&loader.decode_mutex);
+}
+
 static const char *image_source_get_name(void *unused)
 {
 	UNUSED_PARAMETER(unused);
 	return obs_module_text("ImageInput");
 }
 
+/* the current texture is kept until the new one has been decoded */
 static void image_source_load(struct image_source *context)
 {
-	char *file = context->file;
+	pthread_mutex_lock(&loader.mutex);
+	context->load_requested = true;
+	context->watching       = true;
+	pthread_mutex_unlock(&loader.mutex);
+
+	os_event_signal(loader.event);
+}
+
+static void image_source_unload(struct image_source *context)
+{
+	struct loaded_image image;
+
+	pthread_mutex_lock(&loader.mutex);
+	context->load_requested = false;
+	context->watching       = false;
+	take_loaded_image(context, &image);
+	pthread_mutex_unlock(&loader.mutex);
+
+	free_loaded_image(&image);
 
 	obs_enter_graphics();
 
@@ -50,34 +338,46 @@ static void image_source_load(struct image_source *context)
 		gs_texture_destroy(context->tex);
 	context->tex = NULL;
 
-	if (file && *file) {
-		debug("loading texture '%s'", file);
-		context->file_timestamp = get_modified_timestamp(file);
-		context->tex = gs_texture_create_from_file(file);
-		context->update_time_elapsed = 0;
-
-		if (context->tex) {
-			context->cx = gs_texture_get_width(context->tex);
-			context->cy = gs_texture_get_height(context->tex);
-		} else {
-			warn("failed to load texture '%s'", file);
-			context->cx = 0;
-			context->cy = 0;
-		}
-	}
-
 	obs_leave_graphics();
+
+	obs_source_invalidate_cache(context->source);
 }
 
-static void image_source_unload(struct image_source *context)
+/* called from the video tick, so only the upload is done on the graphics
+ * thread */
+static void image_source_upload(struct image_source *context)
 {
+	struct loaded_image image;
+
+	pthread_mutex_lock(&loader.mutex);
+
+	if (!context->loaded_ready) {
+		pthread_mutex_unlock(&loader.mutex);
+		return;
+	}
+
+	take_loaded_image(context, &image);
+
+	pthread_mutex_unlock(&loader.mutex);
+
 	obs_enter_graphics();
 
 	if (context->tex)
 		gs_texture_destroy(context->tex);
-	context->tex = NULL;
+
+	if (image.data)
+		image.tex = gs_image_cache_add(image.file, image.timestamp,
+				image.format, image.cx, image.cy, image.data);
+
+	context->tex = image.tex;
+	context->cx  = image.tex ? gs_texture_get_width(image.tex) : 0;
+	context->cy  = image.tex ? gs_texture_get_height(image.tex) : 0;
+	image.tex    = NULL;
 
 	obs_leave_graphics();
+
+	free_loaded_image(&image);
+	obs_source_invalidate_cache(context->source);
 }
 
 static void image_source_update(void *data, obs_data_t *settings)
@@ -86,9 +386,11 @@ static void image_source_update(void *data, obs_data_t *settings)
 	const char *file = obs_data_get_string(settings, "file");
 	const bool unload = obs_data_get_bool(settings, "unload");
 
-	if (context->file)
-		bfree(context->file);
+	pthread_mutex_lock(&loader.mutex);
+	bfree(context->file);
 	context->file = bstrdup(file);
+	pthread_mutex_unlock(&loader.mutex);
+
 	context->persistent = !unload;
 
 	/* Load the image if the source is persistent or showing */
@@ -124,6 +426,14 @@ static void *image_source_create(obs_data_t *settings, obs_source_t *source)
 	struct image_source *context = bzalloc(sizeof(struct image_source));
 	context->source = source;
 
+	obs_enter_graphics();
+	context->graphics = gs_get_context();
+	obs_leave_graphics();
+
+	pthread_mutex_lock(&loader.mutex);
+	da_push_back(loader.sources, &context);
+	pthread_mutex_unlock(&loader.mutex);
+
 	image_source_update(context, settings);
 	return context;
 }
@@ -132,10 +442,17 @@ static void image_source_destroy(void *data)
 {
 	struct image_source *context = data;
 
+	pthread_mutex_lock(&loader.mutex);
+	da_erase_item(loader.sources, &context);
+	pthread_mutex_unlock(&loader.mutex);
+
+	/* wait for the image being decoded, in case it is this source's */
+	pthread_mutex_lock(&loader.decode_mutex);
+	pthread_mutex_unlock(&loader.decode_mutex);
+
 	image_source_unload(context);
 
-	if (context->file)
-		bfree(context->file);
+	bfree(context->file);
 	bfree(context);
 }
 
@@ -168,18 +485,9 @@ static void image_source_tick(void *data, float seconds)
 {
 	struct image_source *context = data;
 
-	if (!obs_source_showing(context->source)) return;
-
-	context->update_time_elapsed += seconds;
-
-	if (context->update_time_elapsed >= 1.0f) {
-		time_t t = get_modified_timestamp(context->file);
-		context->update_time_elapsed = 0.0f;
+	image_source_upload(context);
 
-		if (context->file_timestamp < t) {
-			image_source_load(context);
-		}
-	}
+	UNUSED_PARAMETER(seconds);
 }
 
 
@@ -209,7 +517,7 @@ static obs_properties_t *image_source_properties(void *unused)
 static struct obs_source_info image_source_info = {
 	.id             = "image_source",
 	.type           = OBS_SOURCE_TYPE_INPUT,
-	.output_flags   = OBS_SOURCE_VIDEO,
+	.output_flags   = OBS_SOURCE_VIDEO | OBS_SOURCE_CACHEABLE,
 	.get_name       = image_source_get_name,
 	.create         = image_source_create,
 	.destroy        = image_source_destroy,
@@ -229,6 +537,16 @@ OBS_MODULE_USE_DEFAULT_LOCALE("image-source", "en-US")
 
 bool obs_module_load(void)
 {
+	if (!loader_init()) {
+		loader_free();
+		return false;
+	}
+
 	obs_register_source(&image_source_info);
 	return true;
 }
+
+void obs_module_unload(void)
+{
+	loader_free();
+}
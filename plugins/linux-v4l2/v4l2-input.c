@@ -63,6 +63,42 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define blog(level, msg, ...) blog(level, "v4l2-input: " msg, ##__VA_ARGS__)
 
+/* buffers that always stay queued in the device, if fewer than this would be
+ * left the frame is copied instead of being handed to obs */
+#define MIN_QUEUED_BUFFERS 2
+
+/* how long to wait for obs to return the last buffers when stopping */
+#define RELEASE_TIMEOUT_MS 1000
+
+struct v4l2_capture;
+
+/**
+ * Reference to a single capture buffer handed to obs
+ */
+struct v4l2_frame_ref {
+	struct v4l2_capture *capture;
+	uint32_t index;
+};
+
+/**
+ * Data structure for the mapped capture buffers
+ *
+ * Captured buffers are given to obs without copying them and are queued to
+ * the device again once obs releases them.  Each buffer held by obs holds a
+ * reference, so that the mapping stays valid until all of them are returned.
+ */
+struct v4l2_capture {
+	pthread_mutex_t mutex;
+	volatile long refs;
+
+	/* device handle while streaming, -1 otherwise */
+	int_fast32_t dev;
+	uint_fast32_t queued;
+
+	struct v4l2_buffer_data buffers;
+	struct v4l2_frame_ref *frames;
+};
+
 /**
  * Data structure for the v4l2 source
  */
@@ -85,7 +121,7 @@ struct v4l2_data {
 	int width;
 	int height;
 	int linesize;
-	struct v4l2_buffer_data buffers;
+	struct v4l2_capture *capture;
 };
 
 /* forward declarations */
@@ -142,6 +178,103 @@ static void v4l2_prep_obs_frame(struct v4l2_data *data,
 	}
 }
 
+/**
+ * Create the capture data and map the buffers of the device
+ */
+static struct v4l2_capture *v4l2_capture_create(int_fast32_t dev)
+{
+	struct v4l2_capture *capture = bzalloc(sizeof(struct v4l2_capture));
+
+	capture->refs = 1;
+	capture->dev  = -1;
+
+	if (pthread_mutex_init(&capture->mutex, NULL) != 0) {
+		bfree(capture);
+		return NULL;
+	}
+
+	if (v4l2_create_mmap(dev, &capture->buffers) < 0) {
+		v4l2_destroy_mmap(&capture->buffers);
+		pthread_mutex_destroy(&capture->mutex);
+		bfree(capture);
+		return NULL;
+	}
+
+	capture->frames = bzalloc(capture->buffers.count *
+			sizeof(struct v4l2_frame_ref));
+	for (uint_fast32_t i = 0; i < capture->buffers.count; ++i) {
+		capture->frames[i].capture = capture;
+		capture->frames[i].index   = i;
+	}
+
+	return capture;
+}
+
+static void v4l2_capture_release(struct v4l2_capture *capture)
+{
+	if (!capture || os_atomic_dec_long(&capture->refs) != 0)
+		return;
+
+	v4l2_destroy_mmap(&capture->buffers);
+	pthread_mutex_destroy(&capture->mutex);
+	bfree(capture->frames);
+	bfree(capture);
+}
+
+/**
+ * Queue a buffer to the device again, must be called with the mutex held
+ */
+static bool v4l2_capture_requeue(struct v4l2_capture *capture,
+		uint32_t index)
+{
+	struct v4l2_buffer buf;
+
+	if (capture->dev == -1)
+		return true;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index  = index;
+
+	if (v4l2_ioctl(capture->dev, VIDIOC_QBUF, &buf) < 0) {
+		blog(LOG_DEBUG, "failed to enqueue buffer");
+		return false;
+	}
+
+	capture->queued++;
+	return true;
+}
+
+/**
+ * Called by obs once it no longer needs a buffer
+ */
+static void v4l2_release_frame(void *param)
+{
+	struct v4l2_frame_ref *ref = param;
+	struct v4l2_capture *capture = ref->capture;
+
+	pthread_mutex_lock(&capture->mutex);
+	v4l2_capture_requeue(capture, ref->index);
+	pthread_mutex_unlock(&capture->mutex);
+
+	v4l2_capture_release(capture);
+}
+
+/**
+ * Wait for obs to return the buffers it still holds
+ */
+static void v4l2_capture_wait(struct v4l2_capture *capture)
+{
+	for (int i = 0; i < RELEASE_TIMEOUT_MS; ++i) {
+		if (os_atomic_load_long(&capture->refs) == 1)
+			return;
+		os_sleep_ms(1);
+	}
+
+	blog(LOG_WARNING, "buffers still in use after stopping capture");
+}
+
 /*
  * Worker thread to get video data
  */
@@ -157,10 +290,17 @@ static void *v4l2_thread(void *vptr)
 	struct v4l2_buffer buf;
 	struct obs_source_frame out;
 	size_t plane_offsets[MAX_AV_PLANES];
+	struct v4l2_capture *capture = data->capture;
+	bool zero_copy;
 
-	if (v4l2_start_capture(data->dev, &data->buffers) < 0)
+	if (v4l2_start_capture(data->dev, &capture->buffers) < 0)
 		goto exit;
 
+	pthread_mutex_lock(&capture->mutex);
+	capture->dev    = data->dev;
+	capture->queued = capture->buffers.count;
+	pthread_mutex_unlock(&capture->mutex);
+
 	frames   = 0;
 	first_ts = 0;
 	v4l2_prep_obs_frame(data, &out, plane_offsets);
@@ -182,10 +322,18 @@ static void *v4l2_thread(void *vptr)
 			continue;
 		}
 
+		memset(&buf, 0, sizeof(buf));
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.memory = V4L2_MEMORY_MMAP;
 
-		if (v4l2_ioctl(data->dev, VIDIOC_DQBUF, &buf) < 0) {
+		pthread_mutex_lock(&capture->mutex);
+		r = v4l2_ioctl(data->dev, VIDIOC_DQBUF, &buf);
+		if (r == 0)
+			capture->queued--;
+		zero_copy = capture->queued >= MIN_QUEUED_BUFFERS;
+		pthread_mutex_unlock(&capture->mutex);
+
+		if (r < 0) {
 			if (errno == EAGAIN)
 				continue;
 			blog(LOG_DEBUG, "failed to dequeue buffer");
@@ -197,23 +345,40 @@ static void *v4l2_thread(void *vptr)
 			first_ts = out.timestamp;
 		out.timestamp -= first_ts;
 
-		start = (uint8_t *) data->buffers.info[buf.index].start;
+		start = (uint8_t *) capture->buffers.info[buf.index].start;
 		for (uint_fast32_t i = 0; i < MAX_AV_PLANES; ++i)
 			out.data[i] = start + plane_offsets[i];
-		obs_source_output_video(data->source, &out);
 
-		if (v4l2_ioctl(data->dev, VIDIOC_QBUF, &buf) < 0) {
-			blog(LOG_DEBUG, "failed to enqueue buffer");
-			break;
+		frames++;
+
+		/* the buffer is queued again when obs releases it */
+		if (zero_copy) {
+			os_atomic_inc_long(&capture->refs);
+			obs_source_output_video_nocopy(data->source, &out,
+					v4l2_release_frame,
+					&capture->frames[buf.index]);
+			continue;
 		}
 
-		frames++;
+		obs_source_output_video(data->source, &out);
+
+		pthread_mutex_lock(&capture->mutex);
+		r = v4l2_capture_requeue(capture, buf.index) ? 0 : -1;
+		pthread_mutex_unlock(&capture->mutex);
+
+		if (r < 0)
+			break;
 	}
 
 	blog(LOG_INFO, "Stopped capture after %"PRIu64" frames", frames);
 
 exit:
+	/* stopping the stream dequeues all buffers, so buffers released by
+	 * obs after this must not be queued again */
+	pthread_mutex_lock(&capture->mutex);
 	v4l2_stop_capture(data->dev);
+	capture->dev = -1;
+	pthread_mutex_unlock(&capture->mutex);
 	return NULL;
 }
 
@@ -784,7 +949,14 @@ static void v4l2_terminate(struct v4l2_data *data)
 		data->thread = 0;
 	}
 
-	v4l2_destroy_mmap(&data->buffers);
+	if (data->capture) {
+		/* drop the frames obs has queued, which returns their
+		 * buffers, and wait for the ones it is still uploading */
+		obs_source_output_video(data->source, NULL);
+		v4l2_capture_wait(data->capture);
+		v4l2_capture_release(data->capture);
+		data->capture = NULL;
+	}
 
 	if (data->dev != -1) {
 		v4l2_close(data->dev);
@@ -892,7 +1064,8 @@ static void v4l2_init(struct v4l2_data *data)
 	blog(LOG_INFO, "Framerate: %.2f fps", (float) fps_denom / fps_num);
 
 	/* map buffers */
-	if (v4l2_create_mmap(data->dev, &data->buffers) < 0) {
+	data->capture = v4l2_capture_create(data->dev);
+	if (!data->capture) {
 		blog(LOG_ERROR, "Failed to map buffers");
 		goto fail;
 	}
@@ -18,6 +18,7 @@
 #include <obs-module.h>
 #include <util/circlebuf.h>
 #include <util/threading.h>
+#include <util/spsc-queue.h>
 #include <util/dstr.h>
 #include <util/darray.h>
 #include <util/platform.h>
@@ -90,12 +91,14 @@ struct ffmpeg_output {
 	pthread_t          start_thread;
 
 	bool               write_thread_active;
-	pthread_mutex_t    write_mutex;
 	pthread_t          write_thread;
 	os_sem_t           *write_sem;
 	os_event_t         *stop_event;
 
-	DARRAY(AVPacket)   packets;
+	/* video and audio are encoded on their own threads, so each has its
+	 * own queue; write_sem is posted once per packet in either */
+	spsc_queue_t       *video_packets;
+	spsc_queue_t       *audio_packets;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -566,10 +569,11 @@ static void ffmpeg_log_callback(void *param, int level, const char *format,
 static void *ffmpeg_output_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct ffmpeg_output *data = bzalloc(sizeof(struct ffmpeg_output));
-	pthread_mutex_init_value(&data->write_mutex);
 	data->output = output;
 
-	if (pthread_mutex_init(&data->write_mutex, NULL) != 0)
+	data->video_packets = spsc_queue_create(sizeof(AVPacket), 64);
+	data->audio_packets = spsc_queue_create(sizeof(AVPacket), 64);
+	if (!data->video_packets || !data->audio_packets)
 		goto fail;
 	if (os_event_init(&data->stop_event, OS_EVENT_TYPE_AUTO) != 0)
 		goto fail;
@@ -582,7 +586,8 @@ static void *ffmpeg_output_create(obs_data_t *settings, obs_output_t *output)
 	return data;
 
 fail:
-	pthread_mutex_destroy(&data->write_mutex);
+	spsc_queue_destroy(data->video_packets);
+	spsc_queue_destroy(data->audio_packets);
 	os_event_destroy(data->stop_event);
 	bfree(data);
 	return NULL;
@@ -601,7 +606,8 @@ static void ffmpeg_output_destroy(void *data)
 
 		ffmpeg_output_stop(output);
 
-		pthread_mutex_destroy(&output->write_mutex);
+		spsc_queue_destroy(output->video_packets);
+		spsc_queue_destroy(output->audio_packets);
 		os_sem_destroy(output->write_sem);
 		os_event_destroy(output->stop_event);
 		bfree(data);
@@ -664,9 +670,7 @@ static void receive_video(void *param, struct video_data *frame)
 		packet.data          = data->dst_picture.data[0];
 		packet.size          = sizeof(AVPicture);
 
-		pthread_mutex_lock(&output->write_mutex);
-		da_push_back(output->packets, &packet);
-		pthread_mutex_unlock(&output->write_mutex);
+		spsc_queue_push(output->video_packets, &packet);
 		os_sem_post(output->write_sem);
 
 	} else {
@@ -688,9 +692,7 @@ static void receive_video(void *param, struct video_data *frame)
 					context->time_base,
 					data->video->time_base);
 
-			pthread_mutex_lock(&output->write_mutex);
-			da_push_back(output->packets, &packet);
-			pthread_mutex_unlock(&output->write_mutex);
+			spsc_queue_push(output->video_packets, &packet);
 			os_sem_post(output->write_sem);
 		} else {
 			ret = 0;
@@ -747,9 +749,7 @@ static void encode_audio(struct ffmpeg_output *output,
 			data->audio->time_base);
 	packet.stream_index = data->audio->index;
 
-	pthread_mutex_lock(&output->write_mutex);
-	da_push_back(output->packets, &packet);
-	pthread_mutex_unlock(&output->write_mutex);
+	spsc_queue_push(output->audio_packets, &packet);
 	os_sem_post(output->write_sem);
 }
 
@@ -812,27 +812,40 @@ static void receive_audio(void *param, struct audio_data *frame)
 	}
 }
 
+/* takes whichever of the two queued packets comes first */
+static bool get_next_packet(struct ffmpeg_output *output, AVPacket *packet)
+{
+	struct ffmpeg_data *data = &output->ff_data;
+	AVPacket video, audio;
+	bool have_video = spsc_queue_peek(output->video_packets, &video);
+	bool have_audio = spsc_queue_peek(output->audio_packets, &audio);
+
+	if (have_video && have_audio) {
+		if (av_compare_ts(video.dts, data->video->time_base,
+		                  audio.dts, data->audio->time_base) <= 0)
+			have_audio = false;
+		else
+			have_video = false;
+	}
+
+	if (have_video)
+		return spsc_queue_pop(output->video_packets, packet);
+	if (have_audio)
+		return spsc_queue_pop(output->audio_packets, packet);
+	return false;
+}
+
 static int process_packet(struct ffmpeg_output *output)
 {
 	AVPacket packet;
-	bool new_packet = false;
 	int ret;
 
-	pthread_mutex_lock(&output->write_mutex);
-	if (output->packets.num) {
-		packet = output->packets.array[0];
-		da_erase(output->packets, 0);
-		new_packet = true;
-	}
-	pthread_mutex_unlock(&output->write_mutex);
-
-	if (!new_packet)
+	if (!get_next_packet(output, &packet))
 		return 0;
 
-	/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d, "
-			"packets queued: %lu",
+	/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d",
 			packet.size, packet.flags,
-			packet.stream_index, output->packets.num);*/
+			packet.stream_index);*/
 
 	ret = av_interleaved_write_frame(output->ff_data.output, &packet);
 	if (ret < 0) {
@@ -1008,13 +1021,15 @@ static void ffmpeg_deactivate(struct ffmpeg_output *output)
 		output->write_thread_active = false;
 	}
 
-	pthread_mutex_lock(&output->write_mutex);
+	for (;;) {
+		AVPacket packet;
 
-	for (size_t i = 0; i < output->packets.num; i++)
-		av_free_packet(output->packets.array+i);
-	da_free(output->packets);
+		if (!spsc_queue_pop(output->video_packets, &packet) &&
+		    !spsc_queue_pop(output->audio_packets, &packet))
+			break;
 
-	pthread_mutex_unlock(&output->write_mutex);
+		av_free_packet(&packet);
+	}
 
 	ffmpeg_data_free(&output->ff_data);
 }
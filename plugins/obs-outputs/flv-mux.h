@@ -21,6 +21,9 @@
 
 #define MILLISECOND_DEN   1000
 
+/* largest codec header at the start of an FLV audio/video tag body */
+#define FLV_MAX_PREFIX_SIZE 5
+
 static uint32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 {
 	return (uint32_t)(val * MILLISECOND_DEN / packet->timebase_den);
@@ -32,3 +35,8 @@ extern bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 		bool write_header, size_t audio_idx);
 extern void flv_packet_mux(struct encoder_packet *packet,
 		uint8_t **output, size_t *size, bool is_header);
+
+/* writes the bytes that precede the packet data in an FLV tag body (codec,
+ * packet type and composition time) and returns how many were written */
+extern size_t flv_packet_prefix(struct encoder_packet *packet, bool is_header,
+		uint8_t prefix[FLV_MAX_PREFIX_SIZE]);
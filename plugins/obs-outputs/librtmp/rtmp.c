@@ -32,6 +32,11 @@
 #include "rtmp_sys.h"
 #include "log.h"
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <poll.h>
+#endif
+
 #ifdef CRYPTO
 #ifdef USE_POLARSSL
 #include <polarssl/havege.h>
@@ -1374,6 +1379,48 @@ ReadN(RTMP *r, char *buffer, int n)
     return nOriginalSize - n;
 }
 
+/* the socket may be switched to non-blocking mode once the stream is
+ * connected; sends that would block wait for it to become writable */
+static int
+SendWouldBlock(int sockerr)
+{
+#ifdef _WIN32
+    return sockerr == WSAEWOULDBLOCK;
+#else
+    return sockerr == EAGAIN || sockerr == EWOULDBLOCK;
+#endif
+}
+
+static int
+WaitWritable(RTMP *r)
+{
+    int ret;
+#ifdef _WIN32
+    fd_set fds;
+    struct timeval tv = {r->Link.timeout, 0};
+
+    FD_ZERO(&fds);
+    FD_SET(r->m_sb.sb_socket, &fds);
+    ret = select(0, NULL, &fds, NULL, &tv);
+#else
+    struct pollfd pfd = {r->m_sb.sb_socket, POLLOUT, 0};
+
+    do
+    {
+        ret = poll(&pfd, 1, r->Link.timeout * 1000);
+    }
+    while (ret < 0 && errno == EINTR);
+#endif
+
+    if (ret <= 0)
+    {
+        RTMP_Log(RTMP_LOGERROR, "%s, %s while waiting to send", __FUNCTION__,
+                 ret == 0 ? "timed out" : "error");
+        return FALSE;
+    }
+    return TRUE;
+}
+
 static int
 WriteN(RTMP *r, const char *buffer, int n)
 {
@@ -1408,6 +1455,10 @@ WriteN(RTMP *r, const char *buffer, int n)
         if (nBytes < 0)
         {
             int sockerr = GetSockError();
+
+            if (SendWouldBlock(sockerr) && WaitWritable(r))
+                continue;
+
             RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d bytes)", __FUNCTION__,
                      sockerr, n);
 
@@ -1419,8 +1470,14 @@ WriteN(RTMP *r, const char *buffer, int n)
             break;
         }
 
+        /* nothing written means the connection is gone, so close it
+         * like on a send error (WriteV does the same) */
         if (nBytes == 0)
+        {
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send wrote 0 bytes", __FUNCTION__);
+            RTMP_Close(r);
             break;
+        }
 
         n -= nBytes;
         ptr += nBytes;
@@ -3905,18 +3962,15 @@ RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
     return wrote;
 }
 
-int
-RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+/* grows the outgoing channel table if needed, then picks the smallest chunk
+ * header type that the previous packet on the channel allows.  *last is set
+ * to the timestamp the header's timestamp delta is relative to. */
+static int
+PrepareChannelOut(RTMP *r, RTMPPacket *packet, uint32_t *last)
 {
     const RTMPPacket *prevPacket;
-    uint32_t last = 0;
-    int nSize;
-    int hSize, cSize;
-    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
-    uint32_t t;
-    char *buffer, *tbuf = NULL, *toff = NULL;
-    int nChunkSize;
-    int tlen;
+
+    *last = 0;
 
     if (packet->m_nChannel >= r->m_channelsAllocatedOut)
     {
@@ -3946,7 +4000,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         if (prevPacket->m_nTimeStamp == packet->m_nTimeStamp
                 && packet->m_headerType == RTMP_PACKET_SIZE_SMALL)
             packet->m_headerType = RTMP_PACKET_SIZE_MINIMUM;
-        last = prevPacket->m_nTimeStamp;
+        *last = prevPacket->m_nTimeStamp;
     }
 
     if (packet->m_headerType > 3)	/* sanity */
@@ -3956,6 +4010,34 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         return FALSE;
     }
 
+    return TRUE;
+}
+
+/* remembers the attributes of the packet last sent on its channel, so the
+ * next packet's header can be compressed against it */
+static void
+RememberChannelOut(RTMP *r, const RTMPPacket *packet)
+{
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+}
+
+int
+RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+{
+    uint32_t last;
+    int nSize;
+    int hSize, cSize;
+    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    uint32_t t;
+    char *buffer, *tbuf = NULL, *toff = NULL;
+    int nChunkSize;
+    int tlen;
+
+    if (!PrepareChannelOut(r, packet, &last))
+        return FALSE;
+
     nSize = packetSize[packet->m_headerType];
     hSize = nSize;
     cSize = 0;
@@ -4116,9 +4198,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         }
     }
 
-    if (!r->m_vecChannelsOut[packet->m_nChannel])
-        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
-    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+    RememberChannelOut(r, packet);
     return TRUE;
 }
 
@@ -5222,3 +5302,247 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
     }
     return size+s2;
 }
+
+#ifdef _WIN32
+typedef WSABUF RTMPIOVec;
+#define RTMPIOVec_Base(v)      ((v)->buf)
+#define RTMPIOVec_Len(v)       ((int)(v)->len)
+#else
+typedef struct iovec RTMPIOVec;
+#define RTMPIOVec_Base(v)      ((char *)(v)->iov_base)
+#define RTMPIOVec_Len(v)       ((int)(v)->iov_len)
+#endif
+
+static inline void
+RTMPIOVec_Set(RTMPIOVec *v, const char *ptr, int len)
+{
+#ifdef _WIN32
+    v->buf = (char *)ptr;
+    v->len = (ULONG)len;
+#else
+    v->iov_base = (void *)ptr;
+    v->iov_len = (size_t)len;
+#endif
+}
+
+/* slices handed to the socket per gather call; each chunk needs at most
+ * three (chunk header, end of the prefix, start of the body) */
+#define RTMP_MAX_IOV 64
+
+/* the gather path writes straight to the socket, so anything that wraps or
+ * transforms the stream has to go through WriteN instead */
+static int
+CanWriteV(const RTMP *r)
+{
+#ifdef CRYPTO
+    if (r->Link.rc4keyOut || r->m_sb.sb_ssl)
+        return FALSE;
+#endif
+    return !(r->Link.protocol & RTMP_FEATURE_HTTP)
+           && !(r->m_bCustomSend && r->m_customSendFunc);
+}
+
+static int
+WriteV(RTMP *r, RTMPIOVec *iov, int iovcnt)
+{
+#if defined(RTMP_NETSTACK_DUMP)
+    for (int i = 0; i < iovcnt; i++)
+        fwrite(RTMPIOVec_Base(&iov[i]), 1, RTMPIOVec_Len(&iov[i]), netstackdump);
+#endif
+
+    while (iovcnt > 0)
+    {
+        int nBytes;
+#ifdef _WIN32
+        DWORD sent = 0;
+        nBytes = WSASend(r->m_sb.sb_socket, iov, iovcnt, &sent, 0, NULL, NULL) == 0 ?
+                 (int)sent : -1;
+#else
+        nBytes = (int)writev(r->m_sb.sb_socket, iov, iovcnt);
+#endif
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+
+            if (SendWouldBlock(sockerr) && WaitWritable(r))
+                continue;
+
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+        {
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send wrote 0 bytes", __FUNCTION__);
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        /* drop the slices that went out and trim a partially sent one */
+        while (iovcnt > 0 && nBytes >= RTMPIOVec_Len(iov))
+        {
+            nBytes -= RTMPIOVec_Len(iov);
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0 && nBytes > 0)
+            RTMPIOVec_Set(iov, RTMPIOVec_Base(iov) + nBytes,
+                          RTMPIOVec_Len(iov) - nBytes);
+    }
+
+    return TRUE;
+}
+
+/* bytes a media message takes on the wire: its first chunk header, the body
+ * and a one byte header for every continuation chunk (the media channel is
+ * below 64, so basic headers are never longer than that) */
+static int
+MediaWireSize(const RTMP *r, const RTMPPacket *packet, uint32_t last)
+{
+    uint32_t t = packet->m_nTimeStamp - last;
+    int nSize = packetSize[packet->m_headerType];
+    int body = (int)packet->m_nBodySize;
+    int chunks = (body + r->m_outChunkSize - 1) / r->m_outChunkSize;
+
+    if (nSize > 1 && t >= 0xffffff)
+        nSize += 4;
+    return nSize + body + (chunks > 1 ? chunks - 1 : 0);
+}
+
+static int
+WriteMediaCopy(RTMP *r, RTMPPacket *packet, const char *prefix, int prefixSize,
+               const char *body, int bodySize)
+{
+    uint32_t last;
+    int ret;
+
+    /* RTMP_SendPacket repeats this, and picks the same header type since
+     * the channel state doesn't change in between */
+    if (!PrepareChannelOut(r, packet, &last))
+        return -1;
+
+    if (!RTMPPacket_Alloc(packet, packet->m_nBodySize))
+    {
+        RTMP_Log(RTMP_LOGDEBUG, "%s, failed to allocate packet", __FUNCTION__);
+        return -1;
+    }
+
+    memcpy(packet->m_body, prefix, prefixSize);
+    memcpy(packet->m_body + prefixSize, body, bodySize);
+
+    ret = RTMP_SendPacket(r, packet, FALSE);
+    RTMPPacket_Free(packet);
+    return ret ? MediaWireSize(r, packet, last) : -1;
+}
+
+/* Sends one audio/video message whose body is prefix followed by body,
+ * without building an FLV tag for RTMP_Write to parse back apart.  The
+ * message goes out on the same channel with the same header compression as
+ * RTMP_Write, but the chunk headers are kept in a separate buffer and sent
+ * together with slices of the caller's data using a single gather write per
+ * batch of chunks.  Connections that cannot take a gather write (RTMPT,
+ * encryption, custom send functions) copy the body into a packet and use
+ * RTMP_SendPacket.  Returns the number of bytes sent, chunk headers
+ * included, or -1 on failure. */
+int
+RTMP_WriteMedia(RTMP *r, uint8_t packetType, uint32_t timestamp,
+                const char *prefix, int prefixSize,
+                const char *body, int bodySize, int streamIdx)
+{
+    RTMPPacket packet = {0};
+    RTMPIOVec iov[RTMP_MAX_IOV];
+    char hbuf[RTMP_MAX_HEADER_SIZE], *hptr, *hend = hbuf + sizeof(hbuf);
+    char cont;
+    uint32_t last, t;
+    int nSize, iovcnt = 0, sent;
+    int remaining, offset = 0;
+
+    /* only channels below 64 keep the basic header to one byte */
+    packet.m_nChannel = 0x04;	/* source channel, as in RTMP_Write */
+    packet.m_packetType = packetType;
+    packet.m_nTimeStamp = timestamp;
+    packet.m_nInfoField2 = r->Link.streams[streamIdx].id;
+    packet.m_nBodySize = prefixSize + bodySize;
+    packet.m_headerType = timestamp ?
+                          RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
+
+    if (!CanWriteV(r))
+        return WriteMediaCopy(r, &packet, prefix, prefixSize, body, bodySize);
+
+    if (!PrepareChannelOut(r, &packet, &last))
+        return -1;
+
+    nSize = packetSize[packet.m_headerType];
+    t = packet.m_nTimeStamp - last;
+
+    hptr = hbuf;
+    *hptr++ = (char)((packet.m_headerType << 6) | packet.m_nChannel);
+
+    if (nSize > 1)
+        hptr = AMF_EncodeInt24(hptr, hend, t > 0xffffff ? 0xffffff : t);
+
+    if (nSize > 4)
+    {
+        hptr = AMF_EncodeInt24(hptr, hend, packet.m_nBodySize);
+        *hptr++ = packet.m_packetType;
+    }
+
+    if (nSize > 8)
+        hptr += EncodeInt32LE(hptr, packet.m_nInfoField2);
+
+    if (nSize > 1 && t >= 0xffffff)
+        hptr = AMF_EncodeInt32(hptr, hend, t);
+
+    cont = (char)(0xc0 | packet.m_nChannel);
+    sent = MediaWireSize(r, &packet, last);
+
+    RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d, size=%d", __FUNCTION__, (int)r->m_sb.sb_socket,
+             (int)packet.m_nBodySize);
+
+    remaining = (int)packet.m_nBodySize;
+    while (remaining > 0)
+    {
+        int chunk = remaining < r->m_outChunkSize ? remaining : r->m_outChunkSize;
+        int end = offset + chunk;
+
+        if (offset == 0)
+        {
+            RTMPIOVec_Set(&iov[iovcnt++], hbuf, (int)(hptr - hbuf));
+        }
+        else
+        {
+            RTMPIOVec_Set(&iov[iovcnt++], &cont, 1);
+        }
+
+        if (offset < prefixSize)
+        {
+            int n = (end < prefixSize ? end : prefixSize) - offset;
+            RTMPIOVec_Set(&iov[iovcnt++], prefix + offset, n);
+        }
+        if (end > prefixSize)
+        {
+            int start = offset > prefixSize ? offset - prefixSize : 0;
+            RTMPIOVec_Set(&iov[iovcnt++], body + start, end - prefixSize - start);
+        }
+
+        offset = end;
+        remaining -= chunk;
+
+        if (iovcnt + 3 > RTMP_MAX_IOV || remaining == 0)
+        {
+            if (!WriteV(r, iov, iovcnt))
+                return -1;
+            iovcnt = 0;
+        }
+    }
+
+    RememberChannelOut(r, &packet);
+    return sent;
+}
@@ -413,6 +413,9 @@ extern "C"
     void RTMP_DropRequest(RTMP *r, int i, int freeit);
     int RTMP_Read(RTMP *r, char *buf, int size);
     int RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx);
+    int RTMP_WriteMedia(RTMP *r, uint8_t packetType, uint32_t timestamp,
+                        const char *prefix, int prefixSize,
+                        const char *body, int bodySize, int streamIdx);
 
     /* hashswf.c */
     int RTMP_HashSWF(const char *url, unsigned int *size, unsigned char *hash,
@@ -21,6 +21,8 @@
 #include <util/circlebuf.h>
 #include <util/dstr.h>
 #include <util/threading.h>
+#include <util/profiler.h>
+#include <util/spsc-queue.h>
 #include <inttypes.h>
 #include "librtmp/rtmp.h"
 #include "librtmp/log.h"
@@ -30,6 +32,12 @@
 #include <Iphlpapi.h>
 #else
 #include <sys/ioctl.h>
+#include <fcntl.h>
+#endif
+
+#ifdef __linux__
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
 #endif
 
 #define do_log(level, format, ...) \
@@ -48,8 +56,18 @@
 struct rtmp_stream {
 	obs_output_t     *output;
 
+	/* packets from the encoders, moved into the packet buffer (and
+	 * dropped from it when congested) by the send thread, or by the
+	 * encoder thread while the send thread is busy sending */
+	spsc_queue_t     *incoming;
+
+	/* the mutex guards the packet buffer, the statistics and popping from
+	 * the incoming queue.  sending is set while the send thread is not
+	 * touching the incoming queue, which is when the encoder thread may
+	 * move packets over itself. */
 	pthread_mutex_t  packets_mutex;
 	struct circlebuf packets;
+	bool             sending;
 	bool             sent_headers;
 
 	volatile bool    connecting;
@@ -61,7 +79,6 @@ struct rtmp_stream {
 
 	int              max_shutdown_time_sec;
 
-	os_sem_t         *send_sem;
 	os_event_t       *stop_event;
 
 	struct dstr      path, key;
@@ -77,6 +94,17 @@ struct rtmp_stream {
 
 	uint64_t         total_bytes_sent;
 	int              dropped_frames;
+	int              dropped_frames_by_priority[OBS_NAL_PRIORITY_HIGHEST + 1];
+
+	/* congestion metrics, written by the send thread and read by the
+	 * proc handler under packets_mutex */
+	int64_t          buffered_bytes;
+	int64_t          send_queue_bytes;
+	uint32_t         rtt_usec;
+	bool             have_drain_rate;
+	uint64_t         drain_bytes_per_sec;
+	uint64_t         drain_window_start_ns;
+	uint64_t         drain_window_start_bytes;
 
 	RTMP             rtmp;
 };
@@ -96,22 +124,27 @@ static void log_rtmp(int level, const char *format, va_list args)
 }
 
 static inline size_t num_buffered_packets(struct rtmp_stream *stream);
+static void receive_packets(struct rtmp_stream *stream);
 
 static inline void free_packets(struct rtmp_stream *stream)
 {
+	struct encoder_packet packet;
 	size_t num_packets;
 
 	pthread_mutex_lock(&stream->packets_mutex);
 
+	while (spsc_queue_pop(stream->incoming, &packet))
+		obs_encoder_packet_release(&packet);
+
 	num_packets = num_buffered_packets(stream);
 	if (num_packets)
 		info("Freeing %d remaining packets", (int)num_packets);
 
 	while (stream->packets.size) {
-		struct encoder_packet packet;
 		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-		obs_free_encoder_packet(&packet);
+		obs_encoder_packet_release(&packet);
 	}
+	stream->buffered_bytes = 0;
 	pthread_mutex_unlock(&stream->packets_mutex);
 }
 
@@ -149,27 +182,54 @@ static void rtmp_stream_destroy(void *data)
 		os_event_signal(stream->stop_event);
 
 		if (active(stream)) {
-			os_sem_post(stream->send_sem);
+			spsc_queue_wake(stream->incoming);
 			obs_output_end_data_capture(stream->output);
 			pthread_join(stream->send_thread, NULL);
 		}
 	}
 
 	if (stream) {
-		free_packets(stream);
+		if (stream->incoming)
+			free_packets(stream);
 		dstr_free(&stream->path);
 		dstr_free(&stream->key);
 		dstr_free(&stream->username);
 		dstr_free(&stream->password);
 		dstr_free(&stream->encoder_name);
 		os_event_destroy(stream->stop_event);
-		os_sem_destroy(stream->send_sem);
+		spsc_queue_destroy(stream->incoming);
 		pthread_mutex_destroy(&stream->packets_mutex);
 		circlebuf_free(&stream->packets);
 		bfree(stream);
 	}
 }
 
+static void rtmp_stream_get_congestion(void *data, calldata_t *cd)
+{
+	struct rtmp_stream *stream = data;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	calldata_set_int(cd, "send_queue_bytes", stream->send_queue_bytes);
+	calldata_set_int(cd, "buffered_bytes",   stream->buffered_bytes);
+	calldata_set_int(cd, "rtt_usec",         stream->rtt_usec);
+	calldata_set_int(cd, "bandwidth_bps",
+			(long long)(stream->drain_bytes_per_sec * 8));
+	pthread_mutex_unlock(&stream->packets_mutex);
+}
+
+static void rtmp_stream_get_dropped_frames(void *data, calldata_t *cd)
+{
+	struct rtmp_stream *stream = data;
+	const int *dropped = stream->dropped_frames_by_priority;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	calldata_set_int(cd, "disposable", dropped[OBS_NAL_PRIORITY_DISPOSABLE]);
+	calldata_set_int(cd, "low",        dropped[OBS_NAL_PRIORITY_LOW]);
+	calldata_set_int(cd, "high",       dropped[OBS_NAL_PRIORITY_HIGH]);
+	calldata_set_int(cd, "highest",    dropped[OBS_NAL_PRIORITY_HIGHEST]);
+	pthread_mutex_unlock(&stream->packets_mutex);
+}
+
 static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
@@ -180,11 +240,24 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 	RTMP_LogSetCallback(log_rtmp);
 	RTMP_LogSetLevel(RTMP_LOGWARNING);
 
+	stream->incoming = spsc_queue_create(sizeof(struct encoder_packet), 64);
+	if (!stream->incoming)
+		goto fail;
 	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
 		goto fail;
 	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail;
 
+	proc_handler_add(obs_output_get_proc_handler(output),
+			"void get_congestion(out int send_queue_bytes, "
+			"out int buffered_bytes, out int rtt_usec, "
+			"out int bandwidth_bps)",
+			rtmp_stream_get_congestion, stream);
+	proc_handler_add(obs_output_get_proc_handler(output),
+			"void get_dropped_frames(out int disposable, "
+			"out int low, out int high, out int highest)",
+			rtmp_stream_get_dropped_frames, stream);
+
 	UNUSED_PARAMETER(settings);
 	return stream;
 
@@ -206,7 +279,7 @@ static void rtmp_stream_stop(void *data)
 	os_event_signal(stream->stop_event);
 
 	if (active(stream)) {
-		os_sem_post(stream->send_sem);
+		spsc_queue_wake(stream->incoming);
 		obs_output_end_data_capture(stream->output);
 	}
 }
@@ -231,11 +304,23 @@ static inline bool get_next_packet(struct rtmp_stream *stream,
 	bool new_packet = false;
 
 	pthread_mutex_lock(&stream->packets_mutex);
-	if (stream->packets.size) {
+	receive_packets(stream);
+
+	while (stream->packets.size) {
 		circlebuf_pop_front(&stream->packets, packet,
 				sizeof(struct encoder_packet));
-		new_packet = true;
+
+		/* skip the slots of packets that were dropped */
+		if (packet->data) {
+			stream->buffered_bytes -= (int64_t)packet->size;
+			new_packet = true;
+			break;
+		}
 	}
+
+	/* without a packet the send thread goes on to wait on the incoming
+	 * queue, which only it may touch then */
+	stream->sending = new_packet;
 	pthread_mutex_unlock(&stream->packets_mutex);
 
 	return new_packet;
@@ -281,10 +366,12 @@ static bool discard_recv_data(struct rtmp_stream *stream, size_t size)
 static int send_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet, bool is_header, size_t idx)
 {
-	uint8_t *data;
-	size_t  size;
-	int     recv_size = 0;
-	int     ret = 0;
+	uint8_t  prefix[FLV_MAX_PREFIX_SIZE];
+	size_t   prefix_size;
+	uint8_t  type;
+	uint32_t time_ms;
+	int      recv_size = 0;
+	int      ret = 0;
 
 #ifdef _WIN32
 	ret = ioctlsocket(stream->rtmp.m_sb.sb_socket, FIONREAD,
@@ -298,19 +385,105 @@ static int send_packet(struct rtmp_stream *stream,
 			return -1;
 	}
 
-	flv_packet_mux(packet, &data, &size, is_header);
+	if (!packet->data || !packet->size) {
+		obs_encoder_packet_release(packet);
+		return 0;
+	}
+
+	/* the packet data is sent as is, preceded by the same codec bytes and
+	 * timestamp an FLV tag would carry, without muxing it first */
+	prefix_size = flv_packet_prefix(packet, is_header, prefix);
+	type = packet->type == OBS_ENCODER_VIDEO ?
+		RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO;
+	time_ms = get_ms_time(packet, packet->dts) & 0x7FFFFFFF;
+
 #ifdef TEST_FRAMEDROPS
 	os_sleep_ms(rand() % 40);
 #endif
-	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size, (int)idx);
-	bfree(data);
+	ret = RTMP_WriteMedia(&stream->rtmp, type, time_ms,
+			(const char*)prefix, (int)prefix_size,
+			(const char*)packet->data, (int)packet->size, (int)idx);
 
-	obs_free_encoder_packet(packet);
+	obs_encoder_packet_release(packet);
 
-	stream->total_bytes_sent += size;
+	if (ret > 0)
+		stream->total_bytes_sent += ret;
 	return ret;
 }
 
+/* bytes given to the socket that have not been acknowledged (Linux) or not
+ * sent (macOS) yet; other platforms do not report it, in which case the
+ * drain rate is simply the rate at which the socket accepts data */
+static int64_t get_send_queue_bytes(struct rtmp_stream *stream)
+{
+#if defined(__linux__)
+	int outq = 0;
+	if (ioctl(stream->rtmp.m_sb.sb_socket, SIOCOUTQ, &outq) == 0)
+		return outq;
+#elif defined(__APPLE__)
+	int nwrite = 0;
+	socklen_t size = sizeof(nwrite);
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_NWRITE,
+				&nwrite, &size) == 0)
+		return nwrite;
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+	return 0;
+}
+
+static uint32_t get_rtt_usec(struct rtmp_stream *stream)
+{
+#ifdef __linux__
+	struct tcp_info tcp_info;
+	socklen_t size = sizeof(tcp_info);
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP, TCP_INFO,
+				&tcp_info, &size) == 0)
+		return tcp_info.tcpi_rtt;
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+	return 0;
+}
+
+#define DRAIN_WINDOW_NS 500000000ULL
+#define DRAIN_STALL_NS  2000000000ULL
+
+static void update_congestion(struct rtmp_stream *stream)
+{
+	uint64_t now        = os_gettime_ns();
+	int64_t  send_queue = get_send_queue_bytes(stream);
+	uint32_t rtt_usec   = get_rtt_usec(stream);
+	uint64_t drained    = stream->total_bytes_sent;
+
+	if (send_queue > 0 && (uint64_t)send_queue < drained)
+		drained -= (uint64_t)send_queue;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+
+	stream->send_queue_bytes = send_queue;
+	stream->rtt_usec         = rtt_usec;
+
+	if (!stream->drain_window_start_ns) {
+		stream->drain_window_start_ns    = now;
+		stream->drain_window_start_bytes = drained;
+
+	} else if (now - stream->drain_window_start_ns >= DRAIN_WINDOW_NS) {
+		uint64_t bytes = drained > stream->drain_window_start_bytes ?
+			drained - stream->drain_window_start_bytes : 0;
+		uint64_t rate  = bytes * 1000000000ULL /
+			(now - stream->drain_window_start_ns);
+
+		stream->drain_bytes_per_sec = stream->have_drain_rate ?
+			(stream->drain_bytes_per_sec * 3 + rate) / 4 : rate;
+		stream->have_drain_rate          = true;
+		stream->drain_window_start_ns    = now;
+		stream->drain_window_start_bytes = drained;
+	}
+
+	pthread_mutex_unlock(&stream->packets_mutex);
+}
+
 static inline void send_headers(struct rtmp_stream *stream);
 
 static bool send_remaining_packets(struct rtmp_stream *stream)
@@ -338,27 +511,45 @@ static bool send_remaining_packets(struct rtmp_stream *stream)
 	return true;
 }
 
+static const char *send_packet_name = "rtmp_stream_send_packet";
+
 static void *send_thread(void *data)
 {
 	struct rtmp_stream *stream = data;
 
 	os_set_thread_name("rtmp-stream: send_thread");
 
-	while (os_sem_wait(stream->send_sem) == 0) {
+	while (!stopping(stream)) {
 		struct encoder_packet packet;
+		struct obs_frame_timing timing;
+		bool is_video;
+		int ret;
 
-		if (stopping(stream))
-			break;
-		if (!get_next_packet(stream, &packet))
+		if (!get_next_packet(stream, &packet)) {
+			spsc_queue_wait(stream->incoming);
 			continue;
+		}
 
 		if (!stream->sent_headers)
 			send_headers(stream);
 
-		if (send_packet(stream, &packet, false, packet.track_idx) < 0) {
+		/* the packet is released by send_packet */
+		timing   = packet.timing;
+		is_video = packet.type == OBS_ENCODER_VIDEO;
+
+		profile_start(send_packet_name);
+		ret = send_packet(stream, &packet, false, packet.track_idx);
+		profile_end(send_packet_name);
+
+		if (ret < 0) {
 			os_atomic_set_bool(&stream->disconnected, true);
 			break;
 		}
+
+		if (is_video)
+			obs_output_frame_sent(stream->output, &timing);
+
+		update_congestion(stream);
 	}
 
 	if (!disconnected(stream) && !send_remaining_packets(stream))
@@ -371,6 +562,14 @@ static void *send_thread(void *data)
 		info("User stopped the stream");
 	}
 
+	if (stream->dropped_frames)
+		info("Dropped frames by priority: disposable %d, low %d, "
+		     "high %d, highest %d",
+		     stream->dropped_frames_by_priority[0],
+		     stream->dropped_frames_by_priority[1],
+		     stream->dropped_frames_by_priority[2],
+		     stream->dropped_frames_by_priority[3]);
+
 	RTMP_Close(&stream->rtmp);
 
 	if (!stopping(stream)) {
@@ -378,6 +577,10 @@ static void *send_thread(void *data)
 		obs_output_signal_stop(stream->output, OBS_OUTPUT_DISCONNECTED);
 	}
 
+	pthread_mutex_lock(&stream->packets_mutex);
+	stream->sending = false;
+	pthread_mutex_unlock(&stream->packets_mutex);
+
 	os_event_reset(stream->stop_event);
 	os_atomic_set_bool(&stream->active, false);
 	stream->sent_headers = false;
@@ -449,12 +652,6 @@ static inline void send_headers(struct rtmp_stream *stream)
 	while (send_audio_header(stream, i++));
 }
 
-static inline bool reset_semaphore(struct rtmp_stream *stream)
-{
-	os_sem_destroy(stream->send_sem);
-	return os_sem_init(&stream->send_sem, 0) == 0;
-}
-
 #ifdef _WIN32
 #define socklen_t int
 #endif
@@ -476,6 +673,25 @@ static void adjust_sndbuf_size(struct rtmp_stream *stream, int new_size)
 	}
 }
 
+/* sends that would block wait in poll instead (see WriteN in librtmp).
+ * TLS and RTMPT connections still need blocking reads/writes. */
+static void set_nonblocking(struct rtmp_stream *stream)
+{
+	RTMP *rtmp = &stream->rtmp;
+
+	if (rtmp->m_sb.sb_ssl || (rtmp->Link.protocol & RTMP_FEATURE_HTTP))
+		return;
+
+#ifdef _WIN32
+	u_long mode = 1;
+	ioctlsocket(rtmp->m_sb.sb_socket, FIONBIO, &mode);
+#else
+	int flags = fcntl(rtmp->m_sb.sb_socket, F_GETFL, 0);
+	if (flags != -1)
+		fcntl(rtmp->m_sb.sb_socket, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
 static int init_send(struct rtmp_stream *stream)
 {
 	int ret;
@@ -485,7 +701,7 @@ static int init_send(struct rtmp_stream *stream)
 	adjust_sndbuf_size(stream, MIN_SENDBUF_SIZE);
 #endif
 
-	reset_semaphore(stream);
+	set_nonblocking(stream);
 
 	ret = pthread_create(&stream->send_thread, NULL, send_thread, stream);
 	if (ret != 0) {
@@ -640,9 +856,18 @@ static bool init_connect(struct rtmp_stream *stream)
 	os_atomic_set_bool(&stream->disconnected, false);
 	stream->total_bytes_sent = 0;
 	stream->dropped_frames   = 0;
+	memset(stream->dropped_frames_by_priority, 0,
+			sizeof(stream->dropped_frames_by_priority));
 	stream->min_drop_dts_usec= 0;
 	stream->min_priority     = 0;
 
+	stream->send_queue_bytes         = 0;
+	stream->rtt_usec                 = 0;
+	stream->have_drain_rate          = false;
+	stream->drain_bytes_per_sec      = 0;
+	stream->drain_window_start_ns    = 0;
+	stream->drain_window_start_bytes = 0;
+
 	settings = obs_output_get_settings(stream->output);
 	dstr_copy(&stream->path,     obs_service_get_url(service));
 	dstr_copy(&stream->key,      obs_service_get_key(service));
@@ -701,7 +926,8 @@ static inline bool add_packet(struct rtmp_stream *stream,
 {
 	circlebuf_push_back(&stream->packets, packet,
 			sizeof(struct encoder_packet));
-	stream->last_dts_usec = packet->dts_usec;
+	stream->last_dts_usec   = packet->dts_usec;
+	stream->buffered_bytes += (int64_t)packet->size;
 	return true;
 }
 
@@ -710,50 +936,193 @@ static inline size_t num_buffered_packets(struct rtmp_stream *stream)
 	return stream->packets.size / sizeof(struct encoder_packet);
 }
 
-static void drop_frames(struct rtmp_stream *stream)
+/* the packet buffer only ever holds whole packets (its capacity is always a
+ * multiple of the packet size), so a packet never wraps around its end */
+static inline struct encoder_packet *buffered_packet(
+		struct rtmp_stream *stream, size_t idx)
 {
-	struct circlebuf new_buf            = {0};
-	int              drop_priority      = 0;
-	uint64_t         last_drop_dts_usec = 0;
-	int              num_frames_dropped = 0;
+	size_t pos = stream->packets.start_pos +
+		idx * sizeof(struct encoder_packet);
+	if (pos >= stream->packets.capacity)
+		pos -= stream->packets.capacity;
+
+	return (struct encoder_packet*)((uint8_t*)stream->packets.data + pos);
+}
 
-	debug("Previous packet count: %d", (int)num_buffered_packets(stream));
+static inline void count_dropped_frame(struct rtmp_stream *stream,
+		const struct encoder_packet *packet)
+{
+	int priority = packet->priority;
 
-	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
+	if (priority < OBS_NAL_PRIORITY_DISPOSABLE)
+		priority = OBS_NAL_PRIORITY_DISPOSABLE;
+	else if (priority > OBS_NAL_PRIORITY_HIGHEST)
+		priority = OBS_NAL_PRIORITY_HIGHEST;
 
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+	stream->dropped_frames++;
+	stream->dropped_frames_by_priority[priority]++;
+}
 
-		last_drop_dts_usec = packet.dts_usec;
+/* dropped packets keep their slot in the buffer (with no data) so that it
+ * never has to be compacted; the send thread skips over them */
+static void drop_packet(struct rtmp_stream *stream,
+		struct encoder_packet *packet)
+{
+	int64_t dts_usec = packet->dts_usec;
+
+	count_dropped_frame(stream, packet);
+	stream->buffered_bytes -= (int64_t)packet->size;
+	obs_encoder_packet_release(packet);
+
+	packet->type     = OBS_ENCODER_VIDEO;
+	packet->dts_usec = dts_usec;
+}
 
-		/* do not drop audio data or video keyframes */
-		if (packet.type          == OBS_ENCODER_AUDIO ||
-		    packet.drop_priority == OBS_NAL_PRIORITY_HIGHEST) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
+static inline bool packet_dropped(const struct encoder_packet *packet)
+{
+	return !packet->data;
+}
 
-		} else {
-			if (drop_priority < packet.drop_priority)
-				drop_priority = packet.drop_priority;
+/* audio data and video keyframes are never dropped */
+static inline bool droppable_packet(const struct encoder_packet *packet)
+{
+	return packet->type == OBS_ENCODER_VIDEO && !packet->keyframe &&
+		!packet_dropped(packet);
+}
 
-			num_frames_dropped++;
-			obs_free_encoder_packet(&packet);
+/* drops buffered video packets of the given priority, oldest first, along
+ * with the packets after each of them that are below its drop priority and
+ * could reference it.  if that is still going on at the end of the buffer,
+ * incoming packets continue to be dropped by add_video_packet. */
+static bool drop_priority_packets(struct rtmp_stream *stream, int priority,
+		int64_t target_bytes)
+{
+	size_t count        = num_buffered_packets(stream);
+	int    min_priority = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		struct encoder_packet *packet = buffered_packet(stream, i);
+
+		if (packet->type != OBS_ENCODER_VIDEO || packet_dropped(packet))
+			continue;
+
+		if (packet->keyframe) {
+			min_priority = 0;
+			continue;
+		}
+
+		if (packet->priority < min_priority) {
+			drop_packet(stream, packet);
+			continue;
+		}
+
+		min_priority = 0;
+
+		if (stream->buffered_bytes <= target_bytes)
+			return true;
+
+		if (packet->priority == priority) {
+			min_priority = packet->drop_priority;
+			drop_packet(stream, packet);
 		}
 	}
 
-	circlebuf_free(&stream->packets);
-	stream->packets           = new_buf;
-	stream->min_priority      = drop_priority;
-	stream->min_drop_dts_usec = last_drop_dts_usec;
+	if (stream->min_priority < min_priority)
+		stream->min_priority = min_priority;
 
-	stream->dropped_frames += num_frames_dropped;
-	debug("New packet count: %d", (int)num_buffered_packets(stream));
+	return stream->buffered_bytes <= target_bytes;
+}
+
+/* drops frames from the end of the group of pictures in [start, end) back
+ * towards its keyframe.  nothing before a frame can reference it in decode
+ * order, so the remaining start of the group still decodes. */
+static bool drop_gop_tail(struct rtmp_stream *stream, size_t start,
+		size_t end, int64_t target_bytes)
+{
+	for (size_t i = end; i > start; i--) {
+		struct encoder_packet *packet = buffered_packet(stream, i - 1);
+
+		if (stream->buffered_bytes <= target_bytes)
+			return true;
+		if (droppable_packet(packet))
+			drop_packet(stream, packet);
+	}
+
+	return stream->buffered_bytes <= target_bytes;
+}
+
+/* cuts the tails of the buffered groups of pictures, oldest first, which
+ * only freezes the picture until the following keyframe that is already
+ * buffered.  the last group is still being encoded, so cutting it means
+ * dropping incoming frames until the next keyframe. */
+static bool drop_gop_tails(struct rtmp_stream *stream, int64_t target_bytes)
+{
+	size_t count     = num_buffered_packets(stream);
+	size_t gop_start = 0;
+	int    dropped_frames;
+	bool   success;
+
+	for (size_t i = 0; i < count; i++) {
+		struct encoder_packet *packet = buffered_packet(stream, i);
+
+		if (packet->type != OBS_ENCODER_VIDEO || !packet->keyframe ||
+		    packet_dropped(packet))
+			continue;
+
+		if (drop_gop_tail(stream, gop_start, i, target_bytes))
+			return true;
+		gop_start = i;
+	}
+
+	dropped_frames = stream->dropped_frames;
+	success = drop_gop_tail(stream, gop_start, count, target_bytes);
+
+	if (stream->dropped_frames != dropped_frames)
+		stream->min_priority = OBS_NAL_PRIORITY_HIGHEST;
+	return success;
+}
+
+/* drops the least important frames until about target_bytes are left:
+ * disposable frames first, then low priority reference frames, then the
+ * ends of groups of pictures */
+static void drop_frames(struct rtmp_stream *stream, int64_t target_bytes)
+{
+	int dropped_frames = stream->dropped_frames;
+
+	debug("Previous buffered size: %"PRId64" bytes",
+			stream->buffered_bytes);
+
+	if (!drop_priority_packets(stream, OBS_NAL_PRIORITY_DISPOSABLE,
+				target_bytes) &&
+	    !drop_priority_packets(stream, OBS_NAL_PRIORITY_LOW,
+				target_bytes))
+		drop_gop_tails(stream, target_bytes);
+
+	stream->min_drop_dts_usec = stream->last_dts_usec;
+
+	debug("New buffered size: %"PRId64" bytes (%d frames dropped)",
+			stream->buffered_bytes,
+			stream->dropped_frames - dropped_frames);
+}
+
+/* a send that has not completed for a while means nothing is draining */
+static inline bool get_drain_rate(struct rtmp_stream *stream, uint64_t *rate)
+{
+	if (!stream->have_drain_rate)
+		return false;
+
+	if (os_gettime_ns() - stream->drain_window_start_ns > DRAIN_STALL_NS)
+		*rate = 0;
+	else
+		*rate = stream->drain_bytes_per_sec;
+	return true;
 }
 
 static void check_to_drop_frames(struct rtmp_stream *stream)
 {
 	struct encoder_packet first;
 	int64_t buffer_duration_usec;
+	uint64_t drain_rate;
 
 	if (num_buffered_packets(stream) < 5)
 		return;
@@ -765,13 +1134,27 @@ static void check_to_drop_frames(struct rtmp_stream *stream)
 		return;
 
 	/* if the amount of time stored in the buffered packets waiting to be
-	 * sent is higher than threshold, drop frames */
-	buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
+	 * sent is higher than threshold, drop frames.  once the connection's
+	 * drain rate is known, use the time it will take to send them at that
+	 * rate instead, which notices congestion before a full threshold's
+	 * worth of frames has piled up. */
+	if (get_drain_rate(stream, &drain_rate))
+		buffer_duration_usec = drain_rate ?
+			(int64_t)((uint64_t)stream->buffered_bytes * 1000000ULL /
+				drain_rate) : INT64_MAX;
+	else
+		buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
 
+	/* drop just enough to get back to half the threshold */
 	if (buffer_duration_usec > stream->drop_threshold_usec) {
-		drop_frames(stream);
-		debug("dropping %" PRId64 " worth of frames",
+		int64_t target_bytes = buffer_duration_usec == INT64_MAX ? 0 :
+			stream->buffered_bytes *
+			(stream->drop_threshold_usec / 2) /
+			buffer_duration_usec;
+
+		debug("dropping frames, %" PRId64 " usec buffered",
 				buffer_duration_usec);
+		drop_frames(stream, target_bytes);
 	}
 }
 
@@ -783,7 +1166,7 @@ static bool add_video_packet(struct rtmp_stream *stream,
 	/* if currently dropping frames, drop packets until it reaches the
 	 * desired priority */
 	if (packet->priority < stream->min_priority) {
-		stream->dropped_frames++;
+		count_dropped_frame(stream, packet);
 		return false;
 	} else {
 		stream->min_priority = 0;
@@ -792,11 +1175,26 @@ static bool add_video_packet(struct rtmp_stream *stream,
 	return add_packet(stream, packet);
 }
 
+/* called with packets_mutex held, by the send thread or by the encoder thread
+ * while a packet is being sent */
+static void receive_packets(struct rtmp_stream *stream)
+{
+	struct encoder_packet packet;
+
+	while (spsc_queue_pop(stream->incoming, &packet)) {
+		bool added_packet = (packet.type == OBS_ENCODER_VIDEO) ?
+			add_video_packet(stream, &packet) :
+			add_packet(stream, &packet);
+
+		if (!added_packet)
+			obs_encoder_packet_release(&packet);
+	}
+}
+
 static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 {
 	struct rtmp_stream    *stream = data;
 	struct encoder_packet new_packet;
-	bool                  added_packet = false;
 
 	if (disconnected(stream))
 		return;
@@ -804,22 +1202,18 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 	if (packet->type == OBS_ENCODER_VIDEO)
 		obs_parse_avc_packet(&new_packet, packet);
 	else
-		obs_duplicate_encoder_packet(&new_packet, packet);
+		obs_encoder_packet_ref(&new_packet, packet);
 
-	pthread_mutex_lock(&stream->packets_mutex);
+	spsc_queue_push(stream->incoming, &new_packet);
 
-	if (!disconnected(stream)) {
-		added_packet = (packet->type == OBS_ENCODER_VIDEO) ?
-			add_video_packet(stream, &new_packet) :
-			add_packet(stream, &new_packet);
+	/* a send can block for a long time on a congested connection, so
+	 * don't leave frame dropping to the send thread alone.  if the lock
+	 * is taken, the packet is picked up by the next receive instead. */
+	if (pthread_mutex_trylock(&stream->packets_mutex) == 0) {
+		if (stream->sending)
+			receive_packets(stream);
+		pthread_mutex_unlock(&stream->packets_mutex);
 	}
-
-	pthread_mutex_unlock(&stream->packets_mutex);
-
-	if (added_packet)
-		os_sem_post(stream->send_sem);
-	else
-		obs_free_encoder_packet(&new_packet);
 }
 
 static void rtmp_stream_defaults(obs_data_t *defaults)
@@ -0,0 +1,249 @@
+/*
+ * Times the audio mixer kernels against the previous scalar implementation by
+ * mixing 64 lines into 6 mixes of 8-channel planar audio, and verifies that
+ * the output is bit-exact.  The line buffers are set up so that their data
+ * wraps around the end of the circular buffer storage.
+ *
+ * Usage: bench-audio-mix [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/platform.h>
+#include <media-io/audio-mix.h>
+
+#define NUM_LINES    64
+#define NUM_MIXES    6
+#define NUM_CHANNELS 8
+#define TICK_FRAMES  1024
+#define TICK_SIZE    (TICK_FRAMES * sizeof(float))
+
+/* floats popped before the tick is pushed, so that the data wraps */
+#define WRAP_OFFSET  300
+
+#define MIX_BUFFER_SIZE 256
+
+struct bench_line {
+	struct circlebuf buffers[NUM_CHANNELS];
+	uint32_t         mixers;
+};
+
+static struct bench_line lines[NUM_LINES];
+static float ref_mixes[NUM_MIXES][NUM_CHANNELS][TICK_FRAMES];
+static float out_mixes[NUM_MIXES][NUM_CHANNELS][TICK_FRAMES];
+
+/* ------------------------------------------------------------------------- */
+
+static inline float rand_sample(void)
+{
+	return ((float)rand() / (float)RAND_MAX) * 0.5f - 0.25f;
+}
+
+static void lines_init(void)
+{
+	float samples[TICK_FRAMES];
+
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		struct bench_line *line = &lines[i];
+
+		line->mixers = (uint32_t)rand() & ((1 << NUM_MIXES) - 1);
+		if (!line->mixers)
+			line->mixers = 1;
+
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+			struct circlebuf *buf = &line->buffers[ch];
+
+			for (size_t j = 0; j < TICK_FRAMES; j++)
+				samples[j] = rand_sample();
+
+			circlebuf_init(buf);
+			circlebuf_reserve(buf, TICK_SIZE);
+			circlebuf_push_back(buf, samples,
+					WRAP_OFFSET * sizeof(float));
+			circlebuf_pop_front(buf, NULL,
+					WRAP_OFFSET * sizeof(float));
+			circlebuf_push_back(buf, samples, TICK_SIZE);
+		}
+	}
+}
+
+static void lines_free(void)
+{
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++)
+			circlebuf_free(&lines[i].buffers[ch]);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* the mixer as it was before the kernels: copy out, then add per sample */
+static void mix_scalar(float mixes[NUM_MIXES][NUM_CHANNELS][TICK_FRAMES])
+{
+	float vals[MIX_BUFFER_SIZE];
+
+	memset(mixes, 0, sizeof(ref_mixes));
+
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		const struct bench_line *line = &lines[i];
+
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+			/* popping only changes the copy, so the line data can
+			 * be mixed again on the next iteration */
+			struct circlebuf buf = line->buffers[ch];
+			size_t size = TICK_SIZE;
+			size_t offset = 0;
+
+			while (size) {
+				size_t pop_size = size < sizeof(vals) ?
+					size : sizeof(vals);
+				size_t pop_count = pop_size / sizeof(float);
+				size -= pop_size;
+
+				circlebuf_pop_front(&buf, vals, pop_size);
+
+				for (size_t mix = 0; mix < NUM_MIXES; mix++) {
+					float *out = &mixes[mix][ch][offset];
+
+					if ((line->mixers & (1 << mix)) == 0)
+						continue;
+
+					for (size_t j = 0; j < pop_count; j++)
+						out[j] += vals[j];
+				}
+
+				offset += pop_count;
+			}
+		}
+	}
+
+	for (size_t mix = 0; mix < NUM_MIXES; mix++) {
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+			float *data = mixes[mix][ch];
+
+			for (size_t j = 0; j < TICK_FRAMES; j++) {
+				float val = data[j];
+				val = (val >  1.0f) ?  1.0f : val;
+				val = (val < -1.0f) ? -1.0f : val;
+				data[j] = val;
+			}
+		}
+	}
+}
+
+static void mix_simd(float mixes[NUM_MIXES][NUM_CHANNELS][TICK_FRAMES])
+{
+	memset(mixes, 0, sizeof(out_mixes));
+
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		const struct bench_line *line = &lines[i];
+
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+			struct circlebuf buf = line->buffers[ch];
+			float *targets[NUM_MIXES];
+			size_t num_targets = 0;
+
+			for (size_t mix = 0; mix < NUM_MIXES; mix++) {
+				if (line->mixers & (1 << mix))
+					targets[num_targets++] = mixes[mix][ch];
+			}
+
+			audio_mix_add_circlebuf(targets, num_targets, &buf,
+					TICK_SIZE);
+		}
+	}
+
+	for (size_t mix = 0; mix < NUM_MIXES; mix++) {
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++)
+			audio_clamp_float(mixes[mix][ch], TICK_FRAMES);
+	}
+}
+
+typedef void (*mix_func_t)(float[NUM_MIXES][NUM_CHANNELS][TICK_FRAMES]);
+
+static double time_mix(mix_func_t mix,
+		float mixes[NUM_MIXES][NUM_CHANNELS][TICK_FRAMES],
+		int iterations)
+{
+	uint64_t start = os_gettime_ns();
+
+	for (int i = 0; i < iterations; i++)
+		mix(mixes);
+
+	return (double)(os_gettime_ns() - start) / (double)iterations /
+		1000000.0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* odd count so that the scalar tail is covered as well */
+#define GAIN_COUNT (TICK_FRAMES * NUM_CHANNELS + 5)
+
+static bool check_gain(void)
+{
+	float *src = bmalloc(GAIN_COUNT * sizeof(float));
+	float *ref = bmalloc(GAIN_COUNT * sizeof(float));
+	float *out = bmalloc(GAIN_COUNT * sizeof(float));
+	bool equal;
+
+	for (size_t i = 0; i < GAIN_COUNT; i++) {
+		src[i] = rand_sample() * 8.0f;
+		ref[i] = src[i] * 0.7f;
+	}
+
+	audio_gain_float(out, src, 0.7f, GAIN_COUNT);
+	equal = memcmp(ref, out, GAIN_COUNT * sizeof(float)) == 0;
+
+	/* clamping after a large gain must also match */
+	for (size_t i = 0; i < GAIN_COUNT; i++) {
+		float val = ref[i];
+		val = (val >  1.0f) ?  1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		ref[i] = val;
+	}
+
+	audio_clamp_float(out, GAIN_COUNT);
+	if (memcmp(ref, out, GAIN_COUNT * sizeof(float)) != 0)
+		equal = false;
+
+	bfree(src);
+	bfree(ref);
+	bfree(out);
+	return equal;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+	double scalar_ms, simd_ms;
+	bool mix_equal, gain_equal;
+
+	if (iterations <= 0)
+		iterations = 1;
+
+	srand(0);
+	lines_init();
+
+	mix_scalar(ref_mixes);
+	mix_simd(out_mixes);
+	mix_equal = memcmp(ref_mixes, out_mixes, sizeof(ref_mixes)) == 0;
+	gain_equal = check_gain();
+
+	scalar_ms = time_mix(mix_scalar, ref_mixes, iterations);
+	simd_ms   = time_mix(mix_simd,   out_mixes, iterations);
+
+	printf("%d lines, %d mixes, %d channels, %d frames per tick\n",
+			NUM_LINES, NUM_MIXES, NUM_CHANNELS, TICK_FRAMES);
+	printf("scalar: %9.4f ms per tick\n", scalar_ms);
+	printf("simd:   %9.4f ms per tick (%.2fx)\n", simd_ms,
+			simd_ms > 0.0 ? scalar_ms / simd_ms : 0.0);
+	printf("mix %s, gain/clamp %s\n",
+			mix_equal  ? "ok" : "MISMATCH",
+			gain_equal ? "ok" : "MISMATCH");
+
+	lines_free();
+	return (mix_equal && gain_equal) ? 0 : 1;
+}
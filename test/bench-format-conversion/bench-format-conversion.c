@@ -0,0 +1,290 @@
+/*
+ * Times each of the media-io format conversion kernels at common frame sizes
+ * for every instruction set supported by the CPU, and verifies that their
+ * output is bit-exact with the scalar reference kernels.
+ *
+ * Usage: bench-format-conversion [iterations at 1080p]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/format-conversion.h>
+
+enum bench_format {
+	BENCH_UYVX,
+	BENCH_422,
+	BENCH_I420,
+	BENCH_NV12,
+	BENCH_I444
+};
+
+struct bench_frame {
+	uint8_t  *data[3];
+	uint32_t linesize[3];
+	size_t   size[3];
+};
+
+struct bench_kernel {
+	const char        *name;
+	enum bench_format in_format;
+	enum bench_format out_format;
+	void (*convert)(const struct bench_frame *in, struct bench_frame *out,
+			uint32_t height);
+};
+
+struct bench_size {
+	uint32_t cx, cy;
+	bool     timed;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void convert_uyvx_i420(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	compress_uyvx_to_i420(in->data[0], in->linesize[0], 0, height,
+			out->data, out->linesize);
+}
+
+static void convert_uyvx_nv12(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	compress_uyvx_to_nv12(in->data[0], in->linesize[0], 0, height,
+			out->data, out->linesize);
+}
+
+static void convert_uyvx_i444(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	convert_uyvx_to_i444(in->data[0], in->linesize[0], 0, height,
+			out->data, out->linesize);
+}
+
+static void convert_i420_packed(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	decompress_420((const uint8_t *const *)in->data, in->linesize,
+			0, height, out->data[0], out->linesize[0]);
+}
+
+static void convert_nv12_packed(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	decompress_nv12((const uint8_t *const *)in->data, in->linesize,
+			0, height, out->data[0], out->linesize[0]);
+}
+
+static void convert_yuy2_packed(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	decompress_422(in->data[0], in->linesize[0], 0, height,
+			out->data[0], out->linesize[0], true);
+}
+
+static void convert_uyvy_packed(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	decompress_422(in->data[0], in->linesize[0], 0, height,
+			out->data[0], out->linesize[0], false);
+}
+
+static void convert_i444_i420(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	compress_i444_to_i420((const uint8_t *const *)in->data, in->linesize,
+			0, height, out->data, out->linesize);
+}
+
+static void convert_i444_nv12(const struct bench_frame *in,
+		struct bench_frame *out, uint32_t height)
+{
+	compress_i444_to_nv12((const uint8_t *const *)in->data, in->linesize,
+			0, height, out->data, out->linesize);
+}
+
+static const struct bench_kernel kernels[] = {
+	{"compress_uyvx_to_i420", BENCH_UYVX, BENCH_I420, convert_uyvx_i420},
+	{"compress_uyvx_to_nv12", BENCH_UYVX, BENCH_NV12, convert_uyvx_nv12},
+	{"convert_uyvx_to_i444",  BENCH_UYVX, BENCH_I444, convert_uyvx_i444},
+	{"decompress_420",        BENCH_I420, BENCH_UYVX, convert_i420_packed},
+	{"decompress_nv12",       BENCH_NV12, BENCH_UYVX, convert_nv12_packed},
+	{"decompress_422 (yuy2)", BENCH_422,  BENCH_UYVX, convert_yuy2_packed},
+	{"decompress_422 (uyvy)", BENCH_422,  BENCH_UYVX, convert_uyvy_packed},
+	{"compress_i444_to_i420", BENCH_I444, BENCH_I420, convert_i444_i420},
+	{"compress_i444_to_nv12", BENCH_I444, BENCH_NV12, convert_i444_nv12},
+};
+
+/* the odd size isn't timed, it only checks the unaligned line tails */
+static const struct bench_size sizes[] = {
+	{1366,  768, false},
+	{1280,  720, true},
+	{1920, 1080, true},
+	{3840, 2160, true},
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+#define NUM_SIZES   (sizeof(sizes) / sizeof(sizes[0]))
+
+/* ------------------------------------------------------------------------- */
+
+static void frame_init(struct bench_frame *frame, enum bench_format format,
+		uint32_t cx, uint32_t cy)
+{
+	uint32_t cx_d2 = (cx + 1) / 2;
+	uint32_t cy_d2 = (cy + 1) / 2;
+
+	memset(frame, 0, sizeof(*frame));
+
+	switch (format) {
+	case BENCH_UYVX:
+		frame->linesize[0] = cx * 4;
+		frame->size[0]     = frame->linesize[0] * cy;
+		break;
+	case BENCH_422:
+		frame->linesize[0] = cx_d2 * 4;
+		frame->size[0]     = frame->linesize[0] * cy;
+		break;
+	case BENCH_I420:
+		frame->linesize[0] = cx;
+		frame->linesize[1] = cx_d2;
+		frame->linesize[2] = cx_d2;
+		frame->size[0]     = cx * cy;
+		frame->size[1]     = cx_d2 * cy_d2;
+		frame->size[2]     = cx_d2 * cy_d2;
+		break;
+	case BENCH_NV12:
+		frame->linesize[0] = cx;
+		frame->linesize[1] = cx_d2 * 2;
+		frame->size[0]     = cx * cy;
+		frame->size[1]     = cx_d2 * 2 * cy_d2;
+		break;
+	case BENCH_I444:
+		for (size_t i = 0; i < 3; i++) {
+			frame->linesize[i] = cx;
+			frame->size[i]     = cx * cy;
+		}
+	}
+
+	for (size_t i = 0; i < 3; i++) {
+		if (frame->size[i])
+			frame->data[i] = bmalloc(frame->size[i]);
+	}
+}
+
+static void frame_free(struct bench_frame *frame)
+{
+	for (size_t i = 0; i < 3; i++)
+		bfree(frame->data[i]);
+}
+
+static void frame_fill(struct bench_frame *frame, uint8_t val)
+{
+	for (size_t i = 0; i < 3; i++) {
+		if (frame->data[i])
+			memset(frame->data[i], val, frame->size[i]);
+	}
+}
+
+static void frame_randomize(struct bench_frame *frame)
+{
+	for (size_t i = 0; i < 3; i++) {
+		for (size_t j = 0; j < frame->size[i]; j++)
+			frame->data[i][j] = (uint8_t)rand();
+	}
+}
+
+static bool frame_equal(const struct bench_frame *a,
+		const struct bench_frame *b)
+{
+	for (size_t i = 0; i < 3; i++) {
+		if (a->size[i] &&
+		    memcmp(a->data[i], b->data[i], a->size[i]) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool bench_kernel(const struct bench_kernel *kernel,
+		const struct bench_size *size, int iterations)
+{
+	struct bench_frame in, ref, out;
+	bool success = true;
+
+	frame_init(&in,  kernel->in_format,  size->cx, size->cy);
+	frame_init(&ref, kernel->out_format, size->cx, size->cy);
+	frame_init(&out, kernel->out_format, size->cx, size->cy);
+	frame_randomize(&in);
+
+	format_conversion_set_simd(FORMAT_CONVERSION_SIMD_NONE);
+	frame_fill(&ref, 0xCD);
+	kernel->convert(&in, &ref, size->cy);
+
+	for (int simd = FORMAT_CONVERSION_SIMD_NONE;
+	     simd <= FORMAT_CONVERSION_SIMD_AVX2;
+	     simd++) {
+		double ms = 0.0;
+		bool equal;
+
+		if ((int)format_conversion_set_simd(simd) != simd)
+			break;
+
+		frame_fill(&out, 0xCD);
+		kernel->convert(&in, &out, size->cy);
+		equal = frame_equal(&ref, &out);
+
+		if (size->timed) {
+			uint64_t start = os_gettime_ns();
+			for (int i = 0; i < iterations; i++)
+				kernel->convert(&in, &out, size->cy);
+			ms = (double)(os_gettime_ns() - start) /
+				(double)iterations / 1000000.0;
+		}
+
+		printf("%-22s %4ux%-4u %-6s %9.3f ms  %s\n",
+				kernel->name, size->cx, size->cy,
+				format_conversion_simd_name(simd), ms,
+				equal ? "ok" : "MISMATCH");
+
+		if (!equal)
+			success = false;
+	}
+
+	frame_free(&in);
+	frame_free(&ref);
+	frame_free(&out);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations_1080p = argc > 1 ? atoi(argv[1]) : 100;
+	bool success = true;
+
+	if (iterations_1080p <= 0)
+		iterations_1080p = 1;
+
+	srand(0);
+
+	for (size_t i = 0; i < NUM_KERNELS; i++) {
+		for (size_t j = 0; j < NUM_SIZES; j++) {
+			const struct bench_size *size = &sizes[j];
+			uint64_t pixels = (uint64_t)size->cx * size->cy;
+			int iterations = (int)((uint64_t)iterations_1080p *
+					1920 * 1080 / pixels);
+
+			if (!bench_kernel(&kernels[i], size,
+						iterations ? iterations : 1))
+				success = false;
+		}
+	}
+
+	printf("\n%s\n", success ? "all kernels bit-exact" :
+			"kernel output MISMATCH");
+	return success ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+/*
+ * Compares the single-producer/single-consumer queue against the
+ * circlebuf + mutex + semaphore pattern that outputs used to hand encoded
+ * packets to their send threads.
+ *
+ * Two runs are made for each queue:
+ *
+ *   - burst:  the producer pushes packets as fast as it can, to measure the
+ *             raw throughput of the queue and check that the consumer gets
+ *             every packet in order
+ *   - paced:  the producer pushes packets at about the rate of a 60 fps video
+ *             encoder plus four audio tracks, and the time each push takes
+ *             (the time an encoder thread would lose) is measured
+ *
+ * Usage: bench-spsc-queue [burst packets] [paced seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/spsc-queue.h>
+
+#define END_SEQ        UINT64_MAX
+#define PACED_RATE     250 /* 60 video + 4 * ~47 audio packets per second */
+#define BLOCK_PACKETS  64
+
+/* about the size of an encoder_packet */
+struct bench_packet {
+	uint64_t seq;
+	uint64_t push_time;
+	uint8_t  payload[80];
+};
+
+struct mutex_queue {
+	pthread_mutex_t  mutex;
+	struct circlebuf packets;
+	os_sem_t         *sem;
+};
+
+struct bench_queue {
+	const char         *name;
+	struct mutex_queue mq;
+	spsc_queue_t       *sq;
+
+	void (*push)(struct bench_queue *queue,
+			const struct bench_packet *packet);
+	void (*pop)(struct bench_queue *queue, struct bench_packet *packet);
+
+	/* consumer results */
+	uint64_t           received;
+	uint64_t           total_latency_ns;
+	bool               in_order;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void mutex_push(struct bench_queue *queue,
+		const struct bench_packet *packet)
+{
+	pthread_mutex_lock(&queue->mq.mutex);
+	circlebuf_push_back(&queue->mq.packets, packet, sizeof(*packet));
+	pthread_mutex_unlock(&queue->mq.mutex);
+	os_sem_post(queue->mq.sem);
+}
+
+static void mutex_pop(struct bench_queue *queue, struct bench_packet *packet)
+{
+	os_sem_wait(queue->mq.sem);
+
+	pthread_mutex_lock(&queue->mq.mutex);
+	circlebuf_pop_front(&queue->mq.packets, packet, sizeof(*packet));
+	pthread_mutex_unlock(&queue->mq.mutex);
+}
+
+static void spsc_push(struct bench_queue *queue,
+		const struct bench_packet *packet)
+{
+	spsc_queue_push(queue->sq, packet);
+}
+
+static void spsc_pop(struct bench_queue *queue, struct bench_packet *packet)
+{
+	while (!spsc_queue_pop(queue->sq, packet))
+		spsc_queue_wait(queue->sq);
+}
+
+static void *consumer_thread(void *data)
+{
+	struct bench_queue *queue = data;
+	struct bench_packet packet;
+	uint64_t expected = 0;
+
+	for (;;) {
+		queue->pop(queue, &packet);
+		if (packet.seq == END_SEQ)
+			break;
+
+		if (packet.seq != expected++)
+			queue->in_order = false;
+
+		queue->total_latency_ns += os_gettime_ns() - packet.push_time;
+		queue->received++;
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct run_result {
+	double   push_avg_ns;
+	uint64_t push_max_ns;
+	double   total_ms;
+	double   latency_avg_us;
+	bool     ok;
+};
+
+static void init_queue(struct bench_queue *queue, bool spsc)
+{
+	memset(queue, 0, sizeof(*queue));
+	queue->in_order = true;
+
+	if (spsc) {
+		queue->name = "spsc";
+		queue->sq   = spsc_queue_create(sizeof(struct bench_packet),
+				BLOCK_PACKETS);
+		queue->push = spsc_push;
+		queue->pop  = spsc_pop;
+	} else {
+		queue->name = "mutex";
+		pthread_mutex_init(&queue->mq.mutex, NULL);
+		os_sem_init(&queue->mq.sem, 0);
+		queue->push = mutex_push;
+		queue->pop  = mutex_pop;
+	}
+}
+
+static void free_queue(struct bench_queue *queue)
+{
+	if (queue->sq) {
+		spsc_queue_destroy(queue->sq);
+	} else {
+		pthread_mutex_destroy(&queue->mq.mutex);
+		os_sem_destroy(queue->mq.sem);
+		circlebuf_free(&queue->mq.packets);
+	}
+}
+
+static struct run_result run(bool spsc, uint64_t count, uint64_t interval_ns)
+{
+	struct bench_queue  queue;
+	struct bench_packet packet = {0};
+	struct run_result   result = {0};
+	uint64_t push_total_ns = 0;
+	uint64_t start, next_time;
+	pthread_t thread;
+
+	init_queue(&queue, spsc);
+	pthread_create(&thread, NULL, consumer_thread, &queue);
+
+	start = next_time = os_gettime_ns();
+
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t push_start, push_ns;
+
+		if (interval_ns) {
+			next_time += interval_ns;
+			os_sleepto_ns(next_time);
+		}
+
+		packet.seq       = i;
+		packet.push_time = push_start = os_gettime_ns();
+		queue.push(&queue, &packet);
+
+		push_ns = os_gettime_ns() - push_start;
+		push_total_ns += push_ns;
+		if (push_ns > result.push_max_ns)
+			result.push_max_ns = push_ns;
+	}
+
+	packet.seq = END_SEQ;
+	queue.push(&queue, &packet);
+	pthread_join(thread, NULL);
+
+	result.total_ms       = (double)(os_gettime_ns() - start) / 1000000.0;
+	result.push_avg_ns    = (double)push_total_ns / (double)count;
+	result.latency_avg_us = (double)queue.total_latency_ns /
+		(double)count / 1000.0;
+	result.ok             = queue.in_order && queue.received == count;
+
+	free_queue(&queue);
+	return result;
+}
+
+static void print_result(const char *name, const struct run_result *result)
+{
+	printf("  %-6s push avg %8.1f ns, max %8.1f us, "
+	       "consumer latency avg %8.2f us, total %9.2f ms  %s\n",
+			name, result->push_avg_ns,
+			(double)result->push_max_ns / 1000.0,
+			result->latency_avg_us, result->total_ms,
+			result->ok ? "ok" : "MISMATCH");
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t burst_count = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+	int      paced_sec   = argc > 2 ? atoi(argv[2]) : 2;
+	struct run_result mutex_burst, spsc_burst, mutex_paced, spsc_paced;
+
+	if (!burst_count)
+		burst_count = 1;
+	if (paced_sec <= 0)
+		paced_sec = 1;
+
+	mutex_burst = run(false, burst_count, 0);
+	spsc_burst  = run(true,  burst_count, 0);
+
+	printf("burst, %llu packets:\n", (unsigned long long)burst_count);
+	print_result("mutex", &mutex_burst);
+	print_result("spsc",  &spsc_burst);
+
+	mutex_paced = run(false, (uint64_t)paced_sec * PACED_RATE,
+			1000000000ULL / PACED_RATE);
+	spsc_paced  = run(true,  (uint64_t)paced_sec * PACED_RATE,
+			1000000000ULL / PACED_RATE);
+
+	printf("paced, %d packets per second for %d seconds:\n", PACED_RATE,
+			paced_sec);
+	print_result("mutex", &mutex_paced);
+	print_result("spsc",  &spsc_paced);
+
+	return (mutex_burst.ok && spsc_burst.ok &&
+	        mutex_paced.ok && spsc_paced.ok) ? 0 : 1;
+}
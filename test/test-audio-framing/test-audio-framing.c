@@ -0,0 +1,159 @@
+/*
+ * Checks how audio encoders split mixed audio into codec frames.
+ *
+ * Feeds a stand-in encoder (only the fields the framing looks at are set)
+ * ticks of two-plane audio whose samples hold their position in the stream,
+ * with the first tick cut short the way a paired encoder cuts it to start
+ * with the video.  The frames sent to the encoder have to hold every sample
+ * in order, and every frame that lies within a single tick has to be sent
+ * straight from the tick's data rather than copied.
+ *
+ * Usage: test-audio-framing
+ */
+
+#include <stdio.h>
+#include <util/bmem.h>
+#include <obs-audio-framing.h>
+
+#define PLANES  2
+#define TICKS   50
+
+struct framing_test {
+	size_t   tick_frames;
+	size_t   frame_frames;
+
+	uint32_t *ticks[PLANES];
+	size_t   next_sample;
+	size_t   direct;
+	size_t   copied;
+	bool     ok;
+};
+
+static struct framing_test *cur_test = NULL;
+
+static inline uint32_t sample_value(size_t pos, size_t plane)
+{
+	return (uint32_t)(pos * PLANES + plane);
+}
+
+static void check_frame(struct obs_encoder *encoder, uint8_t *const data[])
+{
+	struct framing_test *test = cur_test;
+	size_t first = test->next_sample;
+	size_t last  = first + test->frame_frames - 1;
+
+	for (size_t p = 0; p < PLANES; p++) {
+		const uint32_t *samples = (const uint32_t*)data[p];
+
+		for (size_t i = 0; i < test->frame_frames; i++) {
+			if (samples[i] != sample_value(first + i, p)) {
+				if (test->ok)
+					printf("  sample %d of plane %d is "
+					       "wrong\n", (int)(first + i),
+					       (int)p);
+				test->ok = false;
+			}
+		}
+	}
+
+	if (data[0] == encoder->audio_output_buffer[0])
+		test->copied++;
+	else
+		test->direct++;
+
+	test->next_sample = last + 1;
+}
+
+static bool run(size_t tick_frames, size_t frame_frames, size_t start_offset)
+{
+	struct framing_test test = {0};
+	struct obs_encoder *encoder = bzalloc(sizeof(struct obs_encoder));
+	size_t expected_direct = 0;
+	size_t frames;
+
+	test.tick_frames  = tick_frames;
+	test.frame_frames = frame_frames;
+	test.next_sample  = start_offset;
+	test.ok           = true;
+	cur_test = &test;
+
+	encoder->planes          = PLANES;
+	encoder->blocksize       = sizeof(uint32_t);
+	encoder->framesize       = frame_frames;
+	encoder->framesize_bytes = frame_frames * sizeof(uint32_t);
+
+	for (size_t p = 0; p < PLANES; p++) {
+		encoder->audio_output_buffer[p] =
+			bmalloc(encoder->framesize_bytes);
+		test.ticks[p] = bmalloc(tick_frames * sizeof(uint32_t));
+	}
+
+	for (size_t t = 0; t < TICKS; t++) {
+		size_t tick_start = t * tick_frames;
+		size_t offset     = t ? 0 : start_offset;
+		uint8_t *data[MAX_AV_PLANES] = {NULL};
+
+		for (size_t p = 0; p < PLANES; p++) {
+			for (size_t i = 0; i < tick_frames; i++)
+				test.ticks[p][i] =
+					sample_value(tick_start + i, p);
+
+			data[p] = (uint8_t*)(test.ticks[p] + offset);
+		}
+
+		audio_framing_push(encoder, data,
+				(tick_frames - offset) * sizeof(uint32_t),
+				check_frame);
+	}
+
+	frames = (TICKS * tick_frames - start_offset) / frame_frames;
+	for (size_t f = 0; f < frames; f++) {
+		size_t first = start_offset + f * frame_frames;
+		size_t last  = first + frame_frames - 1;
+
+		if (first / tick_frames == last / tick_frames)
+			expected_direct++;
+	}
+
+	if (test.direct + test.copied != frames) {
+		printf("  sent %d frames, expected %d\n",
+				(int)(test.direct + test.copied), (int)frames);
+		test.ok = false;
+	}
+	if (test.direct != expected_direct) {
+		printf("  sent %d frames directly, expected %d\n",
+				(int)test.direct, (int)expected_direct);
+		test.ok = false;
+	}
+
+	printf("ticks of %4d, frames of %4d, starting at %4d: "
+	       "%3d direct, %3d copied: %s\n",
+	       (int)tick_frames, (int)frame_frames, (int)start_offset,
+	       (int)test.direct, (int)test.copied,
+	       test.ok ? "ok" : "FAILED");
+
+	for (size_t p = 0; p < PLANES; p++) {
+		circlebuf_free(&encoder->audio_input_buffer[p]);
+		bfree(encoder->audio_output_buffer[p]);
+		bfree(test.ticks[p]);
+	}
+	bfree(encoder);
+
+	cur_test = NULL;
+	return test.ok;
+}
+
+int main(void)
+{
+	int failed = 0;
+
+	/* unpaired encoders, and paired ones with the first tick cut short */
+	if (!run(1024, 1024,   0)) failed++;
+	if (!run(1024, 1024, 300)) failed++;
+	if (!run(2048, 1024, 300)) failed++;
+	if (!run(1024,  960, 100)) failed++;
+	if (!run( 480, 1024,   0)) failed++;
+	if (!run( 480, 1024, 479)) failed++;
+
+	return failed ? 1 : 0;
+}
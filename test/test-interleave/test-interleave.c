@@ -0,0 +1,158 @@
+/*
+ * Checks the order in which outputs interleave packets.
+ *
+ * Every run builds the packet streams of a video track and a few audio
+ * tracks, some of them with timestamps that collide with the video's, and
+ * shuffles the streams together the way encoder threads deliver them: each
+ * track mostly in order, with now and then two packets of a track swapped.
+ * Once every packet is queued, they have to come back out sorted by dts,
+ * with packets of equal dts in the order they arrived in.
+ *
+ * Usage: test-interleave [runs] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <obs-interleave.h>
+
+#define AUDIO_TRACKS   3
+#define TRACK_PACKETS  200
+#define TOTAL_PACKETS  ((AUDIO_TRACKS + 1) * TRACK_PACKETS)
+
+struct track {
+	enum obs_encoder_type type;
+	size_t                idx;
+	int64_t               step_usec;
+	int64_t               dts_usec[TRACK_PACKETS];
+	size_t                next;
+};
+
+struct arrival {
+	int64_t               dts_usec;
+	int64_t               seq;
+};
+
+static int compare_arrivals(const void *a, const void *b)
+{
+	const struct arrival *aa = a;
+	const struct arrival *ab = b;
+
+	if (aa->dts_usec != ab->dts_usec)
+		return aa->dts_usec < ab->dts_usec ? -1 : 1;
+	return aa->seq < ab->seq ? -1 : (aa->seq > ab->seq);
+}
+
+static void init_tracks(struct track *tracks)
+{
+	/* 50 fps video, audio with 20 ms packets that line up with every
+	 * video frame, and audio with 1024 and 960 sample packets at 48 khz */
+	static const int64_t steps[AUDIO_TRACKS + 1] = {
+		20000, 20000, 21333, 20000
+	};
+
+	for (size_t i = 0; i < AUDIO_TRACKS + 1; i++) {
+		struct track *track = &tracks[i];
+
+		track->type      = i ? OBS_ENCODER_AUDIO : OBS_ENCODER_VIDEO;
+		track->idx       = i ? i - 1 : 0;
+		track->step_usec = steps[i];
+		track->next      = 0;
+
+		for (size_t j = 0; j < TRACK_PACKETS; j++)
+			track->dts_usec[j] = (int64_t)j * track->step_usec;
+
+		/* an encoder that delivers packets out of order */
+		for (size_t j = 0; j + 1 < TRACK_PACKETS; j++) {
+			if (rand() % 16 == 0) {
+				int64_t dts = track->dts_usec[j];
+				track->dts_usec[j]     = track->dts_usec[j + 1];
+				track->dts_usec[j + 1] = dts;
+				j++;
+			}
+		}
+	}
+}
+
+static bool run(int run_idx)
+{
+	struct interleave_queues iq = {0};
+	struct track tracks[AUDIO_TRACKS + 1];
+	struct arrival expected[TOTAL_PACKETS];
+	struct encoder_packet packet;
+	size_t queue_idx;
+	size_t received = 0;
+	bool ok = true;
+
+	init_tracks(tracks);
+
+	for (int64_t seq = 0; seq < TOTAL_PACKETS; seq++) {
+		struct track *track;
+
+		do {
+			track = &tracks[rand() % (AUDIO_TRACKS + 1)];
+		} while (track->next == TRACK_PACKETS);
+
+		memset(&packet, 0, sizeof(packet));
+		packet.type      = track->type;
+		packet.track_idx = track->idx;
+		packet.dts_usec  = track->dts_usec[track->next++];
+		packet.pts       = seq;
+
+		expected[seq].dts_usec = packet.dts_usec;
+		expected[seq].seq      = seq;
+
+		interleave_insert(&iq, &packet);
+	}
+
+	qsort(expected, TOTAL_PACKETS, sizeof(expected[0]), compare_arrivals);
+
+	while (interleave_next(&iq, NULL, &queue_idx)) {
+		interleave_pop(&iq, queue_idx, &packet);
+
+		if (received < TOTAL_PACKETS && ok &&
+		    (packet.dts_usec != expected[received].dts_usec ||
+		     packet.pts      != expected[received].seq)) {
+			printf("run %d: packet %d is dts %lld (arrival %lld), "
+			       "expected dts %lld (arrival %lld)\n",
+			       run_idx, (int)received,
+			       (long long)packet.dts_usec,
+			       (long long)packet.pts,
+			       (long long)expected[received].dts_usec,
+			       (long long)expected[received].seq);
+			ok = false;
+		}
+
+		received++;
+	}
+
+	if (received != TOTAL_PACKETS) {
+		printf("run %d: got %d packets back, expected %d\n", run_idx,
+				(int)received, TOTAL_PACKETS);
+		ok = false;
+	}
+
+	interleave_free(&iq);
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	int      runs   = argc > 1 ? atoi(argv[1]) : 100;
+	unsigned seed   = argc > 2 ? (unsigned)atoi(argv[2]) : 1;
+	int      failed = 0;
+
+	if (runs <= 0)
+		runs = 1;
+
+	srand(seed);
+
+	for (int i = 0; i < runs; i++) {
+		if (!run(i))
+			failed++;
+	}
+
+	printf("%d of %d runs interleaved in order\n", runs - failed, runs);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Checks which source trees the render cache considers cacheable.
+ *
+ * Builds scenes out of stand-in sources (only the fields the cache looks
+ * at are set) and checks the change stamp and cacheability computed for
+ * each: an audio-only source in a scene isn't drawn and must neither make
+ * the scene uncacheable nor count towards its stamp, while an async or
+ * non-cacheable video source must make the scene uncacheable.
+ *
+ * Usage: test-render-cache
+ */
+
+#include <stdio.h>
+#include <util/bmem.h>
+#include <obs-render-cache.h>
+
+#define MAX_CHILDREN 4
+
+struct scene {
+	obs_source_t *children[MAX_CHILDREN];
+	size_t        num;
+};
+
+static void scene_enum_sources(void *data, obs_source_enum_proc_t enum_proc,
+		void *param)
+{
+	struct scene *scene = data;
+
+	for (size_t i = 0; i < scene->num; i++)
+		enum_proc(NULL, scene->children[i], param);
+}
+
+static obs_source_t *create_source(uint32_t flags, long stamp)
+{
+	obs_source_t *source = bzalloc(sizeof(obs_source_t));
+
+	pthread_mutex_init(&source->filter_mutex, NULL);
+	source->info.output_flags = flags;
+	source->change_stamp      = stamp;
+	return source;
+}
+
+static obs_source_t *create_scene(long stamp, struct scene *scene)
+{
+	obs_source_t *source = create_source(
+			OBS_SOURCE_VIDEO | OBS_SOURCE_CACHEABLE, stamp);
+
+	source->info.enum_active_sources = scene_enum_sources;
+	source->context.data             = scene;
+	return source;
+}
+
+static void destroy_source(obs_source_t *source)
+{
+	pthread_mutex_destroy(&source->filter_mutex);
+	bfree(source);
+}
+
+static bool check(const char *name, obs_source_t *child, bool cacheable,
+		long stamp)
+{
+	struct scene scene = {{NULL}, 0};
+	struct cache_stamp cs = {0, true};
+	obs_source_t *image = create_source(
+			OBS_SOURCE_VIDEO | OBS_SOURCE_CACHEABLE, 2);
+	obs_source_t *source = create_scene(1, &scene);
+	bool ok;
+
+	scene.children[scene.num++] = image;
+	scene.children[scene.num++] = child;
+
+	cache_stamp_get(source, &cs);
+
+	ok = cs.cacheable == cacheable && (!cacheable || cs.stamp == stamp);
+	printf("%-28s cacheable %d stamp %ld: %s\n", name, cs.cacheable,
+			cs.stamp, ok ? "ok" : "FAILED");
+
+	destroy_source(source);
+	destroy_source(image);
+	destroy_source(child);
+	return ok;
+}
+
+int main(void)
+{
+	int failed = 0;
+
+	/* the audio source has the latest stamp, but it's never drawn */
+	if (!check("image + audio capture",
+			create_source(OBS_SOURCE_AUDIO, 5), true, 2))
+		failed++;
+	if (!check("image + cacheable image",
+			create_source(OBS_SOURCE_VIDEO | OBS_SOURCE_CACHEABLE,
+				3), true, 3))
+		failed++;
+	if (!check("image + async video",
+			create_source(OBS_SOURCE_ASYNC_VIDEO |
+				OBS_SOURCE_AUDIO | OBS_SOURCE_CACHEABLE, 3),
+			false, 0))
+		failed++;
+	if (!check("image + uncacheable video",
+			create_source(OBS_SOURCE_VIDEO, 3), false, 0))
+		failed++;
+
+	return failed ? 1 : 0;
+}